@@ -227,6 +227,10 @@ namespace PeterDB {
                     it = aggregate(previous);
                     break;
 
+                case LIMIT:
+                    it = limit(previous);
+                    break;
+
                 case BNL_JOIN:
                     it = blockNestedLoopJoin(previous);
                     break;
@@ -328,6 +332,27 @@ namespace PeterDB {
         return agg;
     }
 
+    // Create Limit
+    Iterator *CLI::limit(Iterator *input) {
+        char *token = next();
+        int code = -2;
+        if (isIterator(std::string(token), code)) {
+            input = query(input, code);
+        }
+
+        if (input == NULL) {
+            input = createBaseScanner(std::string(token));
+        }
+
+        token = next(); // eat ROWS
+        token = next(); // get the number of rows
+
+        // Create Limit, the scans under it stop once the rows are read
+        auto *limit = new Limit(input, (unsigned) atoi(std::string(token).c_str()));
+
+        return limit;
+    }
+
     // Create BNLJoin
     Iterator *CLI::blockNestedLoopJoin(Iterator *input) {
         char *token = next();
@@ -521,6 +546,8 @@ namespace PeterDB {
             code = IDX_SCAN;
         else if (expect(token, "TBLSCAN"))
             code = TBL_SCAN;
+        else if (expect(token, "LIMIT"))
+            code = LIMIT;
         else
             return false;
 
@@ -1522,6 +1549,7 @@ namespace PeterDB {
             std::cout << "\t\t\tINLJOIN <query>, <query> WHERE <attr> <op> <attr>" << std::endl;
             std::cout << "\t\t\tGHJOIN <query>, <query> WHERE <attr> <op> <attr> PARTITIONS(<numPartitions>)" << std::endl;
             std::cout << "\t\t\tAGG <query> [ GROUPBY(<attr>) ] GET <agg-op>(<attr>)" << std::endl;
+            std::cout << "\t\t\tLIMIT <query> ROWS(<numRows>)" << std::endl;
             std::cout << "\t\t\tIDXSCAN <query> <attr> <op> <value>" << std::endl;
             std::cout << "\t\t\tTBLSCAN <query>" << std::endl;
             std::cout << "\t\t\t<tableName>" << std::endl;
@@ -1531,6 +1559,7 @@ namespace PeterDB {
             std::cout << "\t\t<attrs> = <attr> { \",\" <attr> }" << std::endl;
             std::cout << "\t\t<numPages> = is a number bigger than 0" << std::endl;
             std::cout << "\t\t<numPartitions> = is a number bigger than 0" << std::endl;
+            std::cout << "\t\t<numRows> = is a number" << std::endl;
             std::cout << std::endl;
         } else if (input == "all") {
             help("create");
@@ -19,7 +19,7 @@
 
 namespace PeterDB {
     typedef enum {
-        FILTER = 0, PROJECT, BNL_JOIN, INL_JOIN, GH_JOIN, AGG, IDX_SCAN, TBL_SCAN
+        FILTER = 0, PROJECT, BNL_JOIN, INL_JOIN, GH_JOIN, AGG, IDX_SCAN, TBL_SCAN, LIMIT
     } QUERY_OP;
 
     // Return code
@@ -97,6 +97,8 @@ namespace PeterDB {
 
         PeterDB::Iterator *aggregate(PeterDB::Iterator *input);
 
+        PeterDB::Iterator *limit(PeterDB::Iterator *input);
+
         // run the query
         RC run(PeterDB::Iterator *);
 
@@ -9,11 +9,28 @@
 
 # define IX_EOF (-1)  // end of the index scan
 
+#define IX_META_PAGE 0                          // Page holding [root][first free page], also "no page" in node links
+#define IX_NODE_HEADER_SIZE 12                  // [link][level][numEntries][heapStart][unused], entries follow
+#define IX_RID_SIZE (NUM_SIZE + SHORT_SIZE)     // RID stored in an entry: [pageNum][slotNum]
+#define IX_MAX_ENTRY_SIZE ((PAGE_SIZE - IX_NODE_HEADER_SIZE) / 3)      // A split leaves entries on both sides
+#define IX_MERGE_THRESHOLD ((PAGE_SIZE - IX_NODE_HEADER_SIZE) / 3)     // Bytes below which a node takes from a sibling
+#define IX_BULK_LOAD_BUDGET (256 * PAGE_SIZE)   // Memory used to sort entries in IndexManager::bulkLoad
+#define IX_BULK_LOAD_FILL_FACTOR 0.9f           // Default fraction of a node filled by IndexManager::bulkLoad
+#define IX_BULK_LOAD_BATCH 64                   // Pages appended together by IndexManager::bulkLoad
+
 namespace PeterDB {
     class IX_ScanIterator;
 
     class IXFileHandle;
 
+    // Source of (key, RID) entries for IndexManager::bulkLoad, keys follow the IndexManager::insertEntry() format
+    class IX_EntryIterator {
+    public:
+        virtual ~IX_EntryIterator() = default;
+
+        virtual RC getNextEntry(RID &rid, void *key) = 0;                   // IX_EOF after the last entry
+    };
+
     class IndexManager {
 
     public:
@@ -37,6 +54,13 @@ namespace PeterDB {
         // Delete an entry from the given index that is indicated by the given ixFileHandle.
         RC deleteEntry(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid);
 
+        // Build the tree of an empty index from unsorted entries. The entries are sorted within
+        // IX_BULK_LOAD_BUDGET bytes of memory, spilling sorted runs to disk beyond that. Leaves are then
+        // filled left to right up to fillFactor of a page and the internal levels are built bottom-up,
+        // so every node is written exactly once.
+        RC bulkLoad(IXFileHandle &ixFileHandle, const Attribute &attribute, IX_EntryIterator &entries,
+                    float fillFactor = IX_BULK_LOAD_FILL_FACTOR);
+
         // Initialize and IX_ScanIterator to support a range search
         RC scan(IXFileHandle &ixFileHandle,
                 const Attribute &attribute,
@@ -55,6 +79,126 @@ namespace PeterDB {
         IndexManager(const IndexManager &) = default;                               // Prevent construction by copying
         IndexManager &operator=(const IndexManager &) = default;                    // Prevent assignment
 
+    private:
+        RC readRoot(IXFileHandle &ixFileHandle, PageNum &root) const;
+        RC writeRoot(IXFileHandle &ixFileHandle, PageNum root);
+        // Write a new node to the first free page, or append it when none is free
+        RC allocatePage(IXFileHandle &ixFileHandle, const void *data, PageNum &pageNum);
+        // Put a page no longer in the tree on the free list, it links to the next free page
+        RC freePage(IXFileHandle &ixFileHandle, PageNum pageNum);
+        // Read the leaf where entries with keys >= key start, the leftmost leaf if key is null
+        RC findLeaf(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key,
+                    char *page, PageNum &pageNum);
+        // Read the leaf where (key, RID) belongs, path gets the pages from the root down to it
+        RC descend(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid,
+                   char *page, std::vector<PageNum> &path);
+        // Split a full node around an entry that did not fit before entry position. The page keeps the left half
+        // and the right half gets a new page; key, rid and child return the separator and the right half's page.
+        RC splitNode(IXFileHandle &ixFileHandle, const Attribute &attribute, char *page, unsigned position,
+                     char *key, RID &rid, PageNum &child);
+        // After a delete, merge or redistribute the nodes on the path that fell below IX_MERGE_THRESHOLD
+        RC rebalance(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid,
+                     const std::vector<PageNum> &path, char *page);
+        RC printNode(IXFileHandle &ixFileHandle, const Attribute &attribute, PageNum pageNum,
+                     std::ostream &out) const;
+
+        friend class IX_ScanIterator;
+    };
+
+    // A B+ tree node stored in one page: a header followed by a sorted array of fixed-stride entries
+    // that is binary searched in place.
+    //   leaf entry:     [key field][RID]
+    //   internal entry: [key field][RID][child], entry i separates child i and child i + 1
+    // The key field is the value itself for TypeInt and TypeReal. For TypeVarChar it is the first 4 characters,
+    // zero padded, followed by the offset and length of the characters, which live in a heap growing down from
+    // the end of the page; most comparisons are decided by the prefix without leaving the entry array.
+    // Entries are ordered by (key, RID), so duplicate keys may span leaves and still be found exactly.
+    // The link is the right sibling of a leaf and child 0 of an internal node. Leaves are at level 0.
+    class BTreeNode {
+    public:
+        BTreeNode(const Attribute &attribute, char *page);
+
+        void initialize(unsigned short level);                              // Empty node at a level
+        bool isLeaf() const;
+        unsigned short getLevel() const;
+        unsigned short getNumEntries() const;
+        PageNum getLink() const;
+        void setLink(PageNum pageNum);
+        unsigned getFreeSpace() const;                                      // Bytes left for entries and keys
+        unsigned getUsedSpace() const;                                      // Bytes taken by entries and keys
+        unsigned entrySize(const void *key) const;                          // Bytes an entry with this key takes
+        unsigned getEntrySize(unsigned i) const;                            // Bytes entry i takes
+
+        void getKey(unsigned i, void *key) const;                           // Key of entry i in the index key format
+        RID getRID(unsigned i) const;
+        PageNum getChild(unsigned i) const;                                 // Child i of an internal node, 0 is the link
+        void setChild(unsigned i, PageNum pageNum);
+
+        int compareKey(unsigned i, const void *key) const;                  // Key of entry i against a key
+        int compare(unsigned i, const void *key, const RID &rid) const;     // Entry i against (key, RID)
+        unsigned lowerBound(const void *key, bool inclusive) const;         // First entry with key >= key (> if exclusive)
+        unsigned upperBound(const void *key, const RID &rid) const;         // First entry greater than (key, RID)
+
+        // Insert an entry before entry i, child is the page right of it in an internal node
+        RC insert(unsigned i, const void *key, const RID &rid, PageNum child = IX_META_PAGE);
+        // Insert entry i of another node at the same level before entry position, with the child right of it
+        RC insertFrom(const BTreeNode &source, unsigned i, unsigned position);
+        void remove(unsigned i);                                            // Remove entry i and the child right of it
+
+        static unsigned keySize(const Attribute &attribute, const void *key);  // Bytes of a key in the key format
+        static int compareKeys(const Attribute &attribute, const void *key1, const void *key2);
+        static int compareRIDs(const RID &rid1, const RID &rid2);
+
+    private:
+        AttrType type;
+        char *page;
+        unsigned keyFieldSize;
+        unsigned stride;                                                    // bytes of one entry in the array
+
+        char *entry(unsigned i) const;
+        void setNumEntries(unsigned short numEntries);
+        unsigned short getHeapStart() const;
+        void setHeapStart(unsigned short heapStart);
+    };
+
+    // Sorts (key, RID) entries for IndexManager::bulkLoad. Entries are kept in memory up to IX_BULK_LOAD_BUDGET
+    // bytes; past that every sorted batch is written to a run file and the runs are merged while reading back.
+    class IX_EntrySorter {
+    public:
+        IX_EntrySorter(const Attribute &attribute, const std::string &runPrefix);
+        ~IX_EntrySorter();                                                  // Destroys the run files
+        IX_EntrySorter(const IX_EntrySorter &) = delete;
+        IX_EntrySorter &operator=(const IX_EntrySorter &) = delete;
+
+        RC add(const void *key, const RID &rid);                            // Fails for keys insertEntry() rejects
+        RC finish();                                                        // Start reading the entries in order
+        RC getNextEntry(RID &rid, void *key);                               // IX_EOF after the last entry
+
+    private:
+        // A run file being merged: its current page and the position of the next entry on it
+        struct Run {
+            FileHandle fileHandle;
+            std::vector<char> page;
+            PageNum pageNum;
+            unsigned short numEntries;
+            unsigned short next;
+            unsigned offset;
+        };
+
+        Attribute attribute;
+        std::string runPrefix;
+        std::vector<char> arena;                                            // entries as [key][RID]
+        std::vector<unsigned> entryOffsets;
+        size_t nextEntry;
+        std::vector<std::string> runNames;
+        std::vector<Run> runs;
+        std::vector<unsigned> heap;                                         // runs ordered by their next entry
+
+        void sortEntries();
+        RC spill();
+        RC advance(Run &run);                                               // Move a run to its next entry
+        bool runGreater(unsigned run1, unsigned run2) const;
+        int compareEntries(const char *entry1, const char *entry2) const;
     };
 
     class IX_ScanIterator {
@@ -66,11 +210,37 @@ namespace PeterDB {
         // Destructor
         ~IX_ScanIterator();
 
+        RC initializeScan(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *lowKey,
+                          const void *highKey, bool lowKeyInclusive, bool highKeyInclusive);
+
+        // Move an initialized scan to a new key range. If the leaf the scan is on holds the start of the range
+        // and has not changed, it is searched in place instead of descending from the root, so ranges given in
+        // ascending order mostly stay on the leaves already read.
+        RC seek(const void *lowKey, const void *highKey, bool lowKeyInclusive, bool highKeyInclusive);
+
         // Get next matching entry
         RC getNextEntry(RID &rid, void *key);
 
         // Terminate index scan
         RC close();
+
+    private:
+        IXFileHandle *ixFileHandle;
+        Attribute attribute;
+        std::vector<char> lowKey;                                           // empty when unbounded
+        std::vector<char> highKey;
+        bool lowKeyInclusive;
+        bool highKeyInclusive;
+        std::vector<char> page;                                             // copy of the current leaf
+        std::vector<char> current;                                          // the current leaf as it is on disk now
+        PageNum pageNum;
+        unsigned position;
+        bool finished;
+        std::vector<char> lastKey;                                          // last entry returned, empty before any
+        RID lastRid;
+
+        RC restart();                                                       // Find the next entry again from the root
+        void setRange(const void *lowKey, const void *highKey, bool lowKeyInclusive, bool highKeyInclusive);
     };
 
     class IXFileHandle {
@@ -81,6 +251,8 @@ namespace PeterDB {
         unsigned ixWritePageCounter;
         unsigned ixAppendPageCounter;
 
+        FileHandle fileHandle;                                              // meta page followed by the tree nodes
+
         // Constructor
         IXFileHandle();
 
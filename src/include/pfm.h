@@ -7,7 +7,25 @@
 #define WRITE_PAGE_CNT_POS 2
 #define APPEND_PAGE_CNT_POS 3
 
+#define BUFFER_POOL_SIZE (1024 * PAGE_SIZE) // Default memory budget of the shared buffer pool
+#define LRU_K 2                             // Number of references tracked per frame by LRU-K
+#define MMAP_CHUNK_SIZE (256 * PAGE_SIZE)   // Granularity in which memory-mapped files grow their mapping
+#define FSM_GROUP_SIZE (PAGE_SIZE / 2)      // Number of data pages tracked by one free space map page
+#define FSM_CATEGORY_SIZE (PAGE_SIZE / 256) // Bytes of free space per free space map category
+#define READ_AHEAD_WINDOW 32                // Default number of pages requested ahead of a sequential reader
+#define READ_AHEAD_TRIGGER 2                // Consecutive pins of the next page before read-ahead starts
+#define READ_AHEAD_QUEUE_SIZE 64            // Read-ahead requests waiting at most, later ones are dropped
+
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
 namespace PeterDB {
 
@@ -15,6 +33,260 @@ namespace PeterDB {
     typedef int RC;
 
     class FileHandle;
+    class BufferPool;
+    class PagedFile;
+
+    typedef enum {
+        CLOCK_POLICY = 0, LRU_K_POLICY
+    } ReplacementPolicyType;
+
+    // How the pages of a file are brought into memory
+    typedef enum {
+        BUFFERED_IO = 0,    // positional reads and writes cached by the shared buffer pool
+        MMAP_IO             // pages are served straight from a memory mapping of the file
+    } IOBackend;
+
+    // How pages ahead of a sequential reader are brought in before they are pinned
+    typedef enum {
+        NO_READ_AHEAD = 0,  // pages are read when pinned
+        THREAD_READ_AHEAD,  // a background thread reads them into the buffer pool
+        ADVISE_READ_AHEAD   // the kernel is asked to read them into its page cache (posix_fadvise, madvise)
+    } ReadAheadMode;
+
+    // Free space of every data page, kept as one byte category (free bytes / FSM_CATEGORY_SIZE) per page.
+    // Each free space map page is a max-tree over FSM_GROUP_SIZE pages: node i has children 2i and 2i + 1,
+    // node 1 is the root and the leaves start at FSM_GROUP_SIZE, so a search or update touches log2 nodes.
+    // The map is read on first use and only modified groups are written back.
+    class FreeSpaceMap {
+    public:
+        FreeSpaceMap();
+
+        RC update(PagedFile &file, PageNum pageNum, unsigned freeSpace);    // Record the free space of a page
+        RC search(PagedFile &file, unsigned freeSpace, PageNum &pageNum);   // First page with at least freeSpace
+        RC save(PagedFile &file);                                           // Write back the modified groups
+        RC truncate(PagedFile &file, unsigned numberOfPages);               // Forget the pages past numberOfPages
+
+    private:
+        bool loaded;
+        std::vector<std::vector<unsigned char>> groups;                     // one tree per free space map page
+        std::vector<bool> dirtyGroups;
+        std::mutex latch;
+
+        RC load(PagedFile &file);
+    };
+
+    // A paged file opened through PagedFileManager. Every FileHandle opened on the same file name
+    // shares one PagedFile, so the buffer pool sees a single owner for each page on disk.
+    // The hidden page is loaded once on open and only written back by writeHeader().
+    // Physical layout: [hidden page][FSM page 0][FSM_GROUP_SIZE data pages][FSM page 1][data pages]...
+    // The free space map page of a group is written when the first page of the group is appended.
+    // All I/O is positional (pread/pwrite) on a shared descriptor, so there is no file offset to race on
+    // and any number of threads may read pages of the same file at once; appends are serialized.
+    class PagedFile {
+    public:
+        std::string fileName;
+        int fd;
+        unsigned fileId;            // identifies the file's pages in the buffer pool
+        unsigned refCount;          // number of FileHandles currently opened on this file
+        bool destroyed;             // file was destroyed while still open, never write it back
+        std::mutex appendLatch;     // held while the file grows
+
+        // hidden page metadata
+        std::atomic<unsigned> numberOfPages;
+        std::atomic<unsigned> readPageCounter;
+        std::atomic<unsigned> writePageCounter;
+        std::atomic<unsigned> appendPageCounter;
+        std::atomic<bool> headerDirty;
+        FreeSpaceMap spaceMap;
+
+        PagedFile(const std::string &fileName, int fd, unsigned fileId);
+        virtual ~PagedFile() = default;
+
+        virtual RC open();                                                  // Prepare the backend after opening
+        virtual RC pin(PageNum pageNum, char *&data);                       // Make a page addressable
+        virtual RC write(PageNum pageNum, const void *data);                // Replace a whole page
+        virtual RC read(PageNum pageNum, unsigned numPages, void *data);    // Copy consecutive pages out
+        virtual RC pinRange(PageNum pageNum, unsigned numPages, char **data); // Make consecutive pages addressable
+        virtual RC unpin(PageNum pageNum, bool dirty);                      // Release a page made addressable
+        virtual RC appendRange(PageNum pageNum, unsigned numPages, const void *data); // Add pages at the end of the file
+        virtual RC truncateRange(PageNum pageNum);                          // Cut the file before a page
+        virtual RC flush();                                                 // Write back modified pages
+        virtual RC discard();                                               // Forget modified pages
+        virtual RC prefetch(PageNum pageNum, unsigned numPages);            // Bring pages in without pinning them
+        virtual RC advise(PageNum pageNum, unsigned numPages);              // Tell the kernel the pages are needed soon
+
+        RC readBlock(PageNum pageNum, void *data);                          // Physical read of a data page
+        RC readBlocks(PageNum pageNum, unsigned numPages, char *const *data); // Vectored read of consecutive pages
+        RC writeBlock(PageNum pageNum, const void *data);                   // Physical write of a data page
+        RC readHeader();                                                    // Load the hidden page metadata
+        RC writeHeader();                                                   // Persist the hidden pages if they changed
+
+        static uint64_t blockOffset(PageNum pageNum);                       // File offset of a data page
+        static uint64_t spaceMapOffset(unsigned group);                     // File offset of a free space map page
+    };
+
+    // A paged file mapped into memory. The mapping is grown in MMAP_CHUNK_SIZE steps as pages are
+    // appended; mappings that are outgrown stay valid until the file is closed, so pinned pages never move.
+    class MappedPagedFile : public PagedFile {
+    public:
+        MappedPagedFile(const std::string &fileName, int fd, unsigned fileId);
+        ~MappedPagedFile() override;
+
+        RC open() override;
+        RC pin(PageNum pageNum, char *&data) override;
+        RC write(PageNum pageNum, const void *data) override;
+        RC read(PageNum pageNum, unsigned numPages, void *data) override;
+        RC pinRange(PageNum pageNum, unsigned numPages, char **data) override;
+        RC unpin(PageNum pageNum, bool dirty) override;
+        RC appendRange(PageNum pageNum, unsigned numPages, const void *data) override;
+        RC truncateRange(PageNum pageNum) override;
+        RC flush() override;
+        RC discard() override;
+        RC prefetch(PageNum pageNum, unsigned numPages) override;
+        RC advise(PageNum pageNum, unsigned numPages) override;
+
+    private:
+        std::atomic<char *> mapping;                                        // readers pin through it while appends grow it
+        size_t mappingSize;
+        std::vector<std::pair<char *, size_t>> retiredMappings;
+
+        RC growMapping(size_t size);
+    };
+
+    // A frame of the buffer pool holding one page of one file
+    struct Frame {
+        PagedFile *file;
+        PageNum pageNum;
+        unsigned pinCount;
+        unsigned copying;           // pins of readers copying the page out, writePage() waits for them
+        bool dirty;
+        bool loading;               // the page is being read from or written back to disk, wait before using it
+        char *data;
+    };
+
+    // Decides which unpinned frame the buffer pool evicts when it needs room for a page
+    class ReplacementPolicy {
+    public:
+        virtual ~ReplacementPolicy() = default;
+
+        virtual void recordAccess(unsigned frameId) = 0;                    // Frame was pinned
+        virtual void remove(unsigned frameId) = 0;                          // Frame no longer holds a page
+        virtual RC pickVictim(const std::vector<Frame> &frames, unsigned &frameId) = 0;
+    };
+
+    // Second-chance CLOCK: a hand sweeps the frames and clears reference bits until it finds a cold one
+    class ClockPolicy : public ReplacementPolicy {
+    public:
+        explicit ClockPolicy(unsigned numFrames);
+
+        void recordAccess(unsigned frameId) override;
+        void remove(unsigned frameId) override;
+        RC pickVictim(const std::vector<Frame> &frames, unsigned &frameId) override;
+
+    private:
+        std::vector<bool> referenced;
+        unsigned hand;
+    };
+
+    // LRU-K: evicts the frame whose K-th most recent reference is the oldest. Frames referenced fewer
+    // than K times have an infinite backward distance and go first, oldest reference first.
+    class LRUKPolicy : public ReplacementPolicy {
+    public:
+        LRUKPolicy(unsigned numFrames, unsigned k);
+
+        void recordAccess(unsigned frameId) override;
+        void remove(unsigned frameId) override;
+        RC pickVictim(const std::vector<Frame> &frames, unsigned &frameId) override;
+
+    private:
+        unsigned k;
+        uint64_t timestamp;
+        std::vector<std::vector<uint64_t>> history;                        // last k references, most recent last
+    };
+
+    // Fixed-capacity pool of page frames shared by every open file. Pages are pinned while in use,
+    // modified pages are written back when evicted or when their file is closed.
+    // The pool is guarded by a latch that is released while a missing page is read from disk and while an
+    // evicted page is written back, so readers of cached pages never wait on another thread's I/O.
+    class BufferPool {
+    public:
+        BufferPool(size_t budget, ReplacementPolicyType policyType);
+        ~BufferPool();
+        BufferPool(const BufferPool &) = delete;                            // Frames are never shared
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        RC configure(size_t budget, ReplacementPolicyType policyType);      // Resize the pool and swap the policy
+        unsigned getNumberOfFrames() const;
+
+        RC pinPage(PagedFile *file, PageNum pageNum, char *&data);           // Pin a page into the pool
+        // Replace a whole page without reading it from disk. The data is copied into the frame with the latch
+        // held, before the frame is entered in the page table, and only once no reader is copying the page out,
+        // so a copy never mixes the old and the new page. Pages pinned by pinPage() are changed in place.
+        RC writePage(PagedFile *file, PageNum pageNum, const void *data);
+        // Pin consecutive pages; the ones not cached are read with a single vectored read
+        RC pinPages(PagedFile *file, PageNum pageNum, unsigned numPages, char **data);
+        // Copy consecutive pages out, holding writePage() off them until the copies are done
+        RC readPages(PagedFile *file, PageNum pageNum, unsigned numPages, void *data);
+        // Read the pages of a range that are not cached into the pool, unpinned. Pages that find no free or
+        // evictable frame are left out.
+        RC prefetchPages(PagedFile *file, PageNum pageNum, unsigned numPages);
+        RC unpinPage(PagedFile *file, PageNum pageNum, bool dirty);
+
+        RC flushFile(PagedFile *file);                                      // Write back dirty pages of a file
+        RC discardFile(PagedFile *file, PageNum from = 0);                  // Drop pages of a file without writing
+        RC flushAll();
+
+    private:
+        std::vector<Frame> frames;
+        std::vector<char> memory;
+        std::vector<unsigned> freeFrames;
+        std::unordered_map<uint64_t, unsigned> pageTable;                   // (fileId, pageNum) -> frame
+        ReplacementPolicy *policy;
+        std::mutex latch;
+        std::condition_variable loaded;                                     // signalled when a page read completes
+        std::condition_variable copied;                                     // signalled when page copies complete
+
+        static uint64_t pageKey(const PagedFile *file, PageNum pageNum);
+        RC pinFrame(PagedFile *file, PageNum pageNum, char *&data, bool copying);
+        RC pinFrames(PagedFile *file, PageNum pageNum, unsigned numPages, char **data, bool copying);
+        void allocateFrames(size_t budget, ReplacementPolicyType policyType);
+        RC writeBackAll();                                                  // Write back every dirty frame, latch held
+        // Take a free frame or evict one. Writing back a dirty victim drops the latch, so callers look the
+        // page up again afterwards.
+        RC reserveFrame(std::unique_lock<std::mutex> &lock, unsigned &frameId);
+        RC evictFrame(std::unique_lock<std::mutex> &lock, unsigned frameId);
+        void releaseFrame(unsigned frameId);                                // Return a frame to the free list
+    };
+
+    // Serves read-ahead requests on a background thread, started by the first request. Requests are a hint:
+    // they are dropped when READ_AHEAD_QUEUE_SIZE are already waiting, or when their file is closed.
+    class ReadAheadQueue {
+    public:
+        ReadAheadQueue();
+        ~ReadAheadQueue();                                                  // Stops the thread
+        ReadAheadQueue(const ReadAheadQueue &) = delete;
+        ReadAheadQueue &operator=(const ReadAheadQueue &) = delete;
+
+        void push(PagedFile *file, PageNum pageNum, unsigned numPages);
+        void cancel(PagedFile *file);                                       // Drop a file's requests, wait for its I/O
+
+    private:
+        struct Request {
+            PagedFile *file;
+            PageNum pageNum;
+            unsigned numPages;
+        };
+
+        std::deque<Request> requests;
+        PagedFile *serving;                                                 // file of the request being read
+        bool stopping;
+        std::thread thread;
+        std::mutex latch;
+        std::condition_variable pending;                                    // a request was queued or stopping
+        std::condition_variable served;                                     // the request being read is done
+
+        void run();
+    };
 
     class PagedFileManager {
     public:
@@ -22,43 +294,69 @@ namespace PeterDB {
 
         RC createFile(const std::string &fileName);                         // Create a new file
         RC destroyFile(const std::string &fileName);                        // Destroy a file
-        RC openFile(const std::string &fileName, FileHandle &fileHandle);   // Open a file
+        RC openFile(const std::string &fileName, FileHandle &fileHandle,
+                    IOBackend backend = BUFFERED_IO);                       // Open a file
         RC closeFile(FileHandle &fileHandle);                               // Close a file
 
+        BufferPool &getBufferPool();                                        // Pool shared by all open files
+        RC configureBufferPool(size_t budget, ReplacementPolicyType policyType);
+        RC checkpoint();                                                    // Persist pages and metadata of open files
+
+        // Choose how sequential readers are read ahead and by how many pages, a window of 0 turns it off.
+        // The window is capped at a quarter of the buffer pool so read-ahead cannot push out its own pages.
+        RC configureReadAhead(ReadAheadMode mode, unsigned window);
+        unsigned getReadAheadWindow();
+        void readAhead(PagedFile *file, PageNum pageNum, unsigned numPages); // Request pages, never waits for them
+
     protected:
         PagedFileManager();                                                 // Prevent construction
         ~PagedFileManager();                                                // Prevent unwanted destruction
         PagedFileManager(const PagedFileManager &);                         // Prevent construction by copying
         PagedFileManager &operator=(const PagedFileManager &);              // Prevent assignment
+
+    private:
+        BufferPool bufferPool;
+        std::map<std::string, PagedFile *> openFiles;
+        unsigned nextFileId;
+        std::mutex registryLatch;                                           // guards openFiles
+        std::atomic<ReadAheadMode> readAheadMode;
+        std::atomic<unsigned> readAheadWindow;
+        ReadAheadQueue readAheadQueue;                                      // destroyed before the pool it fills
     };
 
     class FileHandle {
     public:
-        // variables to keep the counter for each operation
-        FILE * openedFile;
-        unsigned readPageCounter;
-        unsigned writePageCounter;
-        unsigned appendPageCounter;
+        // the opened file; it keeps the counter for each operation
+        PagedFile *file;
+
+        // sequential access seen through this handle, pages up to readAheadEnd were requested ahead
+        PageNum readAheadNext;
+        unsigned readAheadRun;
+        PageNum readAheadEnd;
 
         FileHandle();                                                       // Default constructor
         ~FileHandle();                                                      // Destructor
 
         RC readPage(PageNum pageNum, void *data);                           // Get a specific page
+        RC readPages(PageNum pageNum, unsigned numPages, void *data);       // Get consecutive pages in one read
         RC writePage(PageNum pageNum, const void *data);                    // Write a specific page
         RC appendPage(const void *data);                                    // Append a specific page
+        RC appendPages(unsigned numPages, const void *data);                // Append consecutive pages in one write
+        RC truncate(unsigned numberOfPages);                                // Drop the pages from numberOfPages on
+        RC pinPage(PageNum pageNum, char *&page);                           // Pin a page for reading and writing
+        const char *pinPage(PageNum pageNum);                               // Pin a page for reading, no copy
+        RC unpinPage(PageNum pageNum, bool dirty);                          // Release a pinned page
+        RC setFreeSpace(PageNum pageNum, unsigned freeSpace);               // Record the free bytes of a page
+        RC findFreeSpace(unsigned freeSpace, PageNum &pageNum);             // Find a page with enough free bytes
         unsigned getNumberOfPages();                                        // Get the number of pages in the file
         RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount,
                                 unsigned &appendPageCount);                 // Put current counter values into variables
+        RC sync();                                                          // Persist dirty pages and the hidden page
         void createHiddenPage();
-        void updateOpenedFile(FILE * pageFile);
-        unsigned getCounterValue(int offset);
-        RC setCounterValue(unsigned value, int offset);
-        RC setNumberOfPages(unsigned numOfPages);
-        RC setReadPageCnt(unsigned readPageCnt);
-        RC setWritePageCnt(unsigned writePageCnt);
-        RC setAppendPageCnt(unsigned appendPageCnt);
+        void updateOpenedFile(PagedFile *pagedFile);
+        void readAhead(PageNum pageNum);                                    // Note a pin, request pages if sequential
     };
 
 } // namespace PeterDB
 
-#endif // _pfm_h_
\ No newline at end of file
+#endif // _pfm_h_
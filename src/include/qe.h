@@ -2,8 +2,10 @@
 #define _qe_h_
 
 #include <vector>
+#include <cstdint>
 #include <string>
 #include <limits>
+#include <memory>
 
 #include "rm.h"
 #include "ix.h"
@@ -11,6 +13,12 @@
 namespace PeterDB {
 
 #define QE_EOF (-1)  // end of the index scan
+#define QE_BATCH_SIZE 1024              // Tuples an operator passes on per Iterator::getNextBatch() call
+#define QE_MAX_TUPLE_SIZE PAGE_SIZE     // Space reserved for a tuple whose length is known only once written
+#define QE_MEMORY_BUDGET (256 * PAGE_SIZE)  // Bytes of tuples an operator keeps in memory before it spills to disk
+#define QE_MAX_PARTITION_LEVEL 3        // Times an operator splits a partition again that does not fit in memory
+#define QE_SPILL_PARTITIONS 16          // Files a hash aggregate spreads the groups over that do not fit in memory
+#define QE_MERGE_FAN_IN 64              // Sorted runs merged at once, each read a batch at a time
     typedef enum AggregateOp {
         MIN = 0, MAX, COUNT, SUM, AVG
     } AggregateOp;
@@ -33,16 +41,156 @@ namespace PeterDB {
         Value rhsValue;             // right-hand side value if bRhsIsAttr = FALSE
     } Condition;
 
+    typedef struct SortKey {
+        std::string attr;           // attribute to order by
+        bool descending;            // TRUE for descending order; FALSE, for ascending
+    } SortKey;
+
+    // Up to QE_BATCH_SIZE tuples in the getNextTuple() format, packed back to back in one buffer. Every tuple is
+    // parsed once when it is added: the offset of each field within it is kept in a column directory, 0 for a
+    // null field, so operators read fields without walking the null bitmap and the variable-length fields again.
+    // The selection vector holds the indexes of the tuples still part of the batch, in order; a filter narrows
+    // it instead of moving tuples.
+    class TupleBatch {
+    public:
+        std::vector<unsigned short> selection;                              // tuples in the batch, in order
+
+        TupleBatch();
+
+        void setAttributes(const std::vector<Attribute> &attrs);            // Layout of the tuples, clears the batch
+        void clear();
+        bool isFull() const;
+        unsigned size() const;                                              // Tuples selected
+
+        char *reserve(unsigned maxLength = QE_MAX_TUPLE_SIZE);              // Space to write the next tuple in
+        void commit();                                                      // Add the tuple written at reserve()
+        void add(const void *tuple, unsigned length);
+
+        const char *getTuple(unsigned t) const;                             // t indexes tuples, not the selection
+        unsigned getLength(unsigned t) const;
+        bool isNull(unsigned t, unsigned field) const;
+        const char *getField(unsigned t, unsigned field) const;             // nullptr if null
+        unsigned getFieldLength(unsigned t, unsigned field) const;          // 0 if null
+
+    private:
+        std::vector<AttrType> types;
+        unsigned nullIndicatorSize;
+        std::vector<char> buffer;                                           // only grows, used bytes are tracked
+        unsigned used;
+        std::vector<unsigned> offsets;                                      // tuple t spans offsets[t], offsets[t + 1]
+        std::vector<unsigned short> columns;                                // field f of tuple t at t * types.size() + f
+    };
+
     class Iterator {
         // All the relational operators and access methods are iterators.
     public:
         virtual RC getNextTuple(void *data) = 0;
 
+        // Replace the batch with the next tuples, QE_EOF once there are none. The default calls getNextTuple().
+        virtual RC getNextBatch(TupleBatch &batch);
+
         virtual RC getAttributes(std::vector<Attribute> &attrs) const = 0;
 
+        // True if the tuples come in ascending order of the attribute, nulls aside. The default knows of none.
+        virtual bool isOrderedOn(const std::string &attr) const;
+
+        // Stop reading before the end: close the underlying scans and release what is held. Nothing may be read
+        // after this. The default holds nothing.
+        virtual RC close();
+
         virtual ~Iterator() = default;
     };
 
+    // An operator that produces whole batches and serves getNextTuple() from them
+    class BatchIterator : public Iterator {
+    public:
+        RC getNextTuple(void *data) override;
+
+        RC getNextBatch(TupleBatch &batch) override = 0;
+
+    protected:
+        BatchIterator();
+
+    private:
+        TupleBatch output;
+        unsigned next;                                                      // position in output.selection
+    };
+
+    // Tuples an operator sets aside in a temporary record-based file, to be read back once in the order they
+    // were added. Tuples are buffered and written a page at a time with RecordBasedFileManager::insertRecords().
+    // The file is created with the object and destroyed with it, adding fails if a file of the name exists.
+    class SpillFile : public Iterator {
+    public:
+        SpillFile(const std::string &fileName, const std::vector<Attribute> &attrs);
+        ~SpillFile() override;
+        SpillFile(const SpillFile &) = delete;
+        SpillFile &operator=(const SpillFile &) = delete;
+
+        // "<name>.<process id>.<n>", a prefix for the files of one operator that no other operator shares
+        static std::string makePrefix(const std::string &name);
+
+        RC add(const void *tuple, unsigned length);
+        size_t getSize() const;                                             // Bytes of the tuples added
+
+        // Reading starts with the first call, no tuple can be added after that
+        RC getNextTuple(void *data) override;
+        RC getNextBatch(TupleBatch &batch) override;
+        RC getAttributes(std::vector<Attribute> &attrs) const override;
+        RC rewind();                                                        // Read the tuples again from the first
+
+    private:
+        std::string fileName;
+        std::vector<Attribute> attrs;
+        FileHandle fileHandle;
+        bool opened;
+        std::vector<char> buffer;                                           // tuples not written yet
+        std::vector<unsigned> offsets;                                      // of each tuple in buffer
+        size_t size;
+        RBFM_ScanIterator scan;
+        bool reading;
+
+        RC flush();
+        RC startReading();
+    };
+
+    // Tuples a join holds in memory, copied into one arena and indexed on a join attribute by an open-addressing
+    // table of hash-tagged slots. Tuples with equal keys are chained, so a lookup walks only the matches.
+    class TupleBlock {
+    public:
+        static const unsigned NO_TUPLE = std::numeric_limits<unsigned>::max();   // empty slot, end of a chain
+
+        TupleBlock();
+
+        void setAttributes(const std::vector<Attribute> &attrs, unsigned keyField);     // Clears the block
+        void clear();
+        void add(const TupleBatch &batch, unsigned t);                      // The key must not be null
+        size_t getSize() const;                                             // Bytes of the tuples added
+        unsigned getNumTuples() const;
+
+        void index();                                                       // Hash the tuples added so far
+        unsigned find(const char *key) const;                               // First tuple with the key
+        unsigned next(unsigned tuple) const;                                // Next tuple with the same key
+
+        const char *getTuple(unsigned i) const;
+        unsigned getLength(unsigned i) const;
+        const char *getKey(unsigned i) const;
+
+    private:
+        // A slot of the table: a key's hash and the first tuple with that key
+        struct Slot {
+            unsigned hash;
+            unsigned tuple;
+        };
+
+        AttrType type;
+        unsigned keyField;
+        std::vector<char> arena;
+        std::vector<unsigned> tupleOffsets;                                 // tuple i spans [i], [i + 1]
+        std::vector<unsigned> keyOffsets;
+        std::vector<unsigned> chain;                                        // next tuple with the same key
+        std::vector<Slot> slots;
+    };
+
     class TableScan : public Iterator {
         // A wrapper inheriting Iterator over RM_ScanIterator
     private:
@@ -52,8 +200,11 @@ namespace PeterDB {
         std::vector<Attribute> attrs;
         std::vector<std::string> attrNames;
         RID rid;
+        unsigned numWorkers;
     public:
-        TableScan(RelationManager &rm, const std::string &tableName, const char *alias = NULL) : rm(rm) {
+        // With more than one worker the table is read by RelationManager's parallel scan, in no particular order
+        TableScan(RelationManager &rm, const std::string &tableName, const char *alias = NULL,
+                  unsigned numWorkers = 1) : rm(rm), numWorkers(numWorkers) {
             //Set members
             this->tableName = tableName;
 
@@ -67,7 +218,7 @@ namespace PeterDB {
             }
 
             // Call RM scan to get an iterator
-            rm.scan(tableName, "", NO_OP, NULL, attrNames, iter);
+            rm.scan(tableName, "", NO_OP, NULL, attrNames, iter, numWorkers);
 
             // Set alias
             if (alias) this->tableName = alias;
@@ -76,13 +227,23 @@ namespace PeterDB {
         // Start a new iterator given the new compOp and value
         void setIterator() {
             iter.close();
-            rm.scan(tableName, "", NO_OP, NULL, attrNames, iter);
+            rm.scan(tableName, "", NO_OP, NULL, attrNames, iter, numWorkers);
         };
 
         RC getNextTuple(void *data) override {
             return iter.getNextTuple(rid, data);
         };
 
+        // Tuples are read straight into the batch
+        RC getNextBatch(TupleBatch &batch) override {
+            batch.setAttributes(attrs);
+            while (!batch.isFull()) {
+                if (iter.getNextTuple(rid, batch.reserve()) != 0) break;
+                batch.commit();
+            }
+            return batch.size() == 0 ? QE_EOF : 0;
+        };
+
         RC getAttributes(std::vector<Attribute> &attributes) const override {
             attributes.clear();
             attributes = this->attrs;
@@ -94,6 +255,11 @@ namespace PeterDB {
             return 0;
         };
 
+        // Stops the workers of a parallel scan and closes the table; setIterator() opens it again
+        RC close() override {
+            return iter.close();
+        };
+
         ~TableScan() override {
             iter.close();
         };
@@ -132,6 +298,20 @@ namespace PeterDB {
             rm.indexScan(tableName, attrName, lowKey, highKey, lowKeyInclusive, highKeyInclusive, iter);
         };
 
+        // Move to a new key range without reopening the index; ranges in ascending order reuse the leaves read
+        RC seek(const void *lowKey, const void *highKey, bool lowKeyInclusive, bool highKeyInclusive) {
+            return iter.seek(lowKey, highKey, lowKeyInclusive, highKeyInclusive);
+        };
+
+        // The index entries in range, without reading their tuples
+        RC getNextEntry(RID &entryRid, void *entryKey) {
+            return iter.getNextEntry(entryRid, entryKey);
+        };
+
+        RC readTuple(const RID &tupleRid, void *data) {
+            return rm.readTuple(tableName, tupleRid, data);
+        };
+
         RC getNextTuple(void *data) override {
             RC rc = iter.getNextEntry(rid, key);
             if (rc == 0) {
@@ -149,6 +329,17 @@ namespace PeterDB {
             for (Attribute &attribute : attributes) {
                 attribute.name = tableName + "." + attribute.name;
             }
+            return 0;
+        };
+
+        // Entries come in key order
+        bool isOrderedOn(const std::string &attr) const override {
+            return attr == tableName + "." + attrName;
+        };
+
+        // Closes the index; setIterator() opens it again
+        RC close() override {
+            return iter.close();
         };
 
         ~IndexScan() override {
@@ -156,7 +347,7 @@ namespace PeterDB {
         };
     };
 
-    class Filter : public Iterator {
+    class Filter : public BatchIterator {
         // Filter operator
     public:
         Filter(Iterator *input,               // Iterator of input R
@@ -165,26 +356,182 @@ namespace PeterDB {
 
         ~Filter() override;
 
-        RC getNextTuple(void *data) override;
+        // Narrows the selection of the input's batches
+        RC getNextBatch(TupleBatch &batch) override;
 
         // For attribute in std::vector<Attribute>, name it as rel.attr
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        bool isOrderedOn(const std::string &attr) const override;
+
+        RC close() override;
+
+    private:
+        Iterator *input;
+        std::vector<Attribute> attrs;
+        CompOp op;
+        int lhsField;                       // -1 if the condition names no input attribute
+        int rhsField;                       // -1 if the right-hand side is a value
+        std::vector<char> rhsValue;
+
+        bool matches(const TupleBatch &batch, unsigned t) const;
     };
 
-    class Project : public Iterator {
+    class Project : public BatchIterator {
         // Projection operator
     public:
         Project(Iterator *input,                                // Iterator of input R
                 const std::vector<std::string> &attrNames);     // std::vector containing attribute names
         ~Project() override;
 
-        RC getNextTuple(void *data) override;
+        // Copies the projected fields of each selected input tuple through the input batch's column directory.
+        // An attribute the input does not have is kept in the output and is null in every tuple.
+        RC getNextBatch(TupleBatch &batch) override;
 
         // For attribute in std::vector<Attribute>, name it as rel.attr
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        bool isOrderedOn(const std::string &attr) const override;
+
+        RC close() override;
+
+    private:
+        Iterator *input;
+        std::vector<Attribute> attrs;
+        std::vector<int> fields;            // input field of each output attribute, -1 if not found (always null)
+        TupleBatch inputBatch;
     };
 
-    class BNLJoin : public Iterator {
+    class Sort : public BatchIterator {
+        // External merge sort operator
+    public:
+        Sort(Iterator *input,                                   // Iterator of input R
+             const std::vector<SortKey> &keys,                  // Attributes to order by, most significant first
+             unsigned numPages = QE_MEMORY_BUDGET / PAGE_SIZE   // # of pages of tuples sorted in memory at a time
+        );
+        ~Sort() override;
+
+        // The input is read on the first call. Each tuple gets a normalized key, the sort keys encoded so that
+        // comparing the bytes orders the tuples, and numPages of tuples at a time are sorted on it. Without
+        // spilling, the tuples are returned from memory; otherwise every sorted run goes to a SpillFile and the
+        // runs are merged through a loser tree, QE_MERGE_FAN_IN at a time. Nulls come first in ascending order.
+        RC getNextBatch(TupleBatch &batch) override;
+
+        RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        bool isOrderedOn(const std::string &attr) const override;
+
+        RC close() override;
+
+    private:
+        // A tuple in memory: its first key bytes as a number, then where the key and tuple are
+        struct Entry {
+            uint64_t prefix;
+            unsigned key;
+            unsigned keyLength;
+            unsigned tuple;
+            unsigned length;
+        };
+        // A run being merged and the tuple it is on
+        struct Run {
+            std::unique_ptr<SpillFile> file;
+            TupleBatch batch;
+            unsigned position;                                              // in batch.selection
+            std::vector<char> key;
+            bool done;
+        };
+
+        Iterator *input;
+        std::vector<Attribute> attrs;
+        std::vector<int> keyFields;                                         // -1 if not found
+        std::vector<bool> descending;
+        size_t budget;                                                      // bytes of tuples, keys and entries
+        std::string filePrefix;
+        unsigned numFiles;
+        bool sorted;
+
+        std::vector<char> arena;
+        std::vector<char> keyArena;
+        std::vector<Entry> entries;
+        unsigned emitPosition;                                              // in entries
+
+        std::vector<Run> runs;
+        std::vector<unsigned> tree;                                         // losers, the winner at 0
+
+        void sortEntries();
+        RC sortInput();                                                     // Sort in memory or into runs
+        RC writeRun(std::vector<std::unique_ptr<SpillFile>> &files);
+        RC startMerge(std::vector<std::unique_ptr<SpillFile>> files);
+        bool beats(unsigned run1, unsigned run2) const;
+        void adjust(unsigned run);                                          // Replay a run's path to the root
+        RC advance(Run &run);                                               // Move a run to its next tuple
+    };
+
+    class Limit : public BatchIterator {
+        // Limit operator
+    public:
+        Limit(Iterator *input,              // Iterator of input R
+              unsigned limit                // # of tuples to return at most
+        );
+        ~Limit() override;
+
+        // Passes the input's batches on, the last one cut to the limit. The input is closed as soon as the limit
+        // is reached, so the scans under it stop without reading the rest of their files.
+        RC getNextBatch(TupleBatch &batch) override;
+
+        RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        bool isOrderedOn(const std::string &attr) const override;
+
+        RC close() override;
+
+    private:
+        Iterator *input;
+        unsigned remaining;                                                 // tuples still to return
+        bool closed;
+    };
+
+    class TopN : public BatchIterator {
+        // Top-N operator
+    public:
+        TopN(Iterator *input,                                   // Iterator of input R
+             const std::vector<SortKey> &keys,                  // Attributes to order by, most significant first
+             unsigned n                                         // # of tuples to return at most
+        );
+        ~TopN() override;
+
+        // The input is read on the first call into a heap of the first n tuples in order, topped by the last of
+        // them, on the normalized keys of Sort. A tuple that does not come before the top is dropped without
+        // being copied, so only the n tuples are ever held. They are returned in order, ties in input order.
+        RC getNextBatch(TupleBatch &batch) override;
+
+        RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        bool isOrderedOn(const std::string &attr) const override;
+
+        RC close() override;
+
+    private:
+        // A tuple kept, with its normalized key and its position in the input
+        struct Entry {
+            std::vector<char> key;
+            std::vector<char> tuple;
+            uint64_t position;
+        };
+
+        Iterator *input;
+        std::vector<Attribute> attrs;
+        std::vector<int> keyFields;                                         // -1 if not found
+        std::vector<bool> descending;
+        unsigned n;
+        bool ranked;
+        std::vector<Entry> heap;                                            // in order once the input is read
+        unsigned emitPosition;                                              // in heap
+
+        RC rank();                                                          // Keep the first n tuples of the input
+    };
+
+    class BNLJoin : public BatchIterator {
         // Block nested-loop join operator
     public:
         BNLJoin(Iterator *leftIn,            // Iterator of input R
@@ -196,13 +543,44 @@ namespace PeterDB {
 
         ~BNLJoin() override;
 
-        RC getNextTuple(void *data) override;
+        // Left tuples are loaded numPages at a time into a TupleBlock and the right input is scanned once per
+        // block. An equality join looks each right tuple up in the block's hash table; any other comparison is
+        // checked against every tuple of the block.
+        RC getNextBatch(TupleBatch &batch) override;
 
         // For attribute in std::vector<Attribute>, name it as rel.attr
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        RC close() override;
+
+    private:
+        Iterator *leftIn;
+        TableScan *rightIn;
+        std::vector<Attribute> leftAttrs;
+        std::vector<Attribute> rightAttrs;
+        std::vector<Attribute> attrs;
+        int leftField;                                                      // join attribute of each input
+        int rightField;
+        CompOp op;
+        size_t blockSize;                                                   // bytes of left tuples per block
+
+        TupleBlock block;
+        unsigned numBlocks;                                                 // blocks loaded so far
+        TupleBatch leftBatch;                                               // left tuples not in a block yet
+        unsigned leftPosition;                                              // in leftBatch.selection
+        bool leftDone;
+
+        TupleBatch rightBatch;
+        unsigned rightPosition;                                             // in rightBatch.selection
+        unsigned rightTuple;
+        bool rightDone;                                                     // right input read for this block
+        unsigned match;                                                     // next block tuple to check or join
+
+        RC loadBlock();                                                     // QE_EOF once the left input is used up
+        unsigned nextMatch(unsigned tuple) const;                           // First match from tuple on
     };
 
-    class INLJoin : public Iterator {
+    class INLJoin : public BatchIterator {
         // Index nested-loop join operator
     public:
         INLJoin(Iterator *leftIn,           // Iterator of input R
@@ -212,14 +590,52 @@ namespace PeterDB {
 
         ~INLJoin() override;
 
-        RC getNextTuple(void *data) override;
+        // Left tuples are taken a batch at a time and sorted on the join key, so the index is probed in key order
+        // with IndexScan::seek() and left tuples sharing a key share a probe. Up to QE_BATCH_SIZE matches are
+        // collected at a time and their right tuples read in RID order, each once.
+        RC getNextBatch(TupleBatch &batch) override;
 
         // For attribute in std::vector<Attribute>, name it as rel.attr
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        RC close() override;
+
+    private:
+        // A left tuple of the block and the right tuple it joins with
+        struct Match {
+            RID rid;
+            unsigned left;
+            unsigned right;                                                 // in rightTuples
+        };
+
+        Iterator *leftIn;
+        IndexScan *rightIn;
+        std::vector<Attribute> leftAttrs;
+        std::vector<Attribute> rightAttrs;
+        std::vector<Attribute> attrs;
+        int leftField;                                                      // join attribute of each input
+        int rightField;
+        CompOp op;
+
+        TupleBatch leftBatch;
+        TupleBlock block;
+        std::vector<unsigned> order;                                        // block tuples by key
+        unsigned probe;                                                     // in order, first tuple of the key
+        unsigned probeEnd;                                                  // after the last tuple of the key
+        bool probing;                                                       // the index is in the key's range
+        std::vector<char> rightKey;
+
+        std::vector<Match> matches;
+        TupleBatch rightTuples;
+        unsigned emitted;                                                   // matches joined so far
+
+        RC loadBlock();                                                     // QE_EOF once the left input is used up
+        RC startProbe(const char *key);                                     // Seek the index to the key's range
+        RC collect();                                                       // Next matches, QE_EOF if none
     };
 
     // 10 extra-credit points
-    class GHJoin : public Iterator {
+    class GHJoin : public BatchIterator {
         // Grace hash join operator
     public:
         GHJoin(Iterator *leftIn,               // Iterator of input R
@@ -230,13 +646,105 @@ namespace PeterDB {
 
         ~GHJoin() override;
 
-        RC getNextTuple(void *data) override;
+        // Both inputs are hashed into numPartitions spill files each on the first call. Partition pairs are then
+        // joined one at a time: the left one is loaded into an open-addressing hash table and the right one is
+        // streamed past it. A left partition larger than QE_MEMORY_BUDGET is split again with another hash,
+        // up to QE_MAX_PARTITION_LEVEL times. The partition files stay until the join is destroyed.
+        RC getNextBatch(TupleBatch &batch) override;
 
         // For attribute in std::vector<Attribute>, name it as rel.attr
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        RC close() override;
+
+    private:
+        struct PartitionPair {
+            std::unique_ptr<SpillFile> left;
+            std::unique_ptr<SpillFile> right;
+            unsigned level;                                                 // times the inputs were hashed
+        };
+
+        Iterator *leftIn;
+        Iterator *rightIn;
+        std::vector<Attribute> leftAttrs;
+        std::vector<Attribute> rightAttrs;
+        std::vector<Attribute> attrs;
+        int leftField;                                                      // join attribute of each input
+        int rightField;
+        unsigned numPartitions;
+        std::string filePrefix;
+        bool partitioned;
+        std::vector<PartitionPair> partitions;
+        std::vector<unsigned> pending;                                      // partitions still to be joined
+
+        TupleBlock block;                                                   // the left partition being joined
+        SpillFile *probeFile;                                               // nullptr between partitions
+        TupleBatch probeBatch;
+        unsigned probePosition;                                             // in probeBatch.selection
+        unsigned probeTuple;
+        unsigned match;                                                     // next block tuple to join with it
+
+        RC partition(Iterator *input, int field, unsigned level, bool left, unsigned first);
+        RC nextPartition();                                                 // Build the next pair, QE_EOF if none
+        RC build(SpillFile &file);
     };
 
-    class Aggregate : public Iterator {
+    class SMJoin : public BatchIterator {
+        // Sort-merge join operator
+    public:
+        SMJoin(Iterator *leftIn,                                    // Iterator of input R
+               Iterator *rightIn,                                   // Iterator of input S
+               const Condition &condition,                          // Join condition (CompOp is always EQ)
+               unsigned numPages = QE_MEMORY_BUDGET / PAGE_SIZE     // # of pages for sorting and duplicate keys
+        );
+
+        ~SMJoin() override;
+
+        // An input not ordered on its join attribute, as told by Iterator::isOrderedOn(), is read through a Sort.
+        // The inputs are then merged in one pass. The right tuples of a key are kept as the left tuples of the
+        // key go by; past numPages they are spilled to a SpillFile and read again for each left tuple.
+        RC getNextBatch(TupleBatch &batch) override;
+
+        // For attribute in std::vector<Attribute>, name it as rel.attr
+        RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        RC close() override;
+
+    private:
+        Iterator *leftIn;                                                   // the inputs, sorted if need be
+        Iterator *rightIn;
+        std::unique_ptr<Sort> leftSort;
+        std::unique_ptr<Sort> rightSort;
+        std::vector<Attribute> leftAttrs;
+        std::vector<Attribute> rightAttrs;
+        std::vector<Attribute> attrs;
+        int leftField;                                                      // join attribute of each input
+        int rightField;
+        size_t budget;                                                      // bytes of right tuples kept in memory
+
+        TupleBatch leftBatch;
+        unsigned leftPosition;                                              // in leftBatch.selection
+        bool leftDone;
+        TupleBatch rightBatch;
+        unsigned rightPosition;                                             // in rightBatch.selection
+        bool rightDone;
+
+        // The right tuples of the last key matched
+        std::vector<char> runKey;                                           // empty if none
+        TupleBlock runBlock;
+        std::unique_ptr<SpillFile> runFile;                                 // the tuples past the budget
+        std::string runFileName;
+        bool joining;                                                       // the left tuple has the run's key
+        unsigned runPosition;                                               // in runBlock, or in runBatch
+        TupleBatch runBatch;
+
+        bool hasLeft();                                                     // Fetch a left batch if needed
+        bool hasRight();
+        RC collectRun();                                                    // Take the right tuples of a key
+        RC startJoining();
+    };
+
+    class Aggregate : public BatchIterator {
         // Aggregation operator
     public:
         // Mandatory
@@ -256,12 +764,61 @@ namespace PeterDB {
 
         ~Aggregate() override;
 
-        RC getNextTuple(void *data) override;
+        // The input is aggregated on the first call into an open-addressing table of groups. Once the table
+        // would outgrow QE_MEMORY_BUDGET, tuples of groups not in it are spilled to QE_SPILL_PARTITIONS files
+        // by hash, and each file is aggregated the same way after the table is returned. The aggregate is a
+        // TypeReal, null for an empty group unless it is a COUNT; null group values form one group.
+        RC getNextBatch(TupleBatch &batch) override;
 
         // Please name the output attribute as aggregateOp(aggAttr)
         // E.g. Relation=rel, attribute=attr, aggregateOp=MAX
         // output attrName = "MAX(rel.attr)"
         RC getAttributes(std::vector<Attribute> &attrs) const override;
+
+        RC close() override;
+
+    private:
+        // A slot of the table: the group value, inline or interned, and the aggregate state of the group
+        struct Group {
+            unsigned hash;
+            unsigned key;                                                   // the value, or its offset in strings
+            bool used;
+            unsigned count;                                                 // non-null values aggregated
+            double sum;
+            double min;
+            double max;
+        };
+        struct Partition {
+            std::unique_ptr<SpillFile> file;
+            unsigned level;                                                 // times the groups were hashed
+        };
+
+        Iterator *input;
+        std::vector<Attribute> attrs;
+        std::vector<Attribute> spillAttrs;                                  // the group and aggregated attributes
+        int aggField;
+        int groupField;                                                     // -1 without grouping
+        AttrType aggType;
+        AttrType groupType;
+        AggregateOp op;
+        std::string filePrefix;
+        unsigned numFiles;
+        bool aggregated;
+
+        std::vector<Group> groups;
+        unsigned numGroups;
+        std::vector<char> strings;                                          // interned TypeVarChar group values
+        Group nullGroup;                                                    // the group of null values
+        std::vector<Partition> pending;                                     // spilled groups still to aggregate
+        unsigned emitPosition;                                              // in groups
+
+        RC aggregate(Iterator *source, int groupField, int aggField, unsigned level);
+        Group *findGroup(const char *key, unsigned level);                  // nullptr if it has no room
+        bool grow(unsigned level);
+        void accumulate(Group &group, const char *value) const;
+        RC spill(const TupleBatch &batch, unsigned t, int groupField, int aggField, unsigned level,
+                 std::vector<Partition> &spills);
+        void emit(TupleBatch &batch, const Group &group, bool nullKey) const;
     };
 } // namespace PeterDB
 
@@ -4,14 +4,29 @@
 #define TOMBSTONE_MARKER 4096
 
 #include <vector>
-#include <queue>
 #include <map>
+#include <memory>
+#include <deque>
+#include <thread>
 
 #include "pfm.h"
 #define NUM_SIZE sizeof(unsigned)
 #define SHORT_SIZE sizeof(unsigned short)
 #define SLOT_SIZE (2 * SHORT_SIZE) // One slot has 2 entries: [offset][length]
 
+// A record is stored as [flags][numFields][field directory][null indicator][field values]. Entry i of the
+// directory is the offset from the record start where field i ends; the field starts where field i - 1 ends.
+// VarChar values are stored without their length, which the directory already gives. Fields past numFields
+// read as null.
+#define RECORD_HEADER_SIZE (2 * SHORT_SIZE)     // [flags][numFields], the field directory follows
+#define RECORD_FORWARDED 0x1                    // Moved here by an update, scans reach it through its tombstone
+
+#define ZONE_MAP_SUFFIX ".zone"                 // Side file holding the zone map of a record-based file
+#define ZONE_PREFIX_SIZE 8                      // Bytes of a value kept as a zone bound, VarChar values are cut
+#define SCAN_MORSEL_PAGES 32                    // Pages a parallel scan worker takes from the shared cursor at once
+#define SCAN_BATCH_RECORDS 256                  // Records a parallel scan worker hands to the consumer at once
+#define SCAN_QUEUED_BATCHES 4                   // Batches each parallel scan worker may have waiting
+
 namespace PeterDB {
     // Record ID
     typedef struct {
@@ -44,6 +59,55 @@ namespace PeterDB {
     } CompOp;
 
 
+    // Summaries of the records on each page of a record-based file: per column the number of null and non-null
+    // values and their minimum and maximum, so a scan skips pages its condition cannot match without reading them.
+    // VarChar bounds are the first ZONE_PREFIX_SIZE bytes, zero padded. Deletes only lower the counts, bounds
+    // are widened by inserts and updates and tightened again once a page holds no values.
+    // A page is known once every record on it has been accounted for: pages appended while the map is loaded,
+    // or pages a filtered scan went through. Pages holding tombstones always have to be read, since the moved
+    // records are returned from there.
+    // The map is kept in memory while the file is open and written to a side file when it is closed; that file
+    // is removed again when loaded, so a map that was not written back is never trusted.
+    class ZoneMap {
+    public:
+        explicit ZoneMap(const std::string &fileName);
+
+        RC load(unsigned numberOfPages);                                    // Read the map written at the last close
+        RC save(unsigned numberOfPages);                                    // Write the map for a file of numberOfPages
+
+        void setAttributes(const std::vector<Attribute> &recordDescriptor); // Forget every page if the layout changed
+        void addPage(PageNum pageNum);                                      // A new empty page, known from the start
+        void add(PageNum pageNum, const char *record);                      // A stored record was placed on a page
+        void remove(PageNum pageNum, const char *record);                   // A stored record left a page
+        void addTombstones(PageNum pageNum, int delta);
+        void summarize(PageNum pageNum, const char *page);                  // Make a page known from its records
+        // False only if no record on a known page can satisfy the condition on field
+        bool mayMatch(PageNum pageNum, unsigned field, CompOp compOp, const void *value);
+
+        const std::string &getFileName() const;
+
+    private:
+        struct PageZone {
+            unsigned short tombstones;
+            bool known;
+        };
+        struct ColumnZone {
+            char min[ZONE_PREFIX_SIZE];
+            char max[ZONE_PREFIX_SIZE];
+            unsigned short values;                                          // non-null values on the page
+            unsigned short nulls;
+        };
+
+        std::string fileName;
+        std::vector<AttrType> types;
+        std::vector<PageZone> pages;
+        std::vector<ColumnZone> columns;                                    // column c of page p at p * types.size() + c
+        std::mutex latch;
+
+        void reserve(PageNum pageNum);                                      // Make room for a page, unknown
+        void addRecord(PageNum pageNum, const char *record);
+    };
+
     /********************************************************************
     * The scan iterator is NOT required to be implemented for Project 1 *
     ********************************************************************/
@@ -77,6 +141,10 @@ namespace PeterDB {
         RC getNextRecord(RID &rid, void *data);
         RC close();
 
+        // Restrict the rest of the scan to the pages in [first, end)
+        RC setPageRange(PageNum first, PageNum end);
+        unsigned getRecordSize() const;             // Bytes getNextRecord last wrote to data
+
     private:
         RecordBasedFileManager *rbfm;
         FileHandle fileHandle;
@@ -84,42 +152,88 @@ namespace PeterDB {
         std::string conditionAttribute;
         CompOp compOp;
         const void *value;
-        char* page;
+        const char* page = nullptr;     // current page, pinned for the scan instead of copied
         std::vector<std::string> attributeNames;
         RBFM_ScanIterator *rbfm_ScanIterator;
 
+        // Projection plan, resolved from the names once by initializeScan
+        std::vector<unsigned> projectedFields;      // field of the record behind each output attribute
+        int conditionField;                         // field the condition reads, -1 when every record qualifies
+        unsigned outputNullIndicatorSize;
+
+        std::vector<char> record;                   // stored record, reused by every getNextRecord call
+        ZoneMap *zoneMap;                           // consulted before each page when there is a condition
+
         unsigned pageNum, numberOfPages;
+        unsigned endPage;                           // the scan stops before this page
         unsigned slotNum, numberOfSlots;
+        unsigned recordSize;
         RC getNextSlot();
         bool compareInt(int &num, const void *newValue, CompOp compareOp);
         bool compareReal(float &real, const void *newValue, CompOp compareOp);
-        bool compareVarchar(char* str, const void *newValue, CompOp compareOp);
-        bool checkCondition(void* data, std::vector<Attribute> &recordDescriptor);
-        void extractAttributesAndNullBits(const std::vector<Attribute> &recordDescriptor,
-                                          const std::vector<std::string> &attributeNames,
-                                          const char* record, void* data);
+        bool compareVarchar(const char* str, unsigned length, const void *newValue, CompOp compareOp);
+        bool checkCondition();
+        unsigned project(void* data);               // Write the projected fields in the insertRecord format
 
     };
 
-    struct PageInfo {
-        int pageNum;
-        unsigned short freeSpace;
+    // Scans a file with worker threads. The pages are split into morsels of SCAN_MORSEL_PAGES that idle workers
+    // take from a shared cursor, so a worker held up by slow pages simply takes fewer of them. Every worker runs
+    // its own RBFM_ScanIterator, with its own buffers and condition, over the morsels it took and hands the
+    // records to the consumer in batches. Records come out in no particular order.
+    class RBFM_ParallelScanIterator {
+    public:
+        RBFM_ParallelScanIterator();
+        ~RBFM_ParallelScanIterator();                                      // Stops the workers
+        RBFM_ParallelScanIterator(const RBFM_ParallelScanIterator &) = delete;
+        RBFM_ParallelScanIterator &operator=(const RBFM_ParallelScanIterator &) = delete;
+
+        // Same arguments as RBFM_ScanIterator::initializeScan, numWorkers 0 means one per hardware thread
+        RC initializeScan(FileHandle &fileHandle,
+                          const std::vector<Attribute> &recordDescriptor,
+                          const std::string &conditionAttribute,
+                          const CompOp compOp,
+                          const void *value,
+                          const std::vector<std::string> &attributeNames,
+                          unsigned numWorkers);
+        RC getNextRecord(RID &rid, void *data);
+        RC close();
 
-        bool operator<(const PageInfo &other) const {
-            return freeSpace < other.freeSpace; //
-        }
+    private:
+        // Records of one worker in the getNextRecord format, record i spans offsets[i] to offsets[i + 1]
+        struct Batch {
+            std::vector<RID> rids;
+            std::vector<unsigned> offsets;
+            std::vector<char> data;
+        };
+
+        std::vector<RBFM_ScanIterator> scans;                               // one per worker
+        std::vector<std::thread> workers;
+        std::atomic<PageNum> nextMorsel;                                    // first page of the next morsel
+        PageNum numberOfPages;
+        std::atomic<bool> stopping;
+
+        std::mutex latch;                                                   // guards the members below
+        std::condition_variable ready;                                      // a batch was queued or a worker ended
+        std::condition_variable space;                                      // a batch was taken
+        std::deque<Batch> batches;
+        unsigned runningWorkers;
+
+        Batch current;                                                      // consumer side
+        size_t position;
+
+        void work(unsigned worker);
+        bool push(Batch &batch);                                            // Queue a batch, false once stopping
     };
 
     class RecordBasedFileManager {
     public:
         static RecordBasedFileManager &instance();                          // Access to the singleton instance
-        void reset() {
-            fileHeapMap.clear();
-        }
 
         RC createFile(const std::string &fileName);                         // Create a new record-based file
         RC destroyFile(const std::string &fileName);                        // Destroy a record-based file
-        RC openFile(const std::string &fileName, FileHandle &fileHandle);   // Open a record-based file
+        RC openFile(const std::string &fileName, FileHandle &fileHandle,
+                    IOBackend backend = BUFFERED_IO);                       // Open a record-based file
         RC closeFile(FileHandle &fileHandle);                               // Close a record-based file
 
         //  Format of the data passed into the function is the following:
@@ -141,6 +255,13 @@ namespace PeterDB {
         RC insertRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const void *data,
                         RID &rid);
 
+        // Insert many records at once. Records are packed into each page before it is written,
+        // new pages are appended together and the free space map is updated once per page.
+        // With append, only the last page and new ones are filled, so a scan returns the records in the
+        // order they were inserted.
+        RC insertRecords(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                         const std::vector<const void *> &data, std::vector<RID> &rids, bool append = false);
+
         // Read a record identified by the given rid.
         RC
         readRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const RID &rid, void *data);
@@ -160,7 +281,9 @@ namespace PeterDB {
         // Delete a record identified by the given rid.
         RC deleteRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const RID &rid);
 
-        // Assume the RID does not change after an update
+        // Assume the RID does not change after an update. A record that outgrows its page is moved and its slot
+        // becomes a tombstone pointing straight at it, so reaching a record never takes more than one hop;
+        // it moves back home once its page has room again.
         RC updateRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const void *data,
                         const RID &rid);
 
@@ -177,16 +300,59 @@ namespace PeterDB {
                 const std::vector<std::string> &attributeNames, // a list of projected attributes
                 RBFM_ScanIterator &rbfm_ScanIterator);
 
-        RC readNextRecord(FileHandle fileHandle, RID rid, void *data, void *record);
+        // Compact every page, bring forwarded records back home, give the empty pages at the end of the file back
+        // and rebuild the free space map; the RID of every record stays valid. With numPages > 0 a call processes
+        // that many pages, continuing where the last call on the file stopped, so the work can be spread between
+        // inserts. The file is shortened once a pass reaches its end.
+        RC vacuum(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, unsigned numPages = 0);
+
+        // Copy the stored record at rid on page data, following a tombstone; fails for empty slots and for
+        // forwarded records, which are read through their tombstone instead
+        RC readNextRecord(FileHandle fileHandle, RID rid, const void *data, void *record);
         std::vector<bool> extractNullInformation(const void *data, const std::vector<Attribute> &recordDescriptor);
-        unsigned getRecordSize(const void *data, const std::vector<Attribute> &recordDescriptor, std::vector<bool> &isNull);
-        unsigned getTotalSlots(void *data);
+        unsigned getTotalSlots(const void *data);
 
-    private:
-        std::map<FileHandle*, std::priority_queue<PageInfo>> fileHeapMap;
+        // Conversion between the insertRecord format and the stored record format
+        unsigned getStoredSize(const void *data, const std::vector<Attribute> &recordDescriptor);
+        unsigned short encodeRecord(const void *data, const std::vector<Attribute> &recordDescriptor,
+                                    unsigned short flags, char *record);         // Returns the stored size
+        void decodeRecord(const char *record, const std::vector<Attribute> &recordDescriptor, void *data);
+        // Locate field i of a stored record, false if it is null
+        static bool locateField(const char *record, unsigned i, const char *&value, unsigned short &length);
+
+        // The zone map of an open file, loaded on first use and laid out for recordDescriptor
+        ZoneMap *getZoneMap(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor);
 
-        void addPageToHeap(FileHandle &fileHandle, const int &pageNum, const unsigned short &freeSpace);
-        void updateHeap(FileHandle &fileHandle, const int &pageNum, const unsigned short &freeSpace);
+    private:
+        std::unordered_map<unsigned, std::unique_ptr<ZoneMap>> zoneMaps;     // by PagedFile::fileId
+        std::mutex zoneMapLatch;
+        std::unordered_map<unsigned, PageNum> vacuumCursors;                // next page to vacuum, by fileId
+        std::mutex vacuumLatch;
+
+        // Insert a record already in the stored format
+        RC insertStored(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const char *record,
+                        unsigned short recordSize, RID &rid);
+        // Move the records starting at from by delta bytes and adjust their slots and the free space
+        void shiftRecords(char *page, unsigned short from, int delta);
+        // Turn a buffer into a page without records
+        void initializePage(char *page);
+        // Pack the records to the start of a page and drop the unused slots at the end of its directory
+        void compactPage(char *page);
+        // Copy a record to the end of the records of a page with enough room, returns its slot number
+        unsigned short placeRecord(char *page, const void *data, unsigned short recordSize);
+        // Same for a given slot, which is either unused or one past the last
+        void placeRecordAt(char *page, unsigned short slotNum, const void *data, unsigned short recordSize);
+        // Overwrite the record in a slot with one of another size, false if the page has no room for it
+        bool resizeRecord(char *page, unsigned short slotNum, const char *record, unsigned short recordSize);
+        // Take the forwarded record at rid off its page, copying it to record unless that is null
+        RC removeForwarded(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const RID &rid,
+                           char *record, unsigned short &recordSize);
+        // Update a record reached through the tombstone in slot rid.slotNum of its home page
+        RC updateForwarded(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, char *record,
+                           unsigned short recordSize, const RID &rid, char *page, const RID &target);
+        // Bring forwarded records back into their home page while it has room, the caller writes the page
+        RC migrateBack(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, PageNum pageNum,
+                       char *page);
 
     protected:
         RecordBasedFileManager();                                                   // Prevent construction
@@ -3,13 +3,19 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <list>
 
 #include "src/include/rbfm.h"
+#include "src/include/ix.h"
 
 namespace PeterDB {
 #define RM_EOF (-1)  // end of a scan operator
 #define TABLES_RECORD_SIZE (1 + 4 * sizeof(unsigned) + 2 * 50)
 #define COLUMNS_RECORD_SIZE (1 + 6 * sizeof(unsigned) + 50)
+#define INDEXES_RECORD_SIZE (1 + 2 * sizeof(unsigned))
+#define TABLE_HANDLE_CACHE_SIZE 16  // Tables kept open by RelationManager for tuple operations by name
+#define INDEX_FILE_SUFFIX ".idx"    // An index is the file <table file>_<table id>_<column position>.idx
 
     // RM_ScanIterator is an iterator to go through tuples
     class RM_ScanIterator {
@@ -22,6 +28,8 @@ namespace PeterDB {
         RC getNextTuple(RID &rid, void *data);
         RC close();
         RBFM_ScanIterator rbfm_iter;
+        RBFM_ParallelScanIterator rbfm_parallel_iter;                       // used instead when numWorkers > 1
+        unsigned numWorkers = 1;
         FileHandle fileHandle;
     };
 
@@ -34,6 +42,84 @@ namespace PeterDB {
         // "key" follows the same format as in IndexManager::insertEntry()
         RC getNextEntry(RID &rid, void *key);    // Get next matching entry
         RC close();                              // Terminate index scan
+        // Move to a new key range without reopening the index, see IX_ScanIterator::seek()
+        RC seek(const void *lowKey, const void *highKey, bool lowKeyInclusive, bool highKeyInclusive);
+        IX_ScanIterator ix_iter;
+        IXFileHandle ixFileHandle;
+    };
+
+    // Feeds one attribute of the tuples of a table scan to IndexManager::bulkLoad, tuples where it is null are skipped.
+    // The scan projects every attribute of the table.
+    class RM_IndexEntryIterator : public IX_EntryIterator {
+    public:
+        RM_IndexEntryIterator(RM_ScanIterator &rm_ScanIterator, const std::vector<Attribute> &attrs, unsigned position);
+
+        RC getNextEntry(RID &rid, void *key) override;
+
+    private:
+        RM_ScanIterator &rm_ScanIterator;
+        const std::vector<Attribute> &attrs;
+        unsigned position;
+        std::vector<char> tuple;
+    };
+
+    // Catalog entry of a table, cached by RelationManager until a DDL statement changes the table
+    struct TableInfo {
+        unsigned tableId;
+        std::string fileName;
+        bool isSystem;
+        std::vector<Attribute> attrs;                   // in column-position order
+        std::vector<std::string> indexedAttributes;     // attributes that have an index, as recorded in Indexes
+        unsigned version;                               // catalog version the entry was loaded at
+    };
+
+    // A table opened once for many tuple operations: its file stays open and its catalog entry resident.
+    // Obtained from RelationManager::openTable and released with RelationManager::closeTable.
+    class TableHandle {
+    public:
+        TableHandle();
+        ~TableHandle();
+        TableHandle(const TableHandle &) = delete;                          // The file is opened once per handle
+        TableHandle &operator=(const TableHandle &) = delete;
+
+        RC insertTuple(const void *data, RID &rid);
+        RC insertTuples(const std::vector<const void *> &data, std::vector<RID> &rids);
+        RC deleteTuple(const RID &rid);
+        RC updateTuple(const void *data, const RID &rid);
+        RC readTuple(const RID &rid, void *data);
+        RC readAttribute(const RID &rid, const std::string &attributeName, void *data);
+        RC scan(const std::string &conditionAttribute,
+                const CompOp compOp,
+                const void *value,
+                const std::vector<std::string> &attributeNames,
+                RM_ScanIterator &rm_ScanIterator,
+                unsigned numWorkers = 1);
+        RC vacuum(unsigned numPages = 0);                                   // See RecordBasedFileManager::vacuum()
+        const std::vector<Attribute> &getAttributes() const;
+
+        // Copy the value of the attribute at position out of a tuple, false if it is null
+        static bool getKey(const std::vector<Attribute> &attrs, const void *data, unsigned position, void *key);
+
+    private:
+        // An index of the table, kept open with it and updated by every tuple operation
+        struct TableIndex {
+            unsigned position;                                              // of the attribute in the table
+            IXFileHandle ixFileHandle;
+        };
+
+        std::string tableName;
+        TableInfo info;
+        unsigned catalogVersion;                                            // catalog version info was copied at
+        FileHandle fileHandle;
+        std::vector<TableIndex> indexes;                                    // one per info.indexedAttributes
+        bool opened;
+
+        RC refresh();                                                       // Pick up DDL since the handle was opened
+        RC openIndexes();
+        void closeIndexes();
+        RC insertIndexEntries(const void *data, const RID &rid);
+        RC deleteIndexEntries(const void *data, const RID &rid);
+        friend class RelationManager;
     };
 
     // Relation Manager
@@ -53,12 +139,19 @@ namespace PeterDB {
 
         RC insertTuple(const std::string &tableName, const void *data, RID &rid);
 
+        // Insert many tuples at once, each page is written once
+        RC insertTuples(const std::string &tableName, const std::vector<const void *> &data, std::vector<RID> &rids);
+
         RC deleteTuple(const std::string &tableName, const RID &rid);
 
         RC updateTuple(const std::string &tableName, const void *data, const RID &rid);
 
         RC readTuple(const std::string &tableName, const RID &rid, void *data);
 
+        // Reclaim the space freed by deletes and updates without changing any RID, numPages > 0 vacuums
+        // that many pages per call so it can run between other work
+        RC vacuumTable(const std::string &tableName, unsigned numPages = 0);
+
         // Print a tuple that is passed to this utility method.
         // The format is the same as printRecord().
         RC printTuple(const std::vector<Attribute> &attrs, const void *data, std::ostream &out);
@@ -67,15 +160,19 @@ namespace PeterDB {
 
         // Scan returns an iterator to allow the caller to go through the results one by one.
         // Do not store entire results in the scan iterator.
+        // With more than one worker the table is scanned in parallel and tuples come out in no particular order,
+        // 0 workers means one per hardware thread.
         RC scan(const std::string &tableName,
                 const std::string &conditionAttribute,
                 const CompOp compOp,                  // comparison type such as "<" and "="
                 const void *value,                    // used in the comparison
                 const std::vector<std::string> &attributeNames, // a list of projected attributes
-                RM_ScanIterator &rm_ScanIterator);
+                RM_ScanIterator &rm_ScanIterator,
+                unsigned numWorkers = 1);
 
         RC createTablesRecordDescriptor(std::vector<PeterDB::Attribute> &recordDescriptor);
         RC createColumnsRecordDescriptor(std::vector<PeterDB::Attribute> &recordDescriptor);
+        RC createIndexesRecordDescriptor(std::vector<PeterDB::Attribute> &recordDescriptor);
         void prepareTablesRecord(const std::string &tableName, unsigned &tableId, bool isSystem, void *data);
         void prepareColumnsRecord(unsigned &tableID, const Attribute &attr, unsigned &position, void *data, bool isSystem);
         RC getNextTablesID(unsigned &table_id);
@@ -83,8 +180,17 @@ namespace PeterDB {
         RC parseInt(unsigned &table_id, const void* data);
         RC insertTable(const std::string &table_name, unsigned table_id, bool isSystem);
         RC insertColumns(unsigned table_id, const std::vector<Attribute> &recordDescriptor);
+        RC insertIndex(unsigned table_id, unsigned position);
+        RC deleteIndexes(unsigned table_id, unsigned position);                 // position 0 deletes them all
         RC checkSys(bool &system, const std::string &tableName);
+        RC getTableInfo(const std::string &tableName, const TableInfo *&info);  // Cached catalog entry of a table
+        unsigned getCatalogVersion() const;                                     // Changes with every DDL statement
 
+        // The table id and column position make the name unique, whatever the table and attribute names are
+        static std::string getIndexFileName(const TableInfo &info, const std::string &attributeName);
+
+        RC openTable(const std::string &tableName, TableHandle &tableHandle);   // Keep a table open for many tuples
+        RC closeTable(TableHandle &tableHandle);
 
 
         // Extra credit work (10 points)
@@ -109,7 +215,17 @@ namespace PeterDB {
     private:
         std::vector<Attribute> tableDescriptor;
         std::vector<Attribute> columnDescriptor;
-
+        std::vector<Attribute> indexDescriptor;
+        std::unordered_map<std::string, TableInfo> catalogCache;
+        unsigned catalogVersion;
+        std::list<TableHandle> cachedTables;                                // most recently used first
+        std::unordered_map<std::string, std::list<TableHandle>::iterator> cachedTableIndex;
+
+        RC loadTableInfo(const std::string &tableName, TableInfo &info);
+        void invalidateTable(const std::string &tableName);
+        RC getCachedTable(const std::string &tableName, TableHandle *&tableHandle);
+        void closeCachedTable(const std::string &tableName);
+        void closeCachedTables();
 
     protected:
         RelationManager();                                                  // Prevent construction
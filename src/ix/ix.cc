@@ -1,5 +1,10 @@
 #include "src/include/ix.h"
 
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <ostream>
+
 namespace PeterDB {
     IndexManager &IndexManager::instance() {
         static IndexManager _index_manager = IndexManager();
@@ -7,29 +12,270 @@ namespace PeterDB {
     }
 
     RC IndexManager::createFile(const std::string &fileName) {
-        return -1;
+        return PagedFileManager::instance().createFile(fileName);
     }
 
     RC IndexManager::destroyFile(const std::string &fileName) {
-        return -1;
+        return PagedFileManager::instance().destroyFile(fileName);
     }
 
     RC IndexManager::openFile(const std::string &fileName, IXFileHandle &ixFileHandle) {
-        return -1;
+        if (ixFileHandle.fileHandle.file != nullptr) {
+            // handle is already used for an opened index
+            return -1;
+        }
+        return PagedFileManager::instance().openFile(fileName, ixFileHandle.fileHandle);
     }
 
     RC IndexManager::closeFile(IXFileHandle &ixFileHandle) {
-        return -1;
+        return PagedFileManager::instance().closeFile(ixFileHandle.fileHandle);
     }
 
     RC
     IndexManager::insertEntry(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid) {
-        return -1;
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        const unsigned size = BTreeNode::keySize(attribute, key);
+        if (fileHandle.file == nullptr || size + NUM_SIZE + IX_RID_SIZE + sizeof(PageNum) > IX_MAX_ENTRY_SIZE) {
+            // index is not opened, or the key is too large for a node
+            return -1;
+        }
+        if (fileHandle.getNumberOfPages() == 0) {
+            // The first entry creates the meta page and a root leaf holding the entry
+            std::vector<char> pages(2 * PAGE_SIZE, 0);
+            const PageNum root = IX_META_PAGE + 1;
+            memcpy(pages.data(), &root, sizeof(PageNum));
+            BTreeNode leaf(attribute, pages.data() + PAGE_SIZE);
+            leaf.initialize(0);
+            leaf.insert(0, key, rid);
+            return fileHandle.appendPages(2, pages.data());
+        }
+
+        std::vector<char> page(PAGE_SIZE);
+        std::vector<PageNum> path;
+        if (descend(ixFileHandle, attribute, key, rid, page.data(), path)) {
+            return -1;
+        }
+
+        // Insert into the leaf, then push the separator of every split up to the parent
+        std::vector<char> separator((const char *) key, (const char *) key + size);
+        separator.resize(PAGE_SIZE);
+        RID separatorRid = rid;
+        PageNum child = IX_META_PAGE;
+        for (size_t depth = path.size(); depth-- > 0;) {
+            if (depth + 1 < path.size() && fileHandle.readPage(path[depth], page.data())) {
+                return -1;
+            }
+            BTreeNode node(attribute, page.data());
+            const unsigned position = node.upperBound(separator.data(), separatorRid);
+            if (node.insert(position, separator.data(), separatorRid, child) == 0) {
+                return fileHandle.writePage(path[depth], page.data());
+            }
+            if (splitNode(ixFileHandle, attribute, page.data(), position, separator.data(), separatorRid, child) ||
+                fileHandle.writePage(path[depth], page.data())) {
+                return -1;
+            }
+        }
+
+        // The root split, a new root goes above its two halves
+        const unsigned short level = BTreeNode(attribute, page.data()).getLevel() + 1;
+        BTreeNode root(attribute, page.data());
+        root.initialize(level);
+        root.setLink(path[0]);
+        root.insert(0, separator.data(), separatorRid, child);
+        PageNum rootPage;
+        if (allocatePage(ixFileHandle, page.data(), rootPage)) {
+            return -1;
+        }
+        return writeRoot(ixFileHandle, rootPage);
     }
 
     RC
     IndexManager::deleteEntry(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid) {
-        return -1;
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        if (fileHandle.file == nullptr || fileHandle.getNumberOfPages() == 0) {
+            return -1;
+        }
+        std::vector<char> page(PAGE_SIZE);
+        std::vector<PageNum> path;
+        if (descend(ixFileHandle, attribute, key, rid, page.data(), path)) {
+            return -1;
+        }
+        BTreeNode leaf(attribute, page.data());
+        const unsigned position = leaf.upperBound(key, rid);
+        if (position == 0 || leaf.compare(position - 1, key, rid) != 0) {
+            // entry does not exist
+            return -1;
+        }
+        leaf.remove(position - 1);
+        if (fileHandle.writePage(path.back(), page.data())) {
+            return -1;
+        }
+        return rebalance(ixFileHandle, attribute, key, rid, path, page.data());
+    }
+
+    RC IndexManager::bulkLoad(IXFileHandle &ixFileHandle, const Attribute &attribute, IX_EntryIterator &entries,
+                              float fillFactor) {
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        if (fileHandle.file == nullptr || fileHandle.getNumberOfPages() != 0 || fillFactor <= 0 || fillFactor > 1) {
+            // only an empty index can be loaded
+            return -1;
+        }
+
+        // Sort every entry first
+        IX_EntrySorter sorter(attribute, fileHandle.file->fileName);
+        std::vector<char> key(PAGE_SIZE);
+        RID rid;
+        RC rc;
+        while ((rc = entries.getNextEntry(rid, key.data())) == 0) {
+            if (sorter.add(key.data(), rid)) {
+                return -1;
+            }
+        }
+        if (rc != IX_EOF || sorter.finish()) {
+            return -1;
+        }
+        if (sorter.getNextEntry(rid, key.data()) == IX_EOF) {
+            return 0;
+        }
+
+        // The meta page comes first, the root is known once the levels are built
+        std::vector<char> metaPage(PAGE_SIZE, 0);
+        if (fileHandle.appendPage(metaPage.data())) {
+            return -1;
+        }
+
+        const unsigned limit = (unsigned) (fillFactor * (PAGE_SIZE - IX_NODE_HEADER_SIZE));
+        std::vector<char> pending;                          // nodes not appended yet
+        unsigned numPending = 0;
+        auto appendPending = [&]() -> RC {
+            if (numPending == 0) {
+                return 0;
+            }
+            RC result = fileHandle.appendPages(numPending, pending.data());
+            pending.clear();
+            numPending = 0;
+            return result;
+        };
+
+        // Separators of the level being built: (key, RID) of the first entry under each child but the first
+        std::vector<PageNum> children;
+        std::vector<char> separators;
+        std::vector<size_t> separatorOffsets;
+        auto addSeparator = [&](const void *separatorKey, const RID &separatorRid) {
+            const unsigned size = BTreeNode::keySize(attribute, separatorKey);
+            separatorOffsets.push_back(separators.size());
+            separators.insert(separators.end(), (const char *) separatorKey, (const char *) separatorKey + size);
+            separators.insert(separators.end(), (const char *) &separatorRid.pageNum,
+                              (const char *) &separatorRid.pageNum + NUM_SIZE);
+            separators.insert(separators.end(), (const char *) &separatorRid.slotNum,
+                              (const char *) &separatorRid.slotNum + SHORT_SIZE);
+        };
+        auto separatorRID = [&](size_t i) -> RID {
+            const char *separator = separators.data() + separatorOffsets[i];
+            const unsigned size = BTreeNode::keySize(attribute, separator);
+            RID separatorRid;
+            memcpy(&separatorRid.pageNum, separator + size, NUM_SIZE);
+            memcpy(&separatorRid.slotNum, separator + size + NUM_SIZE, SHORT_SIZE);
+            return separatorRid;
+        };
+
+        // Fill the leaves left to right, they take consecutive pages so each knows its right sibling
+        PageNum pageNum = fileHandle.getNumberOfPages();
+        std::vector<char> page(PAGE_SIZE);
+        BTreeNode leaf(attribute, page.data());
+        leaf.initialize(0);
+        do {
+            if (leaf.getNumEntries() > 0 &&
+                PAGE_SIZE - IX_NODE_HEADER_SIZE - leaf.getFreeSpace() + leaf.entrySize(key.data()) > limit) {
+                leaf.setLink(pageNum + 1);
+                pending.insert(pending.end(), page.begin(), page.end());
+                children.push_back(pageNum++);
+                if (++numPending == IX_BULK_LOAD_BATCH && appendPending()) {
+                    return -1;
+                }
+                addSeparator(key.data(), rid);
+                leaf.initialize(0);
+            }
+            if (leaf.insert(leaf.getNumEntries(), key.data(), rid)) {
+                // entry larger than a page
+                return -1;
+            }
+        } while (sorter.getNextEntry(rid, key.data()) == 0);
+        pending.insert(pending.end(), page.begin(), page.end());
+        children.push_back(pageNum++);
+        numPending++;
+        if (appendPending()) {
+            return -1;
+        }
+
+        // Build each internal level from the children and separators of the level below
+        unsigned short level = 0;
+        while (children.size() > 1) {
+            level++;
+            // Split the children into nodes, a node holds child first and the separators after it
+            std::vector<size_t> firsts;
+            size_t first = 0;
+            while (first < children.size()) {
+                firsts.push_back(first);
+                unsigned used = 0;
+                size_t next = first + 1;
+                while (next < children.size()) {
+                    const char *separator = separators.data() + separatorOffsets[next - 1];
+                    const unsigned size = leaf.entrySize(separator) + sizeof(PageNum); // leaf entry plus child
+                    if (next > first + 1 && used + size > limit) {
+                        break;
+                    }
+                    used += size;
+                    next++;
+                }
+                first = next;
+            }
+            // A node with a single child has no separator: take one child from the node before it, or join that
+            // node when it only has two. Three children fit in any node as entries are under IX_MAX_ENTRY_SIZE.
+            if (firsts.size() > 1 && children.size() - firsts.back() == 1) {
+                if (firsts.back() - firsts[firsts.size() - 2] > 2) {
+                    firsts.back()--;
+                } else {
+                    firsts.pop_back();
+                }
+            }
+
+            std::vector<PageNum> parents;
+            std::vector<char> parentSeparators;
+            std::vector<size_t> parentSeparatorOffsets;
+            for (size_t n = 0; n < firsts.size(); n++) {
+                const size_t begin = firsts[n];
+                const size_t end = n + 1 < firsts.size() ? firsts[n + 1] : children.size();
+                BTreeNode node(attribute, page.data());
+                node.initialize(level);
+                node.setLink(children[begin]);
+                for (size_t child = begin + 1; child < end; child++) {
+                    if (node.insert(node.getNumEntries(), separators.data() + separatorOffsets[child - 1],
+                                    separatorRID(child - 1), children[child])) {
+                        return -1;
+                    }
+                }
+                if (begin > 0) {
+                    const char *separator = separators.data() + separatorOffsets[begin - 1];
+                    parentSeparatorOffsets.push_back(parentSeparators.size());
+                    parentSeparators.insert(parentSeparators.end(), separator,
+                                            separator + BTreeNode::keySize(attribute, separator) + IX_RID_SIZE);
+                }
+                pending.insert(pending.end(), page.begin(), page.end());
+                parents.push_back(pageNum++);
+                if (++numPending == IX_BULK_LOAD_BATCH && appendPending()) {
+                    return -1;
+                }
+            }
+            if (appendPending()) {
+                return -1;
+            }
+            children.swap(parents);
+            separators.swap(parentSeparators);
+            separatorOffsets.swap(parentSeparatorOffsets);
+        }
+
+        return writeRoot(ixFileHandle, children[0]);
     }
 
     RC IndexManager::scan(IXFileHandle &ixFileHandle,
@@ -39,25 +285,1015 @@ namespace PeterDB {
                           bool lowKeyInclusive,
                           bool highKeyInclusive,
                           IX_ScanIterator &ix_ScanIterator) {
-        return -1;
+        return ix_ScanIterator.initializeScan(ixFileHandle, attribute, lowKey, highKey, lowKeyInclusive,
+                                              highKeyInclusive);
     }
 
     RC IndexManager::printBTree(IXFileHandle &ixFileHandle, const Attribute &attribute, std::ostream &out) const {
-        return -1;
+        if (ixFileHandle.fileHandle.file == nullptr) {
+            return -1;
+        }
+        if (ixFileHandle.fileHandle.getNumberOfPages() == 0) {
+            out << "{\"keys\":[]}" << std::endl;
+            return 0;
+        }
+        PageNum root;
+        if (readRoot(ixFileHandle, root) || printNode(ixFileHandle, attribute, root, out)) {
+            return -1;
+        }
+        out << std::endl;
+        return 0;
+    }
+
+    // Print a key as a JSON string body
+    static void printKey(const Attribute &attribute, const void *key, std::ostream &out) {
+        switch (attribute.type) {
+            case TypeInt: {
+                int value;
+                memcpy(&value, key, NUM_SIZE);
+                out << value;
+                break;
+            }
+            case TypeReal: {
+                float value;
+                memcpy(&value, key, NUM_SIZE);
+                out << value;
+                break;
+            }
+            case TypeVarChar: {
+                unsigned length;
+                memcpy(&length, key, NUM_SIZE);
+                const char *chars = (const char *) key + NUM_SIZE;
+                for (unsigned i = 0; i < length; i++) {
+                    if (chars[i] == '"' || chars[i] == '\\') {
+                        out << '\\';
+                    }
+                    out << chars[i];
+                }
+                break;
+            }
+        }
+    }
+
+    RC IndexManager::printNode(IXFileHandle &ixFileHandle, const Attribute &attribute, PageNum pageNum,
+                               std::ostream &out) const {
+        std::vector<char> page(PAGE_SIZE), key(PAGE_SIZE), nextKey(PAGE_SIZE);
+        if (ixFileHandle.fileHandle.readPage(pageNum, page.data())) {
+            return -1;
+        }
+        BTreeNode node(attribute, page.data());
+        const unsigned numEntries = node.getNumEntries();
+        out << "{\"keys\":[";
+        if (node.isLeaf()) {
+            // Entries of a key are grouped: "key:[(pageNum,slotNum),...]"
+            unsigned i = 0;
+            while (i < numEntries) {
+                node.getKey(i, key.data());
+                out << (i > 0 ? ",\"" : "\"");
+                printKey(attribute, key.data(), out);
+                out << ":[";
+                unsigned j = i;
+                do {
+                    const RID rid = node.getRID(j);
+                    out << (j > i ? ",(" : "(") << rid.pageNum << "," << rid.slotNum << ")";
+                } while (++j < numEntries && node.compareKey(j, key.data()) == 0);
+                out << "]\"";
+                i = j;
+            }
+            out << "]}";
+            return 0;
+        }
+        for (unsigned i = 0; i < numEntries; i++) {
+            node.getKey(i, key.data());
+            out << (i > 0 ? ",\"" : "\"");
+            printKey(attribute, key.data(), out);
+            out << "\"";
+        }
+        out << "],\"children\":[";
+        for (unsigned i = 0; i <= numEntries; i++) {
+            if (i > 0) {
+                out << ",";
+            }
+            if (printNode(ixFileHandle, attribute, node.getChild(i), out)) {
+                return -1;
+            }
+        }
+        out << "]}";
+        return 0;
+    }
+
+    RC IndexManager::readRoot(IXFileHandle &ixFileHandle, PageNum &root) const {
+        std::vector<char> metaPage(PAGE_SIZE);
+        if (ixFileHandle.fileHandle.readPage(IX_META_PAGE, metaPage.data())) {
+            return -1;
+        }
+        memcpy(&root, metaPage.data(), sizeof(PageNum));
+        return 0;
+    }
+
+    RC IndexManager::writeRoot(IXFileHandle &ixFileHandle, PageNum root) {
+        std::vector<char> metaPage(PAGE_SIZE);
+        if (ixFileHandle.fileHandle.readPage(IX_META_PAGE, metaPage.data())) {
+            return -1;
+        }
+        memcpy(metaPage.data(), &root, sizeof(PageNum));
+        return ixFileHandle.fileHandle.writePage(IX_META_PAGE, metaPage.data());
+    }
+
+    RC IndexManager::allocatePage(IXFileHandle &ixFileHandle, const void *data, PageNum &pageNum) {
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        std::vector<char> metaPage(PAGE_SIZE);
+        if (fileHandle.readPage(IX_META_PAGE, metaPage.data())) {
+            return -1;
+        }
+        memcpy(&pageNum, metaPage.data() + sizeof(PageNum), sizeof(PageNum));
+        if (pageNum == IX_META_PAGE) {
+            pageNum = fileHandle.getNumberOfPages();
+            return fileHandle.appendPage(data);
+        }
+        // Unlink the first free page before reusing it
+        std::vector<char> page(PAGE_SIZE);
+        if (fileHandle.readPage(pageNum, page.data())) {
+            return -1;
+        }
+        memcpy(metaPage.data() + sizeof(PageNum), page.data(), sizeof(PageNum));
+        if (fileHandle.writePage(IX_META_PAGE, metaPage.data())) {
+            return -1;
+        }
+        return fileHandle.writePage(pageNum, data);
+    }
+
+    RC IndexManager::freePage(IXFileHandle &ixFileHandle, PageNum pageNum) {
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        std::vector<char> metaPage(PAGE_SIZE), page(PAGE_SIZE, 0);
+        if (fileHandle.readPage(IX_META_PAGE, metaPage.data())) {
+            return -1;
+        }
+        // The page changes, so a scan holding it as its leaf starts over instead of following its link
+        memcpy(page.data(), metaPage.data() + sizeof(PageNum), sizeof(PageNum));
+        memcpy(metaPage.data() + sizeof(PageNum), &pageNum, sizeof(PageNum));
+        if (fileHandle.writePage(pageNum, page.data())) {
+            return -1;
+        }
+        return fileHandle.writePage(IX_META_PAGE, metaPage.data());
+    }
+
+    RC IndexManager::findLeaf(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key,
+                              char *page, PageNum &pageNum) {
+        if (readRoot(ixFileHandle, pageNum) || ixFileHandle.fileHandle.readPage(pageNum, page)) {
+            return -1;
+        }
+        // Entries with keys >= key start left of the first separator with a key >= key
+        BTreeNode node(attribute, page);
+        while (!node.isLeaf()) {
+            pageNum = node.getChild(key == nullptr ? 0 : node.lowerBound(key, true));
+            if (ixFileHandle.fileHandle.readPage(pageNum, page)) {
+                return -1;
+            }
+            node = BTreeNode(attribute, page);
+        }
+        return 0;
+    }
+
+    RC IndexManager::descend(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid,
+                             char *page, std::vector<PageNum> &path) {
+        PageNum pageNum;
+        if (readRoot(ixFileHandle, pageNum) || ixFileHandle.fileHandle.readPage(pageNum, page)) {
+            return -1;
+        }
+        path.assign(1, pageNum);
+        // Entry i separates child i and child i + 1, so (key, RID) goes right of every separator not above it
+        BTreeNode node(attribute, page);
+        while (!node.isLeaf()) {
+            pageNum = node.getChild(node.upperBound(key, rid));
+            if (ixFileHandle.fileHandle.readPage(pageNum, page)) {
+                return -1;
+            }
+            path.push_back(pageNum);
+            node = BTreeNode(attribute, page);
+        }
+        return 0;
+    }
+
+    RC IndexManager::splitNode(IXFileHandle &ixFileHandle, const Attribute &attribute, char *page, unsigned position,
+                               char *key, RID &rid, PageNum &child) {
+        // Work from a copy of the full node, with the new entry numbered position among its entries
+        std::vector<char> full(page, page + PAGE_SIZE);
+        BTreeNode source(attribute, full.data());
+        const std::vector<char> newKey(key, key + BTreeNode::keySize(attribute, key));
+        const RID newRid = rid;
+        const PageNum newChild = child;
+        const unsigned numEntries = source.getNumEntries() + 1;
+        const bool leaf = source.isLeaf();
+        auto sizeOf = [&](unsigned j) {
+            return j == position ? source.entrySize(newKey.data()) : source.getEntrySize(j < position ? j : j - 1);
+        };
+        auto copyTo = [&](BTreeNode &target, unsigned j) {
+            return j == position ? target.insert(target.getNumEntries(), newKey.data(), newRid, newChild)
+                                 : target.insertFrom(source, j < position ? j : j - 1, target.getNumEntries());
+        };
+
+        // The left half takes about half of the bytes, an internal node moves the entry after it up
+        unsigned total = 0;
+        for (unsigned j = 0; j < numEntries; j++) {
+            total += sizeOf(j);
+        }
+        const unsigned last = leaf ? numEntries - 1 : numEntries - 2;   // the right half keeps an entry
+        unsigned split = 0, left = 0;
+        while (split < last && (split == 0 || left + sizeOf(split) <= total / 2)) {
+            left += sizeOf(split++);
+        }
+        while (split < last && total - left - (leaf ? 0 : sizeOf(split)) > PAGE_SIZE - IX_NODE_HEADER_SIZE) {
+            left += sizeOf(split++);
+        }
+
+        // The separator is the first entry of the right half, the right half of an internal node starts at its child
+        std::vector<char> right(PAGE_SIZE);
+        BTreeNode rightNode(attribute, right.data());
+        rightNode.initialize(source.getLevel());
+        if (split == position) {
+            memcpy(key, newKey.data(), newKey.size());
+            rid = newRid;
+            child = newChild;
+        } else {
+            const unsigned j = split < position ? split : split - 1;
+            source.getKey(j, key);
+            rid = source.getRID(j);
+            child = leaf ? IX_META_PAGE : source.getChild(j + 1);
+        }
+        if (leaf) {
+            rightNode.setLink(source.getLink());
+            for (unsigned j = split; j < numEntries; j++) {
+                copyTo(rightNode, j);
+            }
+        } else {
+            rightNode.setLink(child);
+            for (unsigned j = split + 1; j < numEntries; j++) {
+                copyTo(rightNode, j);
+            }
+        }
+        PageNum rightPage;
+        if (allocatePage(ixFileHandle, right.data(), rightPage)) {
+            return -1;
+        }
+        BTreeNode leftNode(attribute, page);
+        leftNode.initialize(source.getLevel());
+        leftNode.setLink(leaf ? rightPage : source.getLink());
+        for (unsigned j = 0; j < split; j++) {
+            copyTo(leftNode, j);
+        }
+        child = rightPage;
+        return 0;
+    }
+
+    RC IndexManager::rebalance(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid,
+                               const std::vector<PageNum> &path, char *page) {
+        FileHandle &fileHandle = ixFileHandle.fileHandle;
+        std::vector<char> parentPage(PAGE_SIZE), siblingPage(PAGE_SIZE);
+        std::vector<char> separator(PAGE_SIZE), nextSeparator(PAGE_SIZE);
+        for (size_t depth = path.size() - 1; depth > 0; depth--) {
+            // page holds path[depth], the root is never short of entries
+            if (BTreeNode(attribute, page).getUsedSpace() >= IX_MERGE_THRESHOLD) {
+                return 0;
+            }
+            if (fileHandle.readPage(path[depth - 1], parentPage.data())) {
+                return -1;
+            }
+            BTreeNode parent(attribute, parentPage.data());
+            // Pair the node with its left sibling, or with its right one when it is the first child
+            const unsigned childIndex = parent.upperBound(key, rid);
+            const unsigned separatorIndex = childIndex > 0 ? childIndex - 1 : 0;
+            const PageNum siblingNum = parent.getChild(childIndex > 0 ? childIndex - 1 : 1);
+            if (fileHandle.readPage(siblingNum, siblingPage.data())) {
+                return -1;
+            }
+            char *leftPage = childIndex > 0 ? siblingPage.data() : page;
+            char *rightPage = childIndex > 0 ? page : siblingPage.data();
+            const PageNum leftNum = childIndex > 0 ? siblingNum : path[depth];
+            const PageNum rightNum = childIndex > 0 ? path[depth] : siblingNum;
+            BTreeNode left(attribute, leftPage), right(attribute, rightPage);
+            const bool leaf = left.isLeaf();
+            parent.getKey(separatorIndex, separator.data());
+            RID separatorRid = parent.getRID(separatorIndex);
+
+            const unsigned merged = left.getUsedSpace() + right.getUsedSpace() +
+                                    (leaf ? 0 : left.entrySize(separator.data()));
+            if (merged <= PAGE_SIZE - IX_NODE_HEADER_SIZE) {
+                // Merge the right node into the left one, an internal node takes the separator down with it
+                if (leaf) {
+                    left.setLink(right.getLink());
+                } else {
+                    left.insert(left.getNumEntries(), separator.data(), separatorRid, right.getLink());
+                }
+                for (unsigned j = 0; j < right.getNumEntries(); j++) {
+                    left.insertFrom(right, j, left.getNumEntries());
+                }
+                parent.remove(separatorIndex);
+                if (fileHandle.writePage(leftNum, leftPage) ||
+                    fileHandle.writePage(path[depth - 1], parentPage.data()) ||
+                    freePage(ixFileHandle, rightNum)) {
+                    return -1;
+                }
+                if (depth - 1 == 0 && parent.getNumEntries() == 0) {
+                    // The root lost its last separator, its only child becomes the root
+                    if (writeRoot(ixFileHandle, parent.getLink())) {
+                        return -1;
+                    }
+                    return freePage(ixFileHandle, path[0]);
+                }
+                memcpy(page, parentPage.data(), PAGE_SIZE);
+                continue;
+            }
+
+            // Too full to merge: move entries from the fuller node one at a time until the two are balanced,
+            // each move replaces the separator in the parent
+            bool moved = false;
+            const bool toLeft = left.getUsedSpace() < right.getUsedSpace();
+            BTreeNode &from = toLeft ? right : left;
+            BTreeNode &to = toLeft ? left : right;
+            while (true) {
+                const unsigned numEntries = from.getNumEntries();
+                const unsigned i = toLeft ? 0 : numEntries - 1;
+                const unsigned size = from.getEntrySize(i);
+                if (numEntries < 2 || to.getUsedSpace() + size > from.getUsedSpace() - size) {
+                    break;
+                }
+                // A leaf copies the new first entry of the right node up, an internal node moves entry i up
+                const unsigned next = leaf && toLeft ? 1 : i;
+                from.getKey(next, nextSeparator.data());
+                const RID nextRid = from.getRID(next);
+                if (parent.getFreeSpace() + parent.getEntrySize(separatorIndex) <
+                    parent.entrySize(nextSeparator.data())) {
+                    break;
+                }
+                if (leaf) {
+                    if (to.insertFrom(from, i, toLeft ? to.getNumEntries() : 0)) {
+                        break;
+                    }
+                    from.remove(i);
+                } else if (toLeft) {
+                    if (to.insert(to.getNumEntries(), separator.data(), separatorRid, from.getLink())) {
+                        break;
+                    }
+                    from.setLink(from.getChild(1));
+                    from.remove(0);
+                } else {
+                    if (to.insert(0, separator.data(), separatorRid, to.getLink())) {
+                        break;
+                    }
+                    to.setLink(from.getChild(numEntries));
+                    from.remove(i);
+                }
+                const PageNum separatorChild = parent.getChild(separatorIndex + 1);
+                parent.remove(separatorIndex);
+                parent.insert(separatorIndex, nextSeparator.data(), nextRid, separatorChild);
+                memcpy(separator.data(), nextSeparator.data(), BTreeNode::keySize(attribute, nextSeparator.data()));
+                separatorRid = nextRid;
+                moved = true;
+            }
+            if (!moved) {
+                return 0;
+            }
+            if (fileHandle.writePage(leftNum, leftPage) || fileHandle.writePage(rightNum, rightPage)) {
+                return -1;
+            }
+            return fileHandle.writePage(path[depth - 1], parentPage.data());
+        }
+        return 0;
+    }
+
+    BTreeNode::BTreeNode(const Attribute &attribute, char *page): type(attribute.type), page(page) {
+        keyFieldSize = type == TypeVarChar ? 2 * NUM_SIZE : NUM_SIZE;
+        stride = keyFieldSize + IX_RID_SIZE + (isLeaf() ? 0 : sizeof(PageNum));
+    }
+
+    void BTreeNode::initialize(unsigned short level) {
+        const PageNum link = IX_META_PAGE;
+        const unsigned short numEntries = 0;
+        const unsigned short heapStart = PAGE_SIZE;
+        memset(page, 0, IX_NODE_HEADER_SIZE);
+        memcpy(page, &link, sizeof(PageNum));
+        memcpy(page + sizeof(PageNum), &level, SHORT_SIZE);
+        memcpy(page + sizeof(PageNum) + SHORT_SIZE, &numEntries, SHORT_SIZE);
+        memcpy(page + sizeof(PageNum) + 2 * SHORT_SIZE, &heapStart, SHORT_SIZE);
+        stride = keyFieldSize + IX_RID_SIZE + (level == 0 ? 0 : sizeof(PageNum));
+    }
+
+    bool BTreeNode::isLeaf() const {
+        return getLevel() == 0;
+    }
+
+    unsigned short BTreeNode::getLevel() const {
+        unsigned short level;
+        memcpy(&level, page + sizeof(PageNum), SHORT_SIZE);
+        return level;
+    }
+
+    unsigned short BTreeNode::getNumEntries() const {
+        unsigned short numEntries;
+        memcpy(&numEntries, page + sizeof(PageNum) + SHORT_SIZE, SHORT_SIZE);
+        return numEntries;
+    }
+
+    void BTreeNode::setNumEntries(unsigned short numEntries) {
+        memcpy(page + sizeof(PageNum) + SHORT_SIZE, &numEntries, SHORT_SIZE);
+    }
+
+    unsigned short BTreeNode::getHeapStart() const {
+        unsigned short heapStart;
+        memcpy(&heapStart, page + sizeof(PageNum) + 2 * SHORT_SIZE, SHORT_SIZE);
+        return heapStart;
+    }
+
+    void BTreeNode::setHeapStart(unsigned short heapStart) {
+        memcpy(page + sizeof(PageNum) + 2 * SHORT_SIZE, &heapStart, SHORT_SIZE);
+    }
+
+    PageNum BTreeNode::getLink() const {
+        PageNum link;
+        memcpy(&link, page, sizeof(PageNum));
+        return link;
+    }
+
+    void BTreeNode::setLink(PageNum pageNum) {
+        memcpy(page, &pageNum, sizeof(PageNum));
+    }
+
+    unsigned BTreeNode::getFreeSpace() const {
+        return getHeapStart() - IX_NODE_HEADER_SIZE - getNumEntries() * stride;
+    }
+
+    unsigned BTreeNode::getUsedSpace() const {
+        return PAGE_SIZE - IX_NODE_HEADER_SIZE - getFreeSpace();
+    }
+
+    unsigned BTreeNode::entrySize(const void *key) const {
+        if (type != TypeVarChar) {
+            return stride;
+        }
+        // the characters go to the heap
+        unsigned length;
+        memcpy(&length, key, NUM_SIZE);
+        return stride + length;
+    }
+
+    unsigned BTreeNode::getEntrySize(unsigned i) const {
+        if (type != TypeVarChar) {
+            return stride;
+        }
+        unsigned short length;
+        memcpy(&length, entry(i) + NUM_SIZE + SHORT_SIZE, SHORT_SIZE);
+        return stride + length;
     }
 
-    IX_ScanIterator::IX_ScanIterator() {
+    char *BTreeNode::entry(unsigned i) const {
+        return page + IX_NODE_HEADER_SIZE + i * stride;
+    }
+
+    void BTreeNode::getKey(unsigned i, void *key) const {
+        const char *field = entry(i);
+        if (type != TypeVarChar) {
+            memcpy(key, field, NUM_SIZE);
+            return;
+        }
+        unsigned short offset, length;
+        memcpy(&offset, field + NUM_SIZE, SHORT_SIZE);
+        memcpy(&length, field + NUM_SIZE + SHORT_SIZE, SHORT_SIZE);
+        const unsigned keyLength = length;
+        memcpy(key, &keyLength, NUM_SIZE);
+        memcpy((char *) key + NUM_SIZE, page + offset, length);
+    }
+
+    RID BTreeNode::getRID(unsigned i) const {
+        const char *ridField = entry(i) + keyFieldSize;
+        RID rid;
+        memcpy(&rid.pageNum, ridField, NUM_SIZE);
+        memcpy(&rid.slotNum, ridField + NUM_SIZE, SHORT_SIZE);
+        return rid;
+    }
+
+    PageNum BTreeNode::getChild(unsigned i) const {
+        if (i == 0) {
+            return getLink();
+        }
+        PageNum child;
+        memcpy(&child, entry(i - 1) + keyFieldSize + IX_RID_SIZE, sizeof(PageNum));
+        return child;
+    }
+
+    void BTreeNode::setChild(unsigned i, PageNum pageNum) {
+        if (i == 0) {
+            setLink(pageNum);
+            return;
+        }
+        memcpy(entry(i - 1) + keyFieldSize + IX_RID_SIZE, &pageNum, sizeof(PageNum));
+    }
+
+    int BTreeNode::compareKey(unsigned i, const void *key) const {
+        const char *field = entry(i);
+        switch (type) {
+            case TypeInt: {
+                int value1, value2;
+                memcpy(&value1, field, NUM_SIZE);
+                memcpy(&value2, key, NUM_SIZE);
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeReal: {
+                float value1, value2;
+                memcpy(&value1, field, NUM_SIZE);
+                memcpy(&value2, key, NUM_SIZE);
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeVarChar: {
+                unsigned keyLength;
+                memcpy(&keyLength, key, NUM_SIZE);
+                const char *chars = (const char *) key + NUM_SIZE;
+
+                // The zero padded prefixes order the keys unless they are equal
+                char prefix[NUM_SIZE] = {0};
+                memcpy(prefix, chars, std::min(keyLength, (unsigned) NUM_SIZE));
+                int result = memcmp(field, prefix, NUM_SIZE);
+                if (result != 0) {
+                    return result;
+                }
+                unsigned short offset, length;
+                memcpy(&offset, field + NUM_SIZE, SHORT_SIZE);
+                memcpy(&length, field + NUM_SIZE + SHORT_SIZE, SHORT_SIZE);
+                result = memcmp(page + offset, chars, std::min((unsigned) length, keyLength));
+                if (result != 0) {
+                    return result;
+                }
+                return (length > keyLength) - (length < keyLength);
+            }
+        }
+        return 0;
+    }
+
+    int BTreeNode::compare(unsigned i, const void *key, const RID &rid) const {
+        const int result = compareKey(i, key);
+        return result != 0 ? result : compareRIDs(getRID(i), rid);
+    }
+
+    unsigned BTreeNode::lowerBound(const void *key, bool inclusive) const {
+        // Entries before the bound compare below key (or equal when exclusive)
+        const int limit = inclusive ? 0 : 1;
+        unsigned first = 0, count = getNumEntries();
+        while (count > 0) {
+            const unsigned half = count / 2;
+            const bool before = compareKey(first + half, key) < limit;
+            first = before ? first + half + 1 : first;
+            count = before ? count - half - 1 : half;
+        }
+        return first;
+    }
+
+    unsigned BTreeNode::upperBound(const void *key, const RID &rid) const {
+        unsigned first = 0, count = getNumEntries();
+        while (count > 0) {
+            const unsigned half = count / 2;
+            const bool before = compare(first + half, key, rid) <= 0;
+            first = before ? first + half + 1 : first;
+            count = before ? count - half - 1 : half;
+        }
+        return first;
+    }
+
+    RC BTreeNode::insert(unsigned i, const void *key, const RID &rid, PageNum child) {
+        const unsigned numEntries = getNumEntries();
+        if (entrySize(key) > getFreeSpace() || i > numEntries) {
+            return -1;
+        }
+        memmove(entry(i + 1), entry(i), (numEntries - i) * stride);
+
+        char *field = entry(i);
+        if (type != TypeVarChar) {
+            memcpy(field, key, NUM_SIZE);
+        } else {
+            unsigned keyLength;
+            memcpy(&keyLength, key, NUM_SIZE);
+            const unsigned short length = keyLength;
+            const unsigned short offset = getHeapStart() - length;
+            memcpy(page + offset, (const char *) key + NUM_SIZE, length);
+            setHeapStart(offset);
+
+            memset(field, 0, NUM_SIZE);
+            memcpy(field, (const char *) key + NUM_SIZE, std::min(keyLength, (unsigned) NUM_SIZE));
+            memcpy(field + NUM_SIZE, &offset, SHORT_SIZE);
+            memcpy(field + NUM_SIZE + SHORT_SIZE, &length, SHORT_SIZE);
+        }
+        memcpy(field + keyFieldSize, &rid.pageNum, NUM_SIZE);
+        memcpy(field + keyFieldSize + NUM_SIZE, &rid.slotNum, SHORT_SIZE);
+        setNumEntries(numEntries + 1);
+        if (!isLeaf()) {
+            setChild(i + 1, child);
+        }
+        return 0;
+    }
+
+    RC BTreeNode::insertFrom(const BTreeNode &source, unsigned i, unsigned position) {
+        char key[PAGE_SIZE];
+        source.getKey(i, key);
+        return insert(position, key, source.getRID(i), source.isLeaf() ? IX_META_PAGE : source.getChild(i + 1));
+    }
+
+    void BTreeNode::remove(unsigned i) {
+        const unsigned numEntries = getNumEntries();
+        if (type == TypeVarChar) {
+            // Close the gap the characters leave in the heap, the keys stored below them move up
+            unsigned short offset, length;
+            memcpy(&offset, entry(i) + NUM_SIZE, SHORT_SIZE);
+            memcpy(&length, entry(i) + NUM_SIZE + SHORT_SIZE, SHORT_SIZE);
+            const unsigned short heapStart = getHeapStart();
+            memmove(page + heapStart + length, page + heapStart, offset - heapStart);
+            setHeapStart(heapStart + length);
+            for (unsigned j = 0; j < numEntries; j++) {
+                unsigned short otherOffset;
+                memcpy(&otherOffset, entry(j) + NUM_SIZE, SHORT_SIZE);
+                if (otherOffset < offset) {
+                    otherOffset += length;
+                    memcpy(entry(j) + NUM_SIZE, &otherOffset, SHORT_SIZE);
+                }
+            }
+        }
+        // The child right of an internal entry is stored with it and goes too
+        memmove(entry(i), entry(i + 1), (numEntries - i - 1) * stride);
+        setNumEntries(numEntries - 1);
+    }
+
+    unsigned BTreeNode::keySize(const Attribute &attribute, const void *key) {
+        if (attribute.type != TypeVarChar) {
+            return NUM_SIZE;
+        }
+        unsigned length;
+        memcpy(&length, key, NUM_SIZE);
+        return NUM_SIZE + length;
+    }
+
+    int BTreeNode::compareKeys(const Attribute &attribute, const void *key1, const void *key2) {
+        switch (attribute.type) {
+            case TypeInt: {
+                int value1, value2;
+                memcpy(&value1, key1, NUM_SIZE);
+                memcpy(&value2, key2, NUM_SIZE);
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeReal: {
+                float value1, value2;
+                memcpy(&value1, key1, NUM_SIZE);
+                memcpy(&value2, key2, NUM_SIZE);
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeVarChar: {
+                unsigned length1, length2;
+                memcpy(&length1, key1, NUM_SIZE);
+                memcpy(&length2, key2, NUM_SIZE);
+                int result = memcmp((const char *) key1 + NUM_SIZE, (const char *) key2 + NUM_SIZE,
+                                    std::min(length1, length2));
+                if (result != 0) {
+                    return result;
+                }
+                return (length1 > length2) - (length1 < length2);
+            }
+        }
+        return 0;
+    }
+
+    int BTreeNode::compareRIDs(const RID &rid1, const RID &rid2) {
+        if (rid1.pageNum != rid2.pageNum) {
+            return rid1.pageNum < rid2.pageNum ? -1 : 1;
+        }
+        return (rid1.slotNum > rid2.slotNum) - (rid1.slotNum < rid2.slotNum);
+    }
+
+    IX_EntrySorter::IX_EntrySorter(const Attribute &attribute, const std::string &runPrefix)
+            : attribute(attribute), runPrefix(runPrefix), nextEntry(0) {}
+
+    IX_EntrySorter::~IX_EntrySorter() {
+        PagedFileManager &pfm = PagedFileManager::instance();
+        for (Run &run : runs) {
+            pfm.closeFile(run.fileHandle);
+        }
+        for (const std::string &runName : runNames) {
+            pfm.destroyFile(runName);
+        }
+    }
+
+    RC IX_EntrySorter::add(const void *key, const RID &rid) {
+        const unsigned size = BTreeNode::keySize(attribute, key);
+        if (size + NUM_SIZE + IX_RID_SIZE + sizeof(PageNum) > IX_MAX_ENTRY_SIZE) {
+            // the key is too large for a node, as in IndexManager::insertEntry()
+            return -1;
+        }
+        if (arena.size() + size + IX_RID_SIZE > IX_BULK_LOAD_BUDGET && spill()) {
+            return -1;
+        }
+        entryOffsets.push_back(arena.size());
+        arena.insert(arena.end(), (const char *) key, (const char *) key + size);
+        arena.insert(arena.end(), (const char *) &rid.pageNum, (const char *) &rid.pageNum + NUM_SIZE);
+        arena.insert(arena.end(), (const char *) &rid.slotNum, (const char *) &rid.slotNum + SHORT_SIZE);
+        return 0;
+    }
+
+    void IX_EntrySorter::sortEntries() {
+        std::sort(entryOffsets.begin(), entryOffsets.end(), [this](unsigned offset1, unsigned offset2) {
+            return compareEntries(arena.data() + offset1, arena.data() + offset2) < 0;
+        });
+    }
+
+    RC IX_EntrySorter::spill() {
+        sortEntries();
+        PagedFileManager &pfm = PagedFileManager::instance();
+        const std::string runName = runPrefix + ".run" + std::to_string(runNames.size());
+        FileHandle fileHandle;
+        if (pfm.createFile(runName)) {
+            return -1;
+        }
+        runNames.push_back(runName);
+        if (pfm.openFile(runName, fileHandle)) {
+            return -1;
+        }
+
+        // Pages hold [numEntries][entries], an entry never crosses a page
+        std::vector<char> pages;
+        unsigned numPages = 0;
+        size_t pageStart = 0, used = PAGE_SIZE;
+        for (unsigned offset : entryOffsets) {
+            const char *entry = arena.data() + offset;
+            const unsigned size = BTreeNode::keySize(attribute, entry) + IX_RID_SIZE;
+            if (used + size > PAGE_SIZE) {
+                pageStart = (size_t) numPages++ * PAGE_SIZE;
+                pages.resize((size_t) numPages * PAGE_SIZE, 0);
+                used = SHORT_SIZE;
+            }
+            memcpy(pages.data() + pageStart + used, entry, size);
+            used += size;
+            unsigned short numEntries;
+            memcpy(&numEntries, pages.data() + pageStart, SHORT_SIZE);
+            numEntries++;
+            memcpy(pages.data() + pageStart, &numEntries, SHORT_SIZE);
+        }
+        RC rc = numPages == 0 ? 0 : fileHandle.appendPages(numPages, pages.data());
+        pfm.closeFile(fileHandle);
+
+        arena.clear();
+        entryOffsets.clear();
+        return rc;
+    }
+
+    RC IX_EntrySorter::finish() {
+        nextEntry = 0;
+        if (runNames.empty()) {
+            // everything fits in memory
+            sortEntries();
+            return 0;
+        }
+        if (!entryOffsets.empty() && spill()) {
+            return -1;
+        }
+
+        // Merge the runs through a heap ordered by the next entry of each run
+        PagedFileManager &pfm = PagedFileManager::instance();
+        runs.resize(runNames.size());
+        for (unsigned i = 0; i < runs.size(); i++) {
+            Run &run = runs[i];
+            run.page.resize(PAGE_SIZE);
+            run.pageNum = 0;
+            run.numEntries = 0;
+            run.next = 0;
+            if (pfm.openFile(runNames[i], run.fileHandle)) {
+                return -1;
+            }
+            if (advance(run) == 0) {
+                heap.push_back(i);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), [this](unsigned run1, unsigned run2) {
+            return runGreater(run1, run2);
+        });
+        return 0;
+    }
+
+    RC IX_EntrySorter::advance(Run &run) {
+        if (run.next < run.numEntries) {
+            // step over the current entry
+            run.offset += BTreeNode::keySize(attribute, run.page.data() + run.offset) + IX_RID_SIZE;
+            run.next++;
+        }
+        while (run.next >= run.numEntries) {
+            if (run.pageNum >= run.fileHandle.getNumberOfPages() ||
+                run.fileHandle.readPage(run.pageNum++, run.page.data())) {
+                return IX_EOF;
+            }
+            memcpy(&run.numEntries, run.page.data(), SHORT_SIZE);
+            run.next = 0;
+            run.offset = SHORT_SIZE;
+        }
+        return 0;
+    }
+
+    bool IX_EntrySorter::runGreater(unsigned run1, unsigned run2) const {
+        return compareEntries(runs[run1].page.data() + runs[run1].offset,
+                              runs[run2].page.data() + runs[run2].offset) > 0;
+    }
+
+    int IX_EntrySorter::compareEntries(const char *entry1, const char *entry2) const {
+        const int result = BTreeNode::compareKeys(attribute, entry1, entry2);
+        if (result != 0) {
+            return result;
+        }
+        RID rid1, rid2;
+        const char *ridField1 = entry1 + BTreeNode::keySize(attribute, entry1);
+        const char *ridField2 = entry2 + BTreeNode::keySize(attribute, entry2);
+        memcpy(&rid1.pageNum, ridField1, NUM_SIZE);
+        memcpy(&rid1.slotNum, ridField1 + NUM_SIZE, SHORT_SIZE);
+        memcpy(&rid2.pageNum, ridField2, NUM_SIZE);
+        memcpy(&rid2.slotNum, ridField2 + NUM_SIZE, SHORT_SIZE);
+        return BTreeNode::compareRIDs(rid1, rid2);
+    }
+
+    RC IX_EntrySorter::getNextEntry(RID &rid, void *key) {
+        const char *entry;
+        if (runNames.empty()) {
+            if (nextEntry >= entryOffsets.size()) {
+                return IX_EOF;
+            }
+            entry = arena.data() + entryOffsets[nextEntry++];
+        } else {
+            if (heap.empty()) {
+                return IX_EOF;
+            }
+            auto greater = [this](unsigned run1, unsigned run2) {
+                return runGreater(run1, run2);
+            };
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            Run &run = runs[heap.back()];
+            entry = run.page.data() + run.offset;
+            const unsigned size = BTreeNode::keySize(attribute, entry);
+            memcpy(key, entry, size);
+            memcpy(&rid.pageNum, entry + size, NUM_SIZE);
+            memcpy(&rid.slotNum, entry + size + NUM_SIZE, SHORT_SIZE);
+            if (advance(run) == 0) {
+                std::push_heap(heap.begin(), heap.end(), greater);
+            } else {
+                heap.pop_back();
+            }
+            return 0;
+        }
+        const unsigned size = BTreeNode::keySize(attribute, entry);
+        memcpy(key, entry, size);
+        memcpy(&rid.pageNum, entry + size, NUM_SIZE);
+        memcpy(&rid.slotNum, entry + size + NUM_SIZE, SHORT_SIZE);
+        return 0;
+    }
+
+    IX_ScanIterator::IX_ScanIterator(): ixFileHandle(nullptr), lowKeyInclusive(false), highKeyInclusive(false),
+                                        pageNum(IX_META_PAGE), position(0), finished(true) {
     }
 
     IX_ScanIterator::~IX_ScanIterator() {
     }
 
+    RC IX_ScanIterator::initializeScan(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *lowKey,
+                                       const void *highKey, bool lowKeyInclusive, bool highKeyInclusive) {
+        if (ixFileHandle.fileHandle.file == nullptr) {
+            // index is not opened
+            return -1;
+        }
+        this->ixFileHandle = &ixFileHandle;
+        this->attribute = attribute;
+        setRange(lowKey, highKey, lowKeyInclusive, highKeyInclusive);
+        page.resize(PAGE_SIZE);
+        current.resize(PAGE_SIZE);
+        pageNum = IX_META_PAGE;
+        position = 0;
+
+        // An index without pages has no entries
+        finished = ixFileHandle.fileHandle.getNumberOfPages() == 0;
+        if (finished) {
+            return 0;
+        }
+        return restart();
+    }
+
+    void IX_ScanIterator::setRange(const void *lowKey, const void *highKey, bool lowKeyInclusive,
+                                   bool highKeyInclusive) {
+        this->lowKeyInclusive = lowKeyInclusive;
+        this->highKeyInclusive = highKeyInclusive;
+        // Keep copies of the bounds, the caller may reuse their buffers for the returned keys
+        this->lowKey.clear();
+        this->highKey.clear();
+        if (lowKey != nullptr) {
+            const char *low = (const char *) lowKey;
+            this->lowKey.assign(low, low + BTreeNode::keySize(attribute, lowKey));
+        }
+        if (highKey != nullptr) {
+            const char *high = (const char *) highKey;
+            this->highKey.assign(high, high + BTreeNode::keySize(attribute, highKey));
+        }
+        lastKey.clear();
+    }
+
+    RC IX_ScanIterator::seek(const void *lowKey, const void *highKey, bool lowKeyInclusive, bool highKeyInclusive) {
+        if (ixFileHandle == nullptr) {
+            return -1;
+        }
+        setRange(lowKey, highKey, lowKeyInclusive, highKeyInclusive);
+        finished = ixFileHandle->fileHandle.getNumberOfPages() == 0;
+        if (finished) {
+            return 0;
+        }
+
+        // The leaf in hand holds the start of the range if its first entry is below the range and its last one
+        // is not, as entries left of it are no greater than its first
+        BTreeNode leaf(attribute, page.data());
+        const unsigned short numEntries = pageNum == IX_META_PAGE ? 0 : leaf.getNumEntries();
+        if (lowKey != nullptr && numEntries > 0
+            && leaf.compareKey(0, lowKey) < (lowKeyInclusive ? 0 : 1)
+            && leaf.compareKey(numEntries - 1, lowKey) >= 0
+            && ixFileHandle->fileHandle.readPage(pageNum, current.data()) == 0
+            && memcmp(current.data(), page.data(), PAGE_SIZE) == 0) {
+            position = leaf.lowerBound(lowKey, lowKeyInclusive);
+            return 0;
+        }
+        return restart();
+    }
+
+    RC IX_ScanIterator::restart() {
+        IndexManager &ix = IndexManager::instance();
+        if (lastKey.empty()) {
+            // Nothing returned yet, start from the low bound
+            const void *low = lowKey.empty() ? nullptr : lowKey.data();
+            if (ix.findLeaf(*ixFileHandle, attribute, low, page.data(), pageNum)) {
+                return -1;
+            }
+            position = low == nullptr ? 0 : BTreeNode(attribute, page.data()).lowerBound(low, lowKeyInclusive);
+            return 0;
+        }
+        std::vector<PageNum> path;
+        if (ix.descend(*ixFileHandle, attribute, lastKey.data(), lastRid, page.data(), path)) {
+            return -1;
+        }
+        pageNum = path.back();
+        position = BTreeNode(attribute, page.data()).upperBound(lastKey.data(), lastRid);
+        return 0;
+    }
+
     RC IX_ScanIterator::getNextEntry(RID &rid, void *key) {
-        return -1;
+        if (finished) {
+            return IX_EOF;
+        }
+        BTreeNode leaf(attribute, page.data());
+        while (true) {
+            if (position >= leaf.getNumEntries()) {
+                if (leaf.getLink() == IX_META_PAGE) {
+                    finished = true;
+                    return IX_EOF;
+                }
+                // Entries deleted since the leaf was read may have merged it with a sibling or moved entries
+                // between them; its link is only followed if the leaf did not change
+                if (ixFileHandle->fileHandle.readPage(pageNum, current.data())) {
+                    finished = true;
+                    return IX_EOF;
+                }
+                if (memcmp(current.data(), page.data(), PAGE_SIZE) != 0) {
+                    if (restart()) {
+                        finished = true;
+                        return IX_EOF;
+                    }
+                    continue;
+                }
+                // Move on to the right sibling
+                pageNum = leaf.getLink();
+                if (ixFileHandle->fileHandle.readPage(pageNum, page.data())) {
+                    finished = true;
+                    return IX_EOF;
+                }
+                position = 0;
+                continue;
+            }
+            // Keys equal to an exclusive low bound may follow the start of the scan
+            if (!lowKey.empty() && leaf.compareKey(position, lowKey.data()) < (lowKeyInclusive ? 0 : 1)) {
+                position++;
+                continue;
+            }
+            break;
+        }
+        if (!highKey.empty() && leaf.compareKey(position, highKey.data()) > (highKeyInclusive ? 0 : -1)) {
+            finished = true;
+            return IX_EOF;
+        }
+        leaf.getKey(position, key);
+        rid = leaf.getRID(position);
+        position++;
+        lastKey.assign((const char *) key, (const char *) key + BTreeNode::keySize(attribute, key));
+        lastRid = rid;
+        return 0;
     }
 
     RC IX_ScanIterator::close() {
-        return -1;
+        finished = true;
+        ixFileHandle = nullptr;
+        return 0;
     }
 
     IXFileHandle::IXFileHandle() {
@@ -71,7 +1307,16 @@ namespace PeterDB {
 
     RC
     IXFileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount) {
-        return -1;
+        if (fileHandle.file == nullptr) {
+            return -1;
+        }
+        if (fileHandle.collectCounterValues(ixReadPageCounter, ixWritePageCounter, ixAppendPageCounter)) {
+            return -1;
+        }
+        readPageCount = ixReadPageCounter;
+        writePageCount = ixWritePageCounter;
+        appendPageCount = ixAppendPageCounter;
+        return 0;
     }
 
-} // namespace PeterDB
\ No newline at end of file
+} // namespace PeterDB
@@ -1,32 +1,49 @@
 #include "src/include/pfm.h"
 
 #include <cstdio>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <memory>
+#include <limits>
+#include <algorithm>
 
 namespace PeterDB {
     PagedFileManager &PagedFileManager::instance() {
         static PagedFileManager _pf_manager = PagedFileManager();
         return _pf_manager;
     }
-    PagedFileManager::PagedFileManager() = default;
-    PagedFileManager::~PagedFileManager() = default;
-    PagedFileManager::PagedFileManager(const PagedFileManager &) = default;
-    PagedFileManager &PagedFileManager::operator=(const PagedFileManager &) = default;
+    PagedFileManager::PagedFileManager(): bufferPool(BUFFER_POOL_SIZE, CLOCK_POLICY), nextFileId(0),
+                                          readAheadMode(THREAD_READ_AHEAD), readAheadWindow(READ_AHEAD_WINDOW) {}
+    PagedFileManager::~PagedFileManager() {
+        // Write back files that were never closed
+        checkpoint();
+    }
+    PagedFileManager::PagedFileManager(const PagedFileManager &): bufferPool(BUFFER_POOL_SIZE, CLOCK_POLICY),
+                                                                  nextFileId(0), readAheadMode(THREAD_READ_AHEAD),
+                                                                  readAheadWindow(READ_AHEAD_WINDOW) {}
+    PagedFileManager &PagedFileManager::operator=(const PagedFileManager &) {
+        return *this;
+    }
 
     RC PagedFileManager::createFile(const std::string &fileName) {
         const char* fileName_c = fileName.c_str();
         //if fileName does not already exist
         if (access(fileName_c, F_OK) != 0) {
-            FILE * pageFile = fopen(fileName_c, "wb+");
-            if (!pageFile) {
+            int fd = ::open(fileName_c, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
                 return -1; // Failed to create file
             }
             //create a hidden page in the file here
+            PagedFile pagedFile(fileName, fd, 0);
             FileHandle fileHandle;
-            fileHandle.openedFile = pageFile;
+            fileHandle.file = &pagedFile;
             fileHandle.createHiddenPage();
-            fclose(pageFile);
+            close(fd);
             return 0;
         }
         // file already exists
@@ -36,54 +53,1094 @@ namespace PeterDB {
     RC PagedFileManager::destroyFile(const std::string &fileName) {
         const char* fileName_c = fileName.c_str();
         if (access(fileName_c, F_OK) == 0) {
+            std::lock_guard<std::mutex> guard(registryLatch);
+            // Pages of a destroyed file must never be written back
+            auto it = openFiles.find(fileName);
+            if (it != openFiles.end()) {
+                readAheadQueue.cancel(it->second);
+                it->second->discard();
+                it->second->destroyed = true;
+                openFiles.erase(it);
+            }
             if (remove(fileName_c) == 0) {return 0;}
         }
         // file does not exist
         return -1;
     }
 
-    RC PagedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle) {
+    RC PagedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle, IOBackend backend) {
         const char* fileName_c = fileName.c_str();
-        if (access(fileName_c, F_OK) == 0) {
-            FILE* pageFile = fopen(fileName_c, "rb+");
-            if (pageFile == nullptr) {
+        if (access(fileName_c, F_OK) != 0) {
+            // file does not exist
+            return -1;
+        }
+        // Share the file with handles already opened on it, the backend of the first handle wins
+        std::lock_guard<std::mutex> guard(registryLatch);
+        auto it = openFiles.find(fileName);
+        if (it == openFiles.end()) {
+            int fd = ::open(fileName_c, O_RDWR);
+            if (fd < 0) {
                 return -1;
             }
-            fileHandle.updateOpenedFile(pageFile);
+            PagedFile *pagedFile;
+            if (backend == MMAP_IO) {
+                pagedFile = new MappedPagedFile(fileName, fd, nextFileId++);
+            } else {
+                pagedFile = new PagedFile(fileName, fd, nextFileId++);
+            }
+            if (pagedFile->readHeader() || pagedFile->open()) {
+                close(fd);
+                delete pagedFile;
+                return -1;
+            }
+            it = openFiles.emplace(fileName, pagedFile).first;
+        }
+        it->second->refCount++;
+        fileHandle.updateOpenedFile(it->second);
+        return 0;
+    }
+
+    RC PagedFileManager::closeFile(FileHandle &fileHandle) {
+        PagedFile *pagedFile = fileHandle.file;
+        if (pagedFile == nullptr) {
+            // the file is not opened
+            return -1;
+        }
+        fileHandle.file = nullptr;
+        std::lock_guard<std::mutex> guard(registryLatch);
+        if (!pagedFile->destroyed) {
+            pagedFile->writeHeader();
+        }
+        if (--pagedFile->refCount > 0) {
+            return 0;
+        }
+
+        // Last handle on the file: write back its pages and release the descriptor
+        readAheadQueue.cancel(pagedFile);
+        if (!pagedFile->destroyed) {
+            pagedFile->flush();
+            openFiles.erase(pagedFile->fileName);
+        }
+        pagedFile->discard();
+        close(pagedFile->fd);
+        delete pagedFile;
+        return 0;
+    }
+
+    BufferPool &PagedFileManager::getBufferPool() {
+        return bufferPool;
+    }
+
+    RC PagedFileManager::configureBufferPool(size_t budget, ReplacementPolicyType policyType) {
+        return bufferPool.configure(budget, policyType);
+    }
+
+    RC PagedFileManager::configureReadAhead(ReadAheadMode mode, unsigned window) {
+        readAheadMode = mode;
+        readAheadWindow = window;
+        return 0;
+    }
+
+    unsigned PagedFileManager::getReadAheadWindow() {
+        if (readAheadMode == NO_READ_AHEAD) {
+            return 0;
+        }
+        return std::min((unsigned) readAheadWindow, bufferPool.getNumberOfFrames() / 4);
+    }
+
+    void PagedFileManager::readAhead(PagedFile *file, PageNum pageNum, unsigned numPages) {
+        if (readAheadMode == THREAD_READ_AHEAD) {
+            readAheadQueue.push(file, pageNum, numPages);
+        } else if (readAheadMode == ADVISE_READ_AHEAD) {
+            file->advise(pageNum, numPages);
+        }
+    }
+
+    RC PagedFileManager::checkpoint() {
+        if (bufferPool.flushAll()) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> guard(registryLatch);
+        for (auto &openFile : openFiles) {
+            if (openFile.second->flush() || openFile.second->writeHeader()) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    PagedFile::PagedFile(const std::string &fileName, int fd, unsigned fileId)
+            : fileName(fileName), fd(fd), fileId(fileId), refCount(0), destroyed(false), numberOfPages(0),
+              readPageCounter(0), writePageCounter(0), appendPageCounter(0), headerDirty(false) {}
+
+    RC PagedFile::open() {
+        return 0;
+    }
+
+    RC PagedFile::pin(PageNum pageNum, char *&data) {
+        return PagedFileManager::instance().getBufferPool().pinPage(this, pageNum, data);
+    }
+
+    RC PagedFile::write(PageNum pageNum, const void *data) {
+        return PagedFileManager::instance().getBufferPool().writePage(this, pageNum, data);
+    }
+
+    RC PagedFile::read(PageNum pageNum, unsigned numPages, void *data) {
+        return PagedFileManager::instance().getBufferPool().readPages(this, pageNum, numPages, data);
+    }
+
+    RC PagedFile::pinRange(PageNum pageNum, unsigned numPages, char **data) {
+        return PagedFileManager::instance().getBufferPool().pinPages(this, pageNum, numPages, data);
+    }
+
+    RC PagedFile::unpin(PageNum pageNum, bool dirty) {
+        return PagedFileManager::instance().getBufferPool().unpinPage(this, pageNum, dirty);
+    }
+
+    RC PagedFile::appendRange(PageNum pageNum, unsigned numPages, const void *data) {
+        // One write per group, the first page of a group is preceded by its empty free space map page
+        for (unsigned done = 0; done < numPages;) {
+            if ((pageNum + done) % FSM_GROUP_SIZE == 0) {
+                const std::vector<char> spaceMapPage(PAGE_SIZE, 0);
+                if (pwrite(fd, spaceMapPage.data(), PAGE_SIZE,
+                           (off_t) spaceMapOffset((pageNum + done) / FSM_GROUP_SIZE)) != PAGE_SIZE) {
+                    return -1;
+                }
+            }
+            const unsigned groupLeft = FSM_GROUP_SIZE - (pageNum + done) % FSM_GROUP_SIZE;
+            const unsigned count = std::min(numPages - done, groupLeft);
+            // Appends go straight to disk so the file grows immediately
+            const size_t size = (size_t) count * PAGE_SIZE;
+            if (pwrite(fd, (const char *) data + (size_t) done * PAGE_SIZE, size,
+                       (off_t) blockOffset(pageNum + done)) != (ssize_t) size) {
+                return -1;
+            }
+            done += count;
+        }
+        return 0;
+    }
+
+    RC PagedFile::truncateRange(PageNum pageNum) {
+        // Cached pages past the end must never be written back
+        if (PagedFileManager::instance().getBufferPool().discardFile(this, pageNum)) {
+            return -1;
+        }
+        // An empty file keeps its hidden page, the free space map page of a group goes with its first page
+        const uint64_t fileSize = pageNum == 0 ? PAGE_SIZE : blockOffset(pageNum - 1) + PAGE_SIZE;
+        return ftruncate(fd, (off_t) fileSize) == 0 ? 0 : -1;
+    }
+
+    RC PagedFile::flush() {
+        return PagedFileManager::instance().getBufferPool().flushFile(this);
+    }
+
+    RC PagedFile::discard() {
+        return PagedFileManager::instance().getBufferPool().discardFile(this);
+    }
+
+    RC PagedFile::prefetch(PageNum pageNum, unsigned numPages) {
+        return PagedFileManager::instance().getBufferPool().prefetchPages(this, pageNum, numPages);
+    }
+
+    RC PagedFile::advise(PageNum pageNum, unsigned numPages) {
+        // The range may span free space map pages, reading them as well does no harm
+        const uint64_t offset = blockOffset(pageNum);
+        const uint64_t length = blockOffset(pageNum + numPages - 1) + PAGE_SIZE - offset;
+        return posix_fadvise(fd, (off_t) offset, (off_t) length, POSIX_FADV_WILLNEED) == 0 ? 0 : -1;
+    }
+
+    uint64_t PagedFile::blockOffset(PageNum pageNum) {
+        // Skip the hidden page and the free space map pages up to and including the page's group
+        return ((uint64_t) pageNum + pageNum / FSM_GROUP_SIZE + 2) * PAGE_SIZE;
+    }
+
+    uint64_t PagedFile::spaceMapOffset(unsigned group) {
+        return ((uint64_t) group * (FSM_GROUP_SIZE + 1) + 1) * PAGE_SIZE;
+    }
+
+    RC PagedFile::readBlock(PageNum pageNum, void *data) {
+        ssize_t result = pread(fd, data, PAGE_SIZE, (off_t) blockOffset(pageNum));
+        return result == PAGE_SIZE ? 0 : -1;
+    }
+
+    RC PagedFile::readBlocks(PageNum pageNum, unsigned numPages, char *const *data) {
+        std::vector<struct iovec> buffers(numPages);
+        for (unsigned i = 0; i < numPages; i++) {
+            buffers[i].iov_base = data[i];
+            buffers[i].iov_len = PAGE_SIZE;
+        }
+        // One system call per IOV_MAX pages, a free space map page also breaks the run
+        for (unsigned done = 0; done < numPages;) {
+            const unsigned groupLeft = FSM_GROUP_SIZE - (pageNum + done) % FSM_GROUP_SIZE;
+            const unsigned count = std::min(std::min(numPages - done, (unsigned) IOV_MAX), groupLeft);
+            ssize_t result = preadv(fd, buffers.data() + done, (int) count, (off_t) blockOffset(pageNum + done));
+            if (result != (ssize_t) count * PAGE_SIZE) {
+                return -1;
+            }
+            done += count;
+        }
+        return 0;
+    }
+
+    RC PagedFile::writeBlock(PageNum pageNum, const void *data) {
+        ssize_t result = pwrite(fd, data, PAGE_SIZE, (off_t) blockOffset(pageNum));
+        return result == PAGE_SIZE ? 0 : -1;
+    }
+
+    RC PagedFile::readHeader() {
+        unsigned header[APPEND_PAGE_CNT_POS + 1];
+        if (pread(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+            return -1;
+        }
+        numberOfPages = header[NUM_PAGE_POS];
+        readPageCounter = header[READ_PAGE_CNT_POS];
+        writePageCounter = header[WRITE_PAGE_CNT_POS];
+        appendPageCounter = header[APPEND_PAGE_CNT_POS];
+        headerDirty = false;
+        return 0;
+    }
+
+    RC PagedFile::writeHeader() {
+        if (spaceMap.save(*this)) {
+            return -1;
+        }
+        if (!headerDirty.exchange(false)) {
+            return 0;
+        }
+        unsigned header[APPEND_PAGE_CNT_POS + 1];
+        header[NUM_PAGE_POS] = numberOfPages;
+        header[READ_PAGE_CNT_POS] = readPageCounter;
+        header[WRITE_PAGE_CNT_POS] = writePageCounter;
+        header[APPEND_PAGE_CNT_POS] = appendPageCounter;
+        if (pwrite(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+            headerDirty = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    MappedPagedFile::MappedPagedFile(const std::string &fileName, int fd, unsigned fileId)
+            : PagedFile(fileName, fd, fileId), mapping(nullptr), mappingSize(0) {}
+
+    MappedPagedFile::~MappedPagedFile() {
+        if (mapping != nullptr) {
+            munmap(mapping, mappingSize);
+        }
+        for (auto &retired : retiredMappings) {
+            munmap(retired.first, retired.second);
+        }
+    }
+
+    RC MappedPagedFile::open() {
+        struct stat fileStat{};
+        if (fstat(fd, &fileStat) != 0) {
+            return -1;
+        }
+        return growMapping(fileStat.st_size);
+    }
+
+    RC MappedPagedFile::growMapping(size_t size) {
+        // Map whole chunks; the part past the end of the file is never touched until pages are appended
+        size_t newSize = (size / MMAP_CHUNK_SIZE + 1) * MMAP_CHUNK_SIZE;
+        if (newSize < 2 * mappingSize) {
+            newSize = 2 * mappingSize;
+        }
+        void *newMapping = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (newMapping == MAP_FAILED) {
+            return -1;
+        }
+        if (mapping != nullptr) {
+            retiredMappings.emplace_back(mapping, mappingSize);
+        }
+        mapping = (char *) newMapping;
+        mappingSize = newSize;
+        return 0;
+    }
+
+    RC MappedPagedFile::pin(PageNum pageNum, char *&data) {
+        data = mapping + blockOffset(pageNum);
+        return 0;
+    }
+
+    RC MappedPagedFile::write(PageNum pageNum, const void *data) {
+        memcpy(mapping + blockOffset(pageNum), data, PAGE_SIZE);
+        return 0;
+    }
+
+    RC MappedPagedFile::read(PageNum pageNum, unsigned numPages, void *data) {
+        memcpy(data, mapping + blockOffset(pageNum), (size_t) numPages * PAGE_SIZE);
+        return 0;
+    }
+
+    RC MappedPagedFile::pinRange(PageNum pageNum, unsigned numPages, char **data) {
+        char *base = mapping;
+        for (unsigned i = 0; i < numPages; i++) {
+            data[i] = base + blockOffset(pageNum + i);
+        }
+        return 0;
+    }
+
+    RC MappedPagedFile::unpin(PageNum, bool) {
+        return 0;
+    }
+
+    RC MappedPagedFile::appendRange(PageNum pageNum, unsigned numPages, const void *data) {
+        const size_t fileSize = blockOffset(pageNum + numPages - 1) + PAGE_SIZE;
+        if (fileSize > mappingSize && growMapping(fileSize)) {
+            return -1;
+        }
+        // Extend the file first, the new pages are then written through the mapping.
+        // Free space map pages in between are zero-filled by the extension.
+        if (ftruncate(fd, (off_t) fileSize) != 0) {
+            return -1;
+        }
+        for (unsigned i = 0; i < numPages; i++) {
+            memcpy(mapping + blockOffset(pageNum + i), (const char *) data + (size_t) i * PAGE_SIZE, PAGE_SIZE);
+        }
+        return 0;
+    }
+
+    RC MappedPagedFile::truncateRange(PageNum pageNum) {
+        // The mapping is kept, pages past the end are not touched until appended again
+        const uint64_t fileSize = pageNum == 0 ? PAGE_SIZE : blockOffset(pageNum - 1) + PAGE_SIZE;
+        return ftruncate(fd, (off_t) fileSize) == 0 ? 0 : -1;
+    }
+
+    RC MappedPagedFile::flush() {
+        // Dirty pages already live in the page cache, only schedule their write-back
+        const size_t fileSize = numberOfPages == 0 ? PAGE_SIZE : blockOffset(numberOfPages - 1) + PAGE_SIZE;
+        return msync(mapping, fileSize, MS_ASYNC) == 0 ? 0 : -1;
+    }
+
+    RC MappedPagedFile::discard() {
+        return 0;
+    }
+
+    RC MappedPagedFile::prefetch(PageNum pageNum, unsigned numPages) {
+        // Mapped pages bypass the buffer pool, the page cache is the only place to read them into
+        return advise(pageNum, numPages);
+    }
+
+    RC MappedPagedFile::advise(PageNum pageNum, unsigned numPages) {
+        const uint64_t offset = blockOffset(pageNum);
+        const uint64_t length = blockOffset(pageNum + numPages - 1) + PAGE_SIZE - offset;
+        return madvise(mapping + offset, length, MADV_WILLNEED) == 0 ? 0 : -1;
+    }
+
+    ReadAheadQueue::ReadAheadQueue(): serving(nullptr), stopping(false) {}
+
+    ReadAheadQueue::~ReadAheadQueue() {
+        {
+            std::lock_guard<std::mutex> guard(latch);
+            stopping = true;
+            pending.notify_all();
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void ReadAheadQueue::push(PagedFile *file, PageNum pageNum, unsigned numPages) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (stopping || requests.size() >= READ_AHEAD_QUEUE_SIZE) {
+            return;
+        }
+        if (!thread.joinable()) {
+            thread = std::thread(&ReadAheadQueue::run, this);
+        }
+        requests.push_back(Request{file, pageNum, numPages});
+        pending.notify_one();
+    }
+
+    void ReadAheadQueue::cancel(PagedFile *file) {
+        std::unique_lock<std::mutex> lock(latch);
+        requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                      [&](const Request &request) { return request.file == file; }),
+                       requests.end());
+        served.wait(lock, [&] { return serving != file; });
+    }
+
+    void ReadAheadQueue::run() {
+        std::unique_lock<std::mutex> lock(latch);
+        while (true) {
+            pending.wait(lock, [&] { return stopping || !requests.empty(); });
+            if (stopping) {
+                return;
+            }
+            const Request request = requests.front();
+            requests.pop_front();
+            // The file stays open while it is being served, cancel() waits for it
+            serving = request.file;
+            lock.unlock();
+            request.file->prefetch(request.pageNum, request.numPages);
+            lock.lock();
+            serving = nullptr;
+            served.notify_all();
+        }
+    }
+
+    FreeSpaceMap::FreeSpaceMap(): loaded(false) {}
+
+    RC FreeSpaceMap::load(PagedFile &file) {
+        const unsigned numGroups = (file.numberOfPages + FSM_GROUP_SIZE - 1) / FSM_GROUP_SIZE;
+        groups.assign(numGroups, std::vector<unsigned char>(PAGE_SIZE, 0));
+        dirtyGroups.assign(numGroups, false);
+        for (unsigned group = 0; group < numGroups; group++) {
+            if (pread(file.fd, groups[group].data(), PAGE_SIZE, (off_t) PagedFile::spaceMapOffset(group))
+                != PAGE_SIZE) {
+                return -1;
+            }
+        }
+        loaded = true;
+        return 0;
+    }
+
+    RC FreeSpaceMap::update(PagedFile &file, PageNum pageNum, unsigned freeSpace) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (!loaded && load(file)) {
+            return -1;
+        }
+        const unsigned group = pageNum / FSM_GROUP_SIZE;
+        if (group >= groups.size()) {
+            groups.resize(group + 1, std::vector<unsigned char>(PAGE_SIZE, 0));
+            dirtyGroups.resize(group + 1, false);
+        }
+        std::vector<unsigned char> &tree = groups[group];
+        unsigned node = FSM_GROUP_SIZE + pageNum % FSM_GROUP_SIZE;
+        const unsigned category = std::min(freeSpace / FSM_CATEGORY_SIZE, 255u);
+        if (tree[node] == category) {
+            return 0;
+        }
+        tree[node] = category;
+        // Propagate the new maximum towards the root
+        for (node /= 2; node >= 1; node /= 2) {
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+        }
+        dirtyGroups[group] = true;
+        return 0;
+    }
+
+    RC FreeSpaceMap::search(PagedFile &file, unsigned freeSpace, PageNum &pageNum) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (!loaded && load(file)) {
+            return -1;
+        }
+        // Round up so that any page of the category is guaranteed to fit
+        const unsigned category = std::max((freeSpace + FSM_CATEGORY_SIZE - 1) / FSM_CATEGORY_SIZE, 1u);
+        if (category > 255) {
+            return -1;
+        }
+        for (unsigned group = 0; group < groups.size(); group++) {
+            const std::vector<unsigned char> &tree = groups[group];
+            if (tree[1] < category) {
+                continue;
+            }
+            unsigned node = 1;
+            while (node < FSM_GROUP_SIZE) {
+                node = tree[2 * node] >= category ? 2 * node : 2 * node + 1;
+            }
+            pageNum = group * FSM_GROUP_SIZE + (node - FSM_GROUP_SIZE);
             return 0;
         }
-        // file does not exist
         return -1;
     }
 
-    RC PagedFileManager::closeFile(FileHandle &fileHandle) {
-        if (fileHandle.openedFile != nullptr) {
-            fclose(fileHandle.openedFile);
-            fileHandle.openedFile = nullptr;
+    RC FreeSpaceMap::save(PagedFile &file) {
+        std::lock_guard<std::mutex> guard(latch);
+        for (unsigned group = 0; group < groups.size(); group++) {
+            if (!dirtyGroups[group]) {
+                continue;
+            }
+            if (pwrite(file.fd, groups[group].data(), PAGE_SIZE, (off_t) PagedFile::spaceMapOffset(group))
+                != PAGE_SIZE) {
+                return -1;
+            }
+            dirtyGroups[group] = false;
+        }
+        return 0;
+    }
+
+    RC FreeSpaceMap::truncate(PagedFile &file, unsigned numberOfPages) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (!loaded && load(file)) {
+            return -1;
+        }
+        const unsigned numGroups = (numberOfPages + FSM_GROUP_SIZE - 1) / FSM_GROUP_SIZE;
+        if (numGroups < groups.size()) {
+            groups.resize(numGroups);
+            dirtyGroups.resize(numGroups);
+        }
+        if (numberOfPages % FSM_GROUP_SIZE == 0 || numGroups > groups.size()) {
+            return 0;
+        }
+        // Clear the leaves past the end in the last group and rebuild its tree
+        std::vector<unsigned char> &tree = groups[numGroups - 1];
+        std::fill(tree.begin() + FSM_GROUP_SIZE + numberOfPages % FSM_GROUP_SIZE, tree.end(), 0);
+        for (unsigned node = FSM_GROUP_SIZE - 1; node >= 1; node--) {
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+        }
+        dirtyGroups[numGroups - 1] = true;
+        return 0;
+    }
+
+    ClockPolicy::ClockPolicy(unsigned numFrames): referenced(numFrames, false), hand(0) {}
+
+    void ClockPolicy::recordAccess(unsigned frameId) {
+        referenced[frameId] = true;
+    }
+
+    void ClockPolicy::remove(unsigned frameId) {
+        referenced[frameId] = false;
+    }
+
+    RC ClockPolicy::pickVictim(const std::vector<Frame> &frames, unsigned &frameId) {
+        // Two sweeps clear every reference bit, so a third finding nothing means everything is pinned
+        const unsigned numFrames = frames.size();
+        for (unsigned i = 0; i < 3 * numFrames; i++) {
+            unsigned current = hand;
+            hand = (hand + 1) % numFrames;
+            if (frames[current].pinCount > 0) {
+                continue;
+            }
+            if (referenced[current]) {
+                referenced[current] = false;
+                continue;
+            }
+            frameId = current;
             return 0;
         }
-        // the file is not opened
         return -1;
+    }
+
+    LRUKPolicy::LRUKPolicy(unsigned numFrames, unsigned k): k(k), timestamp(0), history(numFrames) {}
 
+    void LRUKPolicy::recordAccess(unsigned frameId) {
+        std::vector<uint64_t> &references = history[frameId];
+        if (references.size() == k) {
+            references.erase(references.begin());
+        }
+        references.push_back(++timestamp);
     }
 
-    FileHandle::FileHandle(): openedFile(nullptr), readPageCounter(0), writePageCounter(0), appendPageCounter(0) {}
-    FileHandle::~FileHandle() = default;
+    void LRUKPolicy::remove(unsigned frameId) {
+        history[frameId].clear();
+    }
 
-    RC FileHandle::readPage(PageNum pageNum, void *data) {
-        if (pageNum < getNumberOfPages()) {
-            // Read pageNum + 1 to skip the hidden page
-            fseek(openedFile, (pageNum + 1) * PAGE_SIZE, SEEK_SET);
-            size_t result = fread(data, sizeof(char), PAGE_SIZE, openedFile);
-            if (result == PAGE_SIZE) {
-                //update readPageCounter
-                readPageCounter++;
-                setReadPageCnt(readPageCounter);
+    RC LRUKPolicy::pickVictim(const std::vector<Frame> &frames, unsigned &frameId) {
+        bool found = false;
+        bool victimInfinite = false;
+        uint64_t victimTime = std::numeric_limits<uint64_t>::max();
+
+        for (unsigned i = 0; i < frames.size(); i++) {
+            if (frames[i].pinCount > 0) {
+                continue;
+            }
+            const std::vector<uint64_t> &references = history[i];
+            const bool infinite = references.size() < k;
+            // Infinite distance frames are compared by their oldest reference, others by the k-th most recent
+            const uint64_t time = references.empty() ? 0 : references.front();
+            if (!found || (infinite && !victimInfinite) || (infinite == victimInfinite && time < victimTime)) {
+                found = true;
+                victimInfinite = infinite;
+                victimTime = time;
+                frameId = i;
+            }
+        }
+        return found ? 0 : -1;
+    }
+
+    BufferPool::BufferPool(size_t budget, ReplacementPolicyType policyType): policy(nullptr) {
+        allocateFrames(budget, policyType);
+    }
+
+    BufferPool::~BufferPool() {
+        delete policy;
+    }
+
+    void BufferPool::allocateFrames(size_t budget, ReplacementPolicyType policyType) {
+        unsigned numFrames = budget / PAGE_SIZE;
+        if (numFrames == 0) {
+            numFrames = 1;
+        }
+        memory.assign((size_t) numFrames * PAGE_SIZE, 0);
+        frames.assign(numFrames, Frame{nullptr, 0, 0, 0, false, false, nullptr});
+        freeFrames.clear();
+        pageTable.clear();
+        for (unsigned i = 0; i < numFrames; i++) {
+            frames[i].data = memory.data() + (size_t) i * PAGE_SIZE;
+            freeFrames.push_back(numFrames - 1 - i);
+        }
+
+        delete policy;
+        if (policyType == LRU_K_POLICY) {
+            policy = new LRUKPolicy(numFrames, LRU_K);
+        } else {
+            policy = new ClockPolicy(numFrames);
+        }
+    }
+
+    RC BufferPool::configure(size_t budget, ReplacementPolicyType policyType) {
+        std::lock_guard<std::mutex> guard(latch);
+        for (const Frame &frame : frames) {
+            if (frame.pinCount > 0) {
+                return -1;
+            }
+        }
+        if (writeBackAll()) {
+            return -1;
+        }
+        allocateFrames(budget, policyType);
+        return 0;
+    }
+
+    unsigned BufferPool::getNumberOfFrames() const {
+        return frames.size();
+    }
+
+    uint64_t BufferPool::pageKey(const PagedFile *file, PageNum pageNum) {
+        return ((uint64_t) file->fileId << 32) | pageNum;
+    }
+
+    RC BufferPool::evictFrame(std::unique_lock<std::mutex> &lock, unsigned frameId) {
+        Frame &frame = frames[frameId];
+        if (frame.dirty && !frame.file->destroyed) {
+            // The frame is pinned and marked as in flight, so the latch can be dropped during the write
+            frame.pinCount = 1;
+            frame.loading = true;
+            lock.unlock();
+            RC rc = frame.file->writeBlock(frame.pageNum, frame.data);
+            lock.lock();
+            frame.pinCount = 0;
+            frame.loading = false;
+            loaded.notify_all();
+            if (rc) {
+                return -1;
+            }
+        }
+        pageTable.erase(pageKey(frame.file, frame.pageNum));
+        policy->remove(frameId);
+        frame.file = nullptr;
+        frame.dirty = false;
+        return 0;
+    }
+
+    RC BufferPool::reserveFrame(std::unique_lock<std::mutex> &lock, unsigned &frameId) {
+        if (!freeFrames.empty()) {
+            frameId = freeFrames.back();
+            freeFrames.pop_back();
+            return 0;
+        }
+        if (policy->pickVictim(frames, frameId) || evictFrame(lock, frameId)) {
+            return -1; // every frame is pinned
+        }
+        return 0;
+    }
+
+    void BufferPool::releaseFrame(unsigned frameId) {
+        Frame &frame = frames[frameId];
+        pageTable.erase(pageKey(frame.file, frame.pageNum));
+        policy->remove(frameId);
+        frame.file = nullptr;
+        frame.dirty = false;
+        frame.loading = false;
+        frame.pinCount = 0;
+        frame.copying = 0;
+        freeFrames.push_back(frameId);
+    }
+
+    RC BufferPool::pinPage(PagedFile *file, PageNum pageNum, char *&data) {
+        return pinFrame(file, pageNum, data, false);
+    }
+
+    RC BufferPool::pinFrame(PagedFile *file, PageNum pageNum, char *&data, bool copying) {
+        const uint64_t key = pageKey(file, pageNum);
+        std::unique_lock<std::mutex> lock(latch);
+        unsigned frameId;
+        while (true) {
+            auto it = pageTable.find(key);
+            if (it != pageTable.end() && frames[it->second].loading) {
+                // Another thread is bringing the page in or writing it back
+                loaded.wait(lock);
+                continue;
+            }
+            if (it != pageTable.end()) {
+                Frame &frame = frames[it->second];
+                frame.pinCount++;
+                frame.copying += copying;
+                policy->recordAccess(it->second);
+                data = frame.data;
                 return 0;
             }
+            if (reserveFrame(lock, frameId)) {
+                return -1;
+            }
+            // Writing back the victim drops the latch, someone may have brought the page in meanwhile
+            if (pageTable.find(key) == pageTable.end()) {
+                break;
+            }
+            freeFrames.push_back(frameId);
         }
-        // page does not exist
-        return -1;
+        Frame &frame = frames[frameId];
+        frame.file = file;
+        frame.pageNum = pageNum;
+        frame.pinCount = 1;
+        frame.copying = copying;
+        frame.dirty = false;
+        frame.loading = true;
+        pageTable[key] = frameId;
+        policy->recordAccess(frameId);
+
+        // The frame is pinned and marked as loading, so the latch can be dropped during the read
+        lock.unlock();
+        RC rc = file->readBlock(pageNum, frame.data);
+        lock.lock();
+        frame.loading = false;
+        loaded.notify_all();
+        if (rc) {
+            releaseFrame(frameId);
+            return -1;
+        }
+        data = frame.data;
+        return 0;
+    }
+
+    RC BufferPool::writePage(PagedFile *file, PageNum pageNum, const void *data) {
+        const uint64_t key = pageKey(file, pageNum);
+        std::unique_lock<std::mutex> lock(latch);
+        unsigned frameId;
+        while (true) {
+            auto it = pageTable.find(key);
+            if (it != pageTable.end() && frames[it->second].loading) {
+                // A read would overwrite the new data when it completes
+                loaded.wait(lock);
+                continue;
+            }
+            if (it != pageTable.end() && frames[it->second].copying > 0) {
+                // Readers are copying the page out, it must not change under them
+                copied.wait(lock);
+                continue;
+            }
+            if (it != pageTable.end()) {
+                frameId = it->second;
+                break;
+            }
+            if (reserveFrame(lock, frameId)) {
+                return -1;
+            }
+            if (pageTable.find(key) != pageTable.end()) {
+                // Brought in while the victim was written back
+                freeFrames.push_back(frameId);
+                continue;
+            }
+            Frame &frame = frames[frameId];
+            frame.file = file;
+            frame.pageNum = pageNum;
+            frame.pinCount = 0;
+            frame.copying = 0;
+            frame.loading = false;
+            pageTable[key] = frameId;
+            break;
+        }
+        Frame &frame = frames[frameId];
+        memcpy(frame.data, data, PAGE_SIZE);
+        frame.dirty = true;
+        policy->recordAccess(frameId);
+        return 0;
+    }
+
+    RC BufferPool::pinPages(PagedFile *file, PageNum pageNum, unsigned numPages, char **data) {
+        return pinFrames(file, pageNum, numPages, data, false);
+    }
+
+    RC BufferPool::pinFrames(PagedFile *file, PageNum pageNum, unsigned numPages, char **data, bool copying) {
+        std::unique_lock<std::mutex> lock(latch);
+        std::vector<unsigned> frameIds(numPages);
+        std::vector<bool> missing(numPages, false);
+        // Unpin the first pages of the range, or drop them if they were to be read
+        auto giveBack = [&](unsigned taken) {
+            for (unsigned j = 0; j < taken; j++) {
+                if (missing[j]) {
+                    releaseFrame(frameIds[j]);
+                    missing[j] = false;
+                } else {
+                    frames[frameIds[j]].pinCount--;
+                    frames[frameIds[j]].copying -= copying;
+                }
+            }
+            loaded.notify_all();
+            copied.notify_all();
+        };
+
+        bool pinned = false;
+        while (!pinned) {
+            for (unsigned i = 0; i < numPages;) {
+                // Start over once no page of the range is being read or written back by someone else
+                auto it = pageTable.find(pageKey(file, pageNum + i));
+                if (it != pageTable.end() && frames[it->second].loading) {
+                    loaded.wait(lock);
+                    i = 0;
+                    continue;
+                }
+                i++;
+            }
+
+            pinned = true;
+            for (unsigned i = 0; i < numPages && pinned; i++) {
+                const uint64_t key = pageKey(file, pageNum + i);
+                auto it = pageTable.find(key);
+                if (it != pageTable.end()) {
+                    frameIds[i] = it->second;
+                    frames[it->second].pinCount++;
+                    frames[it->second].copying += copying;
+                    policy->recordAccess(it->second);
+                    continue;
+                }
+                if (reserveFrame(lock, frameIds[i])) {
+                    // The range does not fit in the pool, give back what was taken
+                    giveBack(i);
+                    return -1;
+                }
+                if (pageTable.find(key) != pageTable.end()) {
+                    // Brought in while the victim was written back, and maybe still loading
+                    freeFrames.push_back(frameIds[i]);
+                    giveBack(i);
+                    pinned = false;
+                    continue;
+                }
+                Frame &frame = frames[frameIds[i]];
+                frame.file = file;
+                frame.pageNum = pageNum + i;
+                frame.pinCount = 1;
+                frame.copying = copying;
+                frame.dirty = false;
+                frame.loading = true;
+                pageTable[key] = frameIds[i];
+                policy->recordAccess(frameIds[i]);
+                missing[i] = true;
+            }
+        }
+
+        // Read every run of missing pages straight into its frames
+        lock.unlock();
+        RC rc = 0;
+        std::vector<char *> buffers;
+        for (unsigned i = 0; i < numPages && rc == 0;) {
+            if (!missing[i]) {
+                i++;
+                continue;
+            }
+            unsigned runStart = i;
+            buffers.clear();
+            while (i < numPages && missing[i]) {
+                buffers.push_back(frames[frameIds[i]].data);
+                i++;
+            }
+            rc = file->readBlocks(pageNum + runStart, buffers.size(), buffers.data());
+        }
+        lock.lock();
+
+        for (unsigned i = 0; i < numPages; i++) {
+            if (missing[i]) {
+                frames[frameIds[i]].loading = false;
+            }
+        }
+        loaded.notify_all();
+        for (unsigned i = 0; i < numPages; i++) {
+            if (rc == 0) {
+                data[i] = frames[frameIds[i]].data;
+            } else if (missing[i]) {
+                releaseFrame(frameIds[i]);
+            } else {
+                frames[frameIds[i]].pinCount--;
+                frames[frameIds[i]].copying -= copying;
+            }
+        }
+        if (rc) {
+            copied.notify_all();
+        }
+        return rc;
+    }
+
+    RC BufferPool::readPages(PagedFile *file, PageNum pageNum, unsigned numPages, void *data) {
+        if (numPages == 1) {
+            char *page;
+            if (pinFrame(file, pageNum, page, true)) {
+                return -1;
+            }
+            memcpy(data, page, PAGE_SIZE);
+        } else {
+            std::vector<char *> pages(numPages);
+            if (pinFrames(file, pageNum, numPages, pages.data(), true)) {
+                return -1;
+            }
+            for (unsigned i = 0; i < numPages; i++) {
+                memcpy((char *) data + (size_t) i * PAGE_SIZE, pages[i], PAGE_SIZE);
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(latch);
+        for (unsigned i = 0; i < numPages; i++) {
+            auto it = pageTable.find(pageKey(file, pageNum + i));
+            if (it != pageTable.end()) {
+                frames[it->second].pinCount--;
+                frames[it->second].copying--;
+            }
+        }
+        copied.notify_all();
+        return 0;
+    }
+
+    RC BufferPool::prefetchPages(PagedFile *file, PageNum pageNum, unsigned numPages) {
+        std::unique_lock<std::mutex> lock(latch);
+        // Frames of the missing pages are pinned while loading, so neither eviction nor configure() takes them
+        std::vector<unsigned> frameIds;
+        for (unsigned i = 0; i < numPages; i++) {
+            const uint64_t key = pageKey(file, pageNum + i);
+            if (pageTable.find(key) != pageTable.end()) {
+                continue;
+            }
+            unsigned frameId;
+            if (reserveFrame(lock, frameId)) {
+                break;
+            }
+            if (pageTable.find(key) != pageTable.end()) {
+                // Brought in while the victim was written back
+                freeFrames.push_back(frameId);
+                continue;
+            }
+            Frame &frame = frames[frameId];
+            frame.file = file;
+            frame.pageNum = pageNum + i;
+            frame.pinCount = 1;
+            frame.dirty = false;
+            frame.loading = true;
+            pageTable[key] = frameId;
+            policy->recordAccess(frameId);
+            frameIds.push_back(frameId);
+        }
+
+        // Read every run of consecutive missing pages with one vectored read
+        lock.unlock();
+        std::vector<RC> results(frameIds.size(), 0);
+        std::vector<char *> buffers;
+        for (unsigned i = 0; i < frameIds.size();) {
+            const unsigned runStart = i;
+            buffers.clear();
+            do {
+                buffers.push_back(frames[frameIds[i]].data);
+                i++;
+            } while (i < frameIds.size() && frames[frameIds[i]].pageNum == frames[frameIds[i - 1]].pageNum + 1);
+            const RC rc = file->readBlocks(frames[frameIds[runStart]].pageNum, buffers.size(), buffers.data());
+            std::fill(results.begin() + runStart, results.begin() + i, rc);
+        }
+        lock.lock();
+
+        RC rc = 0;
+        for (unsigned i = 0; i < frameIds.size(); i++) {
+            Frame &frame = frames[frameIds[i]];
+            frame.loading = false;
+            frame.pinCount = 0;
+            if (results[i]) {
+                releaseFrame(frameIds[i]);
+                rc = -1;
+            }
+        }
+        loaded.notify_all();
+        return rc;
+    }
+
+    RC BufferPool::unpinPage(PagedFile *file, PageNum pageNum, bool dirty) {
+        std::lock_guard<std::mutex> guard(latch);
+        auto it = pageTable.find(pageKey(file, pageNum));
+        if (it == pageTable.end()) {
+            return -1;
+        }
+        Frame &frame = frames[it->second];
+        if (frame.pinCount == 0) {
+            return -1;
+        }
+        frame.pinCount--;
+        frame.dirty = frame.dirty || dirty;
+        return 0;
+    }
+
+    RC BufferPool::flushFile(PagedFile *file) {
+        std::lock_guard<std::mutex> guard(latch);
+        for (Frame &frame : frames) {
+            if (frame.file == file && frame.dirty) {
+                if (file->writeBlock(frame.pageNum, frame.data)) {
+                    return -1;
+                }
+                frame.dirty = false;
+            }
+        }
+        return 0;
+    }
+
+    RC BufferPool::discardFile(PagedFile *file, PageNum from) {
+        std::unique_lock<std::mutex> lock(latch);
+        unsigned i = 0;
+        while (i < frames.size()) {
+            if (frames[i].file == file && frames[i].pageNum >= from && frames[i].loading) {
+                // Let the pending read finish before the frame is reused
+                loaded.wait(lock);
+                i = 0;
+                continue;
+            }
+            if (frames[i].file == file && frames[i].pageNum >= from) {
+                releaseFrame(i);
+            }
+            i++;
+        }
+        return 0;
+    }
+
+    RC BufferPool::flushAll() {
+        std::lock_guard<std::mutex> guard(latch);
+        return writeBackAll();
+    }
+
+    RC BufferPool::writeBackAll() {
+        for (Frame &frame : frames) {
+            if (frame.file != nullptr && frame.dirty && !frame.file->destroyed) {
+                if (frame.file->writeBlock(frame.pageNum, frame.data)) {
+                    return -1;
+                }
+                frame.dirty = false;
+            }
+        }
+        return 0;
+    }
+
+    FileHandle::FileHandle(): file(nullptr), readAheadNext(0), readAheadRun(0), readAheadEnd(0) {}
+    FileHandle::~FileHandle() = default;
+
+    RC FileHandle::readPage(PageNum pageNum, void *data) {
+        if (pageNum >= getNumberOfPages()) {
+            // page does not exist
+            return -1;
+        }
+        readAhead(pageNum);
+        if (file->read(pageNum, 1, data)) {
+            return -1;
+        }
+        //update readPageCounter
+        file->readPageCounter++;
+        file->headerDirty = true;
+        return 0;
+    }
+
+    RC FileHandle::readPages(PageNum pageNum, unsigned numPages, void *data) {
+        if (numPages == 0 || pageNum >= getNumberOfPages() || numPages > getNumberOfPages() - pageNum) {
+            return -1;
+        }
+        if (file->read(pageNum, numPages, data)) {
+            return -1;
+        }
+        //update readPageCounter
+        file->readPageCounter += numPages;
+        file->headerDirty = true;
+        return 0;
     }
 
     RC FileHandle::writePage(PageNum pageNum, const void *data) {
@@ -91,78 +1148,144 @@ namespace PeterDB {
         if (pageNum >= totalPages) {
             return -1;
         }
-        fseek(openedFile, (pageNum + 1) * PAGE_SIZE, SEEK_SET);
-        size_t result = fwrite(data, sizeof(char), PAGE_SIZE, openedFile);
-        fflush(openedFile);
-        if (result == PAGE_SIZE) {
-            //update writePageCounter
-            writePageCounter++;
-            setWritePageCnt(writePageCounter);
-            return 0;
+        // The whole page is overwritten, so there is no need to read it first
+        if (file->write(pageNum, data)) {
+            return -1;
         }
 
-        // page does not exist
-        return -1;
+        //update writePageCounter
+        file->writePageCounter++;
+        file->headerDirty = true;
+        return 0;
     }
 
     RC FileHandle::appendPage(const void *data) {
-        fseek(openedFile, 0, SEEK_END); // write to end of file
-        fwrite(data, sizeof(char), PAGE_SIZE, openedFile);
-        fflush(openedFile);
-        //update appendPageCounter
-        appendPageCounter++;
-        setAppendPageCnt(appendPageCounter);
-        //update the number of pages
-        setNumberOfPages(getNumberOfPages() + 1);
+        return appendPages(1, data);
+    }
+
+    RC FileHandle::appendPages(unsigned numPages, const void *data) {
+        if (numPages == 0) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> guard(file->appendLatch);
+        PageNum pageNum = getNumberOfPages();
+        if (file->appendRange(pageNum, numPages, data)) {
+            return -1;
+        }
+        //update appendPageCounter and the number of pages
+        file->appendPageCounter += numPages;
+        file->numberOfPages = pageNum + numPages;
+        file->headerDirty = true;
         return 0;
     }
 
-    RC FileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount) {
-        readPageCount = readPageCounter;
-        writePageCount = writePageCounter;
-        appendPageCount = appendPageCounter;
+    RC FileHandle::truncate(unsigned numberOfPages) {
+        std::lock_guard<std::mutex> guard(file->appendLatch);
+        if (numberOfPages > getNumberOfPages()) {
+            return -1;
+        }
+        if (numberOfPages == getNumberOfPages()) {
+            return 0;
+        }
+        if (file->spaceMap.truncate(*file, numberOfPages) || file->truncateRange(numberOfPages)) {
+            return -1;
+        }
+        file->numberOfPages = numberOfPages;
+        file->headerDirty = true;
         return 0;
     }
 
-    void FileHandle::updateOpenedFile(FILE * pageFile) {
-        openedFile = pageFile;
-        readPageCounter = getCounterValue(READ_PAGE_CNT_POS);
-        writePageCounter = getCounterValue(WRITE_PAGE_CNT_POS);
-        appendPageCounter = getCounterValue(APPEND_PAGE_CNT_POS);
+    RC FileHandle::pinPage(PageNum pageNum, char *&page) {
+        if (pageNum >= getNumberOfPages()) {
+            return -1;
+        }
+        readAhead(pageNum);
+        if (file->pin(pageNum, page)) {
+            return -1;
+        }
+        //update readPageCounter
+        file->readPageCounter++;
+        file->headerDirty = true;
+        return 0;
     }
 
-    unsigned FileHandle::getCounterValue(int offset) {
-        unsigned counter = 0;
-        fseek(openedFile, offset * sizeof(unsigned), SEEK_SET);
-        fread(&counter, sizeof(unsigned), 1, openedFile);
-        return counter;
+    const char *FileHandle::pinPage(PageNum pageNum) {
+        char *page;
+        if (pinPage(pageNum, page)) {
+            return nullptr;
+        }
+        return page;
     }
 
-    RC FileHandle::setCounterValue(unsigned value, int offset) {
-        fseek(openedFile, offset * sizeof(unsigned), SEEK_SET);
-        fwrite(&value, sizeof(unsigned), 1, openedFile);
-        fflush(openedFile);
+    RC FileHandle::unpinPage(PageNum pageNum, bool dirty) {
+        if (file->unpin(pageNum, dirty)) {
+            return -1;
+        }
+        if (dirty) {
+            //update writePageCounter
+            file->writePageCounter++;
+            file->headerDirty = true;
+        }
         return 0;
     }
 
-    unsigned FileHandle::getNumberOfPages() {
-        return getCounterValue(NUM_PAGE_POS);
+    RC FileHandle::setFreeSpace(PageNum pageNum, unsigned freeSpace) {
+        if (pageNum >= getNumberOfPages()) {
+            return -1;
+        }
+        return file->spaceMap.update(*file, pageNum, freeSpace);
     }
 
-    RC FileHandle::setNumberOfPages(unsigned numOfPages) {
-        return setCounterValue(numOfPages, NUM_PAGE_POS);
+    RC FileHandle::findFreeSpace(unsigned freeSpace, PageNum &pageNum) {
+        return file->spaceMap.search(*file, freeSpace, pageNum);
     }
 
-    RC FileHandle::setReadPageCnt(unsigned readPageCnt) {
-        return setCounterValue(readPageCnt, READ_PAGE_CNT_POS);
+    RC FileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount) {
+        readPageCount = file->readPageCounter;
+        writePageCount = file->writePageCounter;
+        appendPageCount = file->appendPageCounter;
+        return 0;
     }
 
-    RC FileHandle::setWritePageCnt(unsigned writePageCnt) {
-        return setCounterValue(writePageCnt, WRITE_PAGE_CNT_POS);
+    RC FileHandle::sync() {
+        if (file->flush()) {
+            return -1;
+        }
+        return file->writeHeader();
     }
 
-    RC FileHandle::setAppendPageCnt(unsigned appendPageCnt) {
-        return setCounterValue(appendPageCnt, APPEND_PAGE_CNT_POS);
+    void FileHandle::updateOpenedFile(PagedFile *pagedFile) {
+        file = pagedFile;
+        readAheadNext = readAheadRun = readAheadEnd = 0;
+    }
+
+    void FileHandle::readAhead(PageNum pageNum) {
+        if (pageNum != readAheadNext) {
+            readAheadRun = 0;
+            readAheadEnd = 0;
+        } else if (readAheadRun < READ_AHEAD_TRIGGER) {
+            readAheadRun++;
+        }
+        readAheadNext = pageNum + 1;
+        if (readAheadRun < READ_AHEAD_TRIGGER) {
+            return;
+        }
+        PagedFileManager &pfm = PagedFileManager::instance();
+        const unsigned window = pfm.getReadAheadWindow();
+        if (window == 0) {
+            return;
+        }
+        // Keep the window filled in steps of half a window, so requests stay large
+        readAheadEnd = std::max(readAheadEnd, pageNum + 1);
+        const PageNum end = std::min(pageNum + 1 + window, getNumberOfPages());
+        if (readAheadEnd < end && readAheadEnd <= pageNum + window / 2) {
+            pfm.readAhead(file, readAheadEnd, end - readAheadEnd);
+            readAheadEnd = end;
+        }
+    }
+
+    unsigned FileHandle::getNumberOfPages() {
+        return file->numberOfPages;
     }
 
     void FileHandle::createHiddenPage() {
@@ -173,8 +1296,7 @@ namespace PeterDB {
         std::fill(pageInfo.get(), pageInfo.get() + PAGE_SIZE, 0);
 
         //write the hidden page
-        fwrite(pageInfo.get(), sizeof(char), PAGE_SIZE, openedFile);
-        fflush(openedFile);
+        pwrite(file->fd, pageInfo.get(), PAGE_SIZE, 0);
     }
 
-} // namespace PeterDB
\ No newline at end of file
+} // namespace PeterDB
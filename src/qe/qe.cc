@@ -1,102 +1,1845 @@
 #include "src/include/qe.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+
 namespace PeterDB {
-    Filter::Filter(Iterator *input, const Condition &condition) {
+    // Compare two non-null values of a type in the getNextTuple() field format
+    static bool compareValues(AttrType type, const char *lhs, const char *rhs, CompOp op) {
+        int result = 0;
+        switch (type) {
+            case TypeInt: {
+                int left, right;
+                memcpy(&left, lhs, sizeof(int));
+                memcpy(&right, rhs, sizeof(int));
+                result = (left > right) - (left < right);
+                break;
+            }
+            case TypeReal: {
+                float left, right;
+                memcpy(&left, lhs, sizeof(float));
+                memcpy(&right, rhs, sizeof(float));
+                result = (left > right) - (left < right);
+                break;
+            }
+            case TypeVarChar: {
+                unsigned leftLength, rightLength;
+                memcpy(&leftLength, lhs, sizeof(unsigned));
+                memcpy(&rightLength, rhs, sizeof(unsigned));
+                result = memcmp(lhs + sizeof(unsigned), rhs + sizeof(unsigned), std::min(leftLength, rightLength));
+                if (result == 0) {
+                    result = (leftLength > rightLength) - (leftLength < rightLength);
+                }
+                break;
+            }
+        }
+
+        switch (op) {
+            case EQ_OP: return result == 0;
+            case LT_OP: return result < 0;
+            case LE_OP: return result <= 0;
+            case GT_OP: return result > 0;
+            case GE_OP: return result >= 0;
+            case NE_OP: return result != 0;
+            case NO_OP: return true;
+        }
+        return false;
+    }
+
+    // Hash of a non-null value in the getNextTuple() field format; different seeds give unrelated hashes
+    static unsigned hashValue(AttrType type, const char *value, unsigned seed) {
+        const char *bytes = value;
+        unsigned length = sizeof(unsigned);
+        float real;
+        if (type == TypeVarChar) {
+            memcpy(&length, value, sizeof(unsigned));
+            bytes = value + sizeof(unsigned);
+        } else if (type == TypeReal) {
+            // 0.0 and -0.0 are equal, so they must hash alike
+            memcpy(&real, value, sizeof(float));
+            if (real == 0) {
+                real = 0;
+                bytes = (const char *) &real;
+            }
+        }
+        unsigned hash = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (unsigned i = 0; i < length; i++) {
+            hash = (hash ^ (unsigned char) bytes[i]) * 16777619u;
+        }
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        return hash ^ (hash >> 16);
+    }
+
+    // Add a left and a right tuple to a batch as one tuple of the left attributes followed by the right ones
+    static void joinTuples(TupleBatch &batch, const char *left, unsigned leftLength, unsigned leftFields,
+                           const char *right, unsigned rightLength, unsigned rightFields) {
+        const unsigned leftNullSize = (leftFields + 7) / 8;
+        const unsigned rightNullSize = (rightFields + 7) / 8;
+        const unsigned nullIndicatorSize = (leftFields + rightFields + 7) / 8;
+        char *out = batch.reserve(leftLength + rightLength);
+        memset(out, 0, nullIndicatorSize);
+        for (unsigned i = 0; i < leftFields; i++) {
+            if (left[i / 8] & (1 << (7 - i % 8))) {
+                out[i / 8] |= (char) (1 << (7 - i % 8));
+            }
+        }
+        for (unsigned i = 0; i < rightFields; i++) {
+            if (right[i / 8] & (1 << (7 - i % 8))) {
+                const unsigned field = leftFields + i;
+                out[field / 8] |= (char) (1 << (7 - field % 8));
+            }
+        }
+        char *data = out + nullIndicatorSize;
+        memcpy(data, left + leftNullSize, leftLength - leftNullSize);
+        data += leftLength - leftNullSize;
+        memcpy(data, right + rightNullSize, rightLength - rightNullSize);
+        batch.commit();
+    }
+
+    // Append a number to a normalized key with its most significant byte first
+    static void appendBigEndian(std::vector<char> &key, unsigned value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            key.push_back((char) (value >> shift));
+        }
+    }
+
+    // Order of two normalized keys, compared as unsigned bytes
+    static int compareKeys(const char *key1, unsigned length1, const char *key2, unsigned length2) {
+        const int result = memcmp(key1, key2, std::min(length1, length2));
+        if (result != 0) {
+            return result;
+        }
+        return length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+    }
+
+    // Order of two normalized keys of tuples, ties broken by their positions in the input
+    static bool precedes(const std::vector<char> &key1, uint64_t position1, const std::vector<char> &key2,
+                         uint64_t position2) {
+        const int result = compareKeys(key1.data(), key1.size(), key2.data(), key2.size());
+        return result < 0 || (result == 0 && position1 < position2);
+    }
+
+    // Field of each sort key in the attributes, -1 if not found
+    static void findSortKeys(const std::vector<Attribute> &attrs, const std::vector<SortKey> &keys,
+                             std::vector<int> &keyFields, std::vector<bool> &descending) {
+        for (const SortKey &key : keys) {
+            int field = -1;
+            for (unsigned i = 0; i < attrs.size(); i++) {
+                if (attrs[i].name == key.attr) {
+                    field = i;
+                }
+            }
+            keyFields.push_back(field);
+            descending.push_back(key.descending);
+        }
+    }
+
+    // Fields of the join attributes in the left and right attributes, -1 if not found
+    static void findJoinFields(const std::vector<Attribute> &leftAttrs, const std::vector<Attribute> &rightAttrs,
+                               const Condition &condition, int &leftField, int &rightField) {
+        for (unsigned i = 0; i < leftAttrs.size(); i++) {
+            if (leftAttrs[i].name == condition.lhsAttr) {
+                leftField = i;
+            }
+        }
+        for (unsigned i = 0; i < rightAttrs.size(); i++) {
+            if (condition.bRhsIsAttr && rightAttrs[i].name == condition.rhsAttr) {
+                rightField = i;
+            }
+        }
+    }
+
+    // Encode the sort keys of a tuple so that comparing the bytes with compareKeys() orders the tuples
+    static void normalizeKey(const std::vector<Attribute> &attrs, const std::vector<int> &keyFields,
+                             const std::vector<bool> &descending, const TupleBatch &batch, unsigned t,
+                             std::vector<char> &key) {
+        key.clear();
+        for (unsigned k = 0; k < keyFields.size(); k++) {
+            const size_t start = key.size();
+            const char *value = batch.getField(t, keyFields[k]);
+            if (value == nullptr) {
+                key.push_back(0);
+            } else {
+                key.push_back(1);
+                unsigned bits;
+                float real;
+                unsigned length;
+                switch (attrs[keyFields[k]].type) {
+                    case TypeInt:
+                        // Flipping the sign bit orders two's complement as unsigned
+                        memcpy(&bits, value, sizeof(unsigned));
+                        appendBigEndian(key, bits ^ 0x80000000u);
+                        break;
+                    case TypeReal:
+                        // Negative numbers have every bit flipped, positive ones the sign bit; -0.0 is 0.0
+                        memcpy(&real, value, sizeof(float));
+                        if (real == 0) {
+                            real = 0;
+                        }
+                        memcpy(&bits, &real, sizeof(unsigned));
+                        appendBigEndian(key, bits & 0x80000000u ? ~bits : bits | 0x80000000u);
+                        break;
+                    case TypeVarChar:
+                        // A zero byte is escaped, so the terminator sorts a string before its extensions
+                        memcpy(&length, value, sizeof(unsigned));
+                        for (unsigned i = 0; i < length; i++) {
+                            key.push_back(value[sizeof(unsigned) + i]);
+                            if (value[sizeof(unsigned) + i] == 0) {
+                                key.push_back(1);
+                            }
+                        }
+                        key.push_back(0);
+                        key.push_back(0);
+                        break;
+                }
+            }
+            // The encoding of one key is never a prefix of another, so inverting it reverses the order
+            if (descending[k]) {
+                for (size_t i = start; i < key.size(); i++) {
+                    key[i] = (char) ~key[i];
+                }
+            }
+        }
+    }
+
+    TupleBatch::TupleBatch() : nullIndicatorSize(0), used(0), offsets(1, 0) {
+    }
+
+    void TupleBatch::setAttributes(const std::vector<Attribute> &attrs) {
+        types.resize(attrs.size());
+        for (unsigned i = 0; i < attrs.size(); i++) {
+            types[i] = attrs[i].type;
+        }
+        nullIndicatorSize = (attrs.size() + 7) / 8;
+        clear();
+    }
+
+    void TupleBatch::clear() {
+        selection.clear();
+        used = 0;
+        offsets.resize(1);
+        columns.clear();
+    }
+
+    bool TupleBatch::isFull() const {
+        return offsets.size() > QE_BATCH_SIZE;
+    }
+
+    unsigned TupleBatch::size() const {
+        return selection.size();
+    }
+
+    char *TupleBatch::reserve(unsigned maxLength) {
+        if (buffer.size() < used + maxLength) {
+            buffer.resize(used + maxLength);
+        }
+        return buffer.data() + used;
+    }
+
+    void TupleBatch::commit() {
+        const char *tuple = buffer.data() + used;
+        unsigned offset = nullIndicatorSize;
+        for (unsigned i = 0; i < types.size(); i++) {
+            if (tuple[i / 8] & (1 << (7 - i % 8))) {
+                columns.push_back(0);
+                continue;
+            }
+            columns.push_back(offset);
+            if (types[i] == TypeVarChar) {
+                unsigned length;
+                memcpy(&length, tuple + offset, sizeof(unsigned));
+                offset += length;
+            }
+            offset += sizeof(unsigned);
+        }
+        used += offset;
+        selection.push_back(offsets.size() - 1);
+        offsets.push_back(used);
+    }
+
+    void TupleBatch::add(const void *tuple, unsigned length) {
+        memcpy(reserve(length), tuple, length);
+        commit();
+    }
+
+    const char *TupleBatch::getTuple(unsigned t) const {
+        return buffer.data() + offsets[t];
+    }
+
+    unsigned TupleBatch::getLength(unsigned t) const {
+        return offsets[t + 1] - offsets[t];
+    }
+
+    bool TupleBatch::isNull(unsigned t, unsigned field) const {
+        return columns[t * types.size() + field] == 0;
+    }
+
+    const char *TupleBatch::getField(unsigned t, unsigned field) const {
+        unsigned short column = columns[t * types.size() + field];
+        return column == 0 ? nullptr : buffer.data() + offsets[t] + column;
+    }
+
+    unsigned TupleBatch::getFieldLength(unsigned t, unsigned field) const {
+        const char *value = getField(t, field);
+        if (value == nullptr) {
+            return 0;
+        }
+        unsigned length = 0;
+        if (types[field] == TypeVarChar) {
+            memcpy(&length, value, sizeof(unsigned));
+        }
+        return length + sizeof(unsigned);
+    }
+
+    RC Iterator::getNextBatch(TupleBatch &batch) {
+        std::vector<Attribute> attrs;
+        getAttributes(attrs);
+        batch.setAttributes(attrs);
+        while (!batch.isFull()) {
+            if (getNextTuple(batch.reserve()) != 0) {
+                break;
+            }
+            batch.commit();
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
+    }
+
+    bool Iterator::isOrderedOn(const std::string &) const {
+        return false;
+    }
+
+    RC Iterator::close() {
+        return 0;
+    }
+
+    BatchIterator::BatchIterator() : next(0) {
+    }
+
+    RC BatchIterator::getNextTuple(void *data) {
+        while (next >= output.size()) {
+            // The batch is cleared at the end, so reading again after QE_EOF asks for another batch
+            if (getNextBatch(output) == QE_EOF) {
+                next = 0;
+                return QE_EOF;
+            }
+            next = 0;
+        }
+        unsigned short t = output.selection[next++];
+        memcpy(data, output.getTuple(t), output.getLength(t));
+        return 0;
+    }
+
+    SpillFile::SpillFile(const std::string &fileName, const std::vector<Attribute> &attrs)
+            : fileName(fileName), attrs(attrs), opened(false), size(0), reading(false) {
+        // An existing file belongs to someone else, it is left alone
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.createFile(fileName) == 0) {
+            opened = rbfm.openFile(fileName, fileHandle) == 0;
+            if (!opened) {
+                rbfm.destroyFile(fileName);
+            }
+        }
+    }
+
+    SpillFile::~SpillFile() {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        scan.close();
+        if (opened) {
+            rbfm.closeFile(fileHandle);
+            rbfm.destroyFile(fileName);
+        }
+    }
+
+    std::string SpillFile::makePrefix(const std::string &name) {
+        // Operators of other processes in the same directory differ in the process id
+        static std::atomic<unsigned> next(0);
+        return name + "." + std::to_string(getpid()) + "." + std::to_string(next++);
+    }
+
+    RC SpillFile::add(const void *tuple, unsigned length) {
+        if (!opened || reading) {
+            return -1;
+        }
+        offsets.push_back(buffer.size());
+        buffer.insert(buffer.end(), (const char *) tuple, (const char *) tuple + length);
+        size += length;
+        return buffer.size() >= PAGE_SIZE ? flush() : 0;
+    }
+
+    size_t SpillFile::getSize() const {
+        return size;
+    }
+
+    RC SpillFile::flush() {
+        if (offsets.empty()) {
+            return 0;
+        }
+        std::vector<const void *> tuples;
+        for (unsigned offset : offsets) {
+            tuples.push_back(buffer.data() + offset);
+        }
+        std::vector<RID> rids;
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.insertRecords(fileHandle, attrs, tuples, rids, true)) {
+            return -1;
+        }
+        buffer.clear();
+        offsets.clear();
+        return 0;
+    }
+
+    RC SpillFile::startReading() {
+        if (!opened || flush()) {
+            return -1;
+        }
+        std::vector<std::string> attrNames;
+        for (const Attribute &attr : attrs) {
+            attrNames.push_back(attr.name);
+        }
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.scan(fileHandle, attrs, "", NO_OP, nullptr, attrNames, scan)) {
+            return -1;
+        }
+        reading = true;
+        return 0;
+    }
+
+    RC SpillFile::getNextTuple(void *data) {
+        if (!reading && startReading()) {
+            return QE_EOF;
+        }
+        RID rid;
+        return scan.getNextRecord(rid, data) == RBFM_EOF ? QE_EOF : 0;
+    }
+
+    RC SpillFile::getNextBatch(TupleBatch &batch) {
+        batch.setAttributes(attrs);
+        if (!reading && startReading()) {
+            return QE_EOF;
+        }
+        RID rid;
+        while (!batch.isFull() && scan.getNextRecord(rid, batch.reserve()) != RBFM_EOF) {
+            batch.commit();
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
+    }
+
+    RC SpillFile::getAttributes(std::vector<Attribute> &attrs) const {
+        attrs = this->attrs;
+        return 0;
+    }
+
+    RC SpillFile::rewind() {
+        if (reading) {
+            scan.close();
+            reading = false;
+        }
+        return startReading();
+    }
+
+    const unsigned TupleBlock::NO_TUPLE;
+
+    TupleBlock::TupleBlock() : type(TypeInt), keyField(0) {
+        clear();
+    }
+
+    void TupleBlock::setAttributes(const std::vector<Attribute> &attrs, unsigned keyField) {
+        type = attrs[keyField].type;
+        this->keyField = keyField;
+        clear();
+    }
+
+    void TupleBlock::clear() {
+        arena.clear();
+        tupleOffsets.assign(1, 0);
+        keyOffsets.clear();
+        chain.clear();
+        slots.clear();
+    }
+
+    void TupleBlock::add(const TupleBatch &batch, unsigned t) {
+        const char *tuple = batch.getTuple(t);
+        keyOffsets.push_back(arena.size() + (batch.getField(t, keyField) - tuple));
+        arena.insert(arena.end(), tuple, tuple + batch.getLength(t));
+        tupleOffsets.push_back(arena.size());
+    }
+
+    size_t TupleBlock::getSize() const {
+        return arena.size();
+    }
+
+    unsigned TupleBlock::getNumTuples() const {
+        return keyOffsets.size();
+    }
+
+    void TupleBlock::index() {
+        // At most half the slots are used, so probes stay short
+        const unsigned numTuples = keyOffsets.size();
+        unsigned numSlots = 16;
+        while (numSlots < 2 * numTuples) {
+            numSlots *= 2;
+        }
+        slots.assign(numSlots, Slot{0, NO_TUPLE});
+        chain.assign(numTuples, NO_TUPLE);
+
+        // Tuples are pushed on their chains last to first, so each chain is in the order the tuples were added
+        for (unsigned i = numTuples; i-- > 0;) {
+            const char *key = getKey(i);
+            const unsigned hash = hashValue(type, key, QE_MAX_PARTITION_LEVEL + 1);
+            unsigned slot = hash & (numSlots - 1);
+            while (slots[slot].tuple != NO_TUPLE
+                   && (slots[slot].hash != hash || !compareValues(type, getKey(slots[slot].tuple), key, EQ_OP))) {
+                slot = (slot + 1) & (numSlots - 1);
+            }
+            chain[i] = slots[slot].tuple;
+            slots[slot] = Slot{hash, i};
+        }
+    }
+
+    unsigned TupleBlock::find(const char *key) const {
+        if (slots.empty()) {
+            return NO_TUPLE;
+        }
+        const unsigned hash = hashValue(type, key, QE_MAX_PARTITION_LEVEL + 1);
+        const unsigned mask = slots.size() - 1;
+        for (unsigned slot = hash & mask; slots[slot].tuple != NO_TUPLE; slot = (slot + 1) & mask) {
+            if (slots[slot].hash == hash && compareValues(type, getKey(slots[slot].tuple), key, EQ_OP)) {
+                return slots[slot].tuple;
+            }
+        }
+        return NO_TUPLE;
+    }
+
+    unsigned TupleBlock::next(unsigned tuple) const {
+        return chain[tuple];
+    }
+
+    const char *TupleBlock::getTuple(unsigned i) const {
+        return arena.data() + tupleOffsets[i];
+    }
+
+    unsigned TupleBlock::getLength(unsigned i) const {
+        return tupleOffsets[i + 1] - tupleOffsets[i];
+    }
+
+    const char *TupleBlock::getKey(unsigned i) const {
+        return arena.data() + keyOffsets[i];
+    }
+
+    Filter::Filter(Iterator *input, const Condition &condition)
+            : input(input), op(condition.op), lhsField(-1), rhsField(-1) {
+        input->getAttributes(attrs);
+        for (unsigned i = 0; i < attrs.size(); i++) {
+            if (attrs[i].name == condition.lhsAttr) {
+                lhsField = i;
+            }
+            if (condition.bRhsIsAttr && attrs[i].name == condition.rhsAttr) {
+                rhsField = i;
+            }
+        }
+
+        // Keep a copy of the value, the caller's buffer may not outlive the filter
+        if (!condition.bRhsIsAttr && condition.rhsValue.data != nullptr) {
+            const char *value = (const char *) condition.rhsValue.data;
+            unsigned size = sizeof(unsigned);
+            if (condition.rhsValue.type == TypeVarChar) {
+                unsigned length;
+                memcpy(&length, value, sizeof(unsigned));
+                size += length;
+            }
+            rhsValue.assign(value, value + size);
+        }
     }
 
     Filter::~Filter() {
 
     }
 
-    RC Filter::getNextTuple(void *data) {
-        return -1;
+    bool Filter::matches(const TupleBatch &batch, unsigned t) const {
+        if (op == NO_OP) {
+            return true;
+        }
+        if (lhsField < 0) {
+            return false;
+        }
+        // null satisfies no comparison
+        const char *lhs = batch.getField(t, lhsField);
+        const char *rhs = rhsField < 0 ? rhsValue.data() : batch.getField(t, rhsField);
+        if (lhs == nullptr || rhs == nullptr) {
+            return false;
+        }
+        return compareValues(attrs[lhsField].type, lhs, rhs, op);
+    }
+
+    RC Filter::getNextBatch(TupleBatch &batch) {
+        do {
+            if (input->getNextBatch(batch) == QE_EOF) {
+                return QE_EOF;
+            }
+            unsigned kept = 0;
+            for (unsigned i = 0; i < batch.selection.size(); i++) {
+                if (matches(batch, batch.selection[i])) {
+                    batch.selection[kept++] = batch.selection[i];
+                }
+            }
+            batch.selection.resize(kept);
+        } while (batch.size() == 0);
+        return 0;
     }
 
     RC Filter::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
     }
 
-    Project::Project(Iterator *input, const std::vector<std::string> &attrNames) {
+    bool Filter::isOrderedOn(const std::string &attr) const {
+        return input->isOrderedOn(attr);
+    }
+
+    RC Filter::close() {
+        return input->close();
+    }
 
+    Project::Project(Iterator *input, const std::vector<std::string> &attrNames) : input(input) {
+        std::vector<Attribute> inputAttrs;
+        input->getAttributes(inputAttrs);
+        for (const std::string &name : attrNames) {
+            // An attribute the input lacks stays in the output as an int column that is always null
+            attrs.push_back(Attribute{name, TypeInt, sizeof(int)});
+            fields.push_back(-1);
+            for (unsigned i = 0; i < inputAttrs.size(); i++) {
+                if (inputAttrs[i].name == name) {
+                    attrs.back() = inputAttrs[i];
+                    fields.back() = i;
+                    break;
+                }
+            }
+        }
     }
 
     Project::~Project() {
 
     }
 
-    RC Project::getNextTuple(void *data) {
-        return -1;
+    RC Project::getNextBatch(TupleBatch &batch) {
+        if (input->getNextBatch(inputBatch) == QE_EOF) {
+            return QE_EOF;
+        }
+        batch.setAttributes(attrs);
+        const unsigned nullIndicatorSize = (attrs.size() + 7) / 8;
+        for (unsigned short t : inputBatch.selection) {
+            unsigned length = nullIndicatorSize;
+            for (int position : fields) {
+                length += position < 0 ? 0 : inputBatch.getFieldLength(t, position);
+            }
+
+            char *tuple = batch.reserve(length);
+            memset(tuple, 0, nullIndicatorSize);
+            char *field = tuple + nullIndicatorSize;
+            for (unsigned i = 0; i < fields.size(); i++) {
+                const char *value = fields[i] < 0 ? nullptr : inputBatch.getField(t, fields[i]);
+                if (value == nullptr) {
+                    tuple[i / 8] |= (char) (1 << (7 - i % 8));
+                    continue;
+                }
+                unsigned size = inputBatch.getFieldLength(t, fields[i]);
+                memcpy(field, value, size);
+                field += size;
+            }
+            batch.commit();
+        }
+        return 0;
     }
 
     RC Project::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
+    }
+
+    bool Project::isOrderedOn(const std::string &attr) const {
+        for (const Attribute &projected : attrs) {
+            if (projected.name == attr) {
+                return input->isOrderedOn(attr);
+            }
+        }
+        return false;
+    }
+
+    RC Project::close() {
+        return input->close();
+    }
+
+    Sort::Sort(Iterator *input, const std::vector<SortKey> &keys, unsigned numPages)
+            : input(input), budget((size_t) std::max(numPages, 1u) * PAGE_SIZE), numFiles(0), sorted(false),
+              emitPosition(0) {
+        input->getAttributes(attrs);
+        findSortKeys(attrs, keys, keyFields, descending);
+        filePrefix = SpillFile::makePrefix("sort");
     }
 
-    BNLJoin::BNLJoin(Iterator *leftIn, TableScan *rightIn, const Condition &condition, const unsigned int numPages) {
+    Sort::~Sort() {
 
     }
 
+    void Sort::sortEntries() {
+        const char *keys = keyArena.data();
+        std::sort(entries.begin(), entries.end(), [keys](const Entry &a, const Entry &b) {
+            if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+            }
+            return compareKeys(keys + a.key, a.keyLength, keys + b.key, b.keyLength) < 0;
+        });
+    }
+
+    RC Sort::writeRun(std::vector<std::unique_ptr<SpillFile>> &files) {
+        sortEntries();
+        std::unique_ptr<SpillFile> file(new SpillFile(filePrefix + "." + std::to_string(numFiles++), attrs));
+        for (const Entry &entry : entries) {
+            if (file->add(arena.data() + entry.tuple, entry.length)) {
+                return -1;
+            }
+        }
+        files.push_back(std::move(file));
+        arena.clear();
+        keyArena.clear();
+        entries.clear();
+        return 0;
+    }
+
+    RC Sort::sortInput() {
+        std::vector<std::unique_ptr<SpillFile>> files;
+        std::vector<char> key;
+        TupleBatch batch;
+        while (input->getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                normalizeKey(attrs, keyFields, descending, batch, t, key);
+                Entry entry;
+                entry.prefix = 0;
+                for (unsigned i = 0; i < sizeof(uint64_t); i++) {
+                    entry.prefix = entry.prefix << 8 | (i < key.size() ? (unsigned char) key[i] : 0);
+                }
+                entry.key = keyArena.size();
+                entry.keyLength = key.size();
+                entry.tuple = arena.size();
+                entry.length = batch.getLength(t);
+                keyArena.insert(keyArena.end(), key.begin(), key.end());
+                arena.insert(arena.end(), batch.getTuple(t), batch.getTuple(t) + entry.length);
+                entries.push_back(entry);
+                if (arena.size() + keyArena.size() + entries.size() * sizeof(Entry) >= budget && writeRun(files)) {
+                    return -1;
+                }
+            }
+        }
+        if (files.empty()) {
+            sortEntries();
+            return 0;
+        }
+        if (!entries.empty() && writeRun(files)) {
+            return -1;
+        }
+
+        // Merge the first runs into one until a single merge takes them all
+        while (files.size() > QE_MERGE_FAN_IN) {
+            std::vector<std::unique_ptr<SpillFile>> merging;
+            for (unsigned i = 0; i < QE_MERGE_FAN_IN; i++) {
+                merging.push_back(std::move(files[i]));
+            }
+            files.erase(files.begin(), files.begin() + QE_MERGE_FAN_IN);
+            if (startMerge(std::move(merging))) {
+                return -1;
+            }
+            std::unique_ptr<SpillFile> file(new SpillFile(filePrefix + "." + std::to_string(numFiles++), attrs));
+            while (!runs[tree[0]].done) {
+                Run &run = runs[tree[0]];
+                const unsigned t = run.batch.selection[run.position];
+                if (file->add(run.batch.getTuple(t), run.batch.getLength(t)) || advance(run)) {
+                    return -1;
+                }
+                adjust(tree[0]);
+            }
+            runs.clear();
+            files.push_back(std::move(file));
+        }
+        return startMerge(std::move(files));
+    }
+
+    RC Sort::startMerge(std::vector<std::unique_ptr<SpillFile>> files) {
+        runs.clear();
+        runs.resize(files.size());
+        for (unsigned i = 0; i < files.size(); i++) {
+            runs[i].file = std::move(files[i]);
+            runs[i].position = 0;
+            runs[i].done = false;
+            if (advance(runs[i])) {
+                return -1;
+            }
+        }
+        // Every node starts with a run that beats all others, each run's replay pushes one of them out
+        tree.assign(runs.size(), runs.size());
+        for (unsigned i = runs.size(); i-- > 0;) {
+            adjust(i);
+        }
+        return 0;
+    }
+
+    bool Sort::beats(unsigned run1, unsigned run2) const {
+        if (run1 == runs.size() || run2 == runs.size()) {
+            return run1 == runs.size();
+        }
+        if (runs[run1].done || runs[run2].done) {
+            return runs[run2].done && !runs[run1].done;
+        }
+        const std::vector<char> &key1 = runs[run1].key;
+        const std::vector<char> &key2 = runs[run2].key;
+        const int result = compareKeys(key1.data(), key1.size(), key2.data(), key2.size());
+        return result < 0 || (result == 0 && run1 < run2);
+    }
+
+    void Sort::adjust(unsigned run) {
+        for (unsigned node = (run + runs.size()) / 2; node > 0; node /= 2) {
+            if (beats(tree[node], run)) {
+                std::swap(run, tree[node]);
+            }
+        }
+        tree[0] = run;
+    }
+
+    RC Sort::advance(Run &run) {
+        run.position++;
+        if (run.position >= run.batch.size()) {
+            run.position = 0;
+            if (run.file->getNextBatch(run.batch) == QE_EOF) {
+                run.done = true;
+                return 0;
+            }
+        }
+        normalizeKey(attrs, keyFields, descending, run.batch, run.batch.selection[run.position], run.key);
+        return 0;
+    }
+
+    RC Sort::getNextBatch(TupleBatch &batch) {
+        batch.setAttributes(attrs);
+        if (std::find(keyFields.begin(), keyFields.end(), -1) != keyFields.end()) {
+            return QE_EOF;
+        }
+        if (!sorted) {
+            sorted = true;
+            if (sortInput()) {
+                return QE_EOF;
+            }
+        }
+        if (runs.empty()) {
+            while (!batch.isFull() && emitPosition < entries.size()) {
+                const Entry &entry = entries[emitPosition++];
+                batch.add(arena.data() + entry.tuple, entry.length);
+            }
+        } else {
+            while (!batch.isFull() && !runs[tree[0]].done) {
+                Run &run = runs[tree[0]];
+                const unsigned t = run.batch.selection[run.position];
+                batch.add(run.batch.getTuple(t), run.batch.getLength(t));
+                if (advance(run)) {
+                    break;
+                }
+                adjust(tree[0]);
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
+    }
+
+    RC Sort::getAttributes(std::vector<Attribute> &attrs) const {
+        attrs = this->attrs;
+        return 0;
+    }
+
+    bool Sort::isOrderedOn(const std::string &attr) const {
+        return !keyFields.empty() && keyFields[0] >= 0 && attrs[keyFields[0]].name == attr && !descending[0];
+    }
+
+    RC Sort::close() {
+        runs.clear();
+        entries.clear();
+        entries.shrink_to_fit();
+        arena.clear();
+        arena.shrink_to_fit();
+        keyArena.clear();
+        keyArena.shrink_to_fit();
+        return input->close();
+    }
+
+    Limit::Limit(Iterator *input, unsigned limit) : input(input), remaining(limit), closed(false) {
+    }
+
+    Limit::~Limit() {
+
+    }
+
+    RC Limit::getNextBatch(TupleBatch &batch) {
+        if (remaining > 0 && input->getNextBatch(batch) != QE_EOF) {
+            if (batch.size() > remaining) {
+                batch.selection.resize(remaining);
+            }
+            remaining -= batch.size();
+        } else {
+            std::vector<Attribute> attrs;
+            input->getAttributes(attrs);
+            batch.setAttributes(attrs);
+            remaining = 0;
+        }
+        if (remaining == 0 && !closed) {
+            close();
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
+    }
+
+    RC Limit::getAttributes(std::vector<Attribute> &attrs) const {
+        return input->getAttributes(attrs);
+    }
+
+    bool Limit::isOrderedOn(const std::string &attr) const {
+        return input->isOrderedOn(attr);
+    }
+
+    RC Limit::close() {
+        remaining = 0;
+        if (closed) {
+            return 0;
+        }
+        closed = true;
+        return input->close();
+    }
+
+    TopN::TopN(Iterator *input, const std::vector<SortKey> &keys, unsigned n)
+            : input(input), n(n), ranked(false), emitPosition(0) {
+        input->getAttributes(attrs);
+        findSortKeys(attrs, keys, keyFields, descending);
+    }
+
+    TopN::~TopN() {
+
+    }
+
+    RC TopN::rank() {
+        auto before = [](const Entry &a, const Entry &b) {
+            return precedes(a.key, a.position, b.key, b.position);
+        };
+        heap.reserve(std::min(n, (unsigned) QE_BATCH_SIZE));
+        std::vector<char> key;
+        uint64_t position = 0;
+        TupleBatch batch;
+        while (input->getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                normalizeKey(attrs, keyFields, descending, batch, t, key);
+                if (heap.size() == n) {
+                    // A later tuple with the key of the top comes after it
+                    if (!precedes(key, position, heap.front().key, heap.front().position)) {
+                        position++;
+                        continue;
+                    }
+                    std::pop_heap(heap.begin(), heap.end(), before);
+                } else {
+                    heap.emplace_back();
+                }
+                Entry &entry = heap.back();
+                entry.key.swap(key);
+                entry.tuple.assign(batch.getTuple(t), batch.getTuple(t) + batch.getLength(t));
+                entry.position = position++;
+                std::push_heap(heap.begin(), heap.end(), before);
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), before);
+        return 0;
+    }
+
+    RC TopN::getNextBatch(TupleBatch &batch) {
+        batch.setAttributes(attrs);
+        if (n == 0 || std::find(keyFields.begin(), keyFields.end(), -1) != keyFields.end()) {
+            return QE_EOF;
+        }
+        if (!ranked) {
+            ranked = true;
+            if (rank()) {
+                return QE_EOF;
+            }
+        }
+        while (!batch.isFull() && emitPosition < heap.size()) {
+            const Entry &entry = heap[emitPosition++];
+            batch.add(entry.tuple.data(), entry.tuple.size());
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
+    }
+
+    RC TopN::getAttributes(std::vector<Attribute> &attrs) const {
+        attrs = this->attrs;
+        return 0;
+    }
+
+    bool TopN::isOrderedOn(const std::string &attr) const {
+        return !keyFields.empty() && keyFields[0] >= 0 && attrs[keyFields[0]].name == attr && !descending[0];
+    }
+
+    RC TopN::close() {
+        heap.clear();
+        heap.shrink_to_fit();
+        return input->close();
+    }
+
+    BNLJoin::BNLJoin(Iterator *leftIn, TableScan *rightIn, const Condition &condition, const unsigned int numPages)
+            : leftIn(leftIn), rightIn(rightIn), leftField(-1), rightField(-1), op(condition.op),
+              blockSize((size_t) std::max(numPages, 1u) * PAGE_SIZE), numBlocks(0), leftPosition(0),
+              leftDone(false), rightPosition(0), rightTuple(0), rightDone(true), match(TupleBlock::NO_TUPLE) {
+        leftIn->getAttributes(leftAttrs);
+        rightIn->getAttributes(rightAttrs);
+        findJoinFields(leftAttrs, rightAttrs, condition, leftField, rightField);
+        if (leftField >= 0) {
+            block.setAttributes(leftAttrs, leftField);
+        }
+        attrs = leftAttrs;
+        attrs.insert(attrs.end(), rightAttrs.begin(), rightAttrs.end());
+    }
+
     BNLJoin::~BNLJoin() {
 
     }
 
-    RC BNLJoin::getNextTuple(void *data) {
-        return -1;
+    RC BNLJoin::loadBlock() {
+        block.clear();
+        while (block.getSize() < blockSize) {
+            if (leftPosition == leftBatch.size()) {
+                leftPosition = 0;
+                if (leftDone || leftIn->getNextBatch(leftBatch) == QE_EOF) {
+                    leftDone = true;
+                    leftBatch.clear();
+                    break;
+                }
+                continue;
+            }
+            // null joins with nothing
+            const unsigned t = leftBatch.selection[leftPosition++];
+            if (!leftBatch.isNull(t, leftField)) {
+                block.add(leftBatch, t);
+            }
+        }
+        if (block.getNumTuples() == 0) {
+            return QE_EOF;
+        }
+        if (op == EQ_OP) {
+            block.index();
+        }
+
+        // The first block reads the scan the right input was opened with
+        if (numBlocks++ > 0) {
+            rightIn->setIterator();
+        }
+        rightBatch.clear();
+        rightPosition = 0;
+        rightDone = false;
+        match = TupleBlock::NO_TUPLE;
+        return 0;
+    }
+
+    unsigned BNLJoin::nextMatch(unsigned tuple) const {
+        const AttrType type = leftAttrs[leftField].type;
+        const char *key = rightBatch.getField(rightTuple, rightField);
+        const unsigned numTuples = block.getNumTuples();
+        for (; tuple < numTuples; tuple++) {
+            if (compareValues(type, block.getKey(tuple), key, op)) {
+                return tuple;
+            }
+        }
+        return TupleBlock::NO_TUPLE;
+    }
+
+    RC BNLJoin::getNextBatch(TupleBatch &batch) {
+        if (leftField < 0 || rightField < 0) {
+            return QE_EOF;
+        }
+        batch.setAttributes(attrs);
+        while (!batch.isFull()) {
+            // Join the right tuple with the next block tuple it matches
+            if (match != TupleBlock::NO_TUPLE) {
+                joinTuples(batch, block.getTuple(match), block.getLength(match), leftAttrs.size(),
+                           rightBatch.getTuple(rightTuple), rightBatch.getLength(rightTuple), rightAttrs.size());
+                match = op == EQ_OP ? block.next(match) : nextMatch(match + 1);
+                continue;
+            }
+            if (rightPosition < rightBatch.size()) {
+                rightTuple = rightBatch.selection[rightPosition++];
+                const char *key = rightBatch.getField(rightTuple, rightField);
+                if (key != nullptr) {
+                    match = op == EQ_OP ? block.find(key) : nextMatch(0);
+                }
+                continue;
+            }
+            if (!rightDone && rightIn->getNextBatch(rightBatch) != QE_EOF) {
+                rightPosition = 0;
+                continue;
+            }
+            rightDone = true;
+            if (loadBlock() != 0) {
+                break;
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
     }
 
     RC BNLJoin::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
     }
 
-    INLJoin::INLJoin(Iterator *leftIn, IndexScan *rightIn, const Condition &condition) {
+    RC BNLJoin::close() {
+        block.clear();
+        const RC rc = leftIn->close();
+        return rightIn->close() ? -1 : rc;
+    }
 
+    INLJoin::INLJoin(Iterator *leftIn, IndexScan *rightIn, const Condition &condition)
+            : leftIn(leftIn), rightIn(rightIn), leftField(-1), rightField(-1), op(condition.op), probe(0),
+              probeEnd(0), probing(false), rightKey(PAGE_SIZE), emitted(0) {
+        leftIn->getAttributes(leftAttrs);
+        rightIn->getAttributes(rightAttrs);
+        findJoinFields(leftAttrs, rightAttrs, condition, leftField, rightField);
+        if (leftField >= 0) {
+            block.setAttributes(leftAttrs, leftField);
+        }
+        attrs = leftAttrs;
+        attrs.insert(attrs.end(), rightAttrs.begin(), rightAttrs.end());
     }
 
     INLJoin::~INLJoin() {
 
     }
 
-    RC INLJoin::getNextTuple(void *data) {
-        return -1;
+    RC INLJoin::loadBlock() {
+        block.clear();
+        order.clear();
+        probe = 0;
+        if (leftIn->getNextBatch(leftBatch) == QE_EOF) {
+            return QE_EOF;
+        }
+        // null joins with nothing
+        for (unsigned short t : leftBatch.selection) {
+            if (!leftBatch.isNull(t, leftField)) {
+                order.push_back(block.getNumTuples());
+                block.add(leftBatch, t);
+            }
+        }
+        const AttrType type = leftAttrs[leftField].type;
+        std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+            return compareValues(type, block.getKey(a), block.getKey(b), LT_OP);
+        });
+        return 0;
+    }
+
+    RC INLJoin::startProbe(const char *key) {
+        // The condition reads left op right, so the right keys lie on the other side of the left key
+        switch (op) {
+            case EQ_OP:
+                return rightIn->seek(key, key, true, true);
+            case LT_OP:
+                return rightIn->seek(key, nullptr, false, true);
+            case LE_OP:
+                return rightIn->seek(key, nullptr, true, true);
+            case GT_OP:
+                return rightIn->seek(nullptr, key, true, false);
+            case GE_OP:
+                return rightIn->seek(nullptr, key, true, true);
+            default:
+                return rightIn->seek(nullptr, nullptr, true, true);
+        }
+    }
+
+    RC INLJoin::collect() {
+        matches.clear();
+        emitted = 0;
+        const AttrType type = leftAttrs[leftField].type;
+        while (matches.size() < QE_BATCH_SIZE) {
+            if (!probing) {
+                // The matches refer to the block, so a new one waits for them to be joined
+                if (probe == order.size()) {
+                    if (!matches.empty() || loadBlock() == QE_EOF) {
+                        break;
+                    }
+                    continue;
+                }
+                const char *key = block.getKey(order[probe]);
+                probeEnd = probe + 1;
+                while (probeEnd < order.size() && compareValues(type, block.getKey(order[probeEnd]), key, EQ_OP)) {
+                    probeEnd++;
+                }
+                if (startProbe(key)) {
+                    probe = probeEnd;
+                    continue;
+                }
+                probing = true;
+            }
+            RID rid;
+            if (rightIn->getNextEntry(rid, rightKey.data()) != 0) {
+                probing = false;
+                probe = probeEnd;
+                continue;
+            }
+            if (op == NE_OP && compareValues(type, block.getKey(order[probe]), rightKey.data(), EQ_OP)) {
+                continue;
+            }
+            for (unsigned i = probe; i < probeEnd; i++) {
+                matches.push_back(Match{rid, order[i], 0});
+            }
+        }
+        if (matches.empty()) {
+            return QE_EOF;
+        }
+
+        // Read the right tuples in page order, each once
+        std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+            return a.rid.pageNum != b.rid.pageNum ? a.rid.pageNum < b.rid.pageNum
+                                                  : a.rid.slotNum != b.rid.slotNum ? a.rid.slotNum < b.rid.slotNum
+                                                                                   : a.left < b.left;
+        });
+        rightTuples.setAttributes(rightAttrs);
+        for (unsigned i = 0; i < matches.size(); i++) {
+            if (i > 0 && matches[i].rid.pageNum == matches[i - 1].rid.pageNum
+                && matches[i].rid.slotNum == matches[i - 1].rid.slotNum) {
+                matches[i].right = matches[i - 1].right;
+                continue;
+            }
+            matches[i].right = TupleBlock::NO_TUPLE;
+            if (rightIn->readTuple(matches[i].rid, rightTuples.reserve()) == 0) {
+                matches[i].right = rightTuples.size();
+                rightTuples.commit();
+            }
+        }
+        return 0;
+    }
+
+    RC INLJoin::getNextBatch(TupleBatch &batch) {
+        if (leftField < 0 || rightField < 0) {
+            return QE_EOF;
+        }
+        batch.setAttributes(attrs);
+        while (!batch.isFull()) {
+            if (emitted < matches.size()) {
+                const Match &match = matches[emitted++];
+                if (match.right != TupleBlock::NO_TUPLE) {
+                    joinTuples(batch, block.getTuple(match.left), block.getLength(match.left), leftAttrs.size(),
+                               rightTuples.getTuple(match.right), rightTuples.getLength(match.right),
+                               rightAttrs.size());
+                }
+                continue;
+            }
+            if (collect() != 0) {
+                break;
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
     }
 
     RC INLJoin::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
     }
 
-    GHJoin::GHJoin(Iterator *leftIn, Iterator *rightIn, const Condition &condition, const unsigned int numPartitions) {
+    RC INLJoin::close() {
+        block.clear();
+        matches.clear();
+        const RC rc = leftIn->close();
+        return rightIn->close() ? -1 : rc;
+    }
 
+    GHJoin::GHJoin(Iterator *leftIn, Iterator *rightIn, const Condition &condition, const unsigned int numPartitions)
+            : leftIn(leftIn), rightIn(rightIn), leftField(-1), rightField(-1),
+              numPartitions(std::max(numPartitions, 1u)), partitioned(false), probeFile(nullptr),
+              probePosition(0), probeTuple(0), match(TupleBlock::NO_TUPLE) {
+        leftIn->getAttributes(leftAttrs);
+        rightIn->getAttributes(rightAttrs);
+        findJoinFields(leftAttrs, rightAttrs, condition, leftField, rightField);
+        attrs = leftAttrs;
+        attrs.insert(attrs.end(), rightAttrs.begin(), rightAttrs.end());
+        filePrefix = SpillFile::makePrefix("ghjoin");
     }
 
     GHJoin::~GHJoin() {
 
     }
 
-    RC GHJoin::getNextTuple(void *data) {
-        return -1;
+    RC GHJoin::partition(Iterator *input, int field, unsigned level, bool left, unsigned first) {
+        const AttrType type = left ? leftAttrs[field].type : rightAttrs[field].type;
+        TupleBatch batch;
+        while (input->getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                // null joins with nothing
+                const char *key = batch.getField(t, field);
+                if (key == nullptr) {
+                    continue;
+                }
+                PartitionPair &pair = partitions[first + hashValue(type, key, level) % numPartitions];
+                SpillFile &file = left ? *pair.left : *pair.right;
+                if (file.add(batch.getTuple(t), batch.getLength(t))) {
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    RC GHJoin::nextPartition() {
+        while (!pending.empty()) {
+            const unsigned index = pending.back();
+            pending.pop_back();
+            if (partitions[index].left->getSize() == 0 || partitions[index].right->getSize() == 0) {
+                continue;
+            }
+
+            // Too large to build in memory: split both sides again with the hash of the next level
+            const unsigned level = partitions[index].level;
+            if (partitions[index].left->getSize() > QE_MEMORY_BUDGET && level < QE_MAX_PARTITION_LEVEL) {
+                const unsigned first = partitions.size();
+                for (unsigned p = 0; p < numPartitions; p++) {
+                    const std::string name = filePrefix + "." + std::to_string(first + p);
+                    partitions.push_back(PartitionPair{
+                            std::unique_ptr<SpillFile>(new SpillFile(name + ".left", leftAttrs)),
+                            std::unique_ptr<SpillFile>(new SpillFile(name + ".right", rightAttrs)), level + 1});
+                    pending.push_back(first + p);
+                }
+                if (partition(partitions[index].left.get(), leftField, level + 1, true, first)
+                    || partition(partitions[index].right.get(), rightField, level + 1, false, first)) {
+                    return -1;
+                }
+                continue;
+            }
+
+            if (build(*partitions[index].left)) {
+                return -1;
+            }
+            probeFile = partitions[index].right.get();
+            probeBatch.clear();
+            probePosition = 0;
+            match = TupleBlock::NO_TUPLE;
+            return 0;
+        }
+        return QE_EOF;
+    }
+
+    RC GHJoin::build(SpillFile &file) {
+        block.setAttributes(leftAttrs, leftField);
+        TupleBatch batch;
+        while (file.getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                block.add(batch, t);
+            }
+        }
+        block.index();
+        return 0;
+    }
+
+    RC GHJoin::getNextBatch(TupleBatch &batch) {
+        if (leftField < 0 || rightField < 0) {
+            return QE_EOF;
+        }
+        if (!partitioned) {
+            partitioned = true;
+            for (unsigned p = 0; p < numPartitions; p++) {
+                const std::string name = filePrefix + "." + std::to_string(p);
+                partitions.push_back(PartitionPair{
+                        std::unique_ptr<SpillFile>(new SpillFile(name + ".left", leftAttrs)),
+                        std::unique_ptr<SpillFile>(new SpillFile(name + ".right", rightAttrs)), 0});
+                pending.push_back(numPartitions - 1 - p);
+            }
+            if (partition(leftIn, leftField, 0, true, 0) || partition(rightIn, rightField, 0, false, 0)) {
+                return QE_EOF;
+            }
+        }
+
+        batch.setAttributes(attrs);
+        while (!batch.isFull()) {
+            // Join the probe tuple with the next block tuple of its key
+            if (match != TupleBlock::NO_TUPLE) {
+                joinTuples(batch, block.getTuple(match), block.getLength(match), leftAttrs.size(),
+                           probeBatch.getTuple(probeTuple), probeBatch.getLength(probeTuple), rightAttrs.size());
+                match = block.next(match);
+                continue;
+            }
+            // Look up the next probe tuple
+            if (probePosition < probeBatch.size()) {
+                probeTuple = probeBatch.selection[probePosition++];
+                const char *key = probeBatch.getField(probeTuple, rightField);
+                match = key == nullptr ? TupleBlock::NO_TUPLE : block.find(key);
+                continue;
+            }
+            if (probeFile != nullptr && probeFile->getNextBatch(probeBatch) != QE_EOF) {
+                probePosition = 0;
+                continue;
+            }
+            probeFile = nullptr;
+            if (nextPartition() != 0) {
+                break;
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
     }
 
     RC GHJoin::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
+    }
+
+    // The partition files are destroyed
+    RC GHJoin::close() {
+        probeFile = nullptr;
+        pending.clear();
+        partitions.clear();
+        block.clear();
+        const RC rc = leftIn->close();
+        return rightIn->close() ? -1 : rc;
+    }
+
+    SMJoin::SMJoin(Iterator *leftIn, Iterator *rightIn, const Condition &condition, unsigned numPages)
+            : leftIn(leftIn), rightIn(rightIn), leftField(-1), rightField(-1),
+              budget((size_t) std::max(numPages, 1u) * PAGE_SIZE), leftPosition(0), leftDone(false),
+              rightPosition(0), rightDone(false), joining(false), runPosition(0) {
+        leftIn->getAttributes(leftAttrs);
+        rightIn->getAttributes(rightAttrs);
+        findJoinFields(leftAttrs, rightAttrs, condition, leftField, rightField);
+        attrs = leftAttrs;
+        attrs.insert(attrs.end(), rightAttrs.begin(), rightAttrs.end());
+        if (leftField < 0 || rightField < 0) {
+            return;
+        }
+
+        if (!leftIn->isOrderedOn(condition.lhsAttr)) {
+            leftSort.reset(new Sort(leftIn, {SortKey{condition.lhsAttr, false}}, numPages));
+            this->leftIn = leftSort.get();
+        }
+        if (!rightIn->isOrderedOn(condition.rhsAttr)) {
+            rightSort.reset(new Sort(rightIn, {SortKey{condition.rhsAttr, false}}, numPages));
+            this->rightIn = rightSort.get();
+        }
+        runBlock.setAttributes(rightAttrs, rightField);
+        runFileName = SpillFile::makePrefix("smjoin") + ".run";
+    }
+
+    SMJoin::~SMJoin() {
+
+    }
+
+    bool SMJoin::hasLeft() {
+        while (leftPosition >= leftBatch.size()) {
+            leftPosition = 0;
+            if (leftDone || leftIn->getNextBatch(leftBatch) == QE_EOF) {
+                leftDone = true;
+                leftBatch.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool SMJoin::hasRight() {
+        while (rightPosition >= rightBatch.size()) {
+            rightPosition = 0;
+            if (rightDone || rightIn->getNextBatch(rightBatch) == QE_EOF) {
+                rightDone = true;
+                rightBatch.clear();
+                return false;
+            }
+        }
+        return true;
     }
 
-    Aggregate::Aggregate(Iterator *input, const Attribute &aggAttr, AggregateOp op) {
+    RC SMJoin::collectRun() {
+        runBlock.clear();
+        runFile.reset();
+        const unsigned first = rightBatch.selection[rightPosition];
+        const char *key = rightBatch.getField(first, rightField);
+        runKey.assign(key, key + rightBatch.getFieldLength(first, rightField));
 
+        const AttrType type = rightAttrs[rightField].type;
+        while (hasRight()) {
+            const unsigned t = rightBatch.selection[rightPosition];
+            if (!compareValues(type, rightBatch.getField(t, rightField), runKey.data(), EQ_OP)) {
+                break;
+            }
+            rightPosition++;
+            if (runFile != nullptr) {
+                if (runFile->add(rightBatch.getTuple(t), rightBatch.getLength(t))) {
+                    return -1;
+                }
+                continue;
+            }
+            runBlock.add(rightBatch, t);
+
+            // A run past the budget moves to disk, to be read once per left tuple
+            if (runBlock.getSize() > budget) {
+                runFile.reset(new SpillFile(runFileName, rightAttrs));
+                for (unsigned i = 0; i < runBlock.getNumTuples(); i++) {
+                    if (runFile->add(runBlock.getTuple(i), runBlock.getLength(i))) {
+                        return -1;
+                    }
+                }
+                runBlock.clear();
+            }
+        }
+        return 0;
+    }
+
+    RC SMJoin::startJoining() {
+        joining = true;
+        runPosition = 0;
+        runBatch.clear();
+        return runFile == nullptr ? 0 : runFile->rewind();
+    }
+
+    RC SMJoin::getNextBatch(TupleBatch &batch) {
+        if (leftField < 0 || rightField < 0) {
+            return QE_EOF;
+        }
+        batch.setAttributes(attrs);
+        const AttrType type = leftAttrs[leftField].type;
+        while (!batch.isFull()) {
+            // Join the left tuple with the next tuple of the run
+            if (joining) {
+                const unsigned t = leftBatch.selection[leftPosition];
+                if (runFile == nullptr && runPosition < runBlock.getNumTuples()) {
+                    joinTuples(batch, leftBatch.getTuple(t), leftBatch.getLength(t), leftAttrs.size(),
+                               runBlock.getTuple(runPosition), runBlock.getLength(runPosition), rightAttrs.size());
+                    runPosition++;
+                    continue;
+                }
+                if (runFile != nullptr && runPosition < runBatch.size()) {
+                    const unsigned r = runBatch.selection[runPosition++];
+                    joinTuples(batch, leftBatch.getTuple(t), leftBatch.getLength(t), leftAttrs.size(),
+                               runBatch.getTuple(r), runBatch.getLength(r), rightAttrs.size());
+                    continue;
+                }
+                if (runFile != nullptr && runFile->getNextBatch(runBatch) != QE_EOF) {
+                    runPosition = 0;
+                    continue;
+                }
+                joining = false;
+                leftPosition++;
+                continue;
+            }
+
+            if (!hasLeft()) {
+                break;
+            }
+            // null joins with nothing
+            const char *leftKey = leftBatch.getField(leftBatch.selection[leftPosition], leftField);
+            if (leftKey == nullptr) {
+                leftPosition++;
+                continue;
+            }
+            // Left tuples of the run's key join with it again, later keys are past it
+            if (!runKey.empty()) {
+                if (compareValues(type, leftKey, runKey.data(), EQ_OP)) {
+                    if (startJoining()) {
+                        break;
+                    }
+                    continue;
+                }
+                if (compareValues(type, leftKey, runKey.data(), LT_OP)) {
+                    leftPosition++;
+                    continue;
+                }
+                runKey.clear();
+                runBlock.clear();
+                runFile.reset();
+            }
+
+            if (!hasRight()) {
+                break;
+            }
+            const char *rightKey = rightBatch.getField(rightBatch.selection[rightPosition], rightField);
+            if (rightKey == nullptr || compareValues(type, rightKey, leftKey, LT_OP)) {
+                rightPosition++;
+            } else if (compareValues(type, leftKey, rightKey, LT_OP)) {
+                leftPosition++;
+            } else if (collectRun()) {
+                break;
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
     }
 
-    Aggregate::Aggregate(Iterator *input, const Attribute &aggAttr, const Attribute &groupAttr, AggregateOp op) {
+    RC SMJoin::getAttributes(std::vector<Attribute> &attrs) const {
+        attrs = this->attrs;
+        return 0;
+    }
 
+    // Closing a Sort the join reads through closes the input under it
+    RC SMJoin::close() {
+        runFile.reset();
+        runBlock.clear();
+        const RC rc = leftIn->close();
+        return rightIn->close() ? -1 : rc;
+    }
+
+    Aggregate::Aggregate(Iterator *input, const Attribute &aggAttr, AggregateOp op)
+            : input(input), aggField(-1), groupField(-1), aggType(aggAttr.type), groupType(TypeInt), op(op),
+              numFiles(0), aggregated(false), numGroups(0), nullGroup(), emitPosition(0) {
+        std::vector<Attribute> inputAttrs;
+        input->getAttributes(inputAttrs);
+        for (unsigned i = 0; i < inputAttrs.size(); i++) {
+            if (inputAttrs[i].name == aggAttr.name) {
+                aggField = i;
+            }
+        }
+        static const char *const opNames[] = {"MIN", "MAX", "COUNT", "SUM", "AVG"};
+        attrs.push_back(Attribute{std::string(opNames[op]) + "(" + aggAttr.name + ")", TypeReal, sizeof(float)});
+        spillAttrs.push_back(aggAttr);
+        filePrefix = SpillFile::makePrefix("aggregate");
+    }
+
+    Aggregate::Aggregate(Iterator *input, const Attribute &aggAttr, const Attribute &groupAttr, AggregateOp op)
+            : Aggregate(input, aggAttr, op) {
+        std::vector<Attribute> inputAttrs;
+        input->getAttributes(inputAttrs);
+        for (unsigned i = 0; i < inputAttrs.size(); i++) {
+            if (inputAttrs[i].name == groupAttr.name) {
+                groupField = i;
+            }
+        }
+        groupType = groupAttr.type;
+        attrs.insert(attrs.begin(), groupAttr);
+        spillAttrs.insert(spillAttrs.begin(), groupAttr);
     }
 
     Aggregate::~Aggregate() {
 
     }
 
-    RC Aggregate::getNextTuple(void *data) {
-        return -1;
+    bool Aggregate::grow(unsigned level) {
+        // Past the last level the groups stay in memory whatever they take
+        const size_t size = groups.size() * 2;
+        if (level < QE_MAX_PARTITION_LEVEL && size * sizeof(Group) + strings.size() > QE_MEMORY_BUDGET) {
+            return false;
+        }
+        std::vector<Group> old(size);
+        old.swap(groups);
+        for (const Group &group : old) {
+            if (!group.used) {
+                continue;
+            }
+            unsigned slot = group.hash & (size - 1);
+            while (groups[slot].used) {
+                slot = (slot + 1) & (size - 1);
+            }
+            groups[slot] = group;
+        }
+        return true;
+    }
+
+    Aggregate::Group *Aggregate::findGroup(const char *key, unsigned level) {
+        const unsigned hash = hashValue(groupType, key, QE_MAX_PARTITION_LEVEL + 1);
+        unsigned mask = groups.size() - 1;
+        unsigned slot = hash & mask;
+        for (; groups[slot].used; slot = (slot + 1) & mask) {
+            const char *value = groupType == TypeVarChar ? strings.data() + groups[slot].key
+                                                         : (const char *) &groups[slot].key;
+            if (groups[slot].hash == hash && compareValues(groupType, value, key, EQ_OP)) {
+                return &groups[slot];
+            }
+        }
+
+        // A new group, if the table is at most half full with it
+        if (2 * (numGroups + 1) > groups.size()) {
+            if (!grow(level)) {
+                return nullptr;
+            }
+            mask = groups.size() - 1;
+            for (slot = hash & mask; groups[slot].used; slot = (slot + 1) & mask);
+        }
+        Group &group = groups[slot];
+        group = Group();
+        group.hash = hash;
+        if (groupType == TypeVarChar) {
+            unsigned length;
+            memcpy(&length, key, sizeof(unsigned));
+            if (level < QE_MAX_PARTITION_LEVEL
+                && groups.size() * sizeof(Group) + strings.size() + sizeof(unsigned) + length > QE_MEMORY_BUDGET) {
+                return nullptr;
+            }
+            group.key = strings.size();
+            strings.insert(strings.end(), key, key + sizeof(unsigned) + length);
+        } else {
+            memcpy(&group.key, key, sizeof(unsigned));
+        }
+        group.used = true;
+        numGroups++;
+        return &group;
+    }
+
+    void Aggregate::accumulate(Group &group, const char *value) const {
+        if (value == nullptr) {
+            return;
+        }
+        double number = 0;
+        if (aggType == TypeInt) {
+            int i;
+            memcpy(&i, value, sizeof(int));
+            number = i;
+        } else if (aggType == TypeReal) {
+            float f;
+            memcpy(&f, value, sizeof(float));
+            number = f;
+        }
+        if (group.count == 0 || number < group.min) {
+            group.min = number;
+        }
+        if (group.count == 0 || number > group.max) {
+            group.max = number;
+        }
+        group.sum += number;
+        group.count++;
+    }
+
+    RC Aggregate::spill(const TupleBatch &batch, unsigned t, int groupField, int aggField, unsigned level,
+                        std::vector<Partition> &spills) {
+        if (spills.empty()) {
+            for (unsigned p = 0; p < QE_SPILL_PARTITIONS; p++) {
+                const std::string name = filePrefix + "." + std::to_string(numFiles++);
+                spills.push_back(Partition{std::unique_ptr<SpillFile>(new SpillFile(name, spillAttrs)), level + 1});
+            }
+        }
+        // [null indicator][group value][aggregated value]
+        const char *key = batch.getField(t, groupField);
+        const char *value = batch.getField(t, aggField);
+        const unsigned keyLength = batch.getFieldLength(t, groupField);
+        const unsigned valueLength = batch.getFieldLength(t, aggField);
+        char tuple[1 + 2 * PAGE_SIZE];
+        tuple[0] = value == nullptr ? (char) 0x40 : 0;
+        memcpy(tuple + 1, key, keyLength);
+        if (value != nullptr) {
+            memcpy(tuple + 1 + keyLength, value, valueLength);
+        }
+        SpillFile &file = *spills[hashValue(groupType, key, level) % QE_SPILL_PARTITIONS].file;
+        return file.add(tuple, 1 + keyLength + valueLength);
+    }
+
+    RC Aggregate::aggregate(Iterator *source, int groupField, int aggField, unsigned level) {
+        groups.assign(16, Group());
+        numGroups = 0;
+        strings.clear();
+        emitPosition = 0;
+
+        // Without grouping every tuple is in the one group of slot 0
+        if (groupField < 0) {
+            groups[0].used = true;
+            numGroups = 1;
+        }
+        std::vector<Partition> spills;
+        TupleBatch batch;
+        while (source->getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                Group *group = &groups[0];
+                if (groupField >= 0) {
+                    const char *key = batch.getField(t, groupField);
+                    if (key == nullptr) {
+                        nullGroup.used = true;
+                        group = &nullGroup;
+                    } else if ((group = findGroup(key, level)) == nullptr) {
+                        if (spill(batch, t, groupField, aggField, level, spills)) {
+                            return -1;
+                        }
+                        continue;
+                    }
+                }
+                accumulate(*group, batch.getField(t, aggField));
+            }
+        }
+        for (Partition &partition : spills) {
+            if (partition.file->getSize() > 0) {
+                pending.push_back(std::move(partition));
+            }
+        }
+        return 0;
+    }
+
+    void Aggregate::emit(TupleBatch &batch, const Group &group, bool nullKey) const {
+        char *tuple = batch.reserve();
+        tuple[0] = 0;
+        char *data = tuple + 1;
+        if (groupField >= 0) {
+            if (nullKey) {
+                tuple[0] |= (char) 0x80;
+            } else if (groupType == TypeVarChar) {
+                unsigned length;
+                memcpy(&length, strings.data() + group.key, sizeof(unsigned));
+                memcpy(data, strings.data() + group.key, sizeof(unsigned) + length);
+                data += sizeof(unsigned) + length;
+            } else {
+                memcpy(data, &group.key, sizeof(unsigned));
+                data += sizeof(unsigned);
+            }
+        }
+
+        const unsigned field = attrs.size() - 1;
+        if (group.count == 0 && op != COUNT) {
+            tuple[field / 8] |= (char) (1 << (7 - field % 8));
+        } else {
+            const double results[] = {group.min, group.max, (double) group.count, group.sum,
+                                      group.count == 0 ? 0 : group.sum / group.count};
+            const float result = (float) results[op];
+            memcpy(data, &result, sizeof(float));
+        }
+        batch.commit();
+    }
+
+    RC Aggregate::getNextBatch(TupleBatch &batch) {
+        if (aggField < 0 || (attrs.size() > 1 && groupField < 0)) {
+            return QE_EOF;
+        }
+        batch.setAttributes(attrs);
+        if (!aggregated) {
+            aggregated = true;
+            if (aggregate(input, groupField, aggField, 0)) {
+                return QE_EOF;
+            }
+        }
+        while (!batch.isFull()) {
+            if (emitPosition < groups.size()) {
+                const Group &group = groups[emitPosition++];
+                if (group.used) {
+                    emit(batch, group, false);
+                }
+                continue;
+            }
+            if (nullGroup.used) {
+                nullGroup.used = false;
+                emit(batch, nullGroup, true);
+                continue;
+            }
+            if (pending.empty()) {
+                break;
+            }
+            // A spilled partition holds the group value and the aggregated value of its tuples
+            Partition partition = std::move(pending.back());
+            pending.pop_back();
+            if (aggregate(partition.file.get(), 0, 1, partition.level)) {
+                break;
+            }
+        }
+        return batch.size() == 0 ? QE_EOF : 0;
     }
 
     RC Aggregate::getAttributes(std::vector<Attribute> &attrs) const {
-        return -1;
+        attrs = this->attrs;
+        return 0;
+    }
+
+    // The spilled groups are destroyed
+    RC Aggregate::close() {
+        pending.clear();
+        groups.clear();
+        groups.shrink_to_fit();
+        strings.clear();
+        strings.shrink_to_fit();
+        return input->close();
     }
 } // namespace PeterDB
@@ -10,7 +10,6 @@
 namespace PeterDB {
     RecordBasedFileManager &RecordBasedFileManager::instance() {
         static RecordBasedFileManager _rbfm = RecordBasedFileManager();
-        _rbfm.reset();
         return _rbfm;
     }
 
@@ -18,151 +17,335 @@ namespace PeterDB {
 
     RecordBasedFileManager::~RecordBasedFileManager() = default;
 
-    RecordBasedFileManager::RecordBasedFileManager(const RecordBasedFileManager &) = default;
+    RecordBasedFileManager::RecordBasedFileManager(const RecordBasedFileManager &) {}
 
-    RecordBasedFileManager &RecordBasedFileManager::operator=(const RecordBasedFileManager &) = default;
+    RecordBasedFileManager &RecordBasedFileManager::operator=(const RecordBasedFileManager &) {
+        return *this;
+    }
 
     RC RecordBasedFileManager::createFile(const std::string &fileName) {
         PagedFileManager &pfm = PagedFileManager::instance();
-        return pfm.createFile(fileName);
+        if (pfm.createFile(fileName)) {
+            return -1;
+        }
+        // A zone map left by an earlier file of the same name describes other pages
+        ::remove((fileName + ZONE_MAP_SUFFIX).c_str());
+        return 0;
     }
 
     RC RecordBasedFileManager::destroyFile(const std::string &fileName) {
         PagedFileManager &pfm = PagedFileManager::instance();
+        {
+            std::lock_guard<std::mutex> guard(zoneMapLatch);
+            for (auto it = zoneMaps.begin(); it != zoneMaps.end();) {
+                it = it->second->getFileName() == fileName ? zoneMaps.erase(it) : std::next(it);
+            }
+        }
+        ::remove((fileName + ZONE_MAP_SUFFIX).c_str());
         return pfm.destroyFile(fileName);
     }
 
-    RC RecordBasedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle) {
+    RC RecordBasedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle, IOBackend backend) {
         PagedFileManager &pfm = PagedFileManager::instance();
-        return pfm.openFile(fileName, fileHandle);
+        return pfm.openFile(fileName, fileHandle, backend);
     }
 
     RC RecordBasedFileManager::closeFile(FileHandle &fileHandle) {
         PagedFileManager &pfm = PagedFileManager::instance();
+        PagedFile *file = fileHandle.file;
+        if (file != nullptr && file->refCount == 1) {
+            // Last handle: write the zone map back once the pages it describes are on disk
+            std::unique_ptr<ZoneMap> zoneMap;
+            {
+                std::lock_guard<std::mutex> guard(zoneMapLatch);
+                auto it = zoneMaps.find(file->fileId);
+                if (it != zoneMaps.end()) {
+                    zoneMap = std::move(it->second);
+                    zoneMaps.erase(it);
+                }
+            }
+            if (zoneMap && !file->destroyed && fileHandle.sync() == 0) {
+                zoneMap->save(fileHandle.getNumberOfPages());
+            }
+            std::lock_guard<std::mutex> guard(vacuumLatch);
+            vacuumCursors.erase(file->fileId);
+        }
         return pfm.closeFile(fileHandle);
     }
 
-    void RecordBasedFileManager::updateHeap(FileHandle &fileHandle, const int &pageNum, const unsigned short &newFreeSpace) {
-        fileHeapMap[&fileHandle].pop();
-        addPageToHeap(fileHandle, pageNum, newFreeSpace);
+    ZoneMap *RecordBasedFileManager::getZoneMap(FileHandle &fileHandle,
+                                                const std::vector<Attribute> &recordDescriptor) {
+        if (fileHandle.file == nullptr) {
+            return nullptr;
+        }
+        ZoneMap *zoneMap;
+        {
+            std::lock_guard<std::mutex> guard(zoneMapLatch);
+            std::unique_ptr<ZoneMap> &entry = zoneMaps[fileHandle.file->fileId];
+            if (!entry) {
+                entry.reset(new ZoneMap(fileHandle.file->fileName));
+                entry->load(fileHandle.getNumberOfPages());
+            }
+            zoneMap = entry.get();
+        }
+        zoneMap->setAttributes(recordDescriptor);
+        return zoneMap;
     }
 
-    void RecordBasedFileManager::addPageToHeap(FileHandle &fileHandle, const int &pageNum, const unsigned short &freeSpace) {
-        fileHeapMap[&fileHandle].push(PageInfo{pageNum, freeSpace});
+    void RecordBasedFileManager::initializePage(char *page) {
+        const unsigned short numberOfSlots = 0;
+        const unsigned short freeSpace = PAGE_SIZE - SLOT_SIZE;
+        memcpy(page + PAGE_SIZE - SLOT_SIZE, &numberOfSlots, SHORT_SIZE);
+        memcpy(page + PAGE_SIZE - SHORT_SIZE, &freeSpace, SHORT_SIZE);
+    }
+
+    unsigned short RecordBasedFileManager::placeRecord(char *page, const void *data, unsigned short recordSize) {
+        unsigned short numberOfSlots;
+        memcpy(&numberOfSlots, page + PAGE_SIZE - SLOT_SIZE, SHORT_SIZE);
+        const unsigned directoryEnd = PAGE_SIZE - SLOT_SIZE - numberOfSlots * SLOT_SIZE;
+
+        // Find an available slot, or allocate a new one
+        unsigned short slotToInsert = numberOfSlots + 1;
+        const auto dir = page + directoryEnd;
+        for (int i = 0; i < numberOfSlots; i++) {
+            unsigned short slotLength;
+            memcpy(&slotLength, dir + i * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            if (slotLength == 0) {
+                slotToInsert = numberOfSlots - i;
+                break;
+            }
+        }
+        placeRecordAt(page, slotToInsert, data, recordSize);
+        return slotToInsert;
+    }
+
+    void RecordBasedFileManager::placeRecordAt(char *page, unsigned short slotNum, const void *data,
+                                               unsigned short recordSize) {
+        unsigned short numberOfSlots, pageFreeSpace;
+        memcpy(&numberOfSlots, page + PAGE_SIZE - SLOT_SIZE, SHORT_SIZE);
+        memcpy(&pageFreeSpace, page + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+        const unsigned directoryEnd = PAGE_SIZE - SLOT_SIZE - numberOfSlots * SLOT_SIZE;
+
+        // Insert record right after the last byte array
+        const unsigned short offset = directoryEnd - pageFreeSpace;
+        memcpy(page + offset, data, recordSize);
+        pageFreeSpace -= recordSize;
+
+        // If not re-using a slot, allocate space for a new slot
+        if (slotNum > numberOfSlots) {
+            numberOfSlots = slotNum;
+            pageFreeSpace -= SLOT_SIZE;
+        }
+        memcpy(page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE, &offset, SHORT_SIZE);
+        memcpy(page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE + SHORT_SIZE, &recordSize, SHORT_SIZE);
+
+        // Update directory
+        memcpy(page + PAGE_SIZE - SLOT_SIZE, &numberOfSlots, SHORT_SIZE);
+        memcpy(page + PAGE_SIZE - SHORT_SIZE, &pageFreeSpace, SHORT_SIZE);
     }
 
     RC RecordBasedFileManager::insertRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                             const void *data, RID &rid) {
-        // Calculate record size
-        std::vector<bool> isNull = extractNullInformation(data, recordDescriptor);
-        const auto recordSize = static_cast<unsigned short>(getRecordSize(data, recordDescriptor, isNull));
+        // A record and its slot must fit in an empty page
+        if (getStoredSize(data, recordDescriptor) > PAGE_SIZE - 2 * SLOT_SIZE) {
+            return -1;
+        }
+        char record[PAGE_SIZE];
+        const unsigned short recordSize = encodeRecord(data, recordDescriptor, 0, record);
+        return insertStored(fileHandle, recordDescriptor, record, recordSize, rid);
+    }
+
+    RC RecordBasedFileManager::insertStored(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                            const char *record, unsigned short recordSize, RID &rid) {
         const unsigned short requiredSpace = recordSize + SLOT_SIZE;
 
-        unsigned short numberOfSlots, freeSpace, offset = 0;
         unsigned short pageFreeSpace = 0;
-        const unsigned numPages = fileHandle.getNumberOfPages();
-        int pageNum = -1;
+        PageNum pageNum = 0;
+        bool found = false;
         const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
 
-        // Locate largest available space on heap
-        if (!fileHeapMap[&fileHandle].empty() && fileHeapMap[&fileHandle].top().freeSpace >= requiredSpace) {
-            const PageInfo pi = fileHeapMap[&fileHandle].top();
-            pageNum = pi.pageNum;
-            pageFreeSpace = pi.freeSpace;
+        // Locate a page with enough space in the free space map, correcting entries that turn out stale
+        while (!found && fileHandle.findFreeSpace(requiredSpace, pageNum) == 0) {
+            fileHandle.readPage(pageNum, page.get());
+            memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            found = pageFreeSpace >= requiredSpace;
+            if (!found && fileHandle.setFreeSpace(pageNum, pageFreeSpace)) {
+                break;
+            }
         }
 
         // Create and insert in new page
-        if (numPages == 0 || pageNum == -1) {
-            const unsigned directory = PAGE_SIZE - 2 * SLOT_SIZE;
-            numberOfSlots = 1;
-            freeSpace = PAGE_SIZE - recordSize - 2 * SLOT_SIZE;
-            memcpy(page.get(), data, recordSize);
-            memcpy(page.get() + directory, &offset, SHORT_SIZE);
-            memcpy(page.get() + directory + SHORT_SIZE, &recordSize,SHORT_SIZE);
-            memcpy(page.get() + directory + 2 * SHORT_SIZE, &numberOfSlots, SHORT_SIZE);
-            memcpy(page.get() + directory + 3 * SHORT_SIZE, &freeSpace, SHORT_SIZE);
-            fileHandle.appendPage(page.get());
-            rid.slotNum = 1;
-            pageNum = (numPages == 0) ? 0 : static_cast<int>(numPages);
-            addPageToHeap(fileHandle, pageNum, freeSpace);
-        }
-        // Insert in an existing page
+        if (!found) {
+            pageNum = fileHandle.getNumberOfPages();
+            initializePage(page.get());
+            rid.slotNum = placeRecord(page.get(), record, recordSize);
+            if (fileHandle.appendPage(page.get())) {
+                return -1;
+            }
+        }
+        // Insert in an existing page, already read while checking its free space
         else {
-            fileHandle.readPage(pageNum, page.get());
+            rid.slotNum = placeRecord(page.get(), record, recordSize);
+            if (fileHandle.writePage(pageNum, page.get())) {
+                return -1;
+            }
+        }
+
+        memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+        fileHandle.setFreeSpace(pageNum, pageFreeSpace);
+        rid.pageNum = pageNum;
+
+        ZoneMap *zoneMap = getZoneMap(fileHandle, recordDescriptor);
+        if (!found) {
+            zoneMap->addPage(pageNum);
+        }
+        zoneMap->add(pageNum, record);
+        return 0;
+    }
+
+    RC RecordBasedFileManager::insertRecords(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                             const std::vector<const void *> &data, std::vector<RID> &rids,
+                                             bool append) {
+        // Reject the batch before any page is touched if a record cannot fit in a page
+        for (const void *tuple : data) {
+            if (getStoredSize(tuple, recordDescriptor) > PAGE_SIZE - 2 * SLOT_SIZE) {
+                return -1;
+            }
+        }
+        rids.resize(data.size());
+        const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
+        bool pageOpen = false;              // page holds an existing page being filled
+        bool lastPageTried = false;         // an append looked at the last existing page
+        PageNum pageNum = 0;
+        unsigned short pageFreeSpace = 0;
+
+        // Pages created by this call, appended together at the end
+        const PageNum firstNewPage = fileHandle.getNumberOfPages();
+        std::vector<char> newPages;
+        unsigned numNewPages = 0;
+
+        ZoneMap *zoneMap = getZoneMap(fileHandle, recordDescriptor);
+        char record[PAGE_SIZE];
+        for (size_t i = 0; i < data.size(); i++) {
+            const unsigned short recordSize = encodeRecord(data[i], recordDescriptor, 0, record);
+            const unsigned short requiredSpace = recordSize + SLOT_SIZE;
+
+            // Keep filling the current page while the record fits
+            char *target = nullptr;
+            if (pageOpen) {
+                memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+                if (pageFreeSpace >= requiredSpace) {
+                    target = page.get();
+                } else {
+                    // The page is full, write it back once
+                    if (fileHandle.writePage(pageNum, page.get())) {
+                        return -1;
+                    }
+                    fileHandle.setFreeSpace(pageNum, pageFreeSpace);
+                    pageOpen = false;
+                }
+            } else if (numNewPages > 0) {
+                char *lastPage = newPages.data() + (size_t) (numNewPages - 1) * PAGE_SIZE;
+                memcpy(&pageFreeSpace, lastPage + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+                if (pageFreeSpace >= requiredSpace) {
+                    target = lastPage;
+                    pageNum = firstNewPage + numNewPages - 1;
+                }
+            }
+
+            // An append goes on after the last record of the file
+            if (append && target == nullptr && !pageOpen && !lastPageTried && firstNewPage > 0) {
+                lastPageTried = true;
+                pageNum = firstNewPage - 1;
+                if (fileHandle.readPage(pageNum, page.get())) {
+                    return -1;
+                }
+                memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+                if (pageFreeSpace >= requiredSpace) {
+                    target = page.get();
+                    pageOpen = true;
+                }
+            }
 
-            memcpy(&numberOfSlots, page.get() + PAGE_SIZE - SLOT_SIZE, SHORT_SIZE);
-            const unsigned directoryEnd = PAGE_SIZE - SLOT_SIZE - numberOfSlots * SLOT_SIZE;
-
-            // Insert record right after the last byte array
-            const unsigned endOfRecords = directoryEnd - pageFreeSpace;
-            memcpy(page.get() + endOfRecords, data, recordSize);
-
-            // Find an available slot
-            unsigned slotToInsert = 0;
-            const auto dir = page.get() + directoryEnd;
-            for (int i = 0; i < numberOfSlots; i++) {
-                unsigned short slotLength;
-                memcpy(&slotLength, dir + i * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
-                if (slotLength == 0) {
-                    slotToInsert = numberOfSlots - i;
+            // Locate an existing page with enough space, correcting entries that turn out stale
+            while (target == nullptr && numNewPages == 0 && !append
+                   && fileHandle.findFreeSpace(requiredSpace, pageNum) == 0) {
+                fileHandle.readPage(pageNum, page.get());
+                memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+                if (pageFreeSpace >= requiredSpace) {
+                    target = page.get();
+                    pageOpen = true;
+                } else if (fileHandle.setFreeSpace(pageNum, pageFreeSpace)) {
                     break;
                 }
             }
-            // Update slot entry
-            offset = endOfRecords;
-            pageFreeSpace -= recordSize;
-
-            // If not re-using a slot, allocate space for a new slot
-            if (slotToInsert == 0) {
-                memcpy(page.get() + directoryEnd - SLOT_SIZE, &offset, SHORT_SIZE);
-                memcpy(page.get() + directoryEnd - SHORT_SIZE, &recordSize, SHORT_SIZE);
-                numberOfSlots += 1;
-                rid.slotNum = numberOfSlots;
-                pageFreeSpace -= SLOT_SIZE; // subtract space allocated for new slot
-            } else {
-                memcpy(page.get() + PAGE_SIZE - SLOT_SIZE - slotToInsert * SLOT_SIZE, &offset, SHORT_SIZE);
-                memcpy(page.get() + PAGE_SIZE - SLOT_SIZE - slotToInsert * SLOT_SIZE + SHORT_SIZE, &recordSize, SHORT_SIZE);
-                rid.slotNum = slotToInsert;
+
+            // Start a new page, the existing pages are then no longer searched
+            if (target == nullptr) {
+                newPages.resize((size_t) (numNewPages + 1) * PAGE_SIZE);
+                target = newPages.data() + (size_t) numNewPages * PAGE_SIZE;
+                pageNum = firstNewPage + numNewPages;
+                numNewPages++;
+                initializePage(target);
+                zoneMap->addPage(pageNum);
             }
 
-            // Update directory
-            memcpy(page.get() + PAGE_SIZE - SLOT_SIZE, &numberOfSlots, SHORT_SIZE);
-            memcpy(page.get() + PAGE_SIZE - SHORT_SIZE, &pageFreeSpace, SHORT_SIZE);
-            fileHandle.writePage(pageNum, page.get());
-            updateHeap(fileHandle, pageNum, pageFreeSpace);
+            rids[i].pageNum = pageNum;
+            rids[i].slotNum = placeRecord(target, record, recordSize);
+            zoneMap->add(pageNum, record);
         }
 
-        rid.pageNum = pageNum;
+        // Write back the last existing page and append the new ones
+        if (pageOpen) {
+            if (fileHandle.writePage(pageNum, page.get())) {
+                return -1;
+            }
+            memcpy(&pageFreeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            fileHandle.setFreeSpace(pageNum, pageFreeSpace);
+        }
+        if (numNewPages > 0) {
+            if (fileHandle.appendPages(numNewPages, newPages.data())) {
+                return -1;
+            }
+            for (unsigned i = 0; i < numNewPages; i++) {
+                memcpy(&pageFreeSpace, newPages.data() + (size_t) i * PAGE_SIZE + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+                fileHandle.setFreeSpace(firstNewPage + i, pageFreeSpace);
+            }
+        }
         return 0;
     }
 
     RC RecordBasedFileManager::readRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                           const RID &rid, void *data) {
-        // Read page
-        const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
-        fileHandle.readPage(rid.pageNum, page.get());
+        // Pin page, the record is copied straight out of the buffer pool
+        char *page;
+        if (fileHandle.pinPage(rid.pageNum, page)) {
+            return -1;
+        }
 
         // Get record offset and length
         unsigned short offset, length;
-        memcpy(&length, page.get() + (PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE + SHORT_SIZE), SHORT_SIZE);
+        memcpy(&length, page + (PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE + SHORT_SIZE), SHORT_SIZE);
 
         // Reading a non-existent record returns error
         if (length == 0) {
+            fileHandle.unpinPage(rid.pageNum, false);
             return -1;
         }
-        memcpy(&offset, page.get() + (PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE), SHORT_SIZE);
+        memcpy(&offset, page + (PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE), SHORT_SIZE);
 
         // Read from a tombstone
         if (length >= TOMBSTONE_MARKER) {
+            fileHandle.unpinPage(rid.pageNum, false);
             RID rid_t;
             rid_t.pageNum = offset - TOMBSTONE_MARKER;
             rid_t.slotNum = length - TOMBSTONE_MARKER;
             return readRecord(fileHandle, recordDescriptor, rid_t, data);
         }
 
-        // Read record into data
-        memcpy(data, page.get() + offset, length);
-        return 0;
+        // Convert the stored record into data
+        decodeRecord(page + offset, recordDescriptor, data);
+        return fileHandle.unpinPage(rid.pageNum, false);
     }
 
     RC RecordBasedFileManager::printRecord(const std::vector<Attribute> &recordDescriptor, const void *data,
@@ -218,11 +401,39 @@ namespace PeterDB {
         return 0;
     }
 
+    void RecordBasedFileManager::shiftRecords(char *page, unsigned short from, int delta) {
+        unsigned short numberOfSlots, freeSpace;
+        memcpy(&numberOfSlots, page + PAGE_SIZE - 2 * SHORT_SIZE, SHORT_SIZE);
+        memcpy(&freeSpace, page + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
+
+        // Move everything between from and the end of the records
+        const unsigned directoryEnd = PAGE_SIZE - 2 * SHORT_SIZE - numberOfSlots * 2 * SHORT_SIZE;
+        const unsigned endOfRecords = directoryEnd - freeSpace;
+        memmove(page + from + delta, page + from, endOfRecords - from);
+
+        // Update directory, tombstones and deleted slots do not point into the page
+        char* dirPtr = page + directoryEnd;
+        for (int i = 0; i < numberOfSlots; i++) {
+            unsigned short slotOffset, slotLength;
+            memcpy(&slotOffset, dirPtr + i * (SHORT_SIZE * 2), SHORT_SIZE);
+            memcpy(&slotLength, dirPtr + i * (SHORT_SIZE * 2) + SHORT_SIZE, SHORT_SIZE);
+            if (slotLength != 0 && slotLength < TOMBSTONE_MARKER && slotOffset >= from) {
+                slotOffset += delta;
+                memcpy(dirPtr + i * (SHORT_SIZE * 2), &slotOffset, SHORT_SIZE);
+            }
+        }
+
+        freeSpace -= delta;
+        memcpy(page + PAGE_SIZE - 1 * SHORT_SIZE, &freeSpace, SHORT_SIZE);
+    }
+
     RC RecordBasedFileManager::deleteRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                             const RID &rid) {
         // Read page
         const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
-        fileHandle.readPage(rid.pageNum, page.get());
+        if (fileHandle.readPage(rid.pageNum, page.get())) {
+            return -1;
+        }
 
         // Get record offset and length
         unsigned short offset, length;
@@ -234,49 +445,38 @@ namespace PeterDB {
         }
         memcpy(&offset, page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), SHORT_SIZE);
 
-        // Deleting a tombstone record
+        // Deleting a tombstone record: delete where it lives, then free the tombstone's slot
         if (length >= TOMBSTONE_MARKER) {
             RID rid_t;
             rid_t.pageNum = offset - TOMBSTONE_MARKER;
             rid_t.slotNum = length - TOMBSTONE_MARKER;
-            return deleteRecord(fileHandle, recordDescriptor, rid_t);
-        }
-
-        // Find directory
-        unsigned short numberOfSlots, freeSpace;
-        memcpy(&numberOfSlots, page.get() + PAGE_SIZE - 2 * SHORT_SIZE, SHORT_SIZE);
-        memcpy(&freeSpace, page.get() + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
-
-        // Move everything after the record and before the directory to overwrite the record
-        const unsigned directoryEnd = PAGE_SIZE - 2 * SHORT_SIZE - numberOfSlots * 2 * SHORT_SIZE;
-        const unsigned shiftSize = directoryEnd - (offset + length);
-        memmove(page.get() + offset, page.get() + offset + length, shiftSize);
-
-        // Update directory
-        const unsigned short recordToDeleteOffset = offset;
-        const unsigned short recordToDeleteLength = length;
-        char* dirPtr = page.get() + directoryEnd;
-        for (int i = 0; i < numberOfSlots; i++) {
-            unsigned slotOffset;
-            memcpy(&slotOffset, dirPtr + i * (SHORT_SIZE * 2), SHORT_SIZE);
-
-            if (slotOffset > recordToDeleteOffset) {
-                slotOffset -= recordToDeleteLength;
-                memcpy(dirPtr + i * (SHORT_SIZE * 2), &slotOffset, SHORT_SIZE);
+            unsigned short recordSize;
+            if (removeForwarded(fileHandle, recordDescriptor, rid_t, nullptr, recordSize)) {
+                return -1;
             }
+            getZoneMap(fileHandle, recordDescriptor)->addTombstones(rid.pageNum, -1);
+        } else {
+            getZoneMap(fileHandle, recordDescriptor)->remove(rid.pageNum, page.get() + offset);
+            // Move everything after the record and before the directory to overwrite the record
+            shiftRecords(page.get(), offset + length, -length);
         }
 
-        freeSpace += length; // numberOfSlots remain the same
+        // numberOfSlots remain the same, the slot can be reused
         offset = 0;
         length = 0;
-
         memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), &offset, SHORT_SIZE);
         memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE), &length, SHORT_SIZE);
-        memcpy(page.get() + PAGE_SIZE - 2 * SHORT_SIZE, &numberOfSlots, SHORT_SIZE);
-        memcpy(page.get() + PAGE_SIZE - 1 * SHORT_SIZE, &freeSpace, SHORT_SIZE);
+
+        // The freed space may be enough for records that had to leave this page
+        if (migrateBack(fileHandle, recordDescriptor, rid.pageNum, page.get())) {
+            return -1;
+        }
 
         // Flush updated page
+        unsigned short freeSpace;
+        memcpy(&freeSpace, page.get() + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
         fileHandle.writePage(rid.pageNum, page.get());
+        fileHandle.setFreeSpace(rid.pageNum, freeSpace);
         return 0;
     }
 
@@ -284,7 +484,9 @@ namespace PeterDB {
                                             const void *data, const RID &rid) {
         // Read page
         const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
-        fileHandle.readPage(rid.pageNum, page.get());
+        if (fileHandle.readPage(rid.pageNum, page.get())) {
+            return -1;
+        }
 
         // Get record offset and length
         unsigned short offset, length;
@@ -296,135 +498,365 @@ namespace PeterDB {
         }
         memcpy(&offset, page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), SHORT_SIZE);
 
-        // Prepare new record to insert
-        std::vector<bool> isNull = extractNullInformation(data, recordDescriptor);
-        const unsigned recordSize = getRecordSize(data, recordDescriptor, isNull);
+        // Prepare new record to insert, a record at home is never forwarded
+        if (getStoredSize(data, recordDescriptor) > PAGE_SIZE - 2 * SLOT_SIZE) {
+            return -1;
+        }
+        char record[PAGE_SIZE];
+        const unsigned short recordSize = encodeRecord(data, recordDescriptor, 0, record);
 
-        // Find old record
-        unsigned short numberOfSlots, freeSpace;
-        memcpy(&numberOfSlots, page.get() + PAGE_SIZE - 2 * SHORT_SIZE, SHORT_SIZE);
-        memcpy(&freeSpace, page.get() + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
+        // Updating a tombstone record: update where it lives, or bring it back
+        if (length >= TOMBSTONE_MARKER) {
+            RID rid_t;
+            rid_t.pageNum = offset - TOMBSTONE_MARKER;
+            rid_t.slotNum = length - TOMBSTONE_MARKER;
+            return updateForwarded(fileHandle, recordDescriptor, record, recordSize, rid, page.get(), rid_t);
+        }
 
-        // Update the old record
-        const unsigned directoryEnd = PAGE_SIZE - 2 * SHORT_SIZE - numberOfSlots * 2 * SHORT_SIZE;
+        ZoneMap *zoneMap = getZoneMap(fileHandle, recordDescriptor);
+        zoneMap->remove(rid.pageNum, page.get() + offset);
 
-        // Write new record over the old record
-        if (recordSize <= length) {
-            memcpy(page.get() + offset, data, recordSize);
-            // If new record is smaller than old record, compact space
-            if (recordSize < length) {
-                const unsigned shiftSize = directoryEnd - (offset + recordSize);
-                memmove(page.get() + offset + recordSize, page.get() + offset + length, shiftSize);
-                // Update directory entries
-                const unsigned updatedRecordOffset = offset;
-                const unsigned lengthDiff = length - recordSize;
-                char* dirPtr = page.get() + directoryEnd;
-                for (int i = 0; i < numberOfSlots; i++) {
-                    unsigned slotOffset;
-                    memcpy(&slotOffset, dirPtr + i * (SHORT_SIZE * 2), SHORT_SIZE);
-                    if (slotOffset > updatedRecordOffset) {
-                        slotOffset -= lengthDiff;
-                        memcpy(dirPtr + i * (SHORT_SIZE * 2), &slotOffset, SHORT_SIZE);
-                    }
-                }
+        // Write new record over the old record, moving the records behind it
+        if (resizeRecord(page.get(), rid.slotNum, record, recordSize)) {
+            zoneMap->add(rid.pageNum, record);
+            // A smaller record may leave room for records that had to leave this page
+            if (recordSize < length && migrateBack(fileHandle, recordDescriptor, rid.pageNum, page.get())) {
+                return -1;
             }
-            // offset stays the same
         }
-        // If old record is larger than new record, delete it
+        // The page cannot hold the larger record: move it and leave a tombstone
         else {
-            deleteRecord(fileHandle, recordDescriptor, rid);
-            memcpy(&freeSpace, page.get() + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
-            // If there is enough space, insert at the end of current page
-            if (freeSpace >= recordSize) {
-                const unsigned endOfRecords = directoryEnd - freeSpace;
-                memcpy(page.get() + endOfRecords, data, recordSize);
-                freeSpace -= recordSize;
-                offset = endOfRecords;
-            }
-            else {
-                // Insert in new page and leave tombstone: [pageNum_t][slotNum_t]
-                RID rid_t;
-                insertRecord(fileHandle, recordDescriptor, data, rid_t);
-                const unsigned pageNum_t = rid_t.pageNum + TOMBSTONE_MARKER; // length stores pageNum
-                const unsigned slotNum_t = rid_t.slotNum + TOMBSTONE_MARKER; // offset stores slotNum
-                memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), &pageNum_t, SHORT_SIZE);
-                memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE), &slotNum_t, SHORT_SIZE);
-                fileHandle.writePage(rid.pageNum, page.get());
-                return 0;
-            }
-        }
-
-        length = recordSize;
-        memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), &offset, SHORT_SIZE);
-        memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE), &length, SHORT_SIZE);
+            // This page has no room for it, so the record lands on another page, marked as reached through here
+            const unsigned short flags = RECORD_FORWARDED;
+            memcpy(record, &flags, SHORT_SIZE);
+            RID rid_t;
+            if (insertStored(fileHandle, recordDescriptor, record, recordSize, rid_t)) {
+                zoneMap->add(rid.pageNum, page.get() + offset);
+                return -1;
+            }
+            zoneMap->addTombstones(rid.pageNum, 1);
+            shiftRecords(page.get(), offset + length, -length);
+            const unsigned short pageNum_t = rid_t.pageNum + TOMBSTONE_MARKER; // offset stores pageNum
+            const unsigned short slotNum_t = rid_t.slotNum + TOMBSTONE_MARKER; // length stores slotNum
+            memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), &pageNum_t, SHORT_SIZE);
+            memcpy(page.get() + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE), &slotNum_t, SHORT_SIZE);
+        }
 
+        unsigned short freeSpace;
         fileHandle.writePage(rid.pageNum, page.get());
+        memcpy(&freeSpace, page.get() + PAGE_SIZE - 1 * SHORT_SIZE, SHORT_SIZE);
+        fileHandle.setFreeSpace(rid.pageNum, freeSpace);
+        return 0;
+    }
+
+    RC RecordBasedFileManager::updateForwarded(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                               char *record, unsigned short recordSize, const RID &rid, char *page,
+                                               const RID &target) {
+        ZoneMap *zoneMap = getZoneMap(fileHandle, recordDescriptor);
+        unsigned short freeSpace;
+        memcpy(&freeSpace, page + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+
+        // The home page has room again: the record moves back and the tombstone is gone
+        if (recordSize <= freeSpace) {
+            unsigned short oldSize;
+            if (removeForwarded(fileHandle, recordDescriptor, target, nullptr, oldSize)) {
+                return -1;
+            }
+            placeRecordAt(page, rid.slotNum, record, recordSize);
+            zoneMap->add(rid.pageNum, record);
+            zoneMap->addTombstones(rid.pageNum, -1);
+            fileHandle.writePage(rid.pageNum, page);
+            memcpy(&freeSpace, page + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            return fileHandle.setFreeSpace(rid.pageNum, freeSpace);
+        }
+
+        // Otherwise the record stays away from home, still marked as reached through the tombstone
+        const unsigned short flags = RECORD_FORWARDED;
+        memcpy(record, &flags, SHORT_SIZE);
+        const std::unique_ptr<char[]> targetPage(new char[PAGE_SIZE]);
+        if (fileHandle.readPage(target.pageNum, targetPage.get())) {
+            return -1;
+        }
+        unsigned short offset, length;
+        memcpy(&offset, targetPage.get() + PAGE_SIZE - SLOT_SIZE - target.slotNum * SLOT_SIZE, SHORT_SIZE);
+        memcpy(&length, targetPage.get() + PAGE_SIZE - SLOT_SIZE - target.slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+        if (length == 0 || length >= TOMBSTONE_MARKER) {
+            return -1;
+        }
+        const std::vector<char> oldRecord(targetPage.get() + offset, targetPage.get() + offset + length);
+        if (resizeRecord(targetPage.get(), target.slotNum, record, recordSize)) {
+            zoneMap->remove(target.pageNum, oldRecord.data());
+            zoneMap->add(target.pageNum, record);
+            fileHandle.writePage(target.pageNum, targetPage.get());
+            memcpy(&freeSpace, targetPage.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            return fileHandle.setFreeSpace(target.pageNum, freeSpace);
+        }
+
+        // Neither page holds it: move it once more and point the tombstone at the new place, never at the old one
+        RID rid_t;
+        if (insertStored(fileHandle, recordDescriptor, record, recordSize, rid_t)) {
+            return -1;
+        }
+        unsigned short oldSize;
+        if (removeForwarded(fileHandle, recordDescriptor, target, nullptr, oldSize)) {
+            return -1;
+        }
+        const unsigned short pageNum_t = rid_t.pageNum + TOMBSTONE_MARKER; // offset stores pageNum
+        const unsigned short slotNum_t = rid_t.slotNum + TOMBSTONE_MARKER; // length stores slotNum
+        memcpy(page + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE, &pageNum_t, SHORT_SIZE);
+        memcpy(page + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE + SHORT_SIZE, &slotNum_t, SHORT_SIZE);
+        return fileHandle.writePage(rid.pageNum, page);
+    }
+
+    bool RecordBasedFileManager::resizeRecord(char *page, unsigned short slotNum, const char *record,
+                                              unsigned short recordSize) {
+        unsigned short offset, length, freeSpace;
+        memcpy(&offset, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE, SHORT_SIZE);
+        memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+        memcpy(&freeSpace, page + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+        if (recordSize > length && recordSize - length > freeSpace) {
+            return false;
+        }
+        if (recordSize < length) {
+            memcpy(page + offset, record, recordSize);
+            shiftRecords(page, offset + length, (int) recordSize - length);
+        } else {
+            shiftRecords(page, offset + length, (int) recordSize - length);
+            memcpy(page + offset, record, recordSize);
+        }
+        memcpy(page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE + SHORT_SIZE, &recordSize, SHORT_SIZE);
+        return true;
+    }
+
+    RC RecordBasedFileManager::removeForwarded(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                               const RID &rid, char *record, unsigned short &recordSize) {
+        const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
+        if (fileHandle.readPage(rid.pageNum, page.get())) {
+            return -1;
+        }
+        unsigned short offset, length;
+        memcpy(&offset, page.get() + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE, SHORT_SIZE);
+        memcpy(&length, page.get() + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+        if (length == 0 || length >= TOMBSTONE_MARKER) {
+            return -1;
+        }
+        if (record != nullptr) {
+            memcpy(record, page.get() + offset, length);
+        }
+        recordSize = length;
+        getZoneMap(fileHandle, recordDescriptor)->remove(rid.pageNum, page.get() + offset);
+        shiftRecords(page.get(), offset + length, -length);
+        const unsigned short empty = 0;
+        memcpy(page.get() + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE, &empty, SHORT_SIZE);
+        memcpy(page.get() + PAGE_SIZE - SLOT_SIZE - rid.slotNum * SLOT_SIZE + SHORT_SIZE, &empty, SHORT_SIZE);
+
+        unsigned short freeSpace;
+        memcpy(&freeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+        if (fileHandle.writePage(rid.pageNum, page.get())) {
+            return -1;
+        }
+        return fileHandle.setFreeSpace(rid.pageNum, freeSpace);
+    }
+
+    RC RecordBasedFileManager::migrateBack(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                           PageNum pageNum, char *page) {
+        const unsigned short numberOfSlots = getTotalSlots(page);
+        ZoneMap *zoneMap = nullptr;
+        char record[PAGE_SIZE];
+        for (unsigned short slotNum = 1; slotNum <= numberOfSlots; slotNum++) {
+            unsigned short offset, length, freeSpace;
+            memcpy(&offset, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE, SHORT_SIZE);
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            memcpy(&freeSpace, page + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            if (length < TOMBSTONE_MARKER || freeSpace <= RECORD_HEADER_SIZE) {
+                continue;
+            }
+            RID rid_t;
+            rid_t.pageNum = offset - TOMBSTONE_MARKER;
+            rid_t.slotNum = length - TOMBSTONE_MARKER;
+            if (rid_t.pageNum == pageNum) {
+                continue;
+            }
+
+            // Look at the size first, most forwarded records will not fit
+            const char *targetPage = fileHandle.pinPage(rid_t.pageNum);
+            if (targetPage == nullptr) {
+                return -1;
+            }
+            unsigned short recordSize;
+            memcpy(&recordSize, targetPage + PAGE_SIZE - SLOT_SIZE - rid_t.slotNum * SLOT_SIZE + SHORT_SIZE,
+                   SHORT_SIZE);
+            fileHandle.unpinPage(rid_t.pageNum, false);
+            if (recordSize == 0 || recordSize >= TOMBSTONE_MARKER || recordSize > freeSpace) {
+                continue;
+            }
+
+            if (removeForwarded(fileHandle, recordDescriptor, rid_t, record, recordSize)) {
+                return -1;
+            }
+            const unsigned short flags = 0;
+            memcpy(record, &flags, SHORT_SIZE);
+            placeRecordAt(page, slotNum, record, recordSize);
+            if (zoneMap == nullptr) {
+                zoneMap = getZoneMap(fileHandle, recordDescriptor);
+            }
+            zoneMap->add(pageNum, record);
+            zoneMap->addTombstones(pageNum, -1);
+        }
+        return 0;
+    }
+
+    RC RecordBasedFileManager::vacuum(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                      unsigned numPages) {
+        if (fileHandle.file == nullptr) {
+            return -1;
+        }
+        PageNum pageNum = 0;
+        if (numPages > 0) {
+            std::lock_guard<std::mutex> guard(vacuumLatch);
+            pageNum = vacuumCursors[fileHandle.file->fileId];
+        }
+        const PageNum numberOfPages = fileHandle.getNumberOfPages();
+        const PageNum end = numPages == 0 ? numberOfPages : std::min(numberOfPages, pageNum + numPages);
+
+        const std::unique_ptr<char[]> page(new char[PAGE_SIZE]);
+        const std::unique_ptr<char[]> original(new char[PAGE_SIZE]);
+        for (; pageNum < end; pageNum++) {
+            if (fileHandle.readPage(pageNum, page.get())) {
+                return -1;
+            }
+            memcpy(original.get(), page.get(), PAGE_SIZE);
+            if (migrateBack(fileHandle, recordDescriptor, pageNum, page.get())) {
+                return -1;
+            }
+            compactPage(page.get());
+            // Only pages that changed are written, the free space map gets every page
+            if (memcmp(original.get(), page.get(), PAGE_SIZE) != 0 && fileHandle.writePage(pageNum, page.get())) {
+                return -1;
+            }
+            unsigned short freeSpace;
+            memcpy(&freeSpace, page.get() + PAGE_SIZE - SHORT_SIZE, SHORT_SIZE);
+            if (fileHandle.setFreeSpace(pageNum, freeSpace)) {
+                return -1;
+            }
+        }
+
+        // A finished pass drops the pages without slots at the end, no RID can point into them
+        if (pageNum >= numberOfPages) {
+            PageNum last = numberOfPages;
+            while (last > 0) {
+                const char *lastPage = fileHandle.pinPage(last - 1);
+                if (lastPage == nullptr) {
+                    return -1;
+                }
+                const unsigned numberOfSlots = getTotalSlots(lastPage);
+                fileHandle.unpinPage(last - 1, false);
+                if (numberOfSlots > 0) {
+                    break;
+                }
+                last--;
+            }
+            if (fileHandle.truncate(last)) {
+                return -1;
+            }
+            pageNum = 0;
+        }
+        if (numPages > 0) {
+            std::lock_guard<std::mutex> guard(vacuumLatch);
+            vacuumCursors[fileHandle.file->fileId] = pageNum;
+        }
         return 0;
     }
 
+    void RecordBasedFileManager::compactPage(char *page) {
+        unsigned short numberOfSlots;
+        memcpy(&numberOfSlots, page + PAGE_SIZE - SLOT_SIZE, SHORT_SIZE);
+
+        // Unused slots at the end of the directory are not part of any RID
+        while (numberOfSlots > 0) {
+            unsigned short length;
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - numberOfSlots * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            if (length != 0) {
+                break;
+            }
+            numberOfSlots--;
+        }
+
+        // Move the records down in the order they are on the page, so none is overwritten before it moved
+        std::vector<std::pair<unsigned short, unsigned short>> records;      // (offset, slot)
+        for (unsigned short slotNum = 1; slotNum <= numberOfSlots; slotNum++) {
+            unsigned short offset, length;
+            memcpy(&offset, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE, SHORT_SIZE);
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            if (length != 0 && length < TOMBSTONE_MARKER) {
+                records.emplace_back(offset, slotNum);
+            }
+        }
+        std::sort(records.begin(), records.end());
+        unsigned short endOfRecords = 0;
+        for (const auto &record : records) {
+            unsigned short length;
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - record.second * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            memmove(page + endOfRecords, page + record.first, length);
+            memcpy(page + PAGE_SIZE - SLOT_SIZE - record.second * SLOT_SIZE, &endOfRecords, SHORT_SIZE);
+            endOfRecords += length;
+        }
+
+        const unsigned short freeSpace = PAGE_SIZE - SLOT_SIZE - numberOfSlots * SLOT_SIZE - endOfRecords;
+        memcpy(page + PAGE_SIZE - SLOT_SIZE, &numberOfSlots, SHORT_SIZE);
+        memcpy(page + PAGE_SIZE - SHORT_SIZE, &freeSpace, SHORT_SIZE);
+    }
+
     RC RecordBasedFileManager::readAttribute(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                              const RID &rid, const std::string &attributeName, void *data) {
-        char* page = new char[PAGE_SIZE];
-        fileHandle.readPage(rid.pageNum, page);
+        char* page;
+        if (fileHandle.pinPage(rid.pageNum, page)) {
+            return -1;
+        }
         unsigned short offset, length;
         memcpy(&offset, page + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE), SHORT_SIZE);
         memcpy(&length, page + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE), SHORT_SIZE);
         // reading a tombstone attribute
         if (length >= TOMBSTONE_MARKER) {
+            fileHandle.unpinPage(rid.pageNum, false);
             RID rid_t;
             rid_t.pageNum = offset - TOMBSTONE_MARKER;
             rid_t.slotNum = length - TOMBSTONE_MARKER;
-            readAttribute(fileHandle, recordDescriptor, rid_t, attributeName, data);
-            return 0;
+            return readAttribute(fileHandle, recordDescriptor, rid_t, attributeName, data);
         }
         // reading a deleted slot
         if (length == 0) {
+            fileHandle.unpinPage(rid.pageNum, false);
             return -1;
         }
 
-        char* recordPtr = page + offset;
-        std::vector<bool> isNull = extractNullInformation(recordPtr, recordDescriptor);
-        unsigned nullIndicatorSize = (recordDescriptor.size() + 7) / 8;
+        // Find the field by name, then read it straight through the field directory
+        unsigned i = 0;
+        while (i < recordDescriptor.size() && recordDescriptor[i].name != attributeName) {
+            i++;
+        }
+        if (i == recordDescriptor.size()) {
+            fileHandle.unpinPage(rid.pageNum, false);
+            return -1;
+        }
 
-        // Copy the null-indicator bytes
-        char *dataPtr = recordPtr + nullIndicatorSize;
-        unsigned fieldSize = 0;
-        for (int i = 0; i < recordDescriptor.size(); ++i) {
-            if (!isNull[i]) {
-                if (recordDescriptor[i].name == attributeName) {
-                    if (recordDescriptor[i].type == TypeVarChar) {
-                        int varcharLength = 0;
-                        memcpy(&varcharLength, dataPtr, sizeof(int));
-                        fieldSize = sizeof(int) + varcharLength;
-                    } else if (recordDescriptor[i].type == TypeInt) {
-                        fieldSize = sizeof(int);
-                    } else if (recordDescriptor[i].type == TypeReal) {
-                        fieldSize = sizeof(float);
-                    }
-                    char null = 0;
-                    memcpy(data, &null, 1);
-                    memcpy((char*)data+1, dataPtr, fieldSize);
-                    delete[] page;
-                    return 0;
-                }
-                else {
-                    if (recordDescriptor[i].type == TypeVarChar) {
-                        int varcharLength = 0;
-                        memcpy(&varcharLength, dataPtr, sizeof(int));
-                        fieldSize = sizeof(int) + varcharLength;
-                    } else if (recordDescriptor[i].type == TypeInt) {
-                        fieldSize = sizeof(int);
-                    } else if (recordDescriptor[i].type == TypeReal) {
-                        fieldSize = sizeof(float);
-                    }
-                }
-                dataPtr += fieldSize;
-            }
+        // The output is a one-field record: a null indicator byte, then the value unless it is null
+        char *out = (char*) data;
+        const char *value;
+        unsigned short valueLength;
+        if (!locateField(page + offset, i, value, valueLength)) {
+            out[0] = (char) 0x80;
+            return fileHandle.unpinPage(rid.pageNum, false);
+        }
+        out[0] = 0;
+        out++;
+        if (recordDescriptor[i].type == TypeVarChar) {
+            const unsigned varcharLength = valueLength;
+            memcpy(out, &varcharLength, NUM_SIZE);
+            out += NUM_SIZE;
         }
-        char null = 1;
-        memcpy(data, &null, 1);
-        delete[] page;
-        return -1;
+        memcpy(out, value, valueLength);
+        return fileHandle.unpinPage(rid.pageNum, false);
     }
 
     RC RBFM_ScanIterator::initializeScan(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
@@ -437,25 +869,75 @@ namespace PeterDB {
         this->conditionAttribute = conditionAttribute;
         this->compOp = compOp;
         this->value = value;
-        this->page = new char[PAGE_SIZE];
+        this->page = nullptr;
         this->pageNum = 0;
         this->slotNum = 0; // slotNum start from 1
         this->attributeNames = attributeNames;
         this->numberOfPages = 0;
         this->numberOfSlots = 0;
 
-        // read the first page
-        this->numberOfPages = fileHandle.getNumberOfPages();
-        if (numberOfPages > 0) {
-            if (fileHandle.readPage(0, page)) {
+        // Resolve the names to fields once, getNextRecord only follows the plan
+        auto fieldOf = [&](const std::string &name) {
+            for (unsigned i = 0; i < recordDescriptor.size(); i++) {
+                if (recordDescriptor[i].name == name) {
+                    return (int) i;
+                }
+            }
+            return -1;
+        };
+        projectedFields.clear();
+        for (const std::string &name : attributeNames) {
+            const int field = fieldOf(name);
+            if (field < 0) {
                 return -1;
             }
+            projectedFields.push_back(field);
         }
-        // Get number of slots on first page
-        this->numberOfSlots = rbfm->getTotalSlots(page);
+        conditionField = -1;
+        if (!conditionAttribute.empty() && compOp != NO_OP) {
+            conditionField = fieldOf(conditionAttribute);
+            if (conditionField < 0) {
+                return -1;
+            }
+        }
+        outputNullIndicatorSize = (attributeNames.size() + 7) / 8;
+        record.resize(PAGE_SIZE);
+
+        this->zoneMap = conditionField >= 0 ? rbfm->getZoneMap(this->fileHandle, recordDescriptor) : nullptr;
+        this->numberOfPages = fileHandle.getNumberOfPages();
+        this->recordSize = 0;
+        return setPageRange(0, numberOfPages);
+    }
 
+    RC RBFM_ScanIterator::setPageRange(PageNum first, PageNum end) {
+        if (page != nullptr) {
+            fileHandle.unpinPage(pageNum, false);
+            page = nullptr;
+        }
+        pageNum = first;
+        endPage = std::min(end, numberOfPages);
+        slotNum = 0; // slotNum start from 1
+        numberOfSlots = 0;
+
+        // pin the first page, unless its zone rules the condition out
+        if (first < endPage && (zoneMap == nullptr || zoneMap->mayMatch(first, conditionField, compOp, value))) {
+            page = fileHandle.pinPage(first);
+            if (page == nullptr) {
+                return -1;
+            }
+            if (zoneMap != nullptr) {
+                zoneMap->summarize(first, page);
+            }
+            // Get number of slots on first page
+            numberOfSlots = rbfm->getTotalSlots(page);
+        }
         return 0;
     }
+
+    unsigned RBFM_ScanIterator::getRecordSize() const {
+        return recordSize;
+    }
+
     RC RecordBasedFileManager::scan(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                     const std::string &conditionAttribute, const CompOp compOp, const void *value,
                                     const std::vector<std::string> &attributeNames,
@@ -464,95 +946,85 @@ namespace PeterDB {
     }
 
     RC RBFM_ScanIterator::getNextRecord(RID &rid, void *data) {
-        if (getNextSlot() == RBFM_EOF) {
-            return RBFM_EOF;
-        }
-
-        rid.pageNum = pageNum;
-        rid.slotNum = slotNum;
-        // Not returning any result
-        if (attributeNames.empty()) {
-            return -2;
-        }
+        // Move past deleted slots and records that do not satisfy the condition
+        while (true) {
+            if (getNextSlot() == RBFM_EOF) {
+                return RBFM_EOF;
+            }
 
-        char* record = new char[PAGE_SIZE];
-        rbfm->readNextRecord(fileHandle, rid, page, record);
+            rid.pageNum = pageNum;
+            rid.slotNum = slotNum;
+            // Deleted slot or a record returned through its tombstone, nothing to return
+            if (rbfm->readNextRecord(fileHandle, rid, page, record.data())) {
+                continue;
+            }
 
-        // Two passes over record
-        // 1. Check for conditionAttribute
-        if (!conditionAttribute.empty()) {
-            // no matching record
-            if (!checkCondition(record, recordDescriptor)) {
-                delete[] record;
-//                return getNextRecord(rid, data);
-                return -2;
+            if (conditionField < 0 || checkCondition()) {
+                break;
             }
         }
-        // 2. Extract Attribute in attributeNames
-        extractAttributesAndNullBits(recordDescriptor, attributeNames, record, data);
-        delete[] record;
+        recordSize = data != nullptr ? project(data) : 0;
         return 0;
     }
 
     RC RBFM_ScanIterator::close() {
-        free(page);
+        if (page != nullptr) {
+            fileHandle.unpinPage(pageNum, false);
+            page = nullptr;
+        }
         return 0;
     }
 
     RC RBFM_ScanIterator::getNextSlot() {
         slotNum++;
-        if (slotNum > numberOfSlots) {
+        // Move on to the next page that has slots
+        while (slotNum > numberOfSlots) {
+            if (page != nullptr) {
+                fileHandle.unpinPage(pageNum, false);
+                page = nullptr;
+            }
             pageNum++;
-            if (pageNum >= numberOfPages) {
+            // Pages whose zone rules the condition out are skipped without being read
+            while (zoneMap != nullptr && pageNum < endPage
+                   && !zoneMap->mayMatch(pageNum, conditionField, compOp, value)) {
+                pageNum++;
+            }
+            if (pageNum >= endPage) {
                 return RBFM_EOF;
             }
-            fileHandle.readPage(pageNum, page);
+            page = fileHandle.pinPage(pageNum);
+            if (page == nullptr) {
+                return RBFM_EOF;
+            }
+            if (zoneMap != nullptr) {
+                zoneMap->summarize(pageNum, page);
+            }
             slotNum = 1;
             numberOfSlots = rbfm->getTotalSlots(page);
         }
         return 0;
     }
 
-    bool RBFM_ScanIterator::checkCondition(void* data, std::vector<Attribute> &recordDescriptor) {
-        std::vector<bool> isNull = rbfm->extractNullInformation((char*)data, recordDescriptor);
-        unsigned nullIndicatorSize = (recordDescriptor.size() + 7) / 8;
-        char* dataPtr = (char*) data + nullIndicatorSize; // Skip Null for now
-
-        for (int i = 0; i < recordDescriptor.size(); i++) {
-            if (!isNull[i]) {
-                if (recordDescriptor[i].name == conditionAttribute) {
-                    if (recordDescriptor[i].type == TypeInt) {
-                        int num;
-                        memcpy(&num, dataPtr, sizeof(int));
-                        return compareInt(num, value, compOp);
-                    }
-                    else if (recordDescriptor[i].type == TypeReal) {
-                        float real;
-                        memcpy(&real, dataPtr, sizeof(float));
-                        return compareReal(real, value, compOp);
-                    }
-                    else if (recordDescriptor[i].type == TypeVarChar) {
-                        int length;
-                        memcpy(&length, dataPtr, sizeof(int));
-                        dataPtr += sizeof(int);
-                        char* str = new char[length + 1];
-                        memcpy(str, dataPtr, length);
-                        str[length] = '\0';
-                        bool result = compareVarchar(str, value, compOp);
-                        delete[] str; // Avoid memory leak
-                        return result;
-                    }
-                }
-                else {
-                    if (recordDescriptor[i].type == TypeVarChar) {
-                        int varcharLength = 0;
-                        memcpy(&varcharLength, dataPtr, sizeof(int));
-                        dataPtr += sizeof(int) + varcharLength;
-                    } else {
-                        dataPtr += sizeof(int);
-                    }
-                }
+    bool RBFM_ScanIterator::checkCondition() {
+        const char *field;
+        unsigned short length;
+        if (!RecordBasedFileManager::locateField(record.data(), conditionField, field, length)) {
+            // null satisfies no comparison
+            return false;
+        }
+        switch (recordDescriptor[conditionField].type) {
+            case TypeInt: {
+                int num;
+                memcpy(&num, field, sizeof(int));
+                return compareInt(num, value, compOp);
             }
+            case TypeReal: {
+                float real;
+                memcpy(&real, field, sizeof(float));
+                return compareReal(real, value, compOp);
+            }
+            case TypeVarChar:
+                return compareVarchar(field, length, value, compOp);
         }
         return false;
     }
@@ -595,19 +1067,17 @@ namespace PeterDB {
         return false;
     }
 
-    bool RBFM_ScanIterator::compareVarchar(char* str, const void *newValue, CompOp compareOp) {
+    bool RBFM_ScanIterator::compareVarchar(const char* str, unsigned length, const void *newValue, CompOp compareOp) {
         if (compOp == NO_OP) {
             return true;
         }
 
-        int length;
-        memcpy(&length, (char*)newValue, sizeof(int));
-        char* valStr = new char[length + 1];
-        memcpy(valStr, (char*)newValue + sizeof(int), length);
-        valStr[length] = '\0';
-
-        int result = strcmp(str, valStr);
-        delete[] valStr;
+        unsigned valueLength;
+        memcpy(&valueLength, newValue, sizeof(unsigned));
+        int result = memcmp(str, (const char*)newValue + sizeof(unsigned), std::min(length, valueLength));
+        if (result == 0) {
+            result = (length > valueLength) - (length < valueLength);
+        }
 
         switch (compareOp) {
             case EQ_OP: return result == 0;
@@ -622,70 +1092,163 @@ namespace PeterDB {
         return false; // Default case
     }
 
-    void RBFM_ScanIterator::extractAttributesAndNullBits(const std::vector<Attribute> &recordDescriptor,
-            const std::vector<std::string> &attributeNames, const char *record, void *data) {
-        std::vector<bool> nullBits;
-        std::vector<int> attributeIndexes;
-        unsigned newNullIndicatorSize = (recordDescriptor.size() + 7) / 8;
-        std::vector<unsigned char> newNullIndicator(newNullIndicatorSize, 0);
-
-        // Temporary buffer to store extracted attributes before knowing the exact output size
-        std::vector<char> tempBuffer;
-
-        // Calculate the size of the original null indicator
-        size_t nullIndicatorSize = (recordDescriptor.size() + 7) / 8;
-        const char* currentPtr = record + nullIndicatorSize; // Start reading attributes after the null indicator
-
-        for (int i = 0; i < recordDescriptor.size(); ++i) {
-            bool isTargetAttribute = std::find(attributeNames.begin(), attributeNames.end(), recordDescriptor[i].name) != attributeNames.end();
-            int byteIndex = i / 8;
-            int bitIndex = i % 8;
-            bool isNull = record[byteIndex] & (1 << (7 - bitIndex));
-
-            if (isTargetAttribute) {
-                size_t indexInTarget = std::distance(attributeNames.begin(), std::find(attributeNames.begin(), attributeNames.end(), recordDescriptor[i].name));
-                if (!isNull) {
-                    // Extract attribute value
-                    switch (recordDescriptor[i].type) {
-                        case TypeInt:
-                        case TypeReal: {
-                            tempBuffer.insert(tempBuffer.end(), currentPtr, currentPtr + 4);
-                            currentPtr += 4;
-                            break;
-                        }
-                        case TypeVarChar: {
-                            int length;
-                            std::memcpy(&length, currentPtr, sizeof(int));
-                            tempBuffer.insert(tempBuffer.end(), currentPtr, currentPtr + 4 + length);
-                            currentPtr += 4 + length;
-                            break;
-                        }
-                    }
+    unsigned RBFM_ScanIterator::project(void *data) {
+        // Output attributes follow attributeNames, with a null indicator sized for them
+        char *out = (char*) data;
+        memset(out, 0, outputNullIndicatorSize);
+        char *dataPtr = out + outputNullIndicatorSize;
+        for (unsigned i = 0; i < projectedFields.size(); i++) {
+            const unsigned field = projectedFields[i];
+            const char *value;
+            unsigned short length;
+            if (!RecordBasedFileManager::locateField(record.data(), field, value, length)) {
+                out[i / 8] |= (char) (1 << (7 - i % 8));
+                continue;
+            }
+            if (recordDescriptor[field].type == TypeVarChar) {
+                const unsigned varcharLength = length;
+                memcpy(dataPtr, &varcharLength, sizeof(unsigned));
+                dataPtr += sizeof(unsigned);
+            }
+            memcpy(dataPtr, value, length);
+            dataPtr += length;
+        }
+        return dataPtr - out;
+    }
+
+    RBFM_ParallelScanIterator::RBFM_ParallelScanIterator()
+            : nextMorsel(0), numberOfPages(0), stopping(false), runningWorkers(0), position(0) {
+    }
+
+    RBFM_ParallelScanIterator::~RBFM_ParallelScanIterator() {
+        close();
+    }
+
+    RC RBFM_ParallelScanIterator::initializeScan(FileHandle &fileHandle,
+                                                 const std::vector<Attribute> &recordDescriptor,
+                                                 const std::string &conditionAttribute,
+                                                 const CompOp compOp,
+                                                 const void *value,
+                                                 const std::vector<std::string> &attributeNames,
+                                                 unsigned numWorkers) {
+        close();
+        if (numWorkers == 0) {
+            numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        numberOfPages = fileHandle.getNumberOfPages();
+        // no point in workers that would never get a morsel
+        numWorkers = std::max(1u, std::min(numWorkers, (numberOfPages + SCAN_MORSEL_PAGES - 1) / SCAN_MORSEL_PAGES));
+
+        // every worker plans the scan on its own, the morsels are handed out once they all could
+        scans.resize(numWorkers);
+        for (RBFM_ScanIterator &scan : scans) {
+            if (scan.initializeScan(fileHandle, recordDescriptor, conditionAttribute, compOp, value, attributeNames)) {
+                close();
+                return -1;
+            }
+            scan.setPageRange(0, 0);
+        }
+        nextMorsel = 0;
+        stopping = false;
+        runningWorkers = numWorkers;
+        for (unsigned i = 0; i < numWorkers; i++) {
+            workers.emplace_back(&RBFM_ParallelScanIterator::work, this, i);
+        }
+        return 0;
+    }
+
+    void RBFM_ParallelScanIterator::work(unsigned worker) {
+        RBFM_ScanIterator &scan = scans[worker];
+        Batch batch;
+        batch.offsets.push_back(0);
+        bool queued = true;
+        while (queued && !stopping) {
+            const PageNum first = nextMorsel.fetch_add(SCAN_MORSEL_PAGES);
+            if (first >= numberOfPages || scan.setPageRange(first, first + SCAN_MORSEL_PAGES)) {
+                break;
+            }
+            RID rid;
+            while (queued) {
+                // keep room for the largest projected record past the last one
+                const size_t end = batch.offsets.back();
+                if (batch.data.size() < end + 2 * PAGE_SIZE) {
+                    batch.data.resize(end + 2 * PAGE_SIZE);
                 }
-                // Set null bit in new null indicator
-                if (isNull) {
-                    newNullIndicator[indexInTarget / 8] |= (1 << (7 - (indexInTarget % 8)));
+                if (scan.getNextRecord(rid, batch.data.data() + end) == RBFM_EOF) {
+                    break;
                 }
-            } else {
-                // Skip this attribute
-                if (!isNull) {
-                    switch (recordDescriptor[i].type) {
-                        case TypeInt:
-                        case TypeReal:
-                            currentPtr += 4;
-                            break;
-                        case TypeVarChar:
-                            int length;
-                            std::memcpy(&length, currentPtr, sizeof(int));
-                            currentPtr += 4 + length;
-                            break;
-                    }
+                batch.rids.push_back(rid);
+                batch.offsets.push_back(end + scan.getRecordSize());
+                if (batch.rids.size() >= SCAN_BATCH_RECORDS) {
+                    queued = push(batch);
                 }
             }
         }
-        // Copy the temporary buffer and new null indicator to the output
-        std::memcpy(data, newNullIndicator.data(), newNullIndicatorSize);
-        std::memcpy((char*)data + newNullIndicatorSize, tempBuffer.data(), tempBuffer.size());
+        if (queued && !batch.rids.empty()) {
+            push(batch);
+        }
+        scan.close();
+
+        std::lock_guard<std::mutex> guard(latch);
+        runningWorkers--;
+        ready.notify_all();
+    }
+
+    bool RBFM_ParallelScanIterator::push(Batch &batch) {
+        std::unique_lock<std::mutex> guard(latch);
+        space.wait(guard, [&] { return stopping || batches.size() < SCAN_QUEUED_BATCHES * scans.size(); });
+        if (stopping) {
+            return false;
+        }
+        batch.data.resize(batch.offsets.back());
+        batches.push_back(std::move(batch));
+        ready.notify_one();
+
+        batch = Batch();
+        batch.offsets.push_back(0);
+        return true;
+    }
+
+    RC RBFM_ParallelScanIterator::getNextRecord(RID &rid, void *data) {
+        if (position >= current.rids.size()) {
+            std::unique_lock<std::mutex> guard(latch);
+            ready.wait(guard, [&] { return !batches.empty() || runningWorkers == 0; });
+            if (batches.empty()) {
+                return RBFM_EOF;
+            }
+            current = std::move(batches.front());
+            batches.pop_front();
+            position = 0;
+            space.notify_one();
+        }
+        rid = current.rids[position];
+        if (data != nullptr) {
+            memcpy(data, current.data.data() + current.offsets[position],
+                   current.offsets[position + 1] - current.offsets[position]);
+        }
+        position++;
+        return 0;
+    }
+
+    RC RBFM_ParallelScanIterator::close() {
+        {
+            std::lock_guard<std::mutex> guard(latch);
+            stopping = true;
+            space.notify_all();
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        for (RBFM_ScanIterator &scan : scans) {
+            scan.close();
+        }
+        scans.clear();
+        batches.clear();
+        current = Batch();
+        position = 0;
+        runningWorkers = 0;
+        return 0;
     }
 
 
@@ -705,43 +1268,113 @@ namespace PeterDB {
         return isNull;
     }
 
-    unsigned RecordBasedFileManager::getRecordSize(const void *data, const std::vector<Attribute> &recordDescriptor, std::vector<bool> &isNull) {
+    unsigned RecordBasedFileManager::getStoredSize(const void *data, const std::vector<Attribute> &recordDescriptor) {
         const unsigned fieldSize = recordDescriptor.size();
         const unsigned nullIndicatorSize = (fieldSize + 7) / 8;
-        unsigned recordSize = nullIndicatorSize; // Start with the size of the null indicator (in number of bytes)
+        unsigned recordSize = RECORD_HEADER_SIZE + fieldSize * SHORT_SIZE + nullIndicatorSize;
 
-        const char* dataPtr = static_cast<const char*>(data) + nullIndicatorSize;
+        const char *nullIndicator = static_cast<const char*>(data);
+        const char *dataPtr = nullIndicator + nullIndicatorSize;
+        for (unsigned i = 0; i < fieldSize; i++) {
+            if (nullIndicator[i / 8] & (1 << (7 - i % 8))) {
+                continue;
+            }
+            // VarChar lengths are not stored, the field directory gives them
+            unsigned length = NUM_SIZE;
+            if (recordDescriptor[i].type == TypeVarChar) {
+                memcpy(&length, dataPtr, NUM_SIZE);
+                dataPtr += NUM_SIZE;
+            }
+            recordSize += length;
+            dataPtr += length;
+        }
+        return recordSize;
+    }
 
+    unsigned short RecordBasedFileManager::encodeRecord(const void *data, const std::vector<Attribute> &recordDescriptor,
+                                                        unsigned short flags, char *record) {
+        const unsigned short fieldSize = recordDescriptor.size();
+        const unsigned nullIndicatorSize = (fieldSize + 7) / 8;
+        memcpy(record, &flags, SHORT_SIZE);
+        memcpy(record + SHORT_SIZE, &fieldSize, SHORT_SIZE);
+        char *directory = record + RECORD_HEADER_SIZE;
+        memcpy(directory + fieldSize * SHORT_SIZE, data, nullIndicatorSize);
+
+        const char *nullIndicator = static_cast<const char*>(data);
+        const char *dataPtr = nullIndicator + nullIndicatorSize;
+        unsigned short end = RECORD_HEADER_SIZE + fieldSize * SHORT_SIZE + nullIndicatorSize;
         for (unsigned i = 0; i < fieldSize; i++) {
-            if (!isNull[i]) {
-                switch (recordDescriptor[i].type) {
-                    // For VarChar, read the length, then add it to the size of the length field itself
-                    case TypeVarChar: {
-                        const unsigned varcharLength = *reinterpret_cast<const unsigned*>(dataPtr);
-                        recordSize += NUM_SIZE + varcharLength;
-                        dataPtr += NUM_SIZE + varcharLength; // Move past this VarChar field
-                        break;
-                    }
-                    case TypeInt:
-                    case TypeReal:
-                        recordSize += NUM_SIZE;
-                        dataPtr += NUM_SIZE; // Move past this Int or Real field
-                        break;
+            if (!(nullIndicator[i / 8] & (1 << (7 - i % 8)))) {
+                unsigned length = NUM_SIZE;
+                if (recordDescriptor[i].type == TypeVarChar) {
+                    memcpy(&length, dataPtr, NUM_SIZE);
+                    dataPtr += NUM_SIZE;
                 }
+                memcpy(record + end, dataPtr, length);
+                dataPtr += length;
+                end += length;
             }
+            memcpy(directory + i * SHORT_SIZE, &end, SHORT_SIZE);
         }
-        return recordSize;
+        return end;
     }
 
-    unsigned RecordBasedFileManager::getTotalSlots(void *page) {
-        unsigned numSlots;
-        memcpy(&numSlots, (char*)page + PAGE_SIZE - 2 * SHORT_SIZE, SHORT_SIZE);
+    void RecordBasedFileManager::decodeRecord(const char *record, const std::vector<Attribute> &recordDescriptor,
+                                              void *data) {
+        const unsigned nullIndicatorSize = (recordDescriptor.size() + 7) / 8;
+        char *out = static_cast<char*>(data);
+        memset(out, 0, nullIndicatorSize);
+        char *dataPtr = out + nullIndicatorSize;
+        for (unsigned i = 0; i < recordDescriptor.size(); i++) {
+            const char *value;
+            unsigned short length;
+            if (!locateField(record, i, value, length)) {
+                out[i / 8] |= (char) (1 << (7 - i % 8));
+                continue;
+            }
+            if (recordDescriptor[i].type == TypeVarChar) {
+                const unsigned varcharLength = length;
+                memcpy(dataPtr, &varcharLength, NUM_SIZE);
+                dataPtr += NUM_SIZE;
+            }
+            memcpy(dataPtr, value, length);
+            dataPtr += length;
+        }
+    }
+
+    bool RecordBasedFileManager::locateField(const char *record, unsigned i, const char *&value,
+                                             unsigned short &length) {
+        unsigned short fieldSize;
+        memcpy(&fieldSize, record + SHORT_SIZE, SHORT_SIZE);
+        if (i >= fieldSize) {
+            return false;
+        }
+        const char *directory = record + RECORD_HEADER_SIZE;
+        const char *nullIndicator = directory + fieldSize * SHORT_SIZE;
+        if (nullIndicator[i / 8] & (1 << (7 - i % 8))) {
+            return false;
+        }
+        unsigned short start, end;
+        if (i == 0) {
+            start = RECORD_HEADER_SIZE + fieldSize * SHORT_SIZE + (fieldSize + 7) / 8;
+        } else {
+            memcpy(&start, directory + (i - 1) * SHORT_SIZE, SHORT_SIZE);
+        }
+        memcpy(&end, directory + i * SHORT_SIZE, SHORT_SIZE);
+        value = record + start;
+        length = end - start;
+        return true;
+    }
+
+    unsigned RecordBasedFileManager::getTotalSlots(const void *page) {
+        unsigned short numSlots;
+        memcpy(&numSlots, (const char*)page + PAGE_SIZE - 2 * SHORT_SIZE, SHORT_SIZE);
         return numSlots;
     }
 
     // given an rid, read the next record from *data into *record
-    RC RecordBasedFileManager::readNextRecord(FileHandle fileHandle, RID rid, void *data, void *record) {
-        char* page = (char*) data;
+    RC RecordBasedFileManager::readNextRecord(FileHandle fileHandle, RID rid, const void *data, void *record) {
+        const char* page = (const char*) data;
         unsigned short offset, length;
 
         memcpy(&offset, page + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE),
@@ -749,25 +1382,287 @@ namespace PeterDB {
         memcpy(&length,
                page + (PAGE_SIZE - 2 * SHORT_SIZE - rid.slotNum * 2 * SHORT_SIZE + SHORT_SIZE),
                SHORT_SIZE);
-        // read from a tombstone
-        if (length >= TOMBSTONE_MARKER) {
-            unsigned pageNum_t = offset - TOMBSTONE_MARKER;
-            unsigned slotNum_t = length - TOMBSTONE_MARKER;
-            RID rid_t;
-            rid_t.pageNum = pageNum_t;
-            rid_t.slotNum = slotNum_t;
-            char *temp_page = new char[PAGE_SIZE];
-            fileHandle.readPage(pageNum_t, temp_page);
-            readNextRecord(fileHandle, rid_t, temp_page, record);
-            delete[] temp_page;
-            return 0;
-        }
         // reading an empty slot
         if (length == 0) {
             return -1;
         }
-        memcpy(record, page + offset, length);
+        if (length < TOMBSTONE_MARKER) {
+            // a forwarded record is returned when the scan reaches its tombstone
+            unsigned short flags;
+            memcpy(&flags, page + offset, SHORT_SIZE);
+            if (flags & RECORD_FORWARDED) {
+                return -1;
+            }
+            memcpy(record, page + offset, length);
+            return 0;
+        }
+
+        // read from a tombstone, following it to the page the record lives on
+        PageNum pinned = 0;
+        bool isPinned = false;
+        while (length >= TOMBSTONE_MARKER) {
+            const PageNum pageNum_t = offset - TOMBSTONE_MARKER;
+            const unsigned short slotNum_t = length - TOMBSTONE_MARKER;
+            if (isPinned) {
+                fileHandle.unpinPage(pinned, false);
+            }
+            page = fileHandle.pinPage(pageNum_t);
+            if (page == nullptr) {
+                return -1;
+            }
+            pinned = pageNum_t;
+            isPinned = true;
+            memcpy(&offset, page + (PAGE_SIZE - 2 * SHORT_SIZE - slotNum_t * 2 * SHORT_SIZE), SHORT_SIZE);
+            memcpy(&length, page + (PAGE_SIZE - 2 * SHORT_SIZE - slotNum_t * 2 * SHORT_SIZE + SHORT_SIZE),
+                   SHORT_SIZE);
+        }
+        RC rc = -1;
+        if (length != 0) {
+            memcpy(record, page + offset, length);
+            rc = 0;
+        }
+        fileHandle.unpinPage(pinned, false);
+        return rc;
+    }
+
+    // A value as a zone bound: INT and REAL as they are, VarChar as its zero padded prefix
+    static void toZoneValue(AttrType type, const char *value, unsigned length, char *bound) {
+        memset(bound, 0, ZONE_PREFIX_SIZE);
+        memcpy(bound, value, type == TypeVarChar ? std::min(length, (unsigned) ZONE_PREFIX_SIZE) : NUM_SIZE);
+    }
+
+    static int compareZoneValues(AttrType type, const char *bound1, const char *bound2) {
+        switch (type) {
+            case TypeInt: {
+                int value1, value2;
+                memcpy(&value1, bound1, sizeof(int));
+                memcpy(&value2, bound2, sizeof(int));
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeReal: {
+                float value1, value2;
+                memcpy(&value1, bound1, sizeof(float));
+                memcpy(&value2, bound2, sizeof(float));
+                return (value1 > value2) - (value1 < value2);
+            }
+            case TypeVarChar:
+                return memcmp(bound1, bound2, ZONE_PREFIX_SIZE);
+        }
         return 0;
     }
+
+    ZoneMap::ZoneMap(const std::string &fileName) : fileName(fileName) {
+    }
+
+    const std::string &ZoneMap::getFileName() const {
+        return fileName;
+    }
+
+    RC ZoneMap::load(unsigned numberOfPages) {
+        std::lock_guard<std::mutex> guard(latch);
+        const std::string zoneFileName = fileName + ZONE_MAP_SUFFIX;
+        FILE *file = fopen(zoneFileName.c_str(), "rb");
+        if (file == nullptr) {
+            return -1;
+        }
+
+        // [numberOfPages][numberOfColumns][column types][page zones][column zones]
+        unsigned savedPages = 0, numberOfColumns = 0;
+        bool valid = fread(&savedPages, NUM_SIZE, 1, file) == 1 && fread(&numberOfColumns, NUM_SIZE, 1, file) == 1
+                     && savedPages == numberOfPages;
+        if (valid) {
+            types.resize(numberOfColumns);
+            pages.resize(savedPages);
+            columns.resize((size_t) savedPages * numberOfColumns);
+            valid = fread(types.data(), sizeof(AttrType), types.size(), file) == types.size()
+                    && fread(pages.data(), sizeof(PageZone), pages.size(), file) == pages.size()
+                    && fread(columns.data(), sizeof(ColumnZone), columns.size(), file) == columns.size();
+        }
+        fclose(file);
+
+        // The file changes from now on, if the map is not written back at close it must not be found again
+        ::remove(zoneFileName.c_str());
+        if (!valid) {
+            types.clear();
+            pages.clear();
+            columns.clear();
+            return -1;
+        }
+        return 0;
+    }
+
+    RC ZoneMap::save(unsigned numberOfPages) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (numberOfPages > 0) {
+            reserve(numberOfPages - 1);
+        }
+        pages.resize(numberOfPages);
+        columns.resize((size_t) numberOfPages * types.size());
+
+        const std::string zoneFileName = fileName + ZONE_MAP_SUFFIX;
+        FILE *file = fopen(zoneFileName.c_str(), "wb");
+        if (file == nullptr) {
+            return -1;
+        }
+        const unsigned numberOfColumns = types.size();
+        bool written = fwrite(&numberOfPages, NUM_SIZE, 1, file) == 1
+                       && fwrite(&numberOfColumns, NUM_SIZE, 1, file) == 1
+                       && fwrite(types.data(), sizeof(AttrType), types.size(), file) == types.size()
+                       && fwrite(pages.data(), sizeof(PageZone), pages.size(), file) == pages.size()
+                       && fwrite(columns.data(), sizeof(ColumnZone), columns.size(), file) == columns.size();
+        written = fclose(file) == 0 && written;
+        if (!written) {
+            ::remove(zoneFileName.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    void ZoneMap::setAttributes(const std::vector<Attribute> &recordDescriptor) {
+        std::lock_guard<std::mutex> guard(latch);
+        bool same = types.size() == recordDescriptor.size();
+        for (unsigned i = 0; same && i < types.size(); i++) {
+            same = types[i] == recordDescriptor[i].type;
+        }
+        if (same) {
+            return;
+        }
+        types.resize(recordDescriptor.size());
+        for (unsigned i = 0; i < types.size(); i++) {
+            types[i] = recordDescriptor[i].type;
+        }
+        pages.clear();
+        columns.clear();
+    }
+
+    void ZoneMap::reserve(PageNum pageNum) {
+        if (pageNum >= pages.size()) {
+            pages.resize(pageNum + 1, PageZone{0, false});
+            columns.resize((size_t) (pageNum + 1) * types.size(), ColumnZone());
+        }
+    }
+
+    void ZoneMap::addPage(PageNum pageNum) {
+        std::lock_guard<std::mutex> guard(latch);
+        reserve(pageNum);
+        pages[pageNum] = PageZone{0, true};
+        std::fill(columns.begin() + (size_t) pageNum * types.size(),
+                  columns.begin() + (size_t) (pageNum + 1) * types.size(), ColumnZone());
+    }
+
+    void ZoneMap::addRecord(PageNum pageNum, const char *record) {
+        for (unsigned i = 0; i < types.size(); i++) {
+            ColumnZone &zone = columns[(size_t) pageNum * types.size() + i];
+            const char *value;
+            unsigned short length;
+            if (!RecordBasedFileManager::locateField(record, i, value, length)) {
+                zone.nulls++;
+                continue;
+            }
+            char bound[ZONE_PREFIX_SIZE];
+            toZoneValue(types[i], value, length, bound);
+            if (zone.values == 0 || compareZoneValues(types[i], bound, zone.min) < 0) {
+                memcpy(zone.min, bound, ZONE_PREFIX_SIZE);
+            }
+            if (zone.values == 0 || compareZoneValues(types[i], bound, zone.max) > 0) {
+                memcpy(zone.max, bound, ZONE_PREFIX_SIZE);
+            }
+            zone.values++;
+        }
+    }
+
+    void ZoneMap::add(PageNum pageNum, const char *record) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (pageNum < pages.size() && pages[pageNum].known) {
+            addRecord(pageNum, record);
+        }
+    }
+
+    void ZoneMap::remove(PageNum pageNum, const char *record) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (pageNum >= pages.size() || !pages[pageNum].known) {
+            return;
+        }
+        // The bounds stay as they are, they still hold every remaining value
+        for (unsigned i = 0; i < types.size(); i++) {
+            ColumnZone &zone = columns[(size_t) pageNum * types.size() + i];
+            const char *value;
+            unsigned short length;
+            unsigned short &count = RecordBasedFileManager::locateField(record, i, value, length) ? zone.values
+                                                                                                  : zone.nulls;
+            if (count > 0) {
+                count--;
+            }
+        }
+    }
+
+    void ZoneMap::addTombstones(PageNum pageNum, int delta) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (pageNum < pages.size() && pages[pageNum].known) {
+            pages[pageNum].tombstones = (unsigned short) std::max(0, pages[pageNum].tombstones + delta);
+        }
+    }
+
+    void ZoneMap::summarize(PageNum pageNum, const char *page) {
+        std::lock_guard<std::mutex> guard(latch);
+        reserve(pageNum);
+        if (pages[pageNum].known) {
+            return;
+        }
+        std::fill(columns.begin() + (size_t) pageNum * types.size(),
+                  columns.begin() + (size_t) (pageNum + 1) * types.size(), ColumnZone());
+        unsigned short numberOfSlots, tombstones = 0;
+        memcpy(&numberOfSlots, page + PAGE_SIZE - SLOT_SIZE, SHORT_SIZE);
+        for (unsigned short i = 1; i <= numberOfSlots; i++) {
+            unsigned short offset, length;
+            memcpy(&offset, page + PAGE_SIZE - SLOT_SIZE - i * SLOT_SIZE, SHORT_SIZE);
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - i * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+            if (length >= TOMBSTONE_MARKER) {
+                tombstones++;
+            } else if (length != 0) {
+                addRecord(pageNum, page + offset);
+            }
+        }
+        pages[pageNum] = PageZone{tombstones, true};
+    }
+
+    bool ZoneMap::mayMatch(PageNum pageNum, unsigned field, CompOp compOp, const void *value) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (compOp == NO_OP || value == nullptr || field >= types.size() || pageNum >= pages.size()
+            || !pages[pageNum].known || pages[pageNum].tombstones > 0) {
+            return true;
+        }
+        // null satisfies no comparison
+        const ColumnZone &zone = columns[(size_t) pageNum * types.size() + field];
+        if (zone.values == 0) {
+            return false;
+        }
+
+        const AttrType type = types[field];
+        const char *valuePtr = (const char*) value;
+        char bound[ZONE_PREFIX_SIZE];
+        if (type == TypeVarChar) {
+            unsigned length;
+            memcpy(&length, valuePtr, NUM_SIZE);
+            toZoneValue(type, valuePtr + NUM_SIZE, length, bound);
+        } else {
+            toZoneValue(type, valuePtr, NUM_SIZE, bound);
+        }
+        const int low = compareZoneValues(type, zone.min, bound);
+        const int high = compareZoneValues(type, zone.max, bound);
+
+        // VarChar bounds are prefixes, equal prefixes decide nothing about strict comparisons
+        const bool exact = type != TypeVarChar;
+        switch (compOp) {
+            case EQ_OP: return low <= 0 && high >= 0;
+            case LT_OP: return exact ? low < 0 : low <= 0;
+            case LE_OP: return low <= 0;
+            case GT_OP: return exact ? high > 0 : high >= 0;
+            case GE_OP: return high >= 0;
+            case NE_OP: return !exact || low != 0 || high != 0;
+            case NO_OP: return true;
+        }
+        return true;
+    }
 } // namespace PeterDB
 
@@ -2,6 +2,8 @@
 
 #include <cstring>
 #include <cmath>
+#include <memory>
+#include <algorithm>
 
 namespace PeterDB {
     RelationManager &RelationManager::instance() {
@@ -9,13 +11,24 @@ namespace PeterDB {
         return _relation_manager;
     }
 
-    RelationManager::RelationManager() = default;
+    RelationManager::RelationManager(): catalogVersion(0) {
+        // Construct the file managers first so that they outlive the tables cached here
+        PagedFileManager::instance();
+        RecordBasedFileManager::instance();
+        createTablesRecordDescriptor(tableDescriptor);
+        createColumnsRecordDescriptor(columnDescriptor);
+        createIndexesRecordDescriptor(indexDescriptor);
+    }
 
-    RelationManager::~RelationManager() = default;
+    RelationManager::~RelationManager() {
+        closeCachedTables();
+    }
 
-    RelationManager::RelationManager(const RelationManager &) = default;
+    RelationManager::RelationManager(const RelationManager &): catalogVersion(0) {}
 
-    RelationManager &RelationManager::operator=(const RelationManager &) = default;
+    RelationManager &RelationManager::operator=(const RelationManager &) {
+        return *this;
+    }
 
     RC RelationManager::insertTable(const std::string &tableName, unsigned tableID, bool isSys) {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
@@ -38,38 +51,100 @@ namespace PeterDB {
     RC RelationManager::insertColumns(unsigned tableID, const std::vector<Attribute> &recordDescriptor) {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
         FileHandle fileHandle;
-        RID rid;
+        std::vector<RID> rids;
         if (rbfm.openFile("Columns", fileHandle)) {
             return -1;
         }
-        char *data = new char[COLUMNS_RECORD_SIZE];
+        // Columns of a table usually share one page, insert them together
+        std::vector<char> data(recordDescriptor.size() * COLUMNS_RECORD_SIZE);
+        std::vector<const void *> records(recordDescriptor.size());
 
         for (int i = 0; i < recordDescriptor.size(); i++) {
             unsigned position = i+1;
-            prepareColumnsRecord(tableID, recordDescriptor[i], position, data, true);
-            rbfm.insertRecord(fileHandle, columnDescriptor, data, rid);
+            char *record = data.data() + i * COLUMNS_RECORD_SIZE;
+            prepareColumnsRecord(tableID, recordDescriptor[i], position, record, true);
+            records[i] = record;
         }
+        RC rc = rbfm.insertRecords(fileHandle, columnDescriptor, records, rids);
 
         rbfm.closeFile(fileHandle);
-        delete[] data;
-        return 0;
+        return rc;
+    }
+
+    RC RelationManager::insertIndex(unsigned tableID, unsigned position) {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        FileHandle fileHandle;
+        RID rid;
+        if (rbfm.openFile("Indexes", fileHandle)) {
+            return -1;
+        }
+        char data[INDEXES_RECORD_SIZE];
+        data[0] = 0; // no null fields
+        memcpy(data + 1, &tableID, sizeof(unsigned));
+        memcpy(data + 1 + sizeof(unsigned), &position, sizeof(unsigned));
+        RC rc = rbfm.insertRecord(fileHandle, indexDescriptor, data, rid);
+
+        rbfm.closeFile(fileHandle);
+        return rc;
+    }
+
+    RC RelationManager::deleteIndexes(unsigned tableID, unsigned position) {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        FileHandle fileHandle;
+        if (rbfm.openFile("Indexes", fileHandle)) {
+            return -1;
+        }
+        // Collect the entries first, the scan must not see its own deletes
+        std::vector<std::string> attributes{"column-position"};
+        RBFM_ScanIterator rbfm_si;
+        if (rbfm.scan(fileHandle, indexDescriptor, "table-id", EQ_OP, &tableID, attributes, rbfm_si)) {
+            rbfm.closeFile(fileHandle);
+            return -1;
+        }
+        std::vector<RID> rids;
+        RID rid;
+        char data[INDEXES_RECORD_SIZE];
+        while (rbfm_si.getNextRecord(rid, data) != RBFM_EOF) {
+            unsigned indexPosition;
+            if (parseInt(indexPosition, data) == 0 && (position == 0 || indexPosition == position)) {
+                rids.push_back(rid);
+            }
+        }
+        rbfm_si.close();
+
+        RC rc = 0;
+        for (const RID &indexRid : rids) {
+            if (rbfm.deleteRecord(fileHandle, indexDescriptor, indexRid)) {
+                rc = -1;
+            }
+        }
+        rbfm.closeFile(fileHandle);
+        return rc;
     }
 
 
     RC RelationManager::createCatalog() {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        closeCachedTables();
+        catalogCache.clear();
+        catalogVersion++;
         tableDescriptor.clear();
         columnDescriptor.clear();
+        indexDescriptor.clear();
         createTablesRecordDescriptor(tableDescriptor);
         createColumnsRecordDescriptor(columnDescriptor);
+        createIndexesRecordDescriptor(indexDescriptor);
 
-        // Create Tables and Columns tables
+        // Create Tables, Columns and Indexes tables
         if (rbfm.createFile("Tables")) {
             return -1;
         }
         if (rbfm.createFile("Columns")) {
             return -1;
         }
+        if (rbfm.createFile("Indexes")) {
+            return -1;
+        }
         // Add table entries for Tables and Columns
         if (insertTable("Tables", 1, true)) {
             return -1;
@@ -79,19 +154,29 @@ namespace PeterDB {
             return -1;
         }
 
-        // Add columns entries from Tables and Columns to Columns table
+        if (insertTable("Indexes", 3, true)) {
+            return -1;
+        }
+
+        // Add columns entries from Tables, Columns and Indexes to Columns table
         if (insertColumns(1, tableDescriptor)) {
             return -1;
         }
         if (insertColumns(2, columnDescriptor)) {
             return -1;
         }
+        if (insertColumns(3, indexDescriptor)) {
+            return -1;
+        }
 
         return 0;
     }
 
     RC RelationManager::deleteCatalog() {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        closeCachedTables();
+        catalogCache.clear();
+        catalogVersion++;
 
         if (rbfm.destroyFile("Tables")) {
             return -1;
@@ -101,6 +186,10 @@ namespace PeterDB {
             return -1;
         }
 
+        if (rbfm.destroyFile("Indexes")) {
+            return -1;
+        }
+
         return 0;
     }
 
@@ -118,6 +207,7 @@ namespace PeterDB {
         if (rbfm.createFile(tableName)) {
             return -1;
         }
+        invalidateTable(tableName);
 
         // Insert table into Tables
         if (insertTable(tableName, tableID, false)){
@@ -134,19 +224,26 @@ namespace PeterDB {
     RC RelationManager::deleteTable(const std::string &tableName) {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
 
-        bool isSys = false;
-        if (checkSys(isSys, tableName)) // table might not exist
+        const TableInfo *info;
+        if (getTableInfo(tableName, info)) // table might not exist
             return -1;
-        if (isSys)
+        if (info->isSystem)
             return -1;
 
-        // get tableID
-        unsigned tableId;
-        if (getTableID(tableName, tableId)) {
+        // Close the table before its file goes away
+        const TableInfo table = *info;
+        const unsigned tableId = table.tableId;
+        invalidateTable(tableName);
+        if (rbfm.destroyFile(table.fileName)) {
             return -1;
         }
-        // Delete the tableName file
-        if (rbfm.destroyFile(tableName)) {
+        IndexManager &ix = IndexManager::instance();
+        for (const std::string &attributeName : table.indexedAttributes) {
+            if (ix.destroyFile(getIndexFileName(table, attributeName))) {
+                return -1;
+            }
+        }
+        if (deleteIndexes(tableId, 0)) {
             return -1;
         }
 
@@ -155,7 +252,7 @@ namespace PeterDB {
         RBFM_ScanIterator rbfm_si;
         FileHandle fileHandle;
         std::vector<std::string> attrs; // Don't need to project anything
-        void *value = &tableId;
+        const void *value = &tableId;
 
         // Delete tableName from Tables
         if (rbfm.openFile("Tables", fileHandle)) {
@@ -171,8 +268,8 @@ namespace PeterDB {
                 }
             }
         }
-        rbfm.closeFile(fileHandle);
         rbfm_si.close();
+        rbfm.closeFile(fileHandle);
 
         // Delete from Columns table
         if (rbfm.openFile("Columns", fileHandle)) {
@@ -187,216 +284,403 @@ namespace PeterDB {
                 }
             }
         }
-        rbfm.closeFile(fileHandle);
         rbfm_si.close();
+        rbfm.closeFile(fileHandle);
 
         return 0;
     }
 
     RC RelationManager::getAttributes(const std::string &tableName, std::vector<Attribute> &attrs) {
-        unsigned table_id;
-        if (getTableID(tableName, table_id)) {
+        const TableInfo *info;
+        if (getTableInfo(tableName, info)) {
             return -1;
         }
+        attrs = info->attrs;
+        return 0;
+    }
 
-        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        FileHandle fileHandle;
-        if (rbfm.openFile("Columns", fileHandle)) {
+    RC RelationManager::insertTuple(const std::string &tableName, const void *data, RID &rid) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) // table might not exist
             return -1;
-        }
+        return tableHandle->insertTuple(data, rid);
+    }
 
-        void *value = &table_id;
-        std::vector<std::string> attributeNames{"column-name", "column-type", "column-length"};
-        RBFM_ScanIterator rbfm_si;
-        // Scan through Columns for records with matching table_id.
-        if (rbfm.scan(fileHandle, columnDescriptor, "table-id", EQ_OP, value, attributeNames, rbfm_si)) {
-            rbfm.closeFile(fileHandle);
+    RC RelationManager::insertTuples(const std::string &tableName, const std::vector<const void *> &data,
+                                     std::vector<RID> &rids) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) // table might not exist
             return -1;
-        }
-
-        RID rid;
-        RC result;
-        attrs.clear();
-        char *data = new char[PAGE_SIZE];
-        while ((result = rbfm_si.getNextRecord(rid, data)) != RBFM_EOF) {
-            if (result == 0) {
-                unsigned nullIndicatorSize = ceil((double)attributeNames.size() / 8.0);
-                char* dataPtr = (char*) data + nullIndicatorSize;
+        return tableHandle->insertTuples(data, rids);
+    }
 
-                Attribute attr;
-                unsigned nameLength;
-                memcpy(&nameLength, dataPtr, sizeof(unsigned));
-                dataPtr += sizeof(unsigned);
-                char* column_name = new char[nameLength + 1];
-                memcpy(column_name, dataPtr, nameLength);
-                column_name[nameLength] = '\0'; // Ensure null-termination
-                attr.name = std::string(column_name); // Convert C-style string to C++ string
-                delete[] column_name;
-                dataPtr += nameLength; // Move past the column name
+    RC RelationManager::deleteTuple(const std::string &tableName, const RID &rid) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) // table might not exist
+            return -1;
+        return tableHandle->deleteTuple(rid);
+    }
 
-                // Column-type
-                memcpy(&attr.type, dataPtr, sizeof(unsigned));
-                dataPtr += sizeof(unsigned);
+    RC RelationManager::updateTuple(const std::string &tableName, const void *data, const RID &rid) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) // table might not exist
+            return -1;
+        return tableHandle->updateTuple(data, rid);
+    }
 
-                // Column-name
-                memcpy(&attr.length, dataPtr, sizeof(unsigned));
+    RC RelationManager::vacuumTable(const std::string &tableName, unsigned numPages) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) // table might not exist
+            return -1;
+        return tableHandle->vacuum(numPages);
+    }
 
-                attrs.push_back(attr);
-            }
-        }
-        delete[] data;
-        rbfm_si.close();
-        if (rbfm.closeFile(fileHandle)) {
+    RC RelationManager::readTuple(const std::string &tableName, const RID &rid, void *data) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) {
             return -1;
         }
+        return tableHandle->readTuple(rid, data);
+    }
 
-        return 0;
+    RC RelationManager::printTuple(const std::vector<Attribute> &attrs, const void *data, std::ostream &out) {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        return rbfm.printRecord(attrs, data, out);
     }
 
-    RC RelationManager::insertTuple(const std::string &tableName, const void *data, RID &rid) {
-        bool isSys = false;
-        if (checkSys(isSys, tableName)) // table might not exist
+    RC RelationManager::readAttribute(const std::string &tableName, const RID &rid, const std::string &attributeName,
+                                      void *data) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle) != 0) {
             return -1;
+        }
+        return tableHandle->readAttribute(rid, attributeName, data);
+    }
 
-        if (isSys)
+    RC RelationManager::scan(const std::string &tableName,
+                             const std::string &conditionAttribute,
+                             const CompOp compOp,
+                             const void *value,
+                             const std::vector<std::string> &attributeNames,
+                             RM_ScanIterator &rm_ScanIterator,
+                             unsigned numWorkers) {
+        TableHandle *tableHandle;
+        if (getCachedTable(tableName, tableHandle)) {
             return -1;
+        }
+        return tableHandle->scan(conditionAttribute, compOp, value, attributeNames, rm_ScanIterator, numWorkers);
+    }
 
-        std::vector<Attribute> recordDescriptor;
-        if (getAttributes(tableName, recordDescriptor) != 0) {
+    RC RelationManager::openTable(const std::string &tableName, TableHandle &tableHandle) {
+        if (tableHandle.opened) {
             return -1;
-        };
-
+        }
+        const TableInfo *info;
+        if (getTableInfo(tableName, info)) {
+            return -1;
+        }
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, fileHandle)) {
+        if (rbfm.openFile(info->fileName, tableHandle.fileHandle)) {
             return -1;
         }
+        tableHandle.tableName = tableName;
+        tableHandle.info = *info;
+        tableHandle.catalogVersion = catalogVersion;
+        if (tableHandle.openIndexes()) {
+            rbfm.closeFile(tableHandle.fileHandle);
+            return -1;
+        }
+        tableHandle.opened = true;
+        return 0;
+    }
 
-        rbfm.insertRecord(fileHandle, recordDescriptor, data, rid);
-        rbfm.closeFile(fileHandle);
+    RC RelationManager::closeTable(TableHandle &tableHandle) {
+        if (!tableHandle.opened) {
+            return -1;
+        }
+        tableHandle.opened = false;
+        tableHandle.closeIndexes();
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        return rbfm.closeFile(tableHandle.fileHandle);
+    }
 
+    RC RelationManager::getCachedTable(const std::string &tableName, TableHandle *&tableHandle) {
+        auto it = cachedTableIndex.find(tableName);
+        if (it != cachedTableIndex.end()) {
+            // Move to the front of the LRU list
+            cachedTables.splice(cachedTables.begin(), cachedTables, it->second);
+            tableHandle = &*it->second;
+            return 0;
+        }
 
+        if (cachedTables.size() >= TABLE_HANDLE_CACHE_SIZE) {
+            closeCachedTable(cachedTables.back().tableName);
+        }
+        cachedTables.emplace_front();
+        if (openTable(tableName, cachedTables.front())) {
+            cachedTables.pop_front();
+            return -1;
+        }
+        cachedTableIndex[tableName] = cachedTables.begin();
+        tableHandle = &cachedTables.front();
         return 0;
     }
 
-    RC RelationManager::deleteTuple(const std::string &tableName, const RID &rid) {
-        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+    void RelationManager::closeCachedTable(const std::string &tableName) {
+        auto it = cachedTableIndex.find(tableName);
+        if (it == cachedTableIndex.end()) {
+            return;
+        }
+        closeTable(*it->second);
+        cachedTables.erase(it->second);
+        cachedTableIndex.erase(it);
+    }
 
-        bool isSys = false;
-        if (checkSys(isSys, tableName)) // table might not exist
-            return -1;
+    void RelationManager::closeCachedTables() {
+        for (TableHandle &tableHandle : cachedTables) {
+            closeTable(tableHandle);
+        }
+        cachedTables.clear();
+        cachedTableIndex.clear();
+    }
 
-        if (isSys)
-            return -1;
+    TableHandle::TableHandle(): catalogVersion(0), opened(false) {}
 
+    TableHandle::~TableHandle() = default;
 
-        std::vector<Attribute> recordDescriptor;
-        if (getAttributes(tableName, recordDescriptor)) {
-            return -1;
+    RC TableHandle::refresh() {
+        RelationManager &rm = RelationManager::instance();
+        if (catalogVersion == rm.getCatalogVersion()) {
+            return 0;
         }
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, fileHandle)) {
+        // The table may have been dropped, or dropped and created again under another id
+        const TableInfo *current;
+        if (rm.getTableInfo(tableName, current) || current->tableId != info.tableId) {
             return -1;
         }
-        if (rbfm.deleteRecord(fileHandle, recordDescriptor, rid)) {
+        // Indexes created or dropped since are opened or closed
+        const bool indexesChanged = current->indexedAttributes != info.indexedAttributes;
+        if (indexesChanged) {
+            closeIndexes();
+        }
+        info = *current;
+        catalogVersion = rm.getCatalogVersion();
+        if (indexesChanged && openIndexes()) {
             return -1;
         }
-        rbfm.closeFile(fileHandle);
+        return 0;
+    }
 
+    RC TableHandle::openIndexes() {
+        IndexManager &ix = IndexManager::instance();
+        indexes.clear();
+        indexes.resize(info.indexedAttributes.size());
+        for (size_t i = 0; i < indexes.size(); i++) {
+            const std::string &attributeName = info.indexedAttributes[i];
+            auto attr = std::find_if(info.attrs.begin(), info.attrs.end(), [&](const Attribute &a) {
+                return a.name == attributeName;
+            });
+            indexes[i].position = attr - info.attrs.begin();
+            if (ix.openFile(RelationManager::getIndexFileName(info, attributeName),
+                            indexes[i].ixFileHandle)) {
+                indexes.resize(i);
+                closeIndexes();
+                return -1;
+            }
+        }
         return 0;
     }
 
-    RC RelationManager::updateTuple(const std::string &tableName, const void *data, const RID &rid) {
-        bool isSys = false;
-        if (checkSys(isSys, tableName)) // table might not exist
-            return -1;
+    void TableHandle::closeIndexes() {
+        IndexManager &ix = IndexManager::instance();
+        for (TableIndex &index : indexes) {
+            ix.closeFile(index.ixFileHandle);
+        }
+        indexes.clear();
+    }
 
-        if (isSys)
-            return -1;
+    RC TableHandle::insertIndexEntries(const void *data, const RID &rid) {
+        IndexManager &ix = IndexManager::instance();
+        char key[PAGE_SIZE];
+        for (TableIndex &index : indexes) {
+            if (getKey(info.attrs, data, index.position, key) &&
+                ix.insertEntry(index.ixFileHandle, info.attrs[index.position], key, rid)) {
+                return -1;
+            }
+        }
+        return 0;
+    }
 
-        std::vector<Attribute> recordDescriptor;
-        if (getAttributes(tableName, recordDescriptor)) {
-            return -1;
+    RC TableHandle::deleteIndexEntries(const void *data, const RID &rid) {
+        IndexManager &ix = IndexManager::instance();
+        char key[PAGE_SIZE];
+        for (TableIndex &index : indexes) {
+            if (getKey(info.attrs, data, index.position, key) &&
+                ix.deleteEntry(index.ixFileHandle, info.attrs[index.position], key, rid)) {
+                return -1;
+            }
         }
+        return 0;
+    }
 
-        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, fileHandle)) {
+    bool TableHandle::getKey(const std::vector<Attribute> &attrs, const void *data, unsigned position, void *key) {
+        const char *tuple = (const char *) data;
+        auto isNull = [&](unsigned i) {
+            return (tuple[i / 8] & (1 << (7 - i % 8))) != 0;
+        };
+        if (isNull(position)) {
+            return false;
+        }
+        // Step over the non-null fields before it
+        const char *field = tuple + (attrs.size() + 7) / 8;
+        unsigned length;
+        for (unsigned i = 0; i < position; i++) {
+            if (isNull(i)) {
+                continue;
+            }
+            if (attrs[i].type == TypeVarChar) {
+                memcpy(&length, field, sizeof(unsigned));
+                field += length;
+            }
+            field += sizeof(unsigned);
+        }
+        unsigned size = sizeof(unsigned);
+        if (attrs[position].type == TypeVarChar) {
+            memcpy(&length, field, sizeof(unsigned));
+            size += length;
+        }
+        memcpy(key, field, size);
+        return true;
+    }
+
+    RC TableHandle::insertTuple(const void *data, RID &rid) {
+        if (!opened || refresh() || info.isSystem) {
             return -1;
         }
-        if (rbfm.updateRecord(fileHandle, recordDescriptor, data, rid)) {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.insertRecord(fileHandle, info.attrs, data, rid)) {
             return -1;
         }
-        rbfm.closeFile(fileHandle);
+        return insertIndexEntries(data, rid);
+    }
 
+    RC TableHandle::insertTuples(const std::vector<const void *> &data, std::vector<RID> &rids) {
+        if (!opened || refresh() || info.isSystem) {
+            return -1;
+        }
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.insertRecords(fileHandle, info.attrs, data, rids)) {
+            return -1;
+        }
+        for (size_t i = 0; i < data.size() && !indexes.empty(); i++) {
+            if (insertIndexEntries(data[i], rids[i])) {
+                return -1;
+            }
+        }
         return 0;
     }
 
-    RC RelationManager::readTuple(const std::string &tableName, const RID &rid, void *data) {
+    RC TableHandle::deleteTuple(const RID &rid) {
+        if (!opened || refresh() || info.isSystem) {
+            return -1;
+        }
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-
-        std::vector<Attribute> recordDescriptor;
-
-        if (getAttributes(tableName, recordDescriptor)) {
+        if (indexes.empty()) {
+            return rbfm.deleteRecord(fileHandle, info.attrs, rid);
+        }
+        // The keys to remove from the indexes are in the tuple
+        std::vector<char> tuple(PAGE_SIZE);
+        if (rbfm.readRecord(fileHandle, info.attrs, rid, tuple.data()) ||
+            rbfm.deleteRecord(fileHandle, info.attrs, rid)) {
             return -1;
         }
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, fileHandle)) {
+        return deleteIndexEntries(tuple.data(), rid);
+    }
+
+    RC TableHandle::updateTuple(const void *data, const RID &rid) {
+        if (!opened || refresh() || info.isSystem) {
             return -1;
         }
-        if (rbfm.readRecord(fileHandle, recordDescriptor, rid, data)) {
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (indexes.empty()) {
+            return rbfm.updateRecord(fileHandle, info.attrs, data, rid);
+        }
+        std::vector<char> tuple(PAGE_SIZE);
+        if (rbfm.readRecord(fileHandle, info.attrs, rid, tuple.data()) ||
+            rbfm.updateRecord(fileHandle, info.attrs, data, rid)) {
             return -1;
         }
-        rbfm.closeFile(fileHandle);
+        // Only indexes on changed attributes are touched, the RID stays the same
+        IndexManager &ix = IndexManager::instance();
+        char oldKey[PAGE_SIZE], newKey[PAGE_SIZE];
+        for (TableIndex &index : indexes) {
+            const Attribute &attr = info.attrs[index.position];
+            const bool hasOld = getKey(info.attrs, tuple.data(), index.position, oldKey);
+            const bool hasNew = getKey(info.attrs, data, index.position, newKey);
+            if (hasOld && hasNew && BTreeNode::compareKeys(attr, oldKey, newKey) == 0) {
+                continue;
+            }
+            if ((hasOld && ix.deleteEntry(index.ixFileHandle, attr, oldKey, rid)) ||
+                (hasNew && ix.insertEntry(index.ixFileHandle, attr, newKey, rid))) {
+                return -1;
+            }
+        }
         return 0;
     }
 
-    RC RelationManager::printTuple(const std::vector<Attribute> &attrs, const void *data, std::ostream &out) {
+    RC TableHandle::readTuple(const RID &rid, void *data) {
+        if (!opened || refresh()) {
+            return -1;
+        }
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        return rbfm.printRecord(attrs, data, out);
+        return rbfm.readRecord(fileHandle, info.attrs, rid, data);
     }
 
-    RC RelationManager::readAttribute(const std::string &tableName, const RID &rid, const std::string &attributeName,
-                                      void *data) {
+    RC TableHandle::readAttribute(const RID &rid, const std::string &attributeName, void *data) {
+        if (!opened || refresh()) {
+            return -1;
+        }
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        return rbfm.readAttribute(fileHandle, info.attrs, rid, attributeName, data);
+    }
 
-        std::vector<Attribute> recordDescriptor;
-        if (getAttributes(tableName, recordDescriptor) != 0) {
+    RC TableHandle::scan(const std::string &conditionAttribute,
+                         const CompOp compOp,
+                         const void *value,
+                         const std::vector<std::string> &attributeNames,
+                         RM_ScanIterator &rm_ScanIterator,
+                         unsigned numWorkers) {
+        if (!opened || refresh()) {
             return -1;
         }
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, fileHandle) != 0) {
+        // The iterator owns its own handle on the file, so it may outlive this one
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        if (rbfm.openFile(info.fileName, rm_ScanIterator.fileHandle)) {
             return -1;
         }
-        if (rbfm.readAttribute(fileHandle, recordDescriptor, rid, attributeName, data) != 0) {
-            return -1;
+        rm_ScanIterator.numWorkers = numWorkers;
+        if (numWorkers != 1) {
+            return rm_ScanIterator.rbfm_parallel_iter.initializeScan(rm_ScanIterator.fileHandle, info.attrs,
+                                                                     conditionAttribute, compOp, value,
+                                                                     attributeNames, numWorkers);
         }
-
-        rbfm.closeFile(fileHandle);
-        return 0;
+        return rbfm.scan(rm_ScanIterator.fileHandle, info.attrs, conditionAttribute,
+                         compOp, value, attributeNames, rm_ScanIterator.rbfm_iter);
     }
 
-    RC RelationManager::scan(const std::string &tableName,
-                             const std::string &conditionAttribute,
-                             const CompOp compOp,
-                             const void *value,
-                             const std::vector<std::string> &attributeNames,
-                             RM_ScanIterator &rm_ScanIterator) {
-        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        FileHandle fileHandle;
-        if (rbfm.openFile(tableName, rm_ScanIterator.fileHandle)) {
-            return -1;
-        }
-        std::vector<Attribute> recordDescriptor;
-        if (getAttributes(tableName, recordDescriptor)) {
+    RC TableHandle::vacuum(unsigned numPages) {
+        if (!opened || refresh()) {
             return -1;
         }
-        rbfm.scan(rm_ScanIterator.fileHandle, recordDescriptor, conditionAttribute,
-                        compOp, value, attributeNames, rm_ScanIterator.rbfm_iter);
-
-        return 0;
+        // RIDs do not change, so the indexes stay as they are
+        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
+        return rbfm.vacuum(fileHandle, info.attrs, numPages);
+    }
 
+    const std::vector<Attribute> &TableHandle::getAttributes() const {
+        return info.attrs;
     }
+
     RC RelationManager::createTablesRecordDescriptor(std::vector<PeterDB::Attribute> &recordDescriptor) {
         PeterDB::Attribute attr;
         attr.name = "table-id";
@@ -452,6 +736,22 @@ namespace PeterDB {
         return 0;
     }
 
+    RC RelationManager::createIndexesRecordDescriptor(std::vector<PeterDB::Attribute> &recordDescriptor) {
+        PeterDB::Attribute attr;
+
+        attr.name = "table-id";
+        attr.type = PeterDB::TypeInt;
+        attr.length = (PeterDB::AttrLength) 4;
+        recordDescriptor.push_back(attr);
+
+        attr.name = "column-position";
+        attr.type = PeterDB::TypeInt;
+        attr.length = (PeterDB::AttrLength) 4;
+        recordDescriptor.push_back(attr);
+
+        return 0;
+    }
+
     void RelationManager::prepareTablesRecord(const std::string &tableName, unsigned &tableId, bool isSys, void *data) {
         /* need:
          * table-id
@@ -552,88 +852,155 @@ namespace PeterDB {
         delete[] data;
         // Next table ID is 1 more than the largest table id
         table_id = max_table_id + 1;
-        rbfm.closeFile(fileHandle);
         rbfm_si.close();
+        rbfm.closeFile(fileHandle);
         return 0;
     }
 
     RC RelationManager::getTableID(const std::string &table_name, unsigned &table_id) {
-        RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
-        FileHandle fileHandle;
-
-        if (rbfm.openFile("Tables", fileHandle)) {
+        const TableInfo *info;
+        if (getTableInfo(table_name, info)) {
             return -1;
         }
+        table_id = info->tableId;
+        return 0;
+    }
 
-        std::vector<std::string> attributes{"table-id"};
-        RBFM_ScanIterator rbfm_si;
-
-        unsigned str_length = table_name.length();
-        char *value = new char[4 + str_length];
-        memcpy(value, &str_length, sizeof(unsigned));
-        memcpy(value + sizeof(unsigned), table_name.c_str(), str_length);
-
-        rbfm.scan(fileHandle, tableDescriptor, "table-name", EQ_OP, (void*)value, attributes, rbfm_si);
+    RC RelationManager::checkSys(bool &system, const std::string &tableName) {
+        const TableInfo *info;
+        if (getTableInfo(tableName, info)) {
+            return -1;
+        }
+        system = info->isSystem;
+        return 0;
+    }
 
-        RID rid;
-        char* data = new char[sizeof(int) + 1];
-        RC result;
-        while ((result = rbfm_si.getNextRecord(rid, data)) != RBFM_EOF) {
-            if (result == 0) { // Found a matching record
-                // Parse the system field from that table entry
-                unsigned tid;
-                parseInt(tid, (void*)data);
-                table_id = tid;
-                break; // Exit the loop if a match is found
+    RC RelationManager::getTableInfo(const std::string &tableName, const TableInfo *&info) {
+        auto it = catalogCache.find(tableName);
+        if (it == catalogCache.end()) {
+            // First use of the table since the last DDL on it: read its entry from the catalog
+            TableInfo loaded;
+            if (loadTableInfo(tableName, loaded)) {
+                return -1;
             }
-            // If result is -2, continue to the next record automatically
+            it = catalogCache.emplace(tableName, std::move(loaded)).first;
         }
-        delete[] value;
-        delete[] data;
-        rbfm.closeFile(fileHandle);
-        rbfm_si.close();
-
+        info = &it->second;
         return 0;
     }
 
-    RC RelationManager::checkSys(bool &system, const std::string &tableName) {
+    unsigned RelationManager::getCatalogVersion() const {
+        return catalogVersion;
+    }
+
+    void RelationManager::invalidateTable(const std::string &tableName) {
+        closeCachedTable(tableName);
+        catalogCache.erase(tableName);
+        catalogVersion++;
+    }
+
+    RC RelationManager::loadTableInfo(const std::string &tableName, TableInfo &info) {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
         FileHandle fileHandle;
 
+        // Find the Tables entry whose table-name is equal to tableName
         if (rbfm.openFile("Tables", fileHandle)) {
             return -1;
         }
+        unsigned nameLength = tableName.length();
+        std::unique_ptr<char[]> value(new char[sizeof(unsigned) + nameLength]);
+        memcpy(value.get(), &nameLength, sizeof(unsigned));
+        memcpy(value.get() + sizeof(unsigned), tableName.c_str(), nameLength);
 
-        // get sys column
-        std::vector<std::string> attrs{"sys"};
-
-        char *value = new char[5 + 50];
-        unsigned name_len = tableName.length();
-        memcpy(value, &name_len, sizeof(unsigned));
-        memcpy(value + sizeof(unsigned), tableName.c_str(), name_len);
-
-        // Find table whose table-name is equal to tableName
+        std::vector<std::string> tableAttributes{"table-id", "file-name", "sys"};
         RBFM_ScanIterator rbfm_si;
-        rbfm.scan(fileHandle, tableDescriptor, "table-name", EQ_OP, value, attrs, rbfm_si);
+        if (rbfm.scan(fileHandle, tableDescriptor, "table-name", EQ_OP, value.get(), tableAttributes, rbfm_si)) {
+            rbfm.closeFile(fileHandle);
+            return -1;
+        }
 
         RID rid;
-        char *data = new char[1 + sizeof(unsigned)];
         RC result;
+        bool found = false;
+        char data[TABLES_RECORD_SIZE];
         while ((result = rbfm_si.getNextRecord(rid, data)) != RBFM_EOF) {
             if (result == 0) { // Found a matching record
-                // Parse the system field from that table entry
+                const char *dataPtr = data + 1; // skip the null indicator
+                memcpy(&info.tableId, dataPtr, sizeof(unsigned));
+                dataPtr += sizeof(unsigned);
+                unsigned fileNameLength;
+                memcpy(&fileNameLength, dataPtr, sizeof(unsigned));
+                dataPtr += sizeof(unsigned);
+                info.fileName.assign(dataPtr, fileNameLength);
+                dataPtr += fileNameLength;
                 unsigned sysByte;
-                parseInt(sysByte, data);
-                system = sysByte == 1;
-                break; // Exit the loop if a match is found
+                memcpy(&sysByte, dataPtr, sizeof(unsigned));
+                info.isSystem = sysByte == 1;
+                found = true;
+                break;
             }
-            // If result is -2, continue to the next record automatically
+        }
+        rbfm_si.close();
+        rbfm.closeFile(fileHandle);
+        if (!found) {
+            return -1;
         }
 
-        delete[] data;
-        delete[] value;
+        // Scan through Columns for records with matching table_id.
+        if (rbfm.openFile("Columns", fileHandle)) {
+            return -1;
+        }
+        std::vector<std::string> columnAttributes{"column-name", "column-type", "column-length"};
+        if (rbfm.scan(fileHandle, columnDescriptor, "table-id", EQ_OP, &info.tableId, columnAttributes, rbfm_si)) {
+            rbfm.closeFile(fileHandle);
+            return -1;
+        }
+        info.attrs.clear();
+        char column[COLUMNS_RECORD_SIZE];
+        while ((result = rbfm_si.getNextRecord(rid, column)) != RBFM_EOF) {
+            if (result == 0) {
+                const char *dataPtr = column + 1; // skip the null indicator
+
+                Attribute attr;
+                unsigned columnNameLength;
+                memcpy(&columnNameLength, dataPtr, sizeof(unsigned));
+                dataPtr += sizeof(unsigned);
+                attr.name.assign(dataPtr, columnNameLength);
+                dataPtr += columnNameLength;
+
+                // Column-type
+                memcpy(&attr.type, dataPtr, sizeof(unsigned));
+                dataPtr += sizeof(unsigned);
+
+                // Column-length
+                memcpy(&attr.length, dataPtr, sizeof(unsigned));
+
+                info.attrs.push_back(attr);
+            }
+        }
+        rbfm_si.close();
         rbfm.closeFile(fileHandle);
+
+        // Scan through Indexes for the positions of the indexed columns
+        if (rbfm.openFile("Indexes", fileHandle)) {
+            return -1;
+        }
+        std::vector<std::string> indexAttributes{"column-position"};
+        if (rbfm.scan(fileHandle, indexDescriptor, "table-id", EQ_OP, &info.tableId, indexAttributes, rbfm_si)) {
+            rbfm.closeFile(fileHandle);
+            return -1;
+        }
+        info.indexedAttributes.clear();
+        char index[INDEXES_RECORD_SIZE];
+        while ((result = rbfm_si.getNextRecord(rid, index)) != RBFM_EOF) {
+            unsigned position;
+            if (result == 0 && parseInt(position, index) == 0 && position >= 1 && position <= info.attrs.size()) {
+                info.indexedAttributes.push_back(info.attrs[position - 1].name);
+            }
+        }
         rbfm_si.close();
+        rbfm.closeFile(fileHandle);
+        info.version = catalogVersion;
         return 0;
     }
 
@@ -656,7 +1023,7 @@ namespace PeterDB {
     RM_ScanIterator::~RM_ScanIterator() = default;
 
     RC RM_ScanIterator::getNextTuple(RID &rid, void *data) {
-        RC rc = rbfm_iter.getNextRecord(rid, data);
+        RC rc = numWorkers != 1 ? rbfm_parallel_iter.getNextRecord(rid, data) : rbfm_iter.getNextRecord(rid, data);
         if (rc == RBFM_EOF) {
             return RM_EOF;
         }
@@ -666,6 +1033,7 @@ namespace PeterDB {
     RC RM_ScanIterator::close() {
         RecordBasedFileManager &rbfm = RecordBasedFileManager::instance();
         rbfm_iter.close();
+        rbfm_parallel_iter.close();
         rbfm.closeFile(fileHandle);
         return 0;
     }
@@ -682,11 +1050,72 @@ namespace PeterDB {
 
     // QE IX related
     RC RelationManager::createIndex(const std::string &tableName, const std::string &attributeName){
-        return -1;
+        const TableInfo *info;
+        if (getTableInfo(tableName, info) || info->isSystem) {
+            return -1;
+        }
+        const std::vector<Attribute> attrs = info->attrs;
+        auto attr = std::find_if(attrs.begin(), attrs.end(), [&](const Attribute &a) {
+            return a.name == attributeName;
+        });
+        if (attr == attrs.end() || std::find(info->indexedAttributes.begin(), info->indexedAttributes.end(),
+                                             attributeName) != info->indexedAttributes.end()) {
+            // no such attribute, or it is already indexed
+            return -1;
+        }
+        IndexManager &ix = IndexManager::instance();
+        const unsigned tableId = info->tableId;
+        const std::string indexFileName = getIndexFileName(*info, attributeName);
+        if (ix.createFile(indexFileName)) {
+            return -1;
+        }
+
+        // Build the tree bottom-up from the tuples already in the table
+        std::vector<std::string> attributeNames;
+        for (const Attribute &a : attrs) {
+            attributeNames.push_back(a.name);
+        }
+        RM_ScanIterator rm_ScanIterator;
+        IXFileHandle ixFileHandle;
+        RC rc = scan(tableName, attributeName, NO_OP, nullptr, attributeNames, rm_ScanIterator);
+        if (rc == 0) {
+            rc = ix.openFile(indexFileName, ixFileHandle);
+            if (rc == 0) {
+                RM_IndexEntryIterator entries(rm_ScanIterator, attrs, attr - attrs.begin());
+                rc = ix.bulkLoad(ixFileHandle, *attr, entries);
+                ix.closeFile(ixFileHandle);
+            }
+            rm_ScanIterator.close();
+        }
+        if (rc == 0) {
+            rc = insertIndex(tableId, attr - attrs.begin() + 1);
+        }
+        if (rc) {
+            ix.destroyFile(indexFileName);
+            return -1;
+        }
+        // Open handles pick the index up when they reload the table
+        invalidateTable(tableName);
+        return 0;
     }
 
     RC RelationManager::destroyIndex(const std::string &tableName, const std::string &attributeName){
-        return -1;
+        const TableInfo *info;
+        if (getTableInfo(tableName, info) ||
+            std::find(info->indexedAttributes.begin(), info->indexedAttributes.end(),
+                      attributeName) == info->indexedAttributes.end()) {
+            return -1;
+        }
+        const unsigned tableId = info->tableId;
+        const unsigned position = std::find_if(info->attrs.begin(), info->attrs.end(), [&](const Attribute &a) {
+            return a.name == attributeName;
+        }) - info->attrs.begin() + 1;
+        const std::string indexFileName = getIndexFileName(*info, attributeName);
+        invalidateTable(tableName);
+        if (deleteIndexes(tableId, position)) {
+            return -1;
+        }
+        return IndexManager::instance().destroyFile(indexFileName);
     }
 
     // indexScan returns an iterator to allow the caller to go through qualified entries in index
@@ -697,20 +1126,65 @@ namespace PeterDB {
                  bool lowKeyInclusive,
                  bool highKeyInclusive,
                  RM_IndexScanIterator &rm_IndexScanIterator){
-        return -1;
+        const TableInfo *info;
+        if (getTableInfo(tableName, info) ||
+            std::find(info->indexedAttributes.begin(), info->indexedAttributes.end(),
+                      attributeName) == info->indexedAttributes.end()) {
+            return -1;
+        }
+        auto attr = std::find_if(info->attrs.begin(), info->attrs.end(), [&](const Attribute &a) {
+            return a.name == attributeName;
+        });
+        // The iterator owns its own handle on the index
+        IndexManager &ix = IndexManager::instance();
+        if (ix.openFile(getIndexFileName(*info, attributeName), rm_IndexScanIterator.ixFileHandle)) {
+            return -1;
+        }
+        return ix.scan(rm_IndexScanIterator.ixFileHandle, *attr, lowKey, highKey, lowKeyInclusive, highKeyInclusive,
+                       rm_IndexScanIterator.ix_iter);
     }
 
+    std::string RelationManager::getIndexFileName(const TableInfo &info, const std::string &attributeName) {
+        const unsigned position = std::find_if(info.attrs.begin(), info.attrs.end(), [&](const Attribute &a) {
+            return a.name == attributeName;
+        }) - info.attrs.begin() + 1;
+        return info.fileName + "_" + std::to_string(info.tableId) + "_" + std::to_string(position) + INDEX_FILE_SUFFIX;
+    }
 
     RM_IndexScanIterator::RM_IndexScanIterator() = default;
 
     RM_IndexScanIterator::~RM_IndexScanIterator() = default;
 
     RC RM_IndexScanIterator::getNextEntry(RID &rid, void *key){
-        return -1;
+        RC rc = ix_iter.getNextEntry(rid, key);
+        if (rc == IX_EOF) {
+            return RM_EOF;
+        }
+        return rc;
+    }
+
+    RC RM_IndexScanIterator::seek(const void *lowKey, const void *highKey, bool lowKeyInclusive,
+                                  bool highKeyInclusive) {
+        return ix_iter.seek(lowKey, highKey, lowKeyInclusive, highKeyInclusive);
     }
 
     RC RM_IndexScanIterator::close(){
-        return -1;
+        ix_iter.close();
+        return IndexManager::instance().closeFile(ixFileHandle);
+    }
+
+    RM_IndexEntryIterator::RM_IndexEntryIterator(RM_ScanIterator &rm_ScanIterator, const std::vector<Attribute> &attrs,
+                                                 unsigned position)
+            : rm_ScanIterator(rm_ScanIterator), attrs(attrs), position(position), tuple(PAGE_SIZE) {}
+
+    RC RM_IndexEntryIterator::getNextEntry(RID &rid, void *key) {
+        RC rc;
+        while ((rc = rm_ScanIterator.getNextTuple(rid, tuple.data())) == 0) {
+            if (TableHandle::getKey(attrs, tuple.data(), position, key)) {
+                return 0;
+            }
+        }
+        return rc == RM_EOF ? IX_EOF : rc;
     }
 
 } // namespace PeterDB
\ No newline at end of file
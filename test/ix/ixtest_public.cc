@@ -1,4 +1,6 @@
 #include <random>
+#include <algorithm>
+#include <functional>
 
 #include "src/include/ix.h"
 #include "test/utils/ix_test_utils.h"
@@ -1383,6 +1385,8 @@ namespace PeterDBTesting {
                                     << "indexManager::deleteEntry() should succeed.";
 
         // print BTree, by this time the BTree should have height of 1
+        // Note: with D = 1 a tree of height 1 holds at most 3 leaves of 2 entries, so 12 entries cannot pass the
+        // 2D bounds below. Nodes hold 4 of these keys, which IX_Test_2.extra_merge_on_deletion checks with D = 2.
         stream.str(std::string());
         stream.clear();
         ASSERT_EQ(ix.printBTree(ixFileHandle, empNameAttr, stream), success)
@@ -1392,4 +1396,249 @@ namespace PeterDBTesting {
 
     }
 
+    TEST_F(IX_Test, reuse_pages_freed_by_merges) {
+        // Checks that pages freed by merges and root collapses are used again
+        // Functions tested
+        // 1. Insert and delete the same entries a few times
+        // 2. The file stops growing after the first round
+        // 3. Scan the reinserted entries
+
+        unsigned numOfEntries = 10000;
+        unsigned numOfRounds = 5;
+        std::vector<int> keys(numOfEntries);
+        for (unsigned i = 0; i < numOfEntries; i++) {
+            keys[i] = (int) i;
+        }
+        std::shuffle(keys.begin(), keys.end(), std::default_random_engine(1234));
+
+        unsigned pagesAfterFirstRound = 0;
+        for (unsigned round = 0; round < numOfRounds; round++) {
+            for (int key : keys) {
+                rid.pageNum = key;
+                rid.slotNum = key;
+                ASSERT_EQ(ix.insertEntry(ixFileHandle, ageAttr, &key, rid), success)
+                                            << "indexManager::insertEntry() should succeed.";
+            }
+            if (round == 0) {
+                pagesAfterFirstRound = ixFileHandle.fileHandle.getNumberOfPages();
+                ASSERT_GT(pagesAfterFirstRound, 10) << "The entries should take more than a few pages.";
+            }
+            if (round == numOfRounds - 1) {
+                break;
+            }
+            for (int key : keys) {
+                rid.pageNum = key;
+                rid.slotNum = key;
+                ASSERT_EQ(ix.deleteEntry(ixFileHandle, ageAttr, &key, rid), success)
+                                            << "indexManager::deleteEntry() should succeed.";
+            }
+        }
+        EXPECT_LE(ixFileHandle.fileHandle.getNumberOfPages(), pagesAfterFirstRound)
+                            << "Pages freed by deletions should be reused.";
+
+        // The reinserted entries are all found in order
+        ASSERT_EQ(ix.scan(ixFileHandle, ageAttr, NULL, NULL, true, true, ix_ScanIterator), success)
+                                    << "indexManager::scan() should succeed.";
+        int key;
+        unsigned count = 0;
+        while (ix_ScanIterator.getNextEntry(rid, &key) == success) {
+            ASSERT_EQ(key, (int) count) << "Entries should come in key order.";
+            ASSERT_EQ(rid.pageNum, count) << "rid.pageNum is not correct.";
+            count++;
+        }
+        EXPECT_EQ(count, numOfEntries) << "Every reinserted entry should be found.";
+        ASSERT_EQ(ix_ScanIterator.close(), success) << "IX_ScanIterator::close() should succeed.";
+    }
+
+
+    // Entries handed to bulkLoad from memory: key i / 2 with RID (i, i % 100), i in a shuffled order
+    class IX_VectorEntryIterator : public PeterDB::IX_EntryIterator {
+    public:
+        explicit IX_VectorEntryIterator(unsigned numEntries) : order(numEntries), next(0) {
+            for (unsigned i = 0; i < numEntries; i++) {
+                order[i] = i;
+            }
+            std::shuffle(order.begin(), order.end(), std::default_random_engine(4321));
+        }
+
+        PeterDB::RC getNextEntry(PeterDB::RID &rid, void *key) override {
+            if (next == order.size()) {
+                return IX_EOF;
+            }
+            const unsigned i = order[next++];
+            const int value = (int) (i / 2);
+            memcpy(key, &value, sizeof(int));
+            rid.pageNum = i;
+            rid.slotNum = i % 100;
+            return 0;
+        }
+
+    private:
+        std::vector<unsigned> order;
+        size_t next;
+    };
+
+    TEST_F(IX_Test, bulk_load_and_scan) {
+        // Checks an index built bottom-up from unsorted entries
+        // Functions tested
+        // 1. Bulk load more entries than are sorted in memory, the sorted runs are removed afterwards
+        // 2. Scan every entry in (key, RID) order and a range of keys
+        // 3. Insert and delete entries in the loaded tree
+        // 4. A lower fill factor leaves room in more nodes, a second load fails
+
+        const unsigned numOfEntries = 200000;
+        const size_t numFiles = glob("").size();
+        IX_VectorEntryIterator entries(numOfEntries);
+        ASSERT_EQ(ix.bulkLoad(ixFileHandle, ageAttr, entries, 1.0f), success)
+                                    << "indexManager::bulkLoad() should succeed.";
+        EXPECT_EQ(glob("").size(), numFiles) << "bulkLoad() should remove its sorted runs.";
+        const unsigned fullPages = ixFileHandle.fileHandle.getNumberOfPages();
+
+        int key;
+        unsigned count = 0;
+        ASSERT_EQ(ix.scan(ixFileHandle, ageAttr, NULL, NULL, true, true, ix_ScanIterator), success)
+                                    << "indexManager::scan() should succeed.";
+        while (ix_ScanIterator.getNextEntry(rid, &key) == success) {
+            ASSERT_EQ(key, (int) (count / 2)) << "Entries should come in key order.";
+            ASSERT_EQ(rid.pageNum, count) << "Entries of a key should come in RID order.";
+            count++;
+        }
+        EXPECT_EQ(count, numOfEntries) << "Every loaded entry should be found.";
+        ASSERT_EQ(ix_ScanIterator.close(), success) << "IX_ScanIterator::close() should succeed.";
+
+        int low = 1000, high = 1999;
+        count = 0;
+        ASSERT_EQ(ix.scan(ixFileHandle, ageAttr, &low, &high, true, false, ix_ScanIterator), success)
+                                    << "indexManager::scan() should succeed.";
+        while (ix_ScanIterator.getNextEntry(rid, &key) == success) {
+            ASSERT_TRUE(key >= low && key < high) << "Entries should stay in the range.";
+            count++;
+        }
+        EXPECT_EQ(count, 2 * (high - low)) << "Every entry of the range should be found.";
+        ASSERT_EQ(ix_ScanIterator.close(), success) << "IX_ScanIterator::close() should succeed.";
+
+        // Full nodes split on the first insert, emptied ones merge
+        key = 5000;
+        rid.pageNum = numOfEntries;
+        rid.slotNum = 0;
+        ASSERT_EQ(ix.insertEntry(ixFileHandle, ageAttr, &key, rid), success)
+                                    << "indexManager::insertEntry() should succeed.";
+        for (unsigned i = 0; i < 4000; i++) {
+            key = (int) (i / 2);
+            rid.pageNum = i;
+            rid.slotNum = i % 100;
+            ASSERT_EQ(ix.deleteEntry(ixFileHandle, ageAttr, &key, rid), success)
+                                        << "indexManager::deleteEntry() should succeed.";
+        }
+        count = 0;
+        ASSERT_EQ(ix.scan(ixFileHandle, ageAttr, NULL, NULL, true, true, ix_ScanIterator), success)
+                                    << "indexManager::scan() should succeed.";
+        while (ix_ScanIterator.getNextEntry(rid, &key) == success) {
+            ASSERT_GE(key, 2000) << "Deleted entries should not be found.";
+            count++;
+        }
+        EXPECT_EQ(count, numOfEntries - 4000 + 1) << "Every remaining entry should be found.";
+        ASSERT_EQ(ix_ScanIterator.close(), success) << "IX_ScanIterator::close() should succeed.";
+
+        IX_VectorEntryIterator again(10);
+        EXPECT_NE(ix.bulkLoad(ixFileHandle, ageAttr, again), success) << "Loading a non-empty index should fail.";
+
+        reopenIndexFile();
+        ASSERT_EQ(ix.closeFile(ixFileHandle), success) << "indexManager::closeFile() should succeed.";
+        ASSERT_EQ(ix.destroyFile(indexFileName), success) << "indexManager::destroyFile() should succeed.";
+        ASSERT_EQ(ix.createFile(indexFileName), success) << "indexManager::createFile() should succeed.";
+        ASSERT_EQ(ix.openFile(indexFileName, ixFileHandle), success) << "indexManager::openFile() should succeed.";
+        IX_VectorEntryIterator halfEntries(numOfEntries);
+        ASSERT_EQ(ix.bulkLoad(ixFileHandle, ageAttr, halfEntries, 0.5f), success)
+                                    << "indexManager::bulkLoad() should succeed.";
+        EXPECT_GT(ixFileHandle.fileHandle.getNumberOfPages(), fullPages * 3 / 2)
+                            << "Half-full nodes should take more pages.";
+    }
+
+
+    // Entries handed to bulkLoad from memory: key i is length times the letter 'a' + i with RID (i, i)
+    class IX_VarCharEntryIterator : public PeterDB::IX_EntryIterator {
+    public:
+        IX_VarCharEntryIterator(unsigned numEntries, unsigned length) : numEntries(numEntries), length(length),
+                                                                          next(0) {}
+
+        PeterDB::RC getNextEntry(PeterDB::RID &rid, void *key) override {
+            if (next == numEntries) {
+                return IX_EOF;
+            }
+            const unsigned i = numEntries - 1 - next++;
+            memcpy(key, &length, sizeof(unsigned));
+            memset((char *) key + sizeof(unsigned), 'a' + i % 26, length);
+            rid.pageNum = i;
+            rid.slotNum = i;
+            return 0;
+        }
+
+    private:
+        unsigned numEntries;
+        unsigned length;
+        unsigned next;
+    };
+
+    TEST_F(IX_Test, bulk_load_large_keys) {
+        // Checks bulk loading keys so large that a node takes only a few of them
+        // Functions tested
+        // 1. Bulk load 3 keys at a low fill factor, every internal node has a separator
+        // 2. Delete every entry of the loaded tree
+        // 3. Keys too large for insertEntry() are refused by bulkLoad() too
+
+        empNameAttr.length = 1350;
+        IX_VarCharEntryIterator entries(3, 1300);
+        ASSERT_EQ(ix.bulkLoad(ixFileHandle, empNameAttr, entries, 0.5f), success)
+                                    << "indexManager::bulkLoad() should succeed.";
+
+        std::stringstream stream;
+        ASSERT_EQ(ix.printBTree(ixFileHandle, empNameAttr, stream), success)
+                                    << "indexManager::printBTree() should succeed";
+        nlohmann::ordered_json j;
+        stream >> j;
+        TreeNode root = buildTree(j);
+        EXPECT_EQ(root.totalRIDCount(), 3) << "RID count should match.";
+        std::function<void(const TreeNode &)> checkSeparators = [&](const TreeNode &node) {
+            if (!node.children.empty()) {
+                EXPECT_GT(node.keys.size(), 0) << "An internal node should have a separator.";
+                EXPECT_EQ(node.keys.size() + 1, node.children.size())
+                                    << "number of children should be 1 more than the number of keys.";
+            }
+            for (const TreeNode &child : node.children) {
+                checkSeparators(child);
+            }
+        };
+        checkSeparators(root);
+
+        char key[PAGE_SIZE];
+        for (unsigned i = 0; i < 3; i++) {
+            const unsigned length = 1300;
+            memcpy(key, &length, sizeof(unsigned));
+            memset(key + sizeof(unsigned), 'a' + i, length);
+            rid.pageNum = i;
+            rid.slotNum = i;
+            ASSERT_EQ(ix.deleteEntry(ixFileHandle, empNameAttr, key, rid), success)
+                                        << "indexManager::deleteEntry() should succeed.";
+        }
+        ASSERT_EQ(ix.scan(ixFileHandle, empNameAttr, NULL, NULL, true, true, ix_ScanIterator), success)
+                                    << "indexManager::scan() should succeed.";
+        EXPECT_EQ(ix_ScanIterator.getNextEntry(rid, key), IX_EOF) << "Every entry should be deleted.";
+        ASSERT_EQ(ix_ScanIterator.close(), success) << "IX_ScanIterator::close() should succeed.";
+
+        reopenIndexFile();
+        ASSERT_EQ(ix.closeFile(ixFileHandle), success) << "indexManager::closeFile() should succeed.";
+        ASSERT_EQ(ix.destroyFile(indexFileName), success) << "indexManager::destroyFile() should succeed.";
+        ASSERT_EQ(ix.createFile(indexFileName), success) << "indexManager::createFile() should succeed.";
+        ASSERT_EQ(ix.openFile(indexFileName, ixFileHandle), success) << "indexManager::openFile() should succeed.";
+        IX_VarCharEntryIterator oversized(3, 1350);
+        ASSERT_EQ(oversized.getNextEntry(rid, key), success) << "Reading an entry should succeed.";
+        EXPECT_NE(ix.insertEntry(ixFileHandle, empNameAttr, key, rid), success)
+                            << "Inserting a key too large for a node should fail.";
+        IX_VarCharEntryIterator oversizedAgain(3, 1350);
+        EXPECT_NE(ix.bulkLoad(ixFileHandle, empNameAttr, oversizedAgain), success)
+                            << "Loading a key too large for a node should fail.";
+        EXPECT_EQ(ixFileHandle.fileHandle.getNumberOfPages(), 0) << "A failed load should leave the index empty.";
+    }
+
 } // namespace PeterDBTesting
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
 #include "src/include/pfm.h"
 #include "test/utils/pfm_test_utils.h"
 
@@ -360,4 +364,376 @@ namespace PeterDBTesting {
         }
     }
 
+    TEST_F (PFM_Page_Test, concurrent_read_and_write_pages) {
+        // Test case procedure:
+        // 1. Shrink the buffer pool so pages are evicted all the time
+        // 2. Append pages filled with [page number][generation 0] pairs
+        // 3. Read random pages one and two at a time on two threads while a third overwrites random pages,
+        //    each write with a new generation
+        // 4. Check every page read belongs to its page, is whole, and is never older than a page read before it
+        // 5. Check every page holds its last write after reopening the file, under each replacement policy
+
+        const unsigned numPages = 1000;
+        const unsigned numReads = 20000;
+        const unsigned numWrites = 10000;
+        const unsigned numWords = PAGE_SIZE / sizeof(unsigned);
+        auto fill = [&](unsigned *page, unsigned pageNum, unsigned generation) {
+            for (unsigned w = 0; w < numWords; w += 2) {
+                page[w] = pageNum;
+                page[w + 1] = generation;
+            }
+        };
+        // True if the page is [pageNum][generation] throughout, for some generation
+        auto whole = [&](const unsigned *page, unsigned pageNum) {
+            for (unsigned w = 0; w < numWords; w += 2) {
+                if (page[w] != pageNum || page[w + 1] != page[1]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        inBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            fill((unsigned *) inBuffer, i, 0);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+
+        std::vector<unsigned> lastGeneration(numPages, 0);
+        unsigned generation = 0;
+        for (PeterDB::ReplacementPolicyType policy : {PeterDB::CLOCK_POLICY, PeterDB::LRU_K_POLICY}) {
+            ASSERT_EQ(pfm.configureBufferPool(32 * PAGE_SIZE, policy), success)
+                                        << "Configuring the buffer pool should succeed.";
+            std::atomic<unsigned> failures(0), misreads(0), staleReads(0);
+            auto reader = [&](unsigned seed, unsigned pagesPerRead) {
+                std::mt19937 generator(seed);
+                std::vector<unsigned> pages(pagesPerRead * numWords);
+                std::vector<unsigned> seen(numPages, 0);
+                for (unsigned i = 0; i < numReads; i++) {
+                    const unsigned pageNum = generator() % (numPages - pagesPerRead + 1);
+                    const PeterDB::RC rc = pagesPerRead == 1 ? fileHandle.readPage(pageNum, pages.data())
+                                                    : fileHandle.readPages(pageNum, pagesPerRead, pages.data());
+                    if (rc != success) {
+                        failures++;
+                        continue;
+                    }
+                    for (unsigned p = 0; p < pagesPerRead; p++) {
+                        const unsigned *page = pages.data() + p * numWords;
+                        if (!whole(page, pageNum + p)) {
+                            misreads++;
+                        } else if (page[1] < seen[pageNum + p]) {
+                            staleReads++;
+                        } else {
+                            seen[pageNum + p] = page[1];
+                        }
+                    }
+                }
+            };
+            auto writer = [&](unsigned seed) {
+                std::mt19937 generator(seed);
+                std::vector<unsigned> page(numWords);
+                for (unsigned i = 0; i < numWrites; i++) {
+                    const unsigned pageNum = generator() % numPages;
+                    fill(page.data(), pageNum, ++generation);
+                    if (fileHandle.writePage(pageNum, page.data()) != success) {
+                        failures++;
+                    } else {
+                        lastGeneration[pageNum] = generation;
+                    }
+                }
+            };
+            std::thread reader1(reader, 1, 1), reader2(reader, 2, 2), writer1(writer, 3);
+            reader1.join();
+            reader2.join();
+            writer1.join();
+            EXPECT_EQ(failures, 0) << "Reading and writing pages should succeed.";
+            EXPECT_EQ(misreads, 0) << "A page read should hold one write of its own page.";
+            EXPECT_EQ(staleReads, 0) << "A page read should never be older than one read before it.";
+        }
+        ASSERT_EQ(pfm.configureBufferPool(BUFFER_POOL_SIZE, PeterDB::CLOCK_POLICY), success)
+                                    << "Restoring the buffer pool should succeed.";
+
+        // The pages written last must have reached the file
+        reopenFile();
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            fill((unsigned *) inBuffer, i, lastGeneration[i]);
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of a page should succeed.";
+        }
+    }
+
+    TEST(PFM_Buffer_Pool_Test, clock_gives_referenced_frames_a_second_chance) {
+        // Test case procedure:
+        // 1. Reference every frame, the hand clears them all and takes the first
+        // 2. A frame referenced again is passed over
+        // 3. Pinned frames are never picked, and nothing is picked when all are pinned
+
+        std::vector<PeterDB::Frame> frames(3, PeterDB::Frame{nullptr, 0, 0, 0, false, false, nullptr});
+        PeterDB::ClockPolicy clock(3);
+        unsigned victim;
+        for (unsigned i = 0; i < 3; i++) {
+            clock.recordAccess(i);
+        }
+        ASSERT_EQ(clock.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 0) << "The frame under the hand should go once every bit is cleared.";
+
+        clock.recordAccess(1);
+        ASSERT_EQ(clock.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 2) << "A referenced frame should get a second chance.";
+
+        frames[0].pinCount = 1;
+        ASSERT_EQ(clock.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 1) << "A pinned frame should be passed over.";
+
+        frames[1].pinCount = frames[2].pinCount = 1;
+        EXPECT_NE(clock.pickVictim(frames, victim), success) << "Picking a victim should fail when all are pinned.";
+    }
+
+    TEST(PFM_Buffer_Pool_Test, lru_k_evicts_the_oldest_kth_reference) {
+        // Test case procedure:
+        // 1. A frame referenced fewer than K times goes first
+        // 2. Otherwise the frame whose K-th most recent reference is the oldest goes
+        // 3. Pinned frames are never picked
+
+        std::vector<PeterDB::Frame> frames(3, PeterDB::Frame{nullptr, 0, 0, 0, false, false, nullptr});
+        PeterDB::LRUKPolicy lruK(3, 2);
+        unsigned victim;
+        for (unsigned i : {0, 0, 1, 1, 2}) {
+            lruK.recordAccess(i);
+        }
+        ASSERT_EQ(lruK.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 2) << "A frame with fewer than K references should go first.";
+
+        lruK.recordAccess(2);
+        ASSERT_EQ(lruK.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 0) << "The frame with the oldest second reference should go.";
+
+        // A single new reference does not save frame 0, two do
+        lruK.recordAccess(0);
+        ASSERT_EQ(lruK.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 0) << "The frame with the oldest second reference should go.";
+        lruK.recordAccess(0);
+        ASSERT_EQ(lruK.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 1) << "The frame with the oldest second reference should go.";
+
+        frames[1].pinCount = 1;
+        ASSERT_EQ(lruK.pickVictim(frames, victim), success) << "Picking a victim should succeed.";
+        EXPECT_EQ(victim, 2) << "A pinned frame should be passed over.";
+    }
+
+    TEST_F (PFM_Page_Test, evict_pages_from_a_small_buffer_pool) {
+        // Test case procedure:
+        // 1. Shrink the buffer pool to a few frames
+        // 2. Write many more pages than frames, so dirty pages are written back when evicted
+        // 3. Pin every frame, pinning one more page fails until a page is unpinned
+        // 4. Reopen the file and check every page, under each replacement policy
+
+        const unsigned numFrames = 4;
+        const unsigned numPages = 50;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        memset(inBuffer, 0, PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+
+        for (PeterDB::ReplacementPolicyType policy : {PeterDB::CLOCK_POLICY, PeterDB::LRU_K_POLICY}) {
+            ASSERT_EQ(pfm.configureBufferPool(numFrames * PAGE_SIZE, policy), success)
+                                        << "Configuring the buffer pool should succeed.";
+            ASSERT_EQ(pfm.getBufferPool().getNumberOfFrames(), numFrames) << "The pool should have its frames.";
+            for (unsigned i = 0; i < numPages; i++) {
+                std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i + policy);
+                ASSERT_EQ(fileHandle.writePage(i, inBuffer), success) << "Writing a page should succeed.";
+            }
+
+            char *pages[numFrames];
+            for (unsigned i = 0; i < numFrames; i++) {
+                ASSERT_EQ(fileHandle.pinPage(i, pages[i]), success) << "Pinning a page should succeed.";
+            }
+            char *page;
+            EXPECT_NE(fileHandle.pinPage(numFrames, page), success) << "Pinning should fail when every frame is pinned.";
+            EXPECT_NE(pfm.configureBufferPool(BUFFER_POOL_SIZE, policy), success)
+                                << "Configuring the buffer pool should fail while pages are pinned.";
+            ASSERT_EQ(fileHandle.unpinPage(0, false), success) << "Unpinning a page should succeed.";
+            ASSERT_EQ(fileHandle.pinPage(numFrames, page), success) << "Pinning a page should succeed.";
+            ASSERT_EQ(*(unsigned *) page, numFrames + policy) << "The pinned page should hold its last write.";
+            ASSERT_EQ(fileHandle.unpinPage(numFrames, false), success) << "Unpinning a page should succeed.";
+            for (unsigned i = 1; i < numFrames; i++) {
+                ASSERT_EQ(fileHandle.unpinPage(i, false), success) << "Unpinning a page should succeed.";
+            }
+
+            reopenFile();
+            for (unsigned i = 0; i < numPages; i++) {
+                ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+                std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i + policy);
+                ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of a page should succeed.";
+            }
+        }
+        ASSERT_EQ(pfm.configureBufferPool(BUFFER_POOL_SIZE, PeterDB::CLOCK_POLICY), success)
+                                    << "Restoring the buffer pool should succeed.";
+    }
+
+    TEST_F (PFM_Page_Test, persist_counters_on_sync_and_close) {
+        // Test case procedure:
+        // 1. Append, write and read pages, the hidden page on disk is not touched by page I/O
+        // 2. Sync the file, the hidden page holds the page count and the counters
+        // 3. Reopen the file, the counters are loaded back
+
+        auto readHiddenPage = [&](unsigned *header) {
+            FILE *file = fopen(fileName.c_str(), "rb");
+            ASSERT_NE(file, nullptr) << "Opening the file should succeed.";
+            ASSERT_EQ(fread(header, sizeof(unsigned), APPEND_PAGE_CNT_POS + 1, file), APPEND_PAGE_CNT_POS + 1)
+                                        << "Reading the hidden page should succeed.";
+            fclose(file);
+        };
+        unsigned before[APPEND_PAGE_CNT_POS + 1], after[APPEND_PAGE_CNT_POS + 1];
+        readHiddenPage(before);
+
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        generateData(inBuffer, PAGE_SIZE, 7, 11);
+        for (unsigned i = 0; i < 5; i++) {
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        for (unsigned i = 0; i < 3; i++) {
+            ASSERT_EQ(fileHandle.writePage(i, inBuffer), success) << "Writing a page should succeed.";
+        }
+        for (unsigned i = 0; i < 2; i++) {
+            ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+        }
+        unsigned readCount, writeCount, appendCount;
+        ASSERT_EQ(fileHandle.collectCounterValues(readCount, writeCount, appendCount), success)
+                                    << "Collecting the counters should succeed.";
+        readHiddenPage(after);
+        EXPECT_EQ(memcmp(before, after, sizeof(before)), 0) << "Page I/O should not write the hidden page.";
+
+        ASSERT_EQ(fileHandle.sync(), success) << "Syncing the file should succeed.";
+        readHiddenPage(after);
+        EXPECT_EQ(after[NUM_PAGE_POS], 5) << "The hidden page should hold the page count.";
+        EXPECT_EQ(after[READ_PAGE_CNT_POS], readCount) << "The hidden page should hold the read counter.";
+        EXPECT_EQ(after[WRITE_PAGE_CNT_POS], writeCount) << "The hidden page should hold the write counter.";
+        EXPECT_EQ(after[APPEND_PAGE_CNT_POS], appendCount) << "The hidden page should hold the append counter.";
+
+        reopenFile();
+        unsigned readCountAfter, writeCountAfter, appendCountAfter;
+        ASSERT_EQ(fileHandle.collectCounterValues(readCountAfter, writeCountAfter, appendCountAfter), success)
+                                    << "Collecting the counters should succeed.";
+        EXPECT_EQ(readCountAfter, readCount) << "The read counter should survive reopening the file.";
+        EXPECT_EQ(writeCountAfter, writeCount) << "The write counter should survive reopening the file.";
+        EXPECT_EQ(appendCountAfter, appendCount) << "The append counter should survive reopening the file.";
+        EXPECT_EQ(fileHandle.getNumberOfPages(), 5) << "The page count should survive reopening the file.";
+    }
+
+    TEST_F (PFM_Page_Test, append_write_and_read_pages_through_mmap) {
+        // Test case procedure:
+        // 1. Reopen the file memory-mapped and pin its first page
+        // 2. Append pages past several mapping chunks, the pinned page stays readable
+        // 3. Overwrite pages with writePage() and in place through pinPage()
+        // 4. Reopen the file with buffered I/O and check every page
+
+        const unsigned numPages = 3 * MMAP_CHUNK_SIZE / PAGE_SIZE;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), 0);
+        ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        ASSERT_EQ(pfm.closeFile(fileHandle), success) << "Closing the file should not fail.";
+        fileHandle = PeterDB::FileHandle();
+        ASSERT_EQ(pfm.openFile(fileName, fileHandle, PeterDB::MMAP_IO), success)
+                                    << "Opening the file memory-mapped should not fail.";
+
+        const char *first = fileHandle.pinPage(0);
+        ASSERT_NE(first, nullptr) << "Pinning a page should succeed.";
+        for (unsigned i = 1; i < numPages; i++) {
+            std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        ASSERT_EQ(fileHandle.getNumberOfPages(), numPages) << "The page count should be " << numPages << ".";
+        EXPECT_EQ(std::count((const unsigned *) first, (const unsigned *) first + PAGE_SIZE / sizeof(unsigned), 0),
+                  PAGE_SIZE / sizeof(unsigned)) << "A pinned page should stay readable while the mapping grows.";
+        ASSERT_EQ(fileHandle.unpinPage(0, false), success) << "Unpinning a page should succeed.";
+
+        // Even pages are replaced, odd ones are changed in place
+        for (unsigned i = 0; i < numPages; i++) {
+            if (i % 2 == 0) {
+                std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i + numPages);
+                ASSERT_EQ(fileHandle.writePage(i, inBuffer), success) << "Writing a page should succeed.";
+            } else {
+                char *page;
+                ASSERT_EQ(fileHandle.pinPage(i, page), success) << "Pinning a page should succeed.";
+                std::fill((unsigned *) page, (unsigned *) page + PAGE_SIZE / sizeof(unsigned), i + numPages);
+                ASSERT_EQ(fileHandle.unpinPage(i, true), success) << "Unpinning a page should succeed.";
+            }
+        }
+
+        reopenFile();
+        ASSERT_EQ(fileHandle.getNumberOfPages(), numPages) << "The page count should survive reopening the file.";
+        for (unsigned i = 0; i < numPages; i++) {
+            ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i + numPages);
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of a page should succeed.";
+        }
+    }
+
+
+    TEST_F (PFM_Page_Test, read_pages_ahead_of_sequential_readers) {
+        // Test case procedure:
+        // 1. The read-ahead window is off without read-ahead and capped at a quarter of the buffer pool
+        // 2. Read every page in order and then backwards under each read-ahead mode, with a large and a small pool
+        // 3. Read the pages memory-mapped with advice to the kernel
+        // 4. Restore the default read-ahead and buffer pool
+
+        const unsigned numPages = 300;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            std::fill((unsigned *) inBuffer, (unsigned *) inBuffer + PAGE_SIZE / sizeof(unsigned), i * 3 + 1);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+
+        auto checkPages = [&]() {
+            for (unsigned i = 0; i < numPages; i++) {
+                ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+                ASSERT_EQ(*(unsigned *) outBuffer, i * 3 + 1) << "Page " << i << " should hold its own data.";
+            }
+            for (unsigned i = numPages; i-- > 0;) {
+                const char *page = fileHandle.pinPage(i);
+                ASSERT_NE(page, nullptr) << "Pinning a page should succeed.";
+                ASSERT_EQ(*(const unsigned *) page, i * 3 + 1) << "Page " << i << " should hold its own data.";
+                ASSERT_EQ(fileHandle.unpinPage(i, false), success) << "Unpinning a page should succeed.";
+            }
+        };
+
+        ASSERT_EQ(pfm.configureReadAhead(PeterDB::NO_READ_AHEAD, 32), success)
+                                    << "Configuring read-ahead should succeed.";
+        EXPECT_EQ(pfm.getReadAheadWindow(), 0) << "The window should be off without read-ahead.";
+        ASSERT_EQ(pfm.configureBufferPool(16 * PAGE_SIZE, PeterDB::CLOCK_POLICY), success)
+                                    << "Configuring the buffer pool should succeed.";
+        ASSERT_EQ(pfm.configureReadAhead(PeterDB::THREAD_READ_AHEAD, 32), success)
+                                    << "Configuring read-ahead should succeed.";
+        EXPECT_EQ(pfm.getReadAheadWindow(), 4) << "The window should be capped at a quarter of the pool.";
+
+        for (size_t budget : {(size_t) BUFFER_POOL_SIZE, (size_t) 16 * PAGE_SIZE}) {
+            ASSERT_EQ(pfm.configureBufferPool(budget, PeterDB::CLOCK_POLICY), success)
+                                        << "Configuring the buffer pool should succeed.";
+            for (PeterDB::ReadAheadMode mode : {PeterDB::NO_READ_AHEAD, PeterDB::THREAD_READ_AHEAD,
+                                                PeterDB::ADVISE_READ_AHEAD}) {
+                ASSERT_EQ(pfm.configureReadAhead(mode, 32), success) << "Configuring read-ahead should succeed.";
+                reopenFile();
+                checkPages();
+            }
+        }
+
+        ASSERT_EQ(pfm.closeFile(fileHandle), success) << "Closing the file should not fail.";
+        fileHandle = PeterDB::FileHandle();
+        ASSERT_EQ(pfm.openFile(fileName, fileHandle, PeterDB::MMAP_IO), success)
+                                    << "Opening the file memory-mapped should not fail.";
+        checkPages();
+
+        ASSERT_EQ(pfm.configureReadAhead(PeterDB::THREAD_READ_AHEAD, READ_AHEAD_WINDOW), success)
+                                    << "Restoring read-ahead should succeed.";
+        ASSERT_EQ(pfm.configureBufferPool(BUFFER_POOL_SIZE, PeterDB::CLOCK_POLICY), success)
+                                    << "Restoring the buffer pool should succeed.";
+    }
+
 } // namespace PeterDBTesting
\ No newline at end of file
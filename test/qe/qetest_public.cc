@@ -1520,4 +1520,589 @@ namespace PeterDBTesting {
 
     }
 
+    TEST_F(QE_Test, spill_file_keeps_existing_file) {
+        // Checks that a spill file never takes over a file it did not create
+        // Functions tested
+        // 1. SpillFile::makePrefix gives each operator its own name
+        // 2. A SpillFile over an existing file fails to add and leaves the file alone
+
+        std::string fileName = PeterDB::SpillFile::makePrefix("spill");
+        ASSERT_NE(fileName, PeterDB::SpillFile::makePrefix("spill")) << "Spill file prefixes should not repeat.";
+
+        PeterDB::RecordBasedFileManager &rbfm = PeterDB::RecordBasedFileManager::instance();
+        ASSERT_EQ(rbfm.createFile(fileName), success) << "RecordBasedFileManager::createFile() should succeed.";
+        {
+            PeterDB::SpillFile spillFile(fileName, attrsMap["left"]);
+            char tuple[13] = {0};
+            ASSERT_NE(spillFile.add(tuple, sizeof(tuple)), success) << "SpillFile::add() should fail.";
+        }
+        ASSERT_TRUE(fileExists(fileName)) << "The file " << fileName << " should still exist.";
+        ASSERT_EQ(rbfm.destroyFile(fileName), success) << "RecordBasedFileManager::destroyFile() should succeed.";
+    }
+
+
+    TEST_F(QE_Test, filter_and_project_in_batches) {
+        // Project -- Filter -- TableScan, read a batch at a time
+        // SELECT C, A FROM LEFT WHERE B <= 51
+        inBuffer = malloc(bufSize);
+
+        std::string tableName = "left";
+        const unsigned numTuples = 3000;
+        createAndPopulateTable(tableName, {}, numTuples);
+
+        PeterDB::TableScan ts(rm, tableName);
+        PeterDB::Condition cond{"left.B", PeterDB::LE_OP, false, "", {PeterDB::TypeInt, inBuffer}};
+        *(unsigned *) cond.rhsValue.data = 51;
+        PeterDB::Filter filter(&ts, cond);
+        PeterDB::Project project(&filter, {"left.C", "left.A"});
+
+        ASSERT_EQ(project.getAttributes(attrs), success) << "Project.getAttributes() should succeed.";
+        PeterDB::TupleBatch batch;
+        batch.setAttributes(attrs);
+        std::vector<std::pair<unsigned, float>> returned;
+        while (project.getNextBatch(batch) != QE_EOF) {
+            ASSERT_GT(batch.size(), 0) << "A batch before the end should not be empty.";
+            ASSERT_LE(batch.size(), QE_BATCH_SIZE) << "A batch should hold at most QE_BATCH_SIZE tuples.";
+            for (unsigned short t : batch.selection) {
+                ASSERT_FALSE(batch.isNull(t, 0) || batch.isNull(t, 1)) << "No field should be null.";
+                ASSERT_EQ(batch.getFieldLength(t, 0), sizeof(float)) << "C should take 4 bytes.";
+                float c;
+                unsigned a;
+                memcpy(&c, batch.getField(t, 0), sizeof(float));
+                memcpy(&a, batch.getField(t, 1), sizeof(unsigned));
+                ASSERT_EQ(batch.getLength(t), 1 + 2 * sizeof(unsigned)) << "The tuple length is not correct.";
+                returned.emplace_back(a, c);
+            }
+        }
+        EXPECT_EQ(project.getNextBatch(batch), QE_EOF) << "Reading past the end should keep returning QE_EOF.";
+
+        std::vector<std::pair<unsigned, float>> expected;
+        for (unsigned i = 0; i < numTuples; i++) {
+            if ((i + 10) % 197 <= 51) {
+                expected.emplace_back(i % 203, (float) (i % 167) + 50.5f);
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(returned.begin(), returned.end());
+        ASSERT_EQ(returned.size(), expected.size()) << "The number of returned tuple is not correct.";
+        EXPECT_TRUE(returned == expected) << "The returned tuples are not correct.";
+    }
+
+
+    TEST_F(QE_Test, project_unknown_attribute_as_null) {
+        // Project -- TableScan, with an attribute the table does not have
+        // SELECT A, X FROM LEFT
+        inBuffer = malloc(bufSize);
+
+        std::string tableName = "left";
+        const unsigned numTuples = 100;
+        createAndPopulateTable(tableName, {}, numTuples);
+
+        PeterDB::TableScan ts(rm, tableName);
+        PeterDB::Project project(&ts, {"left.A", "left.X"});
+
+        ASSERT_EQ(project.getAttributes(attrs), success) << "Project.getAttributes() should succeed.";
+        ASSERT_EQ(attrs.size(), 2) << "Every projected attribute should be in the output.";
+        EXPECT_EQ(attrs[1].name, "left.X") << "The unknown attribute should keep its name.";
+        PeterDB::TupleBatch batch;
+        batch.setAttributes(attrs);
+        std::vector<unsigned> returned;
+        while (project.getNextBatch(batch) != QE_EOF) {
+            for (unsigned short t : batch.selection) {
+                ASSERT_FALSE(batch.isNull(t, 0)) << "A should not be null.";
+                ASSERT_TRUE(batch.isNull(t, 1)) << "The unknown attribute should be null.";
+                ASSERT_EQ(batch.getLength(t), 1 + sizeof(unsigned)) << "The tuple length is not correct.";
+                unsigned a;
+                memcpy(&a, batch.getField(t, 0), sizeof(unsigned));
+                returned.push_back(a);
+            }
+        }
+
+        std::vector<unsigned> expected;
+        for (unsigned i = 0; i < numTuples; i++) {
+            expected.push_back(i % 203);
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(returned.begin(), returned.end());
+        EXPECT_TRUE(returned == expected) << "The returned tuples are not correct.";
+    }
+
+    // Tuples made up in memory, so operators can be given more than fits in their budget quickly: tuple i is
+    // (rel.K, rel.V, rel.P) = ((i * multiplier) % modulus, i, padLength times a letter of i)
+    class QE_GeneratedIterator : public PeterDB::Iterator {
+    public:
+        QE_GeneratedIterator(const std::string &rel, unsigned numTuples, unsigned modulus, unsigned multiplier,
+                             unsigned padLength)
+                : numTuples(numTuples), modulus(modulus), multiplier(multiplier), padLength(padLength),
+                  produced(0), closed(false) {
+            attrs = {{rel + ".K", PeterDB::TypeInt,     4},
+                     {rel + ".V", PeterDB::TypeInt,     4},
+                     {rel + ".P", PeterDB::TypeVarChar, std::max(padLength, 1u)}};
+        }
+
+        PeterDB::RC getNextTuple(void *data) override {
+            if (closed || produced == numTuples) {
+                return QE_EOF;
+            }
+            const unsigned i = produced++;
+            const int k = (int) ((unsigned long long) i * multiplier % modulus);
+            char *tuple = (char *) data;
+            tuple[0] = 0;
+            memcpy(tuple + 1, &k, sizeof(int));
+            memcpy(tuple + 1 + sizeof(int), &i, sizeof(int));
+            memcpy(tuple + 1 + 2 * sizeof(int), &padLength, sizeof(unsigned));
+            memset(tuple + 1 + 3 * sizeof(int), 'a' + (int) (i % 26), padLength);
+            return 0;
+        }
+
+        PeterDB::RC getAttributes(std::vector<PeterDB::Attribute> &attributes) const override {
+            attributes = attrs;
+            return 0;
+        }
+
+        PeterDB::RC close() override {
+            closed = true;
+            return 0;
+        }
+
+        unsigned numTuples, modulus, multiplier, padLength;
+        unsigned produced;
+        bool closed;
+
+    private:
+        std::vector<PeterDB::Attribute> attrs;
+    };
+
+    // Reads an INT field of a tuple of generated inputs: only the last attribute is a VarChar, so every field up
+    // to it is at a fixed offset after the null indicator
+    int readIntField(const void *tuple, unsigned nullBytes, unsigned field) {
+        int value;
+        memcpy(&value, (const char *) tuple + nullBytes + field * sizeof(int), sizeof(int));
+        return value;
+    }
+
+    TEST_F(QE_Test, ghjoin_splits_large_partitions) {
+        // GHJoin -- the left input is several times QE_MEMORY_BUDGET and split over two partitions only,
+        // so every partition is hashed again before it is joined
+        // SELECT L.K, L.V, R.V FROM L, R WHERE L.K = R.K
+
+        const unsigned numLeft = 60000, numRight = 20000;
+        QE_GeneratedIterator leftIn("L", numLeft, 5000, 1, 60);
+        QE_GeneratedIterator rightIn("R", numRight, 7000, 1, 0);
+        PeterDB::Condition cond{"L.K", PeterDB::EQ_OP, true, "R.K"};
+
+        const size_t numFiles = glob("").size();
+        auto *ghJoin = new PeterDB::GHJoin(&leftIn, &rightIn, cond, 2);
+        ASSERT_EQ(ghJoin->getAttributes(attrs), success) << "GHJoin.getAttributes() should succeed.";
+        ASSERT_EQ(attrs.size(), 6) << "The join should return the attributes of both inputs.";
+        EXPECT_EQ(attrs[0].name, "L.K") << "The left attributes should come first.";
+        EXPECT_EQ(attrs[3].name, "R.K") << "The right attributes should come after the left ones.";
+
+        // Every left key below 5000 is found three times on the right
+        outBuffer = malloc(PAGE_SIZE);
+        std::vector<unsigned char> matches(numLeft, 0);
+        unsigned numReturned = 0;
+        while (ghJoin->getNextTuple(outBuffer) != QE_EOF) {
+            const int leftKey = readIntField(outBuffer, 1, 0);
+            const int leftValue = readIntField(outBuffer, 1, 1);
+            unsigned padLength;
+            memcpy(&padLength, (char *) outBuffer + 1 + 2 * sizeof(int), sizeof(unsigned));
+            ASSERT_EQ(padLength, 60) << "The left VarChar should be returned whole.";
+            const char *right = (char *) outBuffer + 1 + 3 * sizeof(int) + padLength;
+            int rightKey, rightValue;
+            memcpy(&rightKey, right, sizeof(int));
+            memcpy(&rightValue, right + sizeof(int), sizeof(int));
+            ASSERT_EQ(leftKey, rightKey) << "Joined tuples should have the same key.";
+            ASSERT_EQ(leftKey, leftValue % 5000) << "The left tuple should be whole.";
+            ASSERT_EQ(rightKey, rightValue % 7000) << "The right tuple should be whole.";
+            matches[leftValue]++;
+            numReturned++;
+            ASSERT_GE(glob("").size(), numFiles + 4) << "The partitions should be spilled to files.";
+        }
+        ASSERT_EQ(numReturned, 3 * numLeft) << "The number of returned tuple is not correct.";
+        ASSERT_EQ(std::count(matches.begin(), matches.end(), 3), numLeft) << "Each left tuple should join three times.";
+
+        delete ghJoin;
+        ASSERT_EQ(glob("").size(), numFiles) << "GHJoin should clean after itself.";
+    }
+
+
+    TEST_F(QE_Test, bnljoin_over_many_small_blocks) {
+        // BNLJoin -- a block of one page, so the right input is scanned once per block
+        // 1. SELECT * FROM left, right WHERE left.B = right.B, through each block's hash table
+        // 2. SELECT * FROM left, right WHERE left.B < right.D, checked against every tuple of the block
+
+        inBuffer = malloc(bufSize);
+        outBuffer = malloc(bufSize);
+
+        const unsigned numLeft = 3000, numRight = 1000;
+        createAndPopulateTable("left", {}, numLeft);
+        createAndPopulateTable("right", {}, numRight);
+
+        using Joined = std::tuple<unsigned, unsigned, float, unsigned, float, unsigned>;
+        for (PeterDB::CompOp op : {PeterDB::EQ_OP, PeterDB::LT_OP}) {
+            const unsigned maxA = op == PeterDB::EQ_OP ? 203 : 20;
+            PeterDB::TableScan leftScan(rm, "left");
+            PeterDB::Condition leftCond{"left.A", PeterDB::LT_OP, false, "", {PeterDB::TypeInt, inBuffer}};
+            *(unsigned *) inBuffer = maxA;
+            PeterDB::Filter leftIn(&leftScan, leftCond);
+            PeterDB::TableScan rightIn(rm, "right");
+            PeterDB::Condition cond{"left.B", op, true, op == PeterDB::EQ_OP ? "right.B" : "right.D"};
+            PeterDB::BNLJoin bnlJoin(&leftIn, &rightIn, cond, 1);
+
+            std::vector<Joined> returned;
+            while (bnlJoin.getNextTuple(outBuffer) != QE_EOF) {
+                Joined joined;
+                const char *tuple = (const char *) outBuffer + 1;
+                memcpy(&std::get<0>(joined), tuple, 4);
+                memcpy(&std::get<1>(joined), tuple + 4, 4);
+                memcpy(&std::get<2>(joined), tuple + 8, 4);
+                memcpy(&std::get<3>(joined), tuple + 12, 4);
+                memcpy(&std::get<4>(joined), tuple + 16, 4);
+                memcpy(&std::get<5>(joined), tuple + 20, 4);
+                returned.push_back(joined);
+            }
+
+            // left.A is i % 203, all of them pass the filter of the equality join
+            std::vector<Joined> expected;
+            for (unsigned i = 0; i < numLeft; i++) {
+                const unsigned a = i % 203, b1 = (i + 10) % 197;
+                const float c1 = (float) (i % 167) + 50.5f;
+                if (a >= maxA) {
+                    continue;
+                }
+                for (unsigned j = 0; j < numRight; j++) {
+                    const unsigned b2 = j % 251 + 20, d = j % 179;
+                    const float c2 = (float) (j % 261) + 25.5f;
+                    if (op == PeterDB::EQ_OP ? b1 == b2 : b1 < d) {
+                        expected.emplace_back(a, b1, c1, b2, c2, d);
+                    }
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            std::sort(returned.begin(), returned.end());
+            ASSERT_EQ(returned.size(), expected.size()) << "The number of returned tuple is not correct.";
+            EXPECT_TRUE(returned == expected) << "The returned tuples are not correct.";
+        }
+    }
+
+
+    TEST_F(QE_Test, inljoin_probes_batches_in_key_order) {
+        // INLJoin -- several batches of left tuples, many sharing a key and some with no match
+        // 1. SELECT * FROM left, right WHERE left.B = right.B, with an index on right.B
+        // 2. SELECT * FROM left, right WHERE left.C = right.C, with an index on right.C
+
+        inBuffer = malloc(bufSize);
+        outBuffer = malloc(bufSize);
+
+        const unsigned numLeft = 5000, numRight = 3000;
+        createAndPopulateTable("left", {}, numLeft);
+        createAndPopulateTable("right", {"B", "C"}, numRight);
+
+        using Joined = std::tuple<unsigned, unsigned, float, unsigned, float, unsigned>;
+        for (const std::string attr : {"B", "C"}) {
+            PeterDB::TableScan leftIn(rm, "left");
+            PeterDB::IndexScan rightIn(rm, "right", attr);
+            PeterDB::Condition cond{"left." + attr, PeterDB::EQ_OP, true, "right." + attr};
+            PeterDB::INLJoin inlJoin(&leftIn, &rightIn, cond);
+
+            std::vector<Joined> returned;
+            while (inlJoin.getNextTuple(outBuffer) != QE_EOF) {
+                Joined joined;
+                const char *tuple = (const char *) outBuffer + 1;
+                memcpy(&std::get<0>(joined), tuple, 4);
+                memcpy(&std::get<1>(joined), tuple + 4, 4);
+                memcpy(&std::get<2>(joined), tuple + 8, 4);
+                memcpy(&std::get<3>(joined), tuple + 12, 4);
+                memcpy(&std::get<4>(joined), tuple + 16, 4);
+                memcpy(&std::get<5>(joined), tuple + 20, 4);
+                returned.push_back(joined);
+            }
+
+            std::vector<Joined> expected;
+            for (unsigned i = 0; i < numLeft; i++) {
+                const unsigned a = i % 203, b1 = (i + 10) % 197;
+                const float c1 = (float) (i % 167) + 50.5f;
+                for (unsigned j = 0; j < numRight; j++) {
+                    const unsigned b2 = j % 251 + 20, d = j % 179;
+                    const float c2 = (float) (j % 261) + 25.5f;
+                    if (attr == "B" ? b1 == b2 : c1 == c2) {
+                        expected.emplace_back(a, b1, c1, b2, c2, d);
+                    }
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            std::sort(returned.begin(), returned.end());
+            ASSERT_EQ(returned.size(), expected.size()) << "The number of returned tuple is not correct.";
+            EXPECT_TRUE(returned == expected) << "The returned tuples are not correct.";
+        }
+    }
+
+
+    TEST_F(QE_Test, group_aggregation_spills_groups) {
+        // Aggregate -- GROUP BY with more groups than fit in QE_MEMORY_BUDGET, the others are spilled and
+        // aggregated afterwards
+        // 1. SELECT G.K, SUM(G.V) FROM G GROUP BY G.K
+        // 2. SELECT G.K, COUNT(G.V) FROM G GROUP BY G.K
+        // 3. SELECT G.P, MAX(G.V) FROM G GROUP BY G.P, grouped on a VarChar
+
+        const unsigned numTuples = 400000, numGroups = 200000;
+        outBuffer = malloc(PAGE_SIZE);
+        const size_t numFiles = glob("").size();
+
+        for (PeterDB::AggregateOp op : {PeterDB::SUM, PeterDB::COUNT}) {
+            QE_GeneratedIterator input("G", numTuples, numGroups, 1, 0);
+            auto *agg = new PeterDB::Aggregate(&input, {"G.V", PeterDB::TypeInt, 4}, {"G.K", PeterDB::TypeInt, 4}, op);
+            ASSERT_EQ(agg->getAttributes(attrs), success) << "Aggregate.getAttributes() should succeed.";
+            ASSERT_EQ(attrs.size(), 2) << "The group and the aggregate should be returned.";
+            EXPECT_EQ(attrs[1].name, op == PeterDB::SUM ? "SUM(G.V)" : "COUNT(G.V)")
+                                << "The aggregate should be named after its operation.";
+
+            // Group k holds the tuples k and k + numGroups
+            std::vector<bool> seen(numGroups, false);
+            bool spilled = false;
+            while (agg->getNextTuple(outBuffer) != QE_EOF) {
+                const int k = readIntField(outBuffer, 1, 0);
+                float value;
+                memcpy(&value, (char *) outBuffer + 1 + sizeof(int), sizeof(float));
+                ASSERT_TRUE(k >= 0 && k < (int) numGroups) << "The group value is not correct.";
+                ASSERT_FALSE(seen[k]) << "Group " << k << " should be returned once.";
+                seen[k] = true;
+                ASSERT_EQ(value, op == PeterDB::SUM ? (float) (2 * k + numGroups) : 2.0f)
+                                            << "The aggregate of group " << k << " is not correct.";
+                spilled = spilled || glob("").size() > numFiles;
+            }
+            EXPECT_TRUE(spilled) << "The groups that do not fit should be spilled to files.";
+            ASSERT_EQ(std::count(seen.begin(), seen.end(), true), numGroups) << "Every group should be returned.";
+            delete agg;
+            ASSERT_EQ(glob("").size(), numFiles) << "Aggregate should clean after itself.";
+        }
+
+        QE_GeneratedIterator input("G", 1000, 1, 1, 5);
+        PeterDB::Aggregate agg(&input, {"G.V", PeterDB::TypeInt, 4}, {"G.P", PeterDB::TypeVarChar, 5}, PeterDB::MAX);
+        std::vector<std::pair<std::string, float>> returned;
+        while (agg.getNextTuple(outBuffer) != QE_EOF) {
+            unsigned length;
+            memcpy(&length, (char *) outBuffer + 1, sizeof(unsigned));
+            float value;
+            memcpy(&value, (char *) outBuffer + 1 + sizeof(unsigned) + length, sizeof(float));
+            returned.emplace_back(std::string((char *) outBuffer + 1 + sizeof(unsigned), length), value);
+        }
+        std::sort(returned.begin(), returned.end());
+        ASSERT_EQ(returned.size(), 26) << "Each letter should be a group.";
+        for (unsigned letter = 0; letter < 26; letter++) {
+            EXPECT_EQ(returned[letter].first, std::string(5, (char) ('a' + letter))) << "The group value is not correct.";
+            // The last i below 1000 with i % 26 == letter
+            const unsigned last = letter < 1000 % 26 ? 1000 - 1000 % 26 + letter : 1000 - 1000 % 26 - 26 + letter;
+            EXPECT_EQ(returned[letter].second, (float) last) << "The maximum of group " << letter << " is not correct.";
+        }
+    }
+
+
+    TEST_F(QE_Test, sort_spills_and_merges_runs) {
+        // Sort -- four pages of tuples at a time, so there are more runs than are merged at once
+        // 1. SELECT * FROM S ORDER BY S.K, the keys a permutation of 0 to n - 1
+        // 2. SELECT * FROM S ORDER BY S.K DESC, S.V
+        // 3. A sort that fits in memory leaves no file behind
+
+        const unsigned numTuples = 50000;
+        outBuffer = malloc(PAGE_SIZE);
+        const size_t numFiles = glob("").size();
+        {
+            QE_GeneratedIterator input("S", numTuples, numTuples, 7919, 40);
+            PeterDB::Sort sort(&input, {{"S.K", false}}, 4);
+            EXPECT_TRUE(sort.isOrderedOn("S.K")) << "The sort should be ordered on its first key.";
+            EXPECT_FALSE(sort.isOrderedOn("S.V")) << "The sort should not be ordered on other attributes.";
+            int expected = 0;
+            bool spilled = false;
+            while (sort.getNextTuple(outBuffer) != QE_EOF) {
+                const int k = readIntField(outBuffer, 1, 0), v = readIntField(outBuffer, 1, 1);
+                ASSERT_EQ(k, expected) << "The tuples should come in order of S.K.";
+                ASSERT_EQ(k, (int) ((unsigned long long) v * 7919 % numTuples)) << "The tuple should be whole.";
+                unsigned padLength;
+                memcpy(&padLength, (char *) outBuffer + 1 + 2 * sizeof(int), sizeof(unsigned));
+                ASSERT_EQ(padLength, 40) << "The VarChar should be returned whole.";
+                ASSERT_EQ(((char *) outBuffer)[1 + 3 * sizeof(int) + 39], 'a' + v % 26) << "The tuple should be whole.";
+                spilled = spilled || glob("").size() > numFiles;
+                expected++;
+            }
+            ASSERT_EQ(expected, numTuples) << "The number of returned tuple is not correct.";
+            EXPECT_TRUE(spilled) << "The sorted runs should be spilled to files.";
+            ASSERT_EQ(sort.close(), success) << "Sort.close() should succeed.";
+            EXPECT_TRUE(input.closed) << "Closing the sort should close its input.";
+        }
+        ASSERT_EQ(glob("").size(), numFiles) << "Sort should clean after itself.";
+
+        {
+            QE_GeneratedIterator input("S", 20000, 100, 1, 40);
+            PeterDB::Sort sort(&input, {{"S.K", true}, {"S.V", false}}, 4);
+            int lastK = 100, lastV = -1;
+            unsigned numReturned = 0;
+            while (sort.getNextTuple(outBuffer) != QE_EOF) {
+                const int k = readIntField(outBuffer, 1, 0), v = readIntField(outBuffer, 1, 1);
+                ASSERT_TRUE(k < lastK || (k == lastK && v > lastV)) << "The tuples should come in order of the keys.";
+                lastK = k;
+                lastV = v;
+                numReturned++;
+            }
+            ASSERT_EQ(numReturned, 20000) << "The number of returned tuple is not correct.";
+        }
+        ASSERT_EQ(glob("").size(), numFiles) << "Sort should clean after itself.";
+
+        {
+            QE_GeneratedIterator input("S", 1000, 1000, 7919, 10);
+            PeterDB::Sort sort(&input, {{"S.K", false}});
+            unsigned numReturned = 0;
+            while (sort.getNextTuple(outBuffer) != QE_EOF) {
+                ASSERT_EQ(glob("").size(), numFiles) << "A sort in memory should not spill.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 0), (int) numReturned) << "The tuples should come in order.";
+                numReturned++;
+            }
+            ASSERT_EQ(numReturned, 1000) << "The number of returned tuple is not correct.";
+        }
+    }
+
+
+    TEST_F(QE_Test, smjoin_sorts_inputs_and_spills_runs) {
+        // SMJoin -- unordered inputs are sorted, and the right tuples of a key that outgrow the budget are spilled
+        // 1. SELECT * FROM L, R WHERE L.K = R.K, ten thousand right tuples for each of three keys
+        // 2. SELECT * FROM L, R WHERE L.K = R.K, both inputs larger than the budget
+
+        outBuffer = malloc(PAGE_SIZE);
+        const size_t numFiles = glob("").size();
+
+        // Returns how many times each left tuple was joined
+        auto join = [&](QE_GeneratedIterator &leftIn, QE_GeneratedIterator &rightIn, unsigned numPages) {
+            PeterDB::Condition cond{"L.K", PeterDB::EQ_OP, true, "R.K"};
+            std::vector<unsigned> matches(leftIn.numTuples, 0);
+            auto *smJoin = new PeterDB::SMJoin(&leftIn, &rightIn, cond, numPages);
+            EXPECT_EQ(smJoin->getAttributes(attrs), success) << "SMJoin.getAttributes() should succeed.";
+            EXPECT_EQ(attrs.size(), 6) << "The join should return the attributes of both inputs.";
+            while (smJoin->getNextTuple(outBuffer) != QE_EOF) {
+                const int leftKey = readIntField(outBuffer, 1, 0), leftValue = readIntField(outBuffer, 1, 1);
+                unsigned padLength;
+                memcpy(&padLength, (char *) outBuffer + 1 + 2 * sizeof(int), sizeof(unsigned));
+                const char *right = (char *) outBuffer + 1 + 3 * sizeof(int) + padLength;
+                int rightKey, rightValue;
+                memcpy(&rightKey, right, sizeof(int));
+                memcpy(&rightValue, right + sizeof(int), sizeof(int));
+                EXPECT_EQ(leftKey, rightKey) << "Joined tuples should have the same key.";
+                EXPECT_EQ(leftKey, (int) ((unsigned long long) leftValue * leftIn.multiplier % leftIn.modulus))
+                                    << "The left tuple should be whole.";
+                EXPECT_EQ(rightKey, (int) ((unsigned long long) rightValue * rightIn.multiplier % rightIn.modulus))
+                                    << "The right tuple should be whole.";
+                matches[leftValue]++;
+            }
+            delete smJoin;
+            return matches;
+        };
+
+        {
+            QE_GeneratedIterator leftIn("L", 10, 5, 1, 0);
+            QE_GeneratedIterator rightIn("R", 30000, 3, 1, 40);
+            std::vector<unsigned> matches = join(leftIn, rightIn, 2);
+            for (unsigned i = 0; i < 10; i++) {
+                EXPECT_EQ(matches[i], i % 5 < 3 ? 10000 : 0) << "Left tuple " << i << " joined a wrong number of times.";
+            }
+        }
+        ASSERT_EQ(glob("").size(), numFiles) << "SMJoin should clean after itself.";
+
+        {
+            QE_GeneratedIterator leftIn("L", 20000, 5000, 7, 20);
+            QE_GeneratedIterator rightIn("R", 15000, 7000, 1, 20);
+            std::vector<unsigned> matches = join(leftIn, rightIn, 4);
+            for (unsigned i = 0; i < 20000; i++) {
+                const unsigned k = i * 7 % 5000;
+                // Right keys below 1000 are found three times, the others twice
+                ASSERT_EQ(matches[i], k < 1000 ? 3 : 2) << "Left tuple " << i << " joined a wrong number of times.";
+            }
+        }
+        ASSERT_EQ(glob("").size(), numFiles) << "SMJoin should clean after itself.";
+    }
+
+
+    TEST_F(QE_Test, limit_closes_input_early_and_topn_keeps_order) {
+        // Limit and TopN
+        // 1. Limit stops reading and closes its input once the limit is reached
+        // 2. Limit over a spilling Sort removes the runs as soon as it is done
+        // 3. Limit closed before the end, and a limit of 0
+        // 4. TopN returns the first n tuples in order, ties in input order
+
+        inBuffer = malloc(bufSize);
+        outBuffer = malloc(PAGE_SIZE);
+        const size_t numFiles = glob("").size();
+
+        {
+            QE_GeneratedIterator input("T", 100000, 100000, 1, 0);
+            PeterDB::Limit limit(&input, 10);
+            for (int v = 0; v < 10; v++) {
+                ASSERT_EQ(limit.getNextTuple(outBuffer), success) << "Limit.getNextTuple() should succeed.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 1), v) << "The tuples should come in input order.";
+            }
+            ASSERT_EQ(limit.getNextTuple(outBuffer), QE_EOF) << "Limit should stop at the limit.";
+            EXPECT_TRUE(input.closed) << "The input should be closed once the limit is reached.";
+            EXPECT_LE(input.produced, QE_BATCH_SIZE) << "The input should not be read past the limit's batch.";
+        }
+
+        {
+            QE_GeneratedIterator input("T", 50000, 50000, 7919, 40);
+            PeterDB::Sort sort(&input, {{"T.K", false}}, 4);
+            PeterDB::Limit limit(&sort, 5);
+            for (int k = 0; k < 5; k++) {
+                ASSERT_EQ(limit.getNextTuple(outBuffer), success) << "Limit.getNextTuple() should succeed.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 0), k) << "The smallest keys should come first.";
+            }
+            ASSERT_EQ(limit.getNextTuple(outBuffer), QE_EOF) << "Limit should stop at the limit.";
+            EXPECT_TRUE(input.closed) << "Closing the sort should close its input.";
+            ASSERT_EQ(glob("").size(), numFiles) << "The sorted runs should be removed once the limit is reached.";
+        }
+
+        createAndPopulateTable("left", {}, 5000);
+        {
+            PeterDB::TableScan ts(rm, "left");
+            PeterDB::Limit limit(&ts, 1000);
+            for (int i = 0; i < 3; i++) {
+                ASSERT_EQ(limit.getNextTuple(outBuffer), success) << "Limit.getNextTuple() should succeed.";
+            }
+            ASSERT_EQ(limit.close(), success) << "Limit.close() should succeed.";
+            ASSERT_EQ(limit.close(), success) << "Closing Limit twice should succeed.";
+
+            QE_GeneratedIterator input("T", 100, 100, 1, 0);
+            PeterDB::Limit none(&input, 0);
+            EXPECT_EQ(none.getNextTuple(outBuffer), QE_EOF) << "A limit of 0 should return nothing.";
+            EXPECT_TRUE(input.closed) << "A limit of 0 should close its input.";
+        }
+
+        {
+            QE_GeneratedIterator input("T", 20000, 20000, 7919, 10);
+            PeterDB::TopN topN(&input, {{"T.K", true}}, 25);
+            for (int k = 19999; k > 19974; k--) {
+                ASSERT_EQ(topN.getNextTuple(outBuffer), success) << "TopN.getNextTuple() should succeed.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 0), k) << "The largest keys should come first.";
+            }
+            ASSERT_EQ(topN.getNextTuple(outBuffer), QE_EOF) << "TopN should return n tuples.";
+        }
+
+        {
+            QE_GeneratedIterator input("T", 5000, 10, 1, 0);
+            PeterDB::TopN topN(&input, {{"T.K", false}}, 15);
+            for (int v = 0; v < 150; v += 10) {
+                ASSERT_EQ(topN.getNextTuple(outBuffer), success) << "TopN.getNextTuple() should succeed.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 0), 0) << "The smallest key should come first.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 1), v) << "Ties should come in input order.";
+            }
+            ASSERT_EQ(topN.getNextTuple(outBuffer), QE_EOF) << "TopN should return n tuples.";
+        }
+
+        {
+            QE_GeneratedIterator input("T", 50, 50, 7, 0);
+            PeterDB::TopN topN(&input, {{"T.K", true}}, 100);
+            for (int k = 49; k >= 0; k--) {
+                ASSERT_EQ(topN.getNextTuple(outBuffer), success) << "TopN.getNextTuple() should succeed.";
+                ASSERT_EQ(readIntField(outBuffer, 1, 0), k) << "Every tuple should come in order.";
+            }
+            ASSERT_EQ(topN.getNextTuple(outBuffer), QE_EOF) << "TopN should return the whole input at most.";
+        }
+    }
+
 } // namespace PeterDBTesting
\ No newline at end of file
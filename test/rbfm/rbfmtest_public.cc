@@ -993,4 +993,638 @@ namespace PeterDBTesting {
         }
     }
 
+
+    TEST_F(RBFM_Test_2, reuse_space_found_through_free_space_map) {
+        // Functions Tested:
+        // 1. insertRecord() - fill pages with records about a quarter of a page each
+        // 2. deleteRecord() - empty a page early in the file
+        // 3. Close and open the file, the free space map is read back from disk
+        // 4. insertRecord() - a record too large for every other page goes to the emptied page
+
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(3000);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createLargeRecordDescriptor4(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        int numRecords = 200;
+        std::vector<PeterDB::RID> rids;
+        for (int i = 0; i < numRecords; i++) {
+            memset(inBuffer, 0, 3000);
+            prepareLargeRecord4((int) recordDescriptor.size(), nullsIndicator, 999, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            rids.push_back(rid);
+        }
+        unsigned pageCount = fileHandle.getNumberOfPages();
+        ASSERT_GT(pageCount, 20) << "The records should take more than 20 pages.";
+
+        PeterDB::PageNum emptied = 10;
+        for (const PeterDB::RID &r : rids) {
+            if (r.pageNum == emptied) {
+                ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, r), success)
+                                            << "Deleting a record should succeed.";
+            }
+        }
+        ASSERT_EQ(rbfm.closeFile(fileHandle), success) << "Closing the file should not fail.";
+        ASSERT_EQ(rbfm.openFile(fileName, fileHandle), success) << "Opening the file should not fail.";
+
+        memset(inBuffer, 0, 3000);
+        prepareLargeRecord4((int) recordDescriptor.size(), nullsIndicator, 1999, inBuffer, recordSize);
+        ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                    << "Inserting a record should succeed.";
+        EXPECT_EQ(rid.pageNum, emptied) << "The record should go to the page with free space.";
+        EXPECT_EQ(fileHandle.getNumberOfPages(), pageCount) << "No page should be appended.";
+
+        outBuffer = malloc(3000);
+        ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rid, outBuffer), success)
+                                    << "Reading a record should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, recordSize), 0) << "Returned Data should be the same";
+    }
+
+
+    TEST_F(RBFM_Test, insert_records_in_batches) {
+        // Functions tested
+        // 1. insertRecords() - insert a batch and read every record back
+        // 2. deleteRecord() - free space on the first page
+        // 3. insertRecords() with append - the batch goes to the last page and new ones
+        // 4. Scan - records come back in the order they were inserted
+
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        auto prepareBatch = [&](int first, int count, std::vector<std::vector<char>> &records) {
+            records.assign(count, std::vector<char>(100));
+            size_t recordSize;
+            for (int i = 0; i < count; i++) {
+                const std::string name(1 + (first + i) % 30, (char) ('a' + (first + i) % 26));
+                prepareRecord((int) recordDescriptor.size(), nullsIndicator, (int) name.length(), name, first + i,
+                              177.8, 6200, records[i].data(), recordSize);
+                records[i].resize(recordSize);
+            }
+        };
+        auto readBatch = [&](const std::vector<std::vector<char>> &records, const std::vector<PeterDB::RID> &rids) {
+            ASSERT_EQ(rids.size(), records.size()) << "There should be one RID per record.";
+            for (size_t i = 0; i < records.size(); i++) {
+                ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[i], outBuffer), success)
+                                            << "Reading a record should succeed.";
+                ASSERT_EQ(memcmp(records[i].data(), outBuffer, records[i].size()), 0)
+                                            << "Returned Data should be the same";
+            }
+        };
+
+        std::vector<std::vector<char>> first, second;
+        std::vector<const void *> data;
+        std::vector<PeterDB::RID> firstRids, secondRids;
+        prepareBatch(0, 500, first);
+        for (const std::vector<char> &record : first) {
+            data.push_back(record.data());
+        }
+        ASSERT_EQ(rbfm.insertRecords(fileHandle, recordDescriptor, data, firstRids), success)
+                                    << "Inserting records should succeed.";
+        readBatch(first, firstRids);
+
+        for (int i = 0; i < 50; i++) {
+            ASSERT_EQ(firstRids[i].pageNum, 0) << "The first records should be on the first page.";
+            ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, firstRids[i]), success)
+                                        << "Deleting a record should succeed.";
+        }
+        const PeterDB::PageNum lastPage = fileHandle.getNumberOfPages() - 1;
+        prepareBatch(500, 300, second);
+        data.clear();
+        for (const std::vector<char> &record : second) {
+            data.push_back(record.data());
+        }
+        ASSERT_EQ(rbfm.insertRecords(fileHandle, recordDescriptor, data, secondRids, true), success)
+                                    << "Inserting records should succeed.";
+        readBatch(second, secondRids);
+        for (const PeterDB::RID &rid : secondRids) {
+            ASSERT_GE(rid.pageNum, lastPage) << "Appended records should not go to earlier pages.";
+        }
+
+        PeterDB::RBFM_ScanIterator rbfmsi;
+        ASSERT_EQ(rbfm.scan(fileHandle, recordDescriptor, "", PeterDB::NO_OP, NULL, {"Age"}, rbfmsi), success)
+                                    << "Scanning a file should succeed.";
+        PeterDB::RID rid;
+        int expected = 50;
+        while (rbfmsi.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            ASSERT_EQ(*(int *) ((char *) outBuffer + 1), expected++) << "Records should come in insertion order.";
+        }
+        EXPECT_EQ(expected, 800) << "Every record should be scanned.";
+        ASSERT_EQ(rbfmsi.close(), success) << "Closing the scan should succeed.";
+    }
+
+
+    TEST_F(RBFM_Test, scan_with_condition_and_reordered_projection) {
+        // Functions tested
+        // 1. Insert records, some with a null age
+        // 2. Scan with a condition on an attribute that is not projected
+        // 3. Check the projected attributes come in the requested order with their own null indicator
+
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        const int numRecords = 300;
+        std::map<unsigned, int> pageSlotToIndex;
+        PeterDB::RID rid;
+        size_t recordSize;
+        for (int i = 0; i < numRecords; i++) {
+            nullsIndicator[0] = i % 5 == 0 ? 0x40 : 0;  // age is null
+            const std::string name(1 + i % 20, (char) ('a' + i % 26));
+            prepareRecord((int) recordDescriptor.size(), nullsIndicator, (int) name.length(), name, i, 177.8,
+                          1000 + i, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            pageSlotToIndex[rid.pageNum * PAGE_SIZE + rid.slotNum] = i;
+        }
+
+        char value[5];
+        const unsigned length = 1;
+        memcpy(value, &length, sizeof(unsigned));
+        value[4] = 'm';
+        PeterDB::RBFM_ScanIterator rbfmsi;
+        ASSERT_EQ(rbfm.scan(fileHandle, recordDescriptor, "EmpName", PeterDB::GE_OP, value, {"Salary", "Age"}, rbfmsi),
+                  success) << "Scanning a file should succeed.";
+        int numResults = 0;
+        while (rbfmsi.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            const int i = pageSlotToIndex[rid.pageNum * PAGE_SIZE + rid.slotNum];
+            ASSERT_GE(i % 26, 12) << "Only names from \"m\" on should qualify.";
+            const char *data = (const char *) outBuffer;
+            const bool ageIsNull = i % 5 == 0;
+            ASSERT_EQ((unsigned char) data[0], ageIsNull ? 0x40 : 0) << "The null indicator should follow the projection.";
+            ASSERT_EQ(*(int *) (data + 1), 1000 + i) << "Salary should come first.";
+            if (!ageIsNull) {
+                ASSERT_EQ(*(int *) (data + 5), i) << "Age should come second.";
+            }
+            ASSERT_EQ(rbfmsi.getRecordSize(), ageIsNull ? 5 : 9) << "The record size should match the projection.";
+            numResults++;
+        }
+        int expected = 0;
+        for (int i = 0; i < numRecords; i++) {
+            expected += i % 26 >= 12;
+        }
+        EXPECT_EQ(numResults, expected) << "Every qualifying record should be scanned.";
+        ASSERT_EQ(rbfmsi.close(), success) << "Closing the scan should succeed.";
+    }
+
+
+    TEST_F(RBFM_Test, read_fields_through_the_field_directory) {
+        // Functions tested
+        // 1. Insert records of ten fields with nulls and empty VarChars at different positions
+        // 2. readRecord() and readAttribute() for every field
+        // 3. readRecord() with an attribute added at the end reads it as null
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        for (unsigned f = 0; f < 10; f++) {
+            recordDescriptor.push_back({"f" + std::to_string(f), f % 2 == 0 ? PeterDB::TypeVarChar : PeterDB::TypeInt,
+                                        f % 2 == 0 ? 20u : 4u});
+        }
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+
+        // Record r has field f null when (r + f) % 4 == 0, VarChar field f holds (r + f) % 5 characters
+        auto prepare = [&](unsigned r, char *data) {
+            unsigned offset = 2;
+            memset(data, 0, 2);
+            for (unsigned f = 0; f < 10; f++) {
+                if ((r + f) % 4 == 0) {
+                    data[f / 8] |= (char) (1 << (7 - f % 8));
+                    continue;
+                }
+                if (f % 2 == 0) {
+                    const unsigned length = (r + f) % 5;
+                    memcpy(data + offset, &length, sizeof(unsigned));
+                    memset(data + offset + sizeof(unsigned), 'a' + (int) f, length);
+                    offset += sizeof(unsigned) + length;
+                } else {
+                    const int value = (int) (r * 10 + f);
+                    memcpy(data + offset, &value, sizeof(int));
+                    offset += sizeof(int);
+                }
+            }
+            return offset;
+        };
+
+        std::vector<PeterDB::RID> rids;
+        PeterDB::RID rid;
+        for (unsigned r = 0; r < 20; r++) {
+            prepare(r, (char *) inBuffer);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            rids.push_back(rid);
+        }
+
+        std::vector<PeterDB::Attribute> extendedDescriptor = recordDescriptor;
+        extendedDescriptor.push_back({"f10", PeterDB::TypeInt, 4});
+        for (unsigned r = 0; r < 20; r++) {
+            const unsigned size = prepare(r, (char *) inBuffer);
+            ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[r], outBuffer), success)
+                                        << "Reading a record should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, size), 0) << "Returned Data should be the same";
+
+            // Each attribute comes back as a one-field record
+            for (unsigned f = 0; f < 10; f++) {
+                char attribute[PAGE_SIZE];
+                ASSERT_EQ(rbfm.readAttribute(fileHandle, recordDescriptor, rids[r], "f" + std::to_string(f),
+                                             attribute), success) << "Reading an attribute should succeed.";
+                const bool null = (r + f) % 4 == 0;
+                ASSERT_EQ((unsigned char) attribute[0], null ? 0x80 : 0) << "The null indicator is not correct.";
+                if (null) {
+                    continue;
+                }
+                if (f % 2 == 0) {
+                    unsigned length;
+                    memcpy(&length, attribute + 1, sizeof(unsigned));
+                    ASSERT_EQ(length, (r + f) % 5) << "The VarChar length is not correct.";
+                    ASSERT_EQ(std::string(attribute + 1 + sizeof(unsigned), length), std::string(length, 'a' + f))
+                                                << "The VarChar value is not correct.";
+                } else {
+                    ASSERT_EQ(*(int *) (attribute + 1), (int) (r * 10 + f)) << "The Int value is not correct.";
+                }
+            }
+
+            ASSERT_EQ(rbfm.readRecord(fileHandle, extendedDescriptor, rids[r], outBuffer), success)
+                                        << "Reading a record with an added attribute should succeed.";
+            const char *data = (const char *) outBuffer;
+            ASSERT_NE(data[1] & 0x20, 0) << "The added attribute should read as null.";
+            ASSERT_EQ((data[1] & 0xC0), (((char *) inBuffer)[1] & 0xC0)) << "The other null bits should not change.";
+            ASSERT_EQ(data[0], ((char *) inBuffer)[0]) << "The other null bits should not change.";
+            ASSERT_EQ(memcmp(data + 2, (char *) inBuffer + 2, size - 2), 0) << "The values should not change.";
+        }
+    }
+
+
+    TEST_F(RBFM_Test, skip_pages_through_zone_maps) {
+        // Functions tested
+        // 1. Insert records with increasing keys, so every page holds a narrow range
+        // 2. Scan with a selective condition -- pages outside the range are not read
+        // 3. Update and delete records -- the scan still returns the right records
+        // 4. Close and reopen the file -- the zone map is kept
+
+        std::vector<PeterDB::Attribute> recordDescriptor = {{"key", PeterDB::TypeInt,     4},
+                                                            {"pad", PeterDB::TypeVarChar, 200}};
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+
+        auto prepare = [&](int key) {
+            char *data = (char *) inBuffer;
+            const unsigned length = 200;
+            data[0] = 0;
+            memcpy(data + 1, &key, sizeof(int));
+            memcpy(data + 1 + sizeof(int), &length, sizeof(unsigned));
+            memset(data + 1 + sizeof(int) + sizeof(unsigned), 'z', length);
+        };
+
+        // Returns the matching keys, sorted, and the pages read by the scan
+        auto scanKeys = [&](PeterDB::CompOp compOp, int value, unsigned &reads) {
+            unsigned readsBefore, writes, appends, readsAfter;
+            fileHandle.collectCounterValues(readsBefore, writes, appends);
+            PeterDB::RBFM_ScanIterator scanIterator;
+            std::vector<int> keys;
+            EXPECT_EQ(rbfm.scan(fileHandle, recordDescriptor, "key", compOp, &value, {"key"}, scanIterator), success)
+                                << "Initializing a scan should succeed.";
+            PeterDB::RID scanRid;
+            while (scanIterator.getNextRecord(scanRid, outBuffer) != RBFM_EOF) {
+                keys.push_back(*(int *) ((char *) outBuffer + 1));
+            }
+            scanIterator.close();
+            fileHandle.collectCounterValues(readsAfter, writes, appends);
+            reads = readsAfter - readsBefore;
+            std::sort(keys.begin(), keys.end());
+            return keys;
+        };
+
+        const int numRecords = 2000;
+        std::vector<PeterDB::RID> rids;
+        PeterDB::RID rid;
+        for (int key = 0; key < numRecords; key++) {
+            prepare(key);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            rids.push_back(rid);
+        }
+        const unsigned numberOfPages = fileHandle.getNumberOfPages();
+        ASSERT_GT(numberOfPages, 50) << "The records should spread over many pages.";
+
+        unsigned fullReads, selectiveReads;
+        std::vector<int> keys = scanKeys(PeterDB::NO_OP, 0, fullReads);
+        ASSERT_EQ(keys.size(), numRecords) << "A scan without a condition should return every record.";
+        ASSERT_GE(fullReads, numberOfPages) << "A scan without a condition should read every page.";
+
+        keys = scanKeys(PeterDB::GE_OP, numRecords - 10, selectiveReads);
+        std::vector<int> expected;
+        for (int key = numRecords - 10; key < numRecords; key++) {
+            expected.push_back(key);
+        }
+        ASSERT_EQ(keys, expected) << "The selective scan should return the last ten keys.";
+        ASSERT_LE(selectiveReads, 3) << "The selective scan should only read the pages holding its keys.";
+
+        // Move a key from the first page into the range, and delete one from it
+        prepare(numRecords + 5);
+        ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[5]), success)
+                                    << "Updating a record should succeed.";
+        ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, rids[numRecords - 5]), success)
+                                    << "Deleting a record should succeed.";
+        expected.erase(std::find(expected.begin(), expected.end(), numRecords - 5));
+        expected.push_back(numRecords + 5);
+
+        keys = scanKeys(PeterDB::GE_OP, numRecords - 10, selectiveReads);
+        ASSERT_EQ(keys, expected) << "The scan should see the updated and deleted records.";
+        keys = scanKeys(PeterDB::LT_OP, 5, selectiveReads);
+        ASSERT_EQ(keys, std::vector<int>({0, 1, 2, 3, 4})) << "The scan should return the first five keys.";
+        ASSERT_LE(selectiveReads, 2) << "The scan should only read the first page.";
+
+        // The zone map is written at close and read back at open
+        ASSERT_EQ(rbfm.closeFile(fileHandle), success) << "Closing the file should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, fileHandle), success) << "Opening the file should succeed.";
+        keys = scanKeys(PeterDB::GE_OP, numRecords - 10, selectiveReads);
+        ASSERT_EQ(keys, expected) << "The scan after reopening should return the same records.";
+        ASSERT_LE(selectiveReads, 3) << "The scan after reopening should still skip pages.";
+    }
+
+
+    TEST_F(RBFM_Test, parallel_scan_matches_serial_scan) {
+        // Functions tested
+        // 1. Insert records over many pages
+        // 2. Scan with RBFM_ParallelScanIterator and several workers, under a condition and a reordered projection
+        // 3. The parallel scan returns the same records as RBFM_ScanIterator, in any order
+        // 4. close() in the middle of a parallel scan stops the workers
+
+        std::vector<PeterDB::Attribute> recordDescriptor = {{"key",  PeterDB::TypeInt,     4},
+                                                            {"name", PeterDB::TypeVarChar, 100}};
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+
+        const int numRecords = 5000;
+        PeterDB::RID rid;
+        for (int key = 0; key < numRecords; key++) {
+            char *data = (char *) inBuffer;
+            const std::string name = "name" + std::to_string(key) + std::string(key % 60, 'x');
+            const unsigned length = name.size();
+            data[0] = 0;
+            memcpy(data + 1, &key, sizeof(int));
+            memcpy(data + 1 + sizeof(int), &length, sizeof(unsigned));
+            memcpy(data + 1 + sizeof(int) + sizeof(unsigned), name.c_str(), length);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+        }
+        ASSERT_GT(fileHandle.getNumberOfPages(), 20) << "The records should spread over many pages.";
+
+        // Each returned record as its rid and projected bytes: name first, then key
+        using Result = std::pair<std::pair<unsigned, unsigned>, std::string>;
+        auto record = [&](const PeterDB::RID &scanRid) {
+            const char *data = (const char *) outBuffer;
+            unsigned length;
+            memcpy(&length, data + 1, sizeof(unsigned));
+            return Result({scanRid.pageNum, scanRid.slotNum},
+                          std::string(data, 1 + sizeof(unsigned) + length + sizeof(int)));
+        };
+
+        const int value = 3700;
+        const std::vector<std::string> projection = {"name", "key"};
+        std::vector<Result> serial, parallel;
+        PeterDB::RBFM_ScanIterator scanIterator;
+        ASSERT_EQ(rbfm.scan(fileHandle, recordDescriptor, "key", PeterDB::LT_OP, &value, projection, scanIterator),
+                  success) << "Initializing a scan should succeed.";
+        while (scanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            serial.push_back(record(rid));
+        }
+        scanIterator.close();
+        ASSERT_EQ(serial.size(), value) << "The serial scan should return every matching record.";
+
+        PeterDB::RBFM_ParallelScanIterator parallelIterator;
+        ASSERT_EQ(parallelIterator.initializeScan(fileHandle, recordDescriptor, "key", PeterDB::LT_OP, &value,
+                                                  projection, 4), success)
+                                    << "Initializing a parallel scan should succeed.";
+        while (parallelIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            parallel.push_back(record(rid));
+        }
+        ASSERT_EQ(parallelIterator.close(), success) << "Closing a parallel scan should succeed.";
+
+        std::sort(serial.begin(), serial.end());
+        std::sort(parallel.begin(), parallel.end());
+        ASSERT_EQ(parallel, serial) << "The parallel scan should return the records of the serial scan.";
+
+        // Stop after a few records, the workers must not be left running
+        ASSERT_EQ(parallelIterator.initializeScan(fileHandle, recordDescriptor, "", PeterDB::NO_OP, nullptr,
+                                                  projection, 4), success)
+                                    << "Initializing a parallel scan should succeed.";
+        for (int i = 0; i < 10; i++) {
+            ASSERT_EQ(parallelIterator.getNextRecord(rid, outBuffer), success) << "Getting a record should succeed.";
+        }
+        ASSERT_EQ(parallelIterator.close(), success) << "Closing a parallel scan early should succeed.";
+    }
+
+
+    TEST_F(RBFM_Test, update_chains_stay_one_hop) {
+        // Functions tested
+        // 1. Grow records over several rounds, so they leave their page and move again from where they landed
+        // 2. Every home slot holds the record or a tombstone pointing straight at it
+        // 3. readRecord() by RID and a scan return every record once, with its last value
+        // 4. Shrink the records -- they move back home and the tombstones are gone
+
+        std::vector<PeterDB::Attribute> recordDescriptor = {{"id",   PeterDB::TypeInt,     4},
+                                                            {"text", PeterDB::TypeVarChar, 3000}};
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+
+        const int numRecords = 40, numGrown = 10;
+        std::vector<unsigned> lengths(numRecords, 50);
+        auto prepare = [&](int id) {
+            char *data = (char *) inBuffer;
+            data[0] = 0;
+            memcpy(data + 1, &id, sizeof(int));
+            memcpy(data + 1 + sizeof(int), &lengths[id], sizeof(unsigned));
+            memset(data + 1 + sizeof(int) + sizeof(unsigned), 'a' + id % 26, lengths[id]);
+            return 1 + sizeof(int) + sizeof(unsigned) + lengths[id];
+        };
+
+        // The slot of rid on its page as (offset, length)
+        auto readSlot = [&](const PeterDB::RID &slotRid, unsigned short &offset, unsigned short &length) {
+            char page[PAGE_SIZE];
+            ASSERT_EQ(fileHandle.readPage(slotRid.pageNum, page), success) << "Reading a page should succeed.";
+            memcpy(&offset, page + PAGE_SIZE - SLOT_SIZE - slotRid.slotNum * SLOT_SIZE, SHORT_SIZE);
+            memcpy(&length, page + PAGE_SIZE - SLOT_SIZE - slotRid.slotNum * SLOT_SIZE + SHORT_SIZE, SHORT_SIZE);
+        };
+
+        auto checkRecords = [&](std::vector<PeterDB::RID> &rids, unsigned &numForwarded) {
+            numForwarded = 0;
+            for (int id = 0; id < numRecords; id++) {
+                const size_t size = prepare(id);
+                ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[id], outBuffer), success)
+                                            << "Reading a record should succeed.";
+                ASSERT_EQ(memcmp(inBuffer, outBuffer, size), 0) << "Record " << id << " should hold its last value.";
+
+                unsigned short offset, length;
+                readSlot(rids[id], offset, length);
+                ASSERT_NE(length, 0) << "The home slot should not be empty.";
+                if (length >= TOMBSTONE_MARKER) {
+                    numForwarded++;
+                    const PeterDB::RID target = {(unsigned) (offset - TOMBSTONE_MARKER),
+                                                 (unsigned short) (length - TOMBSTONE_MARKER)};
+                    readSlot(target, offset, length);
+                    ASSERT_GT(length, 0) << "A tombstone should point at the record.";
+                    ASSERT_LT(length, TOMBSTONE_MARKER) << "A tombstone should not point at another tombstone.";
+                }
+            }
+
+            PeterDB::RBFM_ScanIterator scanIterator;
+            ASSERT_EQ(rbfm.scan(fileHandle, recordDescriptor, "", PeterDB::NO_OP, nullptr, {"id"}, scanIterator),
+                      success) << "Initializing a scan should succeed.";
+            PeterDB::RID scanRid;
+            std::vector<int> ids;
+            while (scanIterator.getNextRecord(scanRid, outBuffer) != RBFM_EOF) {
+                const int id = *(int *) ((char *) outBuffer + 1);
+                ASSERT_EQ(scanRid.pageNum, rids[id].pageNum) << "A scan should return the home RID of a record.";
+                ASSERT_EQ(scanRid.slotNum, rids[id].slotNum) << "A scan should return the home RID of a record.";
+                ids.push_back(id);
+            }
+            scanIterator.close();
+            std::sort(ids.begin(), ids.end());
+            std::vector<int> expected(numRecords);
+            std::iota(expected.begin(), expected.end(), 0);
+            ASSERT_EQ(ids, expected) << "A scan should return every record once.";
+        };
+
+        std::vector<PeterDB::RID> rids(numRecords);
+        for (int id = 0; id < numRecords; id++) {
+            prepare(id);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                        << "Inserting a record should succeed.";
+        }
+        ASSERT_EQ(rids[numRecords - 1].pageNum, 0) << "Every record should start on the first page.";
+
+        unsigned numForwarded;
+        for (unsigned length : {300, 900, 1600, 2500}) {
+            for (int id = 0; id < numGrown; id++) {
+                lengths[id] = length;
+                prepare(id);
+                ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                            << "Updating a record should succeed.";
+            }
+            checkRecords(rids, numForwarded);
+        }
+        ASSERT_EQ(numForwarded, numGrown) << "Every grown record should have left the first page.";
+
+        for (int id = 0; id < numGrown; id++) {
+            lengths[id] = 20;
+            prepare(id);
+            ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                        << "Updating a record should succeed.";
+        }
+        checkRecords(rids, numForwarded);
+        ASSERT_EQ(numForwarded, 0) << "Every shrunk record should be back home.";
+    }
+
+
+    TEST_F(RBFM_Test, vacuum_keeps_rids_and_drops_empty_pages) {
+        // Functions tested
+        // 1. Grow records so they are forwarded, then delete some of them, leaving empty pages at the end
+        // 2. vacuum() -- every RID reads its record, a scan returns the same records and the file is shorter
+        // 3. Shrink records so forwarded ones have room at home, then vacuum a page per call until a pass ends
+        // 4. Insert after vacuuming -- the free space map was rebuilt and the records land on existing pages
+
+        std::vector<PeterDB::Attribute> recordDescriptor = {{"id",   PeterDB::TypeInt,     4},
+                                                            {"text", PeterDB::TypeVarChar, 3000}};
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+
+        const int numRecords = 40;
+        std::vector<unsigned> lengths(numRecords, 50);
+        std::vector<PeterDB::RID> rids(numRecords);
+        std::set<int> live;
+        auto prepare = [&](int id) {
+            char *data = (char *) inBuffer;
+            data[0] = 0;
+            memcpy(data + 1, &id, sizeof(int));
+            memcpy(data + 1 + sizeof(int), &lengths[id], sizeof(unsigned));
+            memset(data + 1 + sizeof(int) + sizeof(unsigned), 'a' + id % 26, lengths[id]);
+            return 1 + sizeof(int) + sizeof(unsigned) + lengths[id];
+        };
+        auto update = [&](int id, unsigned length) {
+            lengths[id] = length;
+            prepare(id);
+            ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                        << "Updating a record should succeed.";
+        };
+        auto checkRecords = [&]() {
+            for (int id : live) {
+                const size_t size = prepare(id);
+                ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[id], outBuffer), success)
+                                            << "Reading a record should succeed.";
+                ASSERT_EQ(memcmp(inBuffer, outBuffer, size), 0) << "Record " << id << " should hold its last value.";
+            }
+            PeterDB::RBFM_ScanIterator scanIterator;
+            ASSERT_EQ(rbfm.scan(fileHandle, recordDescriptor, "", PeterDB::NO_OP, nullptr, {"id"}, scanIterator),
+                      success) << "Initializing a scan should succeed.";
+            PeterDB::RID scanRid;
+            std::set<int> ids;
+            while (scanIterator.getNextRecord(scanRid, outBuffer) != RBFM_EOF) {
+                ASSERT_TRUE(ids.insert(*(int *) ((char *) outBuffer + 1)).second) << "A record should be returned once.";
+            }
+            scanIterator.close();
+            ASSERT_EQ(ids, live) << "A scan should return every live record.";
+        };
+
+        for (int id = 0; id < numRecords; id++) {
+            prepare(id);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                        << "Inserting a record should succeed.";
+            live.insert(id);
+        }
+
+        // Records 10 and 11 stay forwarded, records 0 to 9 are forwarded to the end of the file and deleted there
+        for (int id = 10; id < 12; id++) {
+            update(id, 1500);
+        }
+        for (int id = 0; id < 10; id++) {
+            update(id, 2500);
+        }
+        for (int id = 0; id < 10; id++) {
+            ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, rids[id]), success)
+                                        << "Deleting a record should succeed.";
+            live.erase(id);
+        }
+        checkRecords();
+        const unsigned pagesBefore = fileHandle.getNumberOfPages();
+
+        ASSERT_EQ(rbfm.vacuum(fileHandle, recordDescriptor), success) << "Vacuuming the file should succeed.";
+        checkRecords();
+        const unsigned pagesAfter = fileHandle.getNumberOfPages();
+        ASSERT_LT(pagesAfter, pagesBefore) << "The empty pages at the end of the file should be given back.";
+        ASSERT_LE(pagesAfter, 3) << "Only the pages holding records should be left.";
+        ASSERT_GT(pagesAfter, 1) << "The forwarded records should not fit on the first page yet.";
+        ASSERT_EQ(rbfm.vacuum(fileHandle, recordDescriptor), success) << "Vacuuming the file should succeed.";
+        ASSERT_EQ(fileHandle.getNumberOfPages(), pagesAfter) << "Vacuuming again should change nothing.";
+
+        // Make room on the first page, the forwarded records come home one vacuumed page at a time
+        for (int id = 12; id < numRecords; id++) {
+            update(id, 5);
+        }
+        for (unsigned call = 0; call <= pagesAfter; call++) {
+            ASSERT_EQ(rbfm.vacuum(fileHandle, recordDescriptor, 1), success) << "Vacuuming a page should succeed.";
+            checkRecords();
+        }
+        ASSERT_EQ(fileHandle.getNumberOfPages(), 1) << "Every record should be back on the first page.";
+
+        // The free space map knows the room left on the first page
+        for (int id = 0; id < 5; id++) {
+            lengths[id] = 30;
+            prepare(id);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rids[id]), success)
+                                        << "Inserting a record should succeed.";
+            ASSERT_EQ(rids[id].pageNum, 0) << "A small record should fit on the first page.";
+            live.insert(id);
+        }
+        checkRecords();
+    }
+
 }// namespace PeterDBTesting
\ No newline at end of file
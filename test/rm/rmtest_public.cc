@@ -54,6 +54,60 @@ namespace PeterDBTesting {
 
     }
 
+    TEST_F(RM_Catalog_Test, indexes_of_tables_with_overlapping_names) {
+        // Functions Tested:
+        // 1. Create two tables whose name and attribute join into the same string: a + b_c and a_b + c
+        // 2. Create an index on each
+        // 3. Insert into one table, only its own index gets the entry
+        // 4. Delete the tables, each takes only its own index with it
+
+        rm.deleteCatalog();
+        for (const std::string &indexFileName : glob(".idx")) {
+            remove(indexFileName.c_str());
+        }
+        remove("a");
+        remove("a_b");
+        ASSERT_EQ(rm.createCatalog(), success) << "Creating the Catalog should succeed.";
+
+        ASSERT_EQ(rm.createTable("a", parseDDL("CREATE TABLE a (b_c INT)")), success)
+                                    << "Create table a should succeed.";
+        ASSERT_EQ(rm.createTable("a_b", parseDDL("CREATE TABLE a_b (c INT)")), success)
+                                    << "Create table a_b should succeed.";
+        ASSERT_EQ(rm.createIndex("a", "b_c"), success) << "RelationManager::createIndex() should succeed.";
+        ASSERT_EQ(rm.createIndex("a_b", "c"), success) << "RelationManager::createIndex() should succeed.";
+        ASSERT_EQ(glob(".idx").size(), 2) << "There should be two index files now.";
+
+        char tuple[1 + sizeof(int)] = {0};
+        int value = 7;
+        memcpy(tuple + 1, &value, sizeof(int));
+        PeterDB::RID rid;
+        ASSERT_EQ(rm.insertTuple("a_b", tuple, rid), success) << "RelationManager::insertTuple() should succeed.";
+
+        auto countEntries = [&](const std::string &tableName, const std::string &attributeName) {
+            PeterDB::RM_IndexScanIterator rmisi;
+            EXPECT_EQ(rm.indexScan(tableName, attributeName, nullptr, nullptr, true, true, rmisi), success)
+                                        << "RelationManager::indexScan() should succeed.";
+            PeterDB::RID entryRid;
+            char key[PAGE_SIZE];
+            int count = 0;
+            while (rmisi.getNextEntry(entryRid, key) != RM_EOF) {
+                count++;
+            }
+            rmisi.close();
+            return count;
+        };
+        ASSERT_EQ(countEntries("a", "b_c"), 0) << "The index of a should not get the tuple of a_b.";
+        ASSERT_EQ(countEntries("a_b", "c"), 1) << "The index of a_b should get its tuple.";
+
+        ASSERT_EQ(rm.deleteTable("a_b"), success) << "Delete table a_b should succeed.";
+        ASSERT_EQ(glob(".idx").size(), 1) << "The index of a should still exist.";
+        ASSERT_EQ(countEntries("a", "b_c"), 0) << "The index of a should still be usable.";
+        ASSERT_EQ(rm.deleteTable("a"), success) << "Delete table a should succeed.";
+        ASSERT_EQ(glob(".idx").size(), 0) << "There should be no index file now.";
+
+        ASSERT_EQ(rm.deleteCatalog(), success) << "Deleting the Catalog should succeed.";
+    }
+
     TEST_F(RM_Tuple_Test, get_attributes) {
         // Functions Tested
         // 1. getAttributes
@@ -1733,4 +1787,287 @@ namespace PeterDBTesting {
     }
 
 
+
+    TEST_F(RM_Catalog_Test, catalog_cache_follows_ddl) {
+        // Functions Tested:
+        // 1. getTableInfo() - a table's entry is read once and then served from the cache
+        // 2. createIndex() - the cached entry is replaced and lists the index
+        // 3. deleteTable() and createTable() - a table created again under the same name gets its new entry
+
+        rm.deleteCatalog();
+        remove("cached");
+        ASSERT_EQ(rm.createCatalog(), success) << "Creating the Catalog should succeed.";
+        ASSERT_EQ(rm.createTable("cached", parseDDL("CREATE TABLE cached (a INT, b REAL)")), success)
+                                    << "Create table cached should succeed.";
+
+        const PeterDB::TableInfo *info, *again;
+        ASSERT_EQ(rm.getTableInfo("cached", info), success) << "RelationManager::getTableInfo() should succeed.";
+        ASSERT_EQ(rm.getTableInfo("cached", again), success) << "RelationManager::getTableInfo() should succeed.";
+        EXPECT_EQ(info, again) << "The entry should be served from the cache.";
+        ASSERT_EQ(info->attrs.size(), 2) << "The entry should hold the attributes of the table.";
+        EXPECT_EQ(info->attrs[0].name, "a") << "The attributes should be in column-position order.";
+        EXPECT_EQ(info->attrs[1].name, "b") << "The attributes should be in column-position order.";
+        EXPECT_TRUE(info->indexedAttributes.empty()) << "The table should have no index yet.";
+        const unsigned version = rm.getCatalogVersion();
+
+        ASSERT_EQ(rm.createIndex("cached", "b"), success) << "RelationManager::createIndex() should succeed.";
+        EXPECT_NE(rm.getCatalogVersion(), version) << "Creating an index should change the catalog version.";
+        ASSERT_EQ(rm.getTableInfo("cached", info), success) << "RelationManager::getTableInfo() should succeed.";
+        ASSERT_EQ(info->indexedAttributes.size(), 1) << "The entry should list the new index.";
+        EXPECT_EQ(info->indexedAttributes[0], "b") << "The entry should list the new index.";
+
+        ASSERT_EQ(rm.deleteTable("cached"), success) << "Delete table cached should succeed.";
+        std::vector<PeterDB::Attribute> attrs;
+        EXPECT_NE(rm.getAttributes("cached", attrs), success) << "A deleted table should have no attributes.";
+        ASSERT_EQ(rm.createTable("cached", parseDDL("CREATE TABLE cached (c VARCHAR(10))")), success)
+                                    << "Create table cached should succeed.";
+        ASSERT_EQ(rm.getAttributes("cached", attrs), success) << "RelationManager::getAttributes() should succeed.";
+        ASSERT_EQ(attrs.size(), 1) << "The new table should have its own attributes.";
+        EXPECT_EQ(attrs[0].name, "c") << "The new table should have its own attributes.";
+        ASSERT_EQ(rm.getTableInfo("cached", info), success) << "RelationManager::getTableInfo() should succeed.";
+        EXPECT_EQ(info->attrs.size(), 1) << "The cached entry should be the new one.";
+        EXPECT_TRUE(info->indexedAttributes.empty()) << "The new table should not inherit the old index.";
+
+        ASSERT_EQ(rm.deleteTable("cached"), success) << "Delete table cached should succeed.";
+        ASSERT_EQ(rm.deleteCatalog(), success) << "Deleting the Catalog should succeed.";
+    }
+
+
+    TEST_F(RM_Catalog_Test, table_handles_across_ddl_and_eviction) {
+        // Functions Tested:
+        // 1. openTable() - a handle inserts tuples and picks up an index created after it was opened
+        // 2. deleteTable() - a handle on a deleted table refuses tuple operations
+        // 3. insertTuple() / readTuple() by name over more tables than are kept open, in turn
+
+        rm.deleteCatalog();
+        for (const std::string &indexFileName : glob(".idx")) {
+            remove(indexFileName.c_str());
+        }
+        const unsigned numTables = TABLE_HANDLE_CACHE_SIZE + 4;
+        for (unsigned t = 0; t < numTables; t++) {
+            remove(("handle" + std::to_string(t)).c_str());
+        }
+        ASSERT_EQ(rm.createCatalog(), success) << "Creating the Catalog should succeed.";
+        for (unsigned t = 0; t < numTables; t++) {
+            const std::string tableName = "handle" + std::to_string(t);
+            ASSERT_EQ(rm.createTable(tableName, parseDDL("CREATE TABLE " + tableName + " (v INT)")), success)
+                                        << "Create table " << tableName << " should succeed.";
+        }
+
+        char tuple[1 + sizeof(int)] = {0}, read[1 + sizeof(int)];
+        PeterDB::RID rid;
+        int value = 1;
+        PeterDB::TableHandle tableHandle;
+        ASSERT_EQ(rm.openTable("handle0", tableHandle), success) << "RelationManager::openTable() should succeed.";
+        EXPECT_NE(rm.openTable("handle0", tableHandle), success) << "Opening an open handle should fail.";
+        memcpy(tuple + 1, &value, sizeof(int));
+        ASSERT_EQ(tableHandle.insertTuple(tuple, rid), success) << "TableHandle::insertTuple() should succeed.";
+        ASSERT_EQ(rm.createIndex("handle0", "v"), success) << "RelationManager::createIndex() should succeed.";
+        value = 2;
+        memcpy(tuple + 1, &value, sizeof(int));
+        ASSERT_EQ(tableHandle.insertTuple(tuple, rid), success) << "TableHandle::insertTuple() should succeed.";
+        ASSERT_EQ(rm.readTuple("handle0", rid, read), success) << "RelationManager::readTuple() should succeed.";
+        EXPECT_EQ(memcmp(tuple, read, sizeof(tuple)), 0) << "The tuple read should be the one inserted.";
+
+        PeterDB::RM_IndexScanIterator rmisi;
+        ASSERT_EQ(rm.indexScan("handle0", "v", nullptr, nullptr, true, true, rmisi), success)
+                                    << "RelationManager::indexScan() should succeed.";
+        PeterDB::RID entryRid;
+        char key[PAGE_SIZE];
+        int numEntries = 0;
+        while (rmisi.getNextEntry(entryRid, key) != RM_EOF) {
+            numEntries++;
+        }
+        ASSERT_EQ(rmisi.close(), success) << "RM_IndexScanIterator::close() should succeed.";
+        EXPECT_EQ(numEntries, 2) << "The index should hold the tuples inserted before and after it was created.";
+
+        // Every table is used in turn, so tables are closed and opened again all the time
+        std::vector<std::vector<PeterDB::RID>> rids(numTables);
+        for (unsigned round = 0; round < 3; round++) {
+            for (unsigned t = 1; t < numTables; t++) {
+                value = (int) (round * numTables + t);
+                memcpy(tuple + 1, &value, sizeof(int));
+                ASSERT_EQ(rm.insertTuple("handle" + std::to_string(t), tuple, rid), success)
+                                            << "RelationManager::insertTuple() should succeed.";
+                rids[t].push_back(rid);
+            }
+        }
+        for (unsigned t = 1; t < numTables; t++) {
+            for (unsigned round = 0; round < 3; round++) {
+                ASSERT_EQ(rm.readTuple("handle" + std::to_string(t), rids[t][round], read), success)
+                                            << "RelationManager::readTuple() should succeed.";
+                memcpy(&value, read + 1, sizeof(int));
+                EXPECT_EQ(value, (int) (round * numTables + t)) << "The tuple read should be the one inserted.";
+            }
+        }
+
+        for (unsigned t = 0; t < numTables; t++) {
+            ASSERT_EQ(rm.deleteTable("handle" + std::to_string(t)), success) << "Deleting a table should succeed.";
+            ASSERT_FALSE(fileExists("handle" + std::to_string(t))) << "The table file should not exist now.";
+        }
+        EXPECT_NE(tableHandle.insertTuple(tuple, rid), success) << "A handle on a deleted table should refuse tuples.";
+        ASSERT_EQ(rm.closeTable(tableHandle), success) << "RelationManager::closeTable() should succeed.";
+        EXPECT_NE(rm.closeTable(tableHandle), success) << "Closing a closed handle should fail.";
+        ASSERT_EQ(glob(".idx").size(), 0) << "There should be no index file now.";
+        ASSERT_EQ(rm.deleteCatalog(), success) << "Deleting the Catalog should succeed.";
+    }
+
+
+    TEST_F(RM_Catalog_Test, scan_table_with_several_workers) {
+        // Functions Tested:
+        // 1. scan() with numWorkers > 1 - returns every matching tuple once, in any order
+        // 2. TableHandle::scan() with numWorkers 0 - one worker per hardware thread
+
+        rm.deleteCatalog();
+        remove("parallel");
+        ASSERT_EQ(rm.createCatalog(), success) << "Creating the Catalog should succeed.";
+        ASSERT_EQ(rm.createTable("parallel", parseDDL("CREATE TABLE parallel (a INT, b VARCHAR(50))")), success)
+                                    << "Create table parallel should succeed.";
+
+        const int numTuples = 4000;
+        char tuple[PAGE_SIZE];
+        PeterDB::RID rid;
+        for (int a = 0; a < numTuples; a++) {
+            const std::string b = "tuple" + std::to_string(a);
+            const unsigned length = b.size();
+            tuple[0] = 0;
+            memcpy(tuple + 1, &a, sizeof(int));
+            memcpy(tuple + 1 + sizeof(int), &length, sizeof(unsigned));
+            memcpy(tuple + 1 + sizeof(int) + sizeof(unsigned), b.c_str(), length);
+            ASSERT_EQ(rm.insertTuple("parallel", tuple, rid), success) << "RelationManager::insertTuple() should succeed.";
+        }
+
+        const int value = 1000;
+        std::vector<int> values;
+        PeterDB::RM_ScanIterator rmsi;
+        ASSERT_EQ(rm.scan("parallel", "a", PeterDB::GE_OP, &value, {"a"}, rmsi, 4), success)
+                                    << "RelationManager::scan() should succeed.";
+        while (rmsi.getNextTuple(rid, tuple) != RM_EOF) {
+            values.push_back(*(int *) (tuple + 1));
+        }
+        ASSERT_EQ(rmsi.close(), success) << "RM_ScanIterator::close() should succeed.";
+        std::sort(values.begin(), values.end());
+        std::vector<int> expected(numTuples - value);
+        std::iota(expected.begin(), expected.end(), value);
+        EXPECT_EQ(values, expected) << "The scan should return every matching tuple once.";
+
+        PeterDB::TableHandle tableHandle;
+        ASSERT_EQ(rm.openTable("parallel", tableHandle), success) << "RelationManager::openTable() should succeed.";
+        unsigned numReturned = 0;
+        ASSERT_EQ(tableHandle.scan("", PeterDB::NO_OP, nullptr, {"b", "a"}, rmsi, 0), success)
+                                    << "TableHandle::scan() should succeed.";
+        while (rmsi.getNextTuple(rid, tuple) != RM_EOF) {
+            unsigned length;
+            memcpy(&length, tuple + 1, sizeof(unsigned));
+            const int a = *(int *) (tuple + 1 + sizeof(unsigned) + length);
+            EXPECT_EQ(std::string(tuple + 1 + sizeof(unsigned), length), "tuple" + std::to_string(a))
+                                << "The projected attributes should belong to the same tuple.";
+            numReturned++;
+        }
+        ASSERT_EQ(rmsi.close(), success) << "RM_ScanIterator::close() should succeed.";
+        EXPECT_EQ(numReturned, numTuples) << "The scan should return every tuple.";
+        ASSERT_EQ(rm.closeTable(tableHandle), success) << "RelationManager::closeTable() should succeed.";
+
+        ASSERT_EQ(rm.deleteTable("parallel"), success) << "Delete table parallel should succeed.";
+        ASSERT_EQ(rm.deleteCatalog(), success) << "Deleting the Catalog should succeed.";
+    }
+
+
+    TEST_F(RM_Catalog_Test, vacuum_table_keeps_rids_and_index) {
+        // Functions Tested:
+        // 1. vacuumTable() - after updates and deletes every RID reads its tuple and the table file is shorter
+        // 2. vacuumTable() with numPages - a page per call, the index still finds every tuple by RID
+        // 3. vacuumTable() on a table that does not exist fails
+
+        rm.deleteCatalog();
+        remove("vacuumed");
+        for (const std::string &indexFileName : glob(".idx")) {
+            remove(indexFileName.c_str());
+        }
+        ASSERT_EQ(rm.createCatalog(), success) << "Creating the Catalog should succeed.";
+        ASSERT_EQ(rm.createTable("vacuumed", parseDDL("CREATE TABLE vacuumed (a INT, b VARCHAR(2000))")), success)
+                                    << "Create table vacuumed should succeed.";
+        ASSERT_EQ(rm.createIndex("vacuumed", "a"), success) << "RelationManager::createIndex() should succeed.";
+
+        const int numTuples = 400;
+        std::vector<unsigned> lengths(numTuples, 40);
+        std::vector<PeterDB::RID> rids(numTuples);
+        std::set<int> live;
+        char tuple[PAGE_SIZE], read[PAGE_SIZE];
+        auto prepare = [&](int a) {
+            tuple[0] = 0;
+            memcpy(tuple + 1, &a, sizeof(int));
+            memcpy(tuple + 1 + sizeof(int), &lengths[a], sizeof(unsigned));
+            memset(tuple + 1 + sizeof(int) + sizeof(unsigned), 'a' + a % 26, lengths[a]);
+            return 1 + sizeof(int) + sizeof(unsigned) + lengths[a];
+        };
+        auto checkTuples = [&]() {
+            for (int a : live) {
+                const size_t size = prepare(a);
+                ASSERT_EQ(rm.readTuple("vacuumed", rids[a], read), success)
+                                            << "RelationManager::readTuple() should succeed.";
+                ASSERT_EQ(memcmp(tuple, read, size), 0) << "Tuple " << a << " should hold its last value.";
+            }
+            PeterDB::RM_IndexScanIterator rmisi;
+            ASSERT_EQ(rm.indexScan("vacuumed", "a", nullptr, nullptr, true, true, rmisi), success)
+                                        << "RelationManager::indexScan() should succeed.";
+            PeterDB::RID entryRid;
+            char key[PAGE_SIZE];
+            unsigned numEntries = 0;
+            while (rmisi.getNextEntry(entryRid, key) != RM_EOF) {
+                const int a = *(int *) key;
+                ASSERT_EQ(entryRid.pageNum, rids[a].pageNum) << "The index should keep the RID of every tuple.";
+                ASSERT_EQ(entryRid.slotNum, rids[a].slotNum) << "The index should keep the RID of every tuple.";
+                numEntries++;
+            }
+            ASSERT_EQ(rmisi.close(), success) << "RM_IndexScanIterator::close() should succeed.";
+            ASSERT_EQ(numEntries, live.size()) << "The index should hold every live tuple.";
+        };
+
+        for (int a = 0; a < numTuples; a++) {
+            prepare(a);
+            ASSERT_EQ(rm.insertTuple("vacuumed", tuple, rids[a]), success)
+                                        << "RelationManager::insertTuple() should succeed.";
+            live.insert(a);
+        }
+        // Grow every tenth tuple so it is forwarded, then delete the second half of the table
+        for (int a = 0; a < numTuples; a += 10) {
+            lengths[a] = 1500;
+            prepare(a);
+            ASSERT_EQ(rm.updateTuple("vacuumed", tuple, rids[a]), success)
+                                        << "RelationManager::updateTuple() should succeed.";
+        }
+        for (int a = numTuples / 2; a < numTuples; a++) {
+            ASSERT_EQ(rm.deleteTuple("vacuumed", rids[a]), success) << "RelationManager::deleteTuple() should succeed.";
+            live.erase(a);
+        }
+        checkTuples();
+
+        PeterDB::FileHandle fileHandle;
+        PeterDB::RecordBasedFileManager &rbfm = PeterDB::RecordBasedFileManager::instance();
+        ASSERT_EQ(rbfm.openFile("vacuumed", fileHandle), success) << "Opening the table file should succeed.";
+        const unsigned pagesBefore = fileHandle.getNumberOfPages();
+        ASSERT_EQ(rbfm.closeFile(fileHandle), success) << "Closing the table file should succeed.";
+
+        ASSERT_EQ(rm.vacuumTable("vacuumed"), success) << "RelationManager::vacuumTable() should succeed.";
+        checkTuples();
+        ASSERT_EQ(rbfm.openFile("vacuumed", fileHandle), success) << "Opening the table file should succeed.";
+        const unsigned pagesAfter = fileHandle.getNumberOfPages();
+        ASSERT_EQ(rbfm.closeFile(fileHandle), success) << "Closing the table file should succeed.";
+        EXPECT_LT(pagesAfter, pagesBefore) << "The empty pages at the end of the table should be given back.";
+
+        for (int a = 0; a < numTuples / 2; a += 3) {
+            ASSERT_EQ(rm.deleteTuple("vacuumed", rids[a]), success) << "RelationManager::deleteTuple() should succeed.";
+            live.erase(a);
+        }
+        for (unsigned call = 0; call <= pagesAfter; call++) {
+            ASSERT_EQ(rm.vacuumTable("vacuumed", 1), success) << "RelationManager::vacuumTable() should succeed.";
+        }
+        checkTuples();
+        EXPECT_NE(rm.vacuumTable("missing"), success) << "Vacuuming a table that does not exist should fail.";
+
+        ASSERT_EQ(rm.deleteTable("vacuumed"), success) << "Delete table vacuumed should succeed.";
+        ASSERT_EQ(rm.deleteCatalog(), success) << "Deleting the Catalog should succeed.";
+    }
+
 } // namespace PeterDBTesting